@@ -0,0 +1,90 @@
+// 注意力引擎对比: softmax (tensor_mul_4d_transpose -> attention_scores_softmax -> tensor_matmul_4d)
+// 与performer核化注意力在不同序列长度下的耗时和近似误差
+#include "tensor_type.h"
+#include "tensor_mul.h"
+#include "softmax.h"
+#include "performer_attention.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include <time.h>
+
+static double now_seconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static void fill_random(Tensor* tensor, float amplitude) {
+    size_t total = calculate_total_size(tensor->shape, tensor->num_dims);
+    for (size_t i = 0; i < total; i++) {
+        tensor->data[i] = amplitude * ((float)rand() / RAND_MAX - 0.5f);
+    }
+}
+
+static bool softmax_attention(const Tensor* q, const Tensor* k, const Tensor* v, Tensor* output) {
+    int score_shape[] = {q->shape[0], q->shape[1], q->shape[2], k->shape[2]};
+    Tensor* scores = tensor_create(score_shape, 4);
+    if (!scores) return false;
+
+    bool success = tensor_mul_4d_transpose(q, k, 1.0f / sqrtf((float)q->shape[3]), scores) &&
+                   attention_scores_softmax(scores, scores) &&
+                   tensor_matmul_4d(scores, v, output);
+
+    tensor_free(scores);
+    return success;
+}
+
+int main(int argc, char** argv) {
+    const int batch_size = 1;
+    const int num_heads = 8;
+    const int head_dim = 64;
+    const int num_features = argc > 1 ? atoi(argv[1]) : 256;
+    const int seq_lens[] = {256, 512, 1024, 2048, 4096};
+    const int num_cases = sizeof(seq_lens) / sizeof(seq_lens[0]);
+
+    RandomFeatureMap* map = random_feature_map_create(head_dim, num_features, 42);
+    if (!map) return 1;
+
+    printf("batch=%d heads=%d head_dim=%d features=%d\n", batch_size, num_heads, head_dim, num_features);
+    printf("%8s %14s %14s %10s %12s\n", "seq_len", "softmax(ms)", "performer(ms)", "speedup", "mean_abs_err");
+
+    srand(1234);
+    for (int c = 0; c < num_cases; c++) {
+        int shape[] = {batch_size, num_heads, seq_lens[c], head_dim};
+        Tensor* q = tensor_create(shape, 4);
+        Tensor* k = tensor_create(shape, 4);
+        Tensor* v = tensor_create(shape, 4);
+        Tensor* exact = tensor_create(shape, 4);
+        Tensor* approx = tensor_create(shape, 4);
+        if (!q || !k || !v || !exact || !approx) return 1;
+
+        fill_random(q, 1.0f);
+        fill_random(k, 1.0f);
+        fill_random(v, 2.0f);
+
+        double t0 = now_seconds();
+        if (!softmax_attention(q, k, v, exact)) return 1;
+        double t1 = now_seconds();
+        if (!performer_attention(map, q, k, v, false, NULL, approx)) return 1;
+        double t2 = now_seconds();
+
+        size_t total = calculate_total_size(shape, 4);
+        double err = 0.0;
+        for (size_t i = 0; i < total; i++) {
+            err += fabsf(exact->data[i] - approx->data[i]);
+        }
+
+        printf("%8d %14.2f %14.2f %9.2fx %12.5f\n", seq_lens[c],
+               (t1 - t0) * 1e3, (t2 - t1) * 1e3, (t1 - t0) / (t2 - t1), err / total);
+
+        tensor_free(q);
+        tensor_free(k);
+        tensor_free(v);
+        tensor_free(exact);
+        tensor_free(approx);
+    }
+
+    random_feature_map_free(map);
+    return 0;
+}
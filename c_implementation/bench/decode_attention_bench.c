@@ -0,0 +1,79 @@
+// 解码注意力延迟: 不分段 (每个(b,h)一个线程) 与split-KV分段的对比
+// 用 TRANSFORMER_NUM_THREADS 或 OMP_NUM_THREADS 控制线程数
+#include "tensor_type.h"
+#include "split_kv_attention.h"
+#include "thread_pool.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include <time.h>
+
+static double now_seconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+int main(void) {
+    const int batch_size = 1;
+    const int num_heads = 8;
+    const int head_dim = 64;
+    const int kv_lens[] = {1024, 4096, 16384, 65536};
+    const int num_cases = sizeof(kv_lens) / sizeof(kv_lens[0]);
+    const int repeats = 20;
+
+    const int num_threads = thread_pool_num_threads();
+    printf("batch=%d heads=%d head_dim=%d threads=%d\n", batch_size, num_heads, head_dim, num_threads);
+    printf("%8s %8s %14s %14s %10s %10s\n", "kv_len", "splits", "unsplit(us)", "split(us)", "speedup", "max_diff");
+
+    srand(7);
+    for (int c = 0; c < num_cases; c++) {
+        int q_shape[] = {batch_size, num_heads, head_dim};
+        int kv_shape[] = {batch_size, num_heads, kv_lens[c], head_dim};
+        Tensor* q = tensor_create(q_shape, 3);
+        Tensor* k = tensor_create(kv_shape, 4);
+        Tensor* v = tensor_create(kv_shape, 4);
+        Tensor* ref = tensor_create(q_shape, 3);
+        Tensor* out = tensor_create(q_shape, 3);
+        if (!q || !k || !v || !ref || !out) return 1;
+
+        size_t kv_total = calculate_total_size(kv_shape, 4);
+        for (size_t i = 0; i < kv_total; i++) {
+            k->data[i] = (float)rand() / RAND_MAX - 0.5f;
+            v->data[i] = (float)rand() / RAND_MAX - 0.5f;
+        }
+        for (int i = 0; i < batch_size * num_heads * head_dim; i++) {
+            q->data[i] = (float)rand() / RAND_MAX - 0.5f;
+        }
+
+        const float scale = 1.0f / sqrtf((float)head_dim);
+        int splits = split_kv_choose_splits(batch_size, num_heads, kv_lens[c], num_threads);
+
+        double t0 = now_seconds();
+        for (int r = 0; r < repeats; r++) {
+            split_kv_decode_attention(q, k, v, kv_lens[c], scale, 1, ref);
+        }
+        double t1 = now_seconds();
+        for (int r = 0; r < repeats; r++) {
+            split_kv_decode_attention(q, k, v, kv_lens[c], scale, splits, out);
+        }
+        double t2 = now_seconds();
+
+        float max_diff = 0.0f;
+        for (int i = 0; i < batch_size * num_heads * head_dim; i++) {
+            max_diff = fmaxf(max_diff, fabsf(ref->data[i] - out->data[i]));
+        }
+
+        double unsplit_us = (t1 - t0) * 1e6 / repeats;
+        double split_us = (t2 - t1) * 1e6 / repeats;
+        printf("%8d %8d %14.1f %14.1f %9.2fx %10.2e\n", kv_lens[c], splits,
+               unsplit_us, split_us, unsplit_us / split_us, max_diff);
+
+        tensor_free(q);
+        tensor_free(k);
+        tensor_free(v);
+        tensor_free(ref);
+        tensor_free(out);
+    }
+    return 0;
+}
@@ -0,0 +1,97 @@
+// 前馈层: 逐步计算 (tensor_matmul_2d + 偏置 + ReLU + tensor_matmul_2d, 完整隐藏层) 与融合前馈的对比
+// 用 TRANSFORMER_NUM_THREADS 或 OMP_NUM_THREADS 控制线程数
+#include "tensor_type.h"
+#include "tensor_mul.h"
+#include "feed_forward.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include <time.h>
+
+static double now_seconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static void fill_random(Tensor* tensor, float amplitude) {
+    size_t total = calculate_total_size(tensor->shape, tensor->num_dims);
+    for (size_t i = 0; i < total; i++) {
+        tensor->data[i] = amplitude * ((float)rand() / RAND_MAX - 0.5f);
+    }
+}
+
+// 原来的实现方式: 完整的 [tokens, hidden_dim] 中间结果, 偏置和激活各扫一遍
+static bool ffn_unfused(const FeedForward* ff, const Tensor* input, Tensor* hidden, Tensor* output) {
+    const int tokens = input->shape[0];
+    const int hidden_dim = ff->w1->shape[1];
+    const int model_dim = ff->w1->shape[0];
+
+    if (!tensor_matmul_2d(input, ff->w1, hidden)) return false;
+    for (int t = 0; t < tokens; t++) {
+        for (int j = 0; j < hidden_dim; j++) hidden->data[(size_t)t * hidden_dim + j] += ff->b1->data[j];
+    }
+    for (size_t i = 0; i < (size_t)tokens * hidden_dim; i++) {
+        hidden->data[i] = hidden->data[i] > 0.0f ? hidden->data[i] : 0.0f;
+    }
+    if (!tensor_matmul_2d(hidden, ff->w2, output)) return false;
+    for (int t = 0; t < tokens; t++) {
+        for (int j = 0; j < model_dim; j++) output->data[(size_t)t * model_dim + j] += ff->b2->data[j];
+    }
+    return true;
+}
+
+int main(void) {
+    const int model_dim = 512;
+    const int hidden_dim = 2048;
+    const int token_counts[] = {1, 16, 128, 512};
+    const int num_cases = sizeof(token_counts) / sizeof(token_counts[0]);
+
+    FeedForward* ff = feed_forward_create(model_dim, hidden_dim);
+    if (!ff) return 1;
+    srand(11);
+    fill_random(ff->w1, 0.1f);
+    fill_random(ff->b1, 0.1f);
+    fill_random(ff->w2, 0.1f);
+    fill_random(ff->b2, 0.1f);
+
+    printf("model_dim=%d hidden_dim=%d\n", model_dim, hidden_dim);
+    printf("%8s %14s %14s %10s %10s\n", "tokens", "unfused(us)", "fused(us)", "speedup", "max_diff");
+
+    for (int c = 0; c < num_cases; c++) {
+        const int tokens = token_counts[c];
+        const int repeats = tokens >= 128 ? 3 : 20;
+        int io_shape[] = {tokens, model_dim};
+        int hidden_shape[] = {tokens, hidden_dim};
+        Tensor* input = tensor_create(io_shape, 2);
+        Tensor* hidden = tensor_create(hidden_shape, 2);
+        Tensor* ref = tensor_create(io_shape, 2);
+        Tensor* out = tensor_create(io_shape, 2);
+        if (!input || !hidden || !ref || !out) return 1;
+        fill_random(input, 1.0f);
+
+        double t0 = now_seconds();
+        for (int r = 0; r < repeats; r++) ffn_unfused(ff, input, hidden, ref);
+        double t1 = now_seconds();
+        for (int r = 0; r < repeats; r++) feed_forward_forward(ff, input, out);
+        double t2 = now_seconds();
+
+        float max_diff = 0.0f;
+        for (size_t i = 0; i < (size_t)tokens * model_dim; i++) {
+            max_diff = fmaxf(max_diff, fabsf(ref->data[i] - out->data[i]));
+        }
+
+        double unfused_us = (t1 - t0) * 1e6 / repeats;
+        double fused_us = (t2 - t1) * 1e6 / repeats;
+        printf("%8d %14.1f %14.1f %9.2fx %10.2e\n", tokens, unfused_us, fused_us,
+               unfused_us / fused_us, max_diff);
+
+        tensor_free(input);
+        tensor_free(hidden);
+        tensor_free(ref);
+        tensor_free(out);
+    }
+
+    feed_forward_free(ff);
+    return 0;
+}
@@ -0,0 +1,114 @@
+// 大页内存区: 比较权重和KV缓存池放在普通页 / 大页上的逐token解码耗时, 并打印实际的大页覆盖率
+// 用 TRANSFORMER_NUM_THREADS 控制线程数; 预留大页: echo N > /proc/sys/vm/nr_hugepages
+// 没有预留大页且透明大页为never时, 两种方式相同
+#include "tensor_type.h"
+#include "feed_forward.h"
+#include "huge_page_arena.h"
+#include "kv_cache_pool.h"
+#include "thread_pool.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+
+static double now_seconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static void fill_random(Tensor* tensor, float amplitude) {
+    size_t total = calculate_total_size(tensor->shape, tensor->num_dims);
+    for (size_t i = 0; i < total; i++) {
+        tensor->data[i] = amplitude * ((float)rand() / RAND_MAX - 0.5f);
+    }
+}
+
+// 每步对每个序列读一个随机块中一个头的K, 模拟分块缓存的注意力读取
+static double kv_gather_seconds(KVCachePool* pool, int steps, float* sink) {
+    unsigned int state = 7;
+    float sum = 0.0f;
+    const size_t head_floats = (size_t)pool->block_tokens * pool->head_dim;
+    const double t0 = now_seconds();
+    for (int s = 0; s < steps; s++) {
+        state = state * 1103515245u + 12345u;
+        const int block = (int)((state >> 8) % (unsigned int)pool->num_blocks);
+        const int layer = (int)((state >> 4) % (unsigned int)pool->num_layers);
+        const int head = (int)(state % (unsigned int)pool->num_heads);
+        const float* keys = kv_cache_pool_keys(pool, block, layer) + head * head_floats;
+        for (size_t i = 0; i < head_floats; i += 16) sum += keys[i];
+    }
+    *sink += sum;
+    return now_seconds() - t0;
+}
+
+int main(void) {
+    const int model_dim = 2048;
+    const int hidden_dim = 8192;
+    const int tokens = 4;
+    const int repeats = 50;
+    const HugePageMode modes[] = {HUGE_PAGES_OFF, huge_page_mode_from_env()};
+
+    int io_shape[] = {tokens, model_dim};
+    Tensor* input = tensor_create(io_shape, 2);
+    Tensor* ref = tensor_create(io_shape, 2);
+    Tensor* out = tensor_create(io_shape, 2);
+    if (!input || !ref || !out) return 1;
+    srand(5);
+    fill_random(input, 1.0f);
+
+    printf("model_dim=%d hidden_dim=%d tokens=%d threads=%d weights=%.0f MB\n", model_dim, hidden_dim,
+           tokens, thread_pool_num_threads(), 2.0 * model_dim * hidden_dim * sizeof(float) / 1048576.0);
+    printf("%24s %12s %10s %14s\n", "weights", "time(us)", "max_diff", "kv_gather(ns)");
+
+    float sink = 0.0f;
+    for (int m = 0; m < 2; m++) {
+        FeedForward* ff = feed_forward_create(model_dim, hidden_dim);
+        HugePageArena* arena = huge_arena_create("bench-weights", 0, modes[m]);
+        if (!ff || !arena) return 1;
+        srand(11);
+        fill_random(ff->w1, 0.05f);
+        fill_random(ff->b1, 0.05f);
+        fill_random(ff->w2, 0.05f);
+        fill_random(ff->b2, 0.05f);
+        if (modes[m] != HUGE_PAGES_OFF &&
+            (!huge_arena_adopt_tensor(arena, ff->w1) || !huge_arena_adopt_tensor(arena, ff->w2))) {
+            return 1;
+        }
+
+        Tensor* result = m == 0 ? ref : out;
+        feed_forward_forward(ff, input, result);   // 预热
+        const double t0 = now_seconds();
+        for (int r = 0; r < repeats; r++) feed_forward_forward(ff, input, result);
+        const double us = (now_seconds() - t0) * 1e6 / repeats;
+
+        float max_diff = 0.0f;
+        for (size_t i = 0; i < (size_t)tokens * model_dim; i++) {
+            max_diff = fmaxf(max_diff, fabsf(ref->data[i] - result->data[i]));
+        }
+
+        // 256 MB 的KV缓存池: 12层, 16头, head_dim 64, 每块16个位置
+        const int blocks = kv_cache_pool_blocks_for_bytes(12, 16, 64, 16, (size_t)256 << 20);
+        KVCachePool* pool = kv_cache_pool_create(12, 16, 64, 16, blocks, modes[m]);
+        if (!pool) return 1;
+        const int steps = 1 << 20;
+        kv_gather_seconds(pool, steps / 16, &sink);
+        const double gather_ns = kv_gather_seconds(pool, steps, &sink) * 1e9 / steps;
+
+        printf("%24s %12.1f %10.2e %14.1f\n", huge_page_mode_name(modes[m]), us, max_diff, gather_ns);
+        if (modes[m] != HUGE_PAGES_OFF) {
+            huge_arena_print_report(arena, stdout);
+            kv_cache_pool_print_report(pool, stdout);
+        }
+        kv_cache_pool_free(pool);
+        feed_forward_free(ff);
+        huge_arena_free(arena);
+    }
+
+    if (sink == 12345.0f) printf("%f\n", sink);
+    tensor_free(input);
+    tensor_free(ref);
+    tensor_free(out);
+    return 0;
+}
@@ -0,0 +1,89 @@
+// 多路服务器上的逐token解码前馈: 比较权重不放置 / 交错 / 每节点复制三种方式, 并打印跨节点流量估计
+// 用 TRANSFORMER_NUM_THREADS 控制线程数, TRANSFORMER_PIN_THREADS=1 绑定工作线程
+// 单节点机器上三种方式相同, 只用于确认结果一致
+#include "tensor_type.h"
+#include "feed_forward.h"
+#include "numa_placement.h"
+#include "thread_pool.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include <time.h>
+
+static double now_seconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static void fill_random(Tensor* tensor, float amplitude) {
+    size_t total = calculate_total_size(tensor->shape, tensor->num_dims);
+    for (size_t i = 0; i < total; i++) {
+        tensor->data[i] = amplitude * ((float)rand() / RAND_MAX - 0.5f);
+    }
+}
+
+static void place(FeedForward* ff, NumaPolicy policy) {
+    numa_forget_weights(ff->w1->data);
+    numa_forget_weights(ff->w2->data);
+    if (policy == NUMA_POLICY_NONE) return;
+    numa_place_weights(ff->w1->data, calculate_total_size(ff->w1->shape, 2), policy);
+    numa_place_weights(ff->w2->data, calculate_total_size(ff->w2->shape, 2), policy);
+}
+
+int main(void) {
+    const int model_dim = 2048;
+    const int hidden_dim = 8192;
+    const int tokens = 4;
+    const int repeats = 50;
+    const NumaPolicy policies[] = {NUMA_POLICY_NONE, NUMA_POLICY_INTERLEAVE, NUMA_POLICY_REPLICATE};
+    const char* names[] = {"none", "interleave", "replicate"};
+
+    FeedForward* ff = feed_forward_create(model_dim, hidden_dim);
+    int io_shape[] = {tokens, model_dim};
+    Tensor* input = tensor_create(io_shape, 2);
+    Tensor* ref = tensor_create(io_shape, 2);
+    Tensor* out = tensor_create(io_shape, 2);
+    if (!ff || !input || !ref || !out) return 1;
+    srand(5);
+    fill_random(ff->w1, 0.05f);
+    fill_random(ff->b1, 0.05f);
+    fill_random(ff->w2, 0.05f);
+    fill_random(ff->b2, 0.05f);
+    fill_random(input, 1.0f);
+
+    numa_set_traffic_stats(true);
+    printf("model_dim=%d hidden_dim=%d tokens=%d threads=%d weights=%.0f MB\n", model_dim, hidden_dim,
+           tokens, thread_pool_num_threads(), 2.0 * model_dim * hidden_dim * sizeof(float) / 1048576.0);
+    printf("%12s %12s %10s %10s %10s\n", "policy", "time(us)", "GB/s", "remote%", "max_diff");
+
+    feed_forward_forward(ff, input, ref);
+    for (int p = 0; p < 3; p++) {
+        place(ff, policies[p]);
+        feed_forward_forward(ff, input, out);   // 预热, 副本页进入TLB
+        numa_traffic_reset();
+
+        double t0 = now_seconds();
+        for (int r = 0; r < repeats; r++) feed_forward_forward(ff, input, out);
+        double t1 = now_seconds();
+
+        NumaTraffic traffic;
+        numa_traffic_snapshot(&traffic);
+        const double total = (double)(traffic.local_bytes + traffic.remote_bytes + traffic.unplaced_bytes);
+        float max_diff = 0.0f;
+        for (size_t i = 0; i < (size_t)tokens * model_dim; i++) {
+            max_diff = fmaxf(max_diff, fabsf(ref->data[i] - out->data[i]));
+        }
+        const double us = (t1 - t0) * 1e6 / repeats;
+        printf("%12s %12.1f %10.2f %9.1f%% %10.2e\n", names[p], us, total / repeats / (us * 1e3),
+               total > 0 ? 100.0 * traffic.remote_bytes / total : 0.0, max_diff);
+    }
+
+    numa_print_report(stdout);
+    place(ff, NUMA_POLICY_NONE);
+    tensor_free(input);
+    tensor_free(ref);
+    tensor_free(out);
+    feed_forward_free(ff);
+    return 0;
+}
@@ -0,0 +1,135 @@
+// 采样: 各种配置下每个token的采样耗时, 与对整个词表排序的核采样对比
+// 同时检查采出的token都在排序得到的核 (top-p集合) 之内
+#include "sampler.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+
+static double now_seconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+typedef struct ProbIndex {
+    float prob;
+    int index;
+} ProbIndex;
+
+static int compare_desc(const void* a, const void* b) {
+    const float pa = ((const ProbIndex*)a)->prob;
+    const float pb = ((const ProbIndex*)b)->prob;
+    return (pa < pb) - (pa > pb);
+}
+
+// 参考实现: softmax后全排序, 取累计概率达到top_p的前缀 (与Python版 _nucleus_sampling 相同)
+static int sorted_nucleus(const float* logits, int vocab, float temperature, float top_p, ProbIndex* items,
+                          SampleRng* rng) {
+    float max = logits[0];
+    for (int v = 1; v < vocab; v++) max = fmaxf(max, logits[v]);
+    double sum = 0.0;
+    for (int v = 0; v < vocab; v++) {
+        items[v].prob = expf((logits[v] - max) / temperature);
+        items[v].index = v;
+        sum += items[v].prob;
+    }
+    qsort(items, vocab, sizeof(ProbIndex), compare_desc);
+    double cumulative = 0.0;
+    int n = 0;
+    while (n < vocab && cumulative < top_p * sum) cumulative += items[n++].prob;
+    double target = sample_rng_uniform(rng) * cumulative;
+    for (int i = 0; i < n; i++) {
+        target -= items[i].prob;
+        if (target < 0.0) return n;
+    }
+    return n;
+}
+
+int main(void) {
+    const int vocab = 32000;
+    const int rows = 8;
+    const int steps = 200;
+    float* logits = (float*)malloc((size_t)rows * vocab * sizeof(float));
+    float* work = (float*)malloc((size_t)rows * vocab * sizeof(float));
+    ProbIndex* items = (ProbIndex*)malloc(vocab * sizeof(ProbIndex));
+    char* in_nucleus = (char*)malloc(vocab);
+    int32_t tokens[8];
+    if (!logits || !work || !items || !in_nucleus) return 1;
+
+    // 长尾分布: 少数词logit较大
+    srand(3);
+    for (size_t i = 0; i < (size_t)rows * vocab; i++) {
+        const float u = ((float)rand() + 1.0f) / ((float)RAND_MAX + 2.0f);
+        logits[i] = 2.0f * sqrtf(-2.0f * logf(u)) * cosf(6.2831853f * (float)rand() / RAND_MAX);
+    }
+
+    const SamplerConfig configs[] = {
+        {0.0f, 0, 1.0f, 1.0f},
+        {0.8f, 0, 1.0f, 1.0f},
+        {0.8f, 50, 1.0f, 1.0f},
+        {0.8f, 0, 0.9f, 1.0f},
+        {0.8f, 50, 0.9f, 1.0f},
+        {0.8f, 0, 0.9f, 1.2f},
+    };
+    const char* names[] = {"greedy", "temperature", "top-k 50", "top-p 0.9", "top-k 50 + top-p 0.9",
+                           "top-p 0.9 + penalty 1.2"};
+    int32_t history[64];
+    for (int i = 0; i < 64; i++) history[i] = (i * 7919) % vocab;
+    const int32_t* histories[8];
+    int history_lengths[8];
+    for (int r = 0; r < rows; r++) {
+        histories[r] = history;
+        history_lengths[r] = 64;
+    }
+
+    printf("vocab=%d rows=%d steps=%d\n", vocab, rows, steps);
+    printf("%26s %14s\n", "config", "us/token");
+    for (size_t c = 0; c < sizeof(configs) / sizeof(configs[0]); c++) {
+        Sampler* sampler = sampler_create(vocab, &configs[c]);
+        if (!sampler) return 1;
+        SampleRng rngs[8];
+        for (int r = 0; r < rows; r++) rngs[r] = sample_rng_init(42, r);
+        double total = 0.0;
+        for (int s = 0; s < steps; s++) {
+            // 重复惩罚会就地修改logits, 每步从原始值开始
+            memcpy(work, logits, (size_t)rows * vocab * sizeof(float));
+            const double t0 = now_seconds();
+            if (!sampler_sample(sampler, work, rows, histories, history_lengths, rngs, tokens)) return 1;
+            total += now_seconds() - t0;
+        }
+        printf("%26s %14.2f\n", names[c], total * 1e6 / ((double)steps * rows));
+        sampler_free(sampler);
+    }
+
+    // 全排序的参考实现, 以及采样结果是否都在核内
+    SampleRng rng = sample_rng_init(42, 100);
+    const double t0 = now_seconds();
+    int nucleus_size = 0;
+    for (int s = 0; s < steps; s++) {
+        nucleus_size = sorted_nucleus(logits, vocab, 0.8f, 0.9f, items, &rng);
+    }
+    printf("%26s %14.2f  (nucleus of row 0: %d tokens)\n", "full sort top-p 0.9",
+           (now_seconds() - t0) * 1e6 / steps, nucleus_size);
+
+    memset(in_nucleus, 0, vocab);
+    for (int i = 0; i < nucleus_size; i++) in_nucleus[items[i].index] = 1;
+    Sampler* sampler = sampler_create(vocab, &configs[3]);
+    if (!sampler) return 1;
+    SampleRng check = sample_rng_init(7, 0);
+    int outside = 0;
+    const int draws = 20000;
+    for (int s = 0; s < draws; s++) {
+        const int32_t token = sampler_sample_row(sampler, &configs[3], logits, NULL, 0, &check);
+        outside += !in_nucleus[token];
+    }
+    printf("top-p samples outside the sorted nucleus: %d / %d\n", outside, draws);
+    sampler_free(sampler);
+
+    free(logits);
+    free(work);
+    free(items);
+    free(in_nucleus);
+    return 0;
+}
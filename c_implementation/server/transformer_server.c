@@ -0,0 +1,209 @@
+// 本地推理服务: 在Unix域套接字或127.0.0.1的TCP端口上接受请求, 连续批处理并流式返回token
+// 协议见 inference_server.h, 例如:
+//   ./build/transformer_server --socket /tmp/transformer.sock &
+//   printf 'TEXT max_new=8 temperature=0.8 | hello\nSTATS\n' | nc -NU /tmp/transformer.sock
+// 还没有权重文件的加载, 模型按命令行给出的尺寸随机初始化, 用于测量服务路径的延迟和吞吐
+// 用 TRANSFORMER_NUM_THREADS 控制计算线程池的大小, TRANSFORMER_HUGE_PAGES 控制权重和KV缓存的大页
+#include "inference_server.h"
+#include "model_config.h"
+#include "transformer.h"
+#include <math.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+typedef struct ServerOptions {
+    const char* socket_path;
+    int port;
+    int layers;
+    int model_dim;
+    int heads;
+    int ff_dim;
+    int vocab;
+    int max_seq;
+    int max_batch;
+    int kv_mb;
+    int block_tokens;
+    int max_new;
+    int bos;
+    int eos;
+    unsigned int seed;
+    bool rope;
+} ServerOptions;
+
+static InferenceServer* g_server = NULL;
+
+static void handle_signal(int signal_number) {
+    (void)signal_number;
+    if (g_server) inference_server_stop(g_server);
+}
+
+static void usage(const char* program) {
+    fprintf(stderr,
+            "usage: %s (--socket PATH | --port N) [options]\n"
+            "  --layers N        encoder/decoder layers (2)\n"
+            "  --model-dim N     model dimension (256)\n"
+            "  --heads N         attention heads (4)\n"
+            "  --ff-dim N        feed-forward hidden size (1024)\n"
+            "  --vocab N         vocabulary size, >= 256 for TEXT requests (512)\n"
+            "  --max-seq N       maximum encoder input / decoder sequence length (256)\n"
+            "  --max-batch N     sequences decoded together (16)\n"
+            "  --kv-mb N         KV cache pool size in MiB (64)\n"
+            "  --block-tokens N  positions per KV cache block (16)\n"
+            "  --max-new N       default max_new for requests (32)\n"
+            "  --bos N --eos N   default decoder prefix / stop token (1, 2)\n"
+            "  --rope            rotary position encoding instead of sinusoidal\n"
+            "  --seed N          weight initialization seed (1)\n",
+            program);
+}
+
+static bool parse_options(int argc, char** argv, ServerOptions* options) {
+    *options = (ServerOptions){NULL, -1, 2, 256, 4, 1024, 512, 256, 16, 64, 16, 32, 1, 2, 1, false};
+    struct {
+        const char* name;
+        int* value;
+    } int_options[] = {
+        {"--port", &options->port},         {"--layers", &options->layers},
+        {"--model-dim", &options->model_dim}, {"--heads", &options->heads},
+        {"--ff-dim", &options->ff_dim},     {"--vocab", &options->vocab},
+        {"--max-seq", &options->max_seq},   {"--max-batch", &options->max_batch},
+        {"--kv-mb", &options->kv_mb},       {"--block-tokens", &options->block_tokens},
+        {"--max-new", &options->max_new},   {"--bos", &options->bos},
+        {"--eos", &options->eos},
+    };
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--rope") == 0) {
+            options->rope = true;
+            continue;
+        }
+        if (i + 1 >= argc) return false;
+        const char* value = argv[++i];
+        if (strcmp(argv[i - 1], "--socket") == 0) {
+            options->socket_path = value;
+            continue;
+        }
+        if (strcmp(argv[i - 1], "--seed") == 0) {
+            options->seed = (unsigned int)strtoul(value, NULL, 10);
+            continue;
+        }
+        bool known = false;
+        for (size_t o = 0; o < sizeof(int_options) / sizeof(int_options[0]); o++) {
+            if (strcmp(argv[i - 1], int_options[o].name) == 0) {
+                char* end;
+                *int_options[o].value = (int)strtol(value, &end, 10);
+                known = *end == '\0';
+                break;
+            }
+        }
+        if (!known) return false;
+    }
+    if (!options->socket_path && options->port < 0) return false;
+    return options->layers > 0 && options->model_dim > 0 && options->heads > 0 &&
+           options->model_dim % options->heads == 0 && options->ff_dim > 0 && options->vocab > 2 &&
+           options->max_seq > 1 && options->max_batch > 0 && options->kv_mb > 0 && options->block_tokens > 0 &&
+           options->max_new > 0 && options->bos >= 0 && options->bos < options->vocab && options->eos < options->vocab;
+}
+
+// 嵌入表和词表投影不属于Transformer, 同样按方差1/fan_in初始化
+static void fill_random(Tensor* tensor, int fan_in) {
+    const float amplitude = 2.0f * sqrtf(3.0f / (float)fan_in);
+    size_t total = calculate_total_size(tensor->shape, tensor->num_dims);
+    for (size_t i = 0; i < total; i++) {
+        tensor->data[i] = amplitude * ((float)rand() / RAND_MAX - 0.5f);
+    }
+}
+
+int main(int argc, char** argv) {
+    ServerOptions options;
+    if (!parse_options(argc, argv, &options)) {
+        usage(argv[0]);
+        return 2;
+    }
+    srand(options.seed);
+
+    init_model_config(1, options.max_seq, options.vocab, options.model_dim, options.ff_dim, options.heads, 0.0f);
+    if (options.rope) set_position_encoding(POSITION_ENCODING_ROTARY, 10000.0);
+    ModelConfig config = g_model_config;
+    config.is_training = false;
+    const int head_dim = options.model_dim / options.heads;
+    const HugePageMode huge_pages = huge_page_mode_from_env();
+    const int kv_blocks = kv_cache_pool_blocks_for_bytes(options.layers, options.heads, head_dim,
+                                                         options.block_tokens, (size_t)options.kv_mb << 20);
+
+    int status = 1;
+    TransformerEmbedding* encoder_embedding = NULL;
+    TransformerEmbedding* decoder_embedding = NULL;
+    VocabProjection* vocab = NULL;
+    KVCachePool* pool = NULL;
+    GenerationScheduler* scheduler = NULL;
+    InferenceServer* server = NULL;
+    Transformer* transformer = transformer_create_from_config(&config, options.layers);
+    if (!transformer) goto done;
+    transformer_init_random(transformer, options.seed);
+    if (!transformer_use_huge_pages(transformer, huge_pages)) goto done;
+
+    // 编码器和解码器共享词表
+    encoder_embedding = transformer_embedding_create(options.vocab, options.model_dim, options.max_seq,
+                                                     config.position_encoding);
+    if (!encoder_embedding) goto done;
+    fill_random(encoder_embedding->token_embedding->embedding_matrix, 1);
+    decoder_embedding = transformer_embedding_create_shared(encoder_embedding->token_embedding, options.max_seq,
+                                                            config.position_encoding);
+    vocab = vocab_projection_create(options.vocab, options.model_dim, false);
+    pool = kv_blocks > 0 ? kv_cache_pool_create(options.layers, options.heads, head_dim, options.block_tokens,
+                                                kv_blocks, huge_pages)
+                         : NULL;
+    if (!decoder_embedding || !vocab || !pool) goto done;
+    fill_random(vocab->weight, options.model_dim);
+    scheduler = generation_scheduler_create(transformer, encoder_embedding, decoder_embedding, vocab, pool,
+                                            options.max_batch);
+    if (!scheduler) goto done;
+
+    InferenceServerConfig server_config = inference_server_default_config();
+    server_config.socket_path = options.socket_path;
+    server_config.tcp_port = options.port;
+    server_config.max_source_tokens = options.max_seq;
+    server_config.max_positions = options.max_seq;
+    server_config.vocab_size = options.vocab;
+    server_config.default_max_new_tokens = options.max_new;
+    server_config.bos_token = options.bos;
+    server_config.eos_token = options.eos;
+    server = inference_server_create(scheduler, &server_config);
+    if (!server) goto done;
+
+    g_server = server;
+    struct sigaction action;
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = handle_signal;
+    sigaction(SIGINT, &action, NULL);
+    sigaction(SIGTERM, &action, NULL);
+
+    if (options.socket_path) {
+        printf("listening on %s\n", options.socket_path);
+    } else {
+        printf("listening on 127.0.0.1:%d\n", server->config.tcp_port);
+    }
+    printf("model: %d layers, d_model %d, %d heads, ff %d, vocab %d, max_seq %d; "
+           "batch %d, %d KV blocks of %d tokens\n",
+           options.layers, options.model_dim, options.heads, options.ff_dim, options.vocab, options.max_seq,
+           options.max_batch, kv_blocks, options.block_tokens);
+    fflush(stdout);
+
+    status = inference_server_run(server) ? 0 : 1;
+    generation_scheduler_print_metrics(scheduler, stdout);
+    inference_server_write_stats(server, stdout);
+
+done:
+    if (status != 0) fprintf(stderr, "transformer_server: startup or event loop failed\n");
+    // 调度器释放时会回调未完成的请求, 必须先于server释放
+    generation_scheduler_free(scheduler);
+    g_server = NULL;
+    inference_server_free(server);
+    kv_cache_pool_free(pool);
+    vocab_projection_free(vocab);
+    free_transformer_embedding(decoder_embedding);
+    free_transformer_embedding(encoder_embedding);
+    transformer_free(transformer);
+    return status;
+}
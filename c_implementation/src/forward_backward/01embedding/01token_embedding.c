@@ -1,13 +1,23 @@
 #include "01token_embedding.h"
-#include "lookup.h"
-#include "model_config.h"
+#include "half.h"
+#include "thread_pool.h"
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <math.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
-// 创建Token嵌入结构
-// embedding_matrix tensor shape: [batch_size, vocab_size, embedding_dim], embedding_dim is the same as encoding_dim, d_model
-TokenEmbedding* token_embedding_create(int vocab_size, int embedding_dim) {
-    TokenEmbedding* token_emb = (TokenEmbedding*)malloc(sizeof(TokenEmbedding));
+static TokenEmbedding* token_embedding_alloc(int vocab_size, int embedding_dim) {
+    if (vocab_size <= 0 || embedding_dim <= 0) {
+        fprintf(stderr, "Invalid token embedding size [%d, %d]\n", vocab_size, embedding_dim);
+        return NULL;
+    }
+
+    TokenEmbedding* token_emb = (TokenEmbedding*)calloc(1, sizeof(TokenEmbedding));
     if (!token_emb) {
         fprintf(stderr, "Failed to allocate memory for token embedding\n");
         return NULL;
@@ -16,34 +26,204 @@ TokenEmbedding* token_embedding_create(int vocab_size, int embedding_dim) {
     // 初始化基本参数
     token_emb->vocab_size = vocab_size;
     token_emb->embedding_dim = embedding_dim;
+    token_emb->storage = EMBEDDING_FP32;
+    token_emb->ref_count = 1;
+    return token_emb;
+}
 
-    // 获取batch_size
-    const int batch_size = g_model_config.batch_size;
+// 创建Token嵌入结构
+// embedding_matrix tensor shape: [vocab_size, embedding_dim], embedding_dim is the same as encoding_dim, d_model
+TokenEmbedding* token_embedding_create(int vocab_size, int embedding_dim) {
+    TokenEmbedding* token_emb = token_embedding_alloc(vocab_size, embedding_dim);
+    if (!token_emb) {
+        return NULL;
+    }
 
-    // 创建嵌入矩阵张量 [batch_size, vocab_size, embedding_dim]
-    int shape[] = {batch_size, vocab_size, embedding_dim};
-    token_emb->embedding_matrix = tensor_create(shape, 3);
+    // 创建嵌入矩阵张量 [vocab_size, embedding_dim], 与batch_size无关
+    int shape[] = {vocab_size, embedding_dim};
+    token_emb->embedding_matrix = tensor_create(shape, 2);
     if (!token_emb->embedding_matrix) {
         free(token_emb);
         return NULL;
     }
+    token_emb->weights = token_emb->embedding_matrix->data;
 
     return token_emb;
 }
 
-void free_token_embedding(TokenEmbedding* token_emb) {
+typedef struct EmbeddingCompressJob {
+    const float* weights;
+    int embedding_dim;
+    uint16_t* half_table;
+    int8_t* int8_table;
+    float* row_scales;
+} EmbeddingCompressJob;
+
+static void embedding_to_half(void* ctx, long begin, long end) {
+    const EmbeddingCompressJob* job = (const EmbeddingCompressJob*)ctx;
+    for (long i = begin; i < end; i++) {
+        job->half_table[i] = float_to_half(job->weights[i]);
+    }
+}
+
+// int8: 每行按最大绝对值对称量化到 [-127, 127]
+static void embedding_to_int8(void* ctx, long begin, long end) {
+    const EmbeddingCompressJob* job = (const EmbeddingCompressJob*)ctx;
+    const int embedding_dim = job->embedding_dim;
+    for (long v = begin; v < end; v++) {
+        const float* src = job->weights + (size_t)v * embedding_dim;
+        int8_t* dst = job->int8_table + (size_t)v * embedding_dim;
+
+        float max_abs = 0.0f;
+        for (int d = 0; d < embedding_dim; d++) {
+            max_abs = fmaxf(max_abs, fabsf(src[d]));
+        }
+        const float row_scale = max_abs / 127.0f;
+        const float inv_scale = max_abs > 0.0f ? 127.0f / max_abs : 0.0f;
+        for (int d = 0; d < embedding_dim; d++) {
+            dst[d] = (int8_t)lrintf(src[d] * inv_scale);
+        }
+        job->row_scales[v] = row_scale;
+    }
+}
+
+TokenEmbedding* token_embedding_create_compressed(
+    const float* weights,
+    int vocab_size,
+    int embedding_dim,
+    EmbeddingStorage storage
+) {
+    if (!weights) {
+        fprintf(stderr, "Null weights passed to token_embedding_create_compressed\n");
+        return NULL;
+    }
+    if (storage == EMBEDDING_FP32) {
+        TokenEmbedding* token_emb = token_embedding_create(vocab_size, embedding_dim);
+        if (token_emb) {
+            memcpy(token_emb->embedding_matrix->data, weights,
+                   (size_t)vocab_size * embedding_dim * sizeof(float));
+        }
+        return token_emb;
+    }
+
+    TokenEmbedding* token_emb = token_embedding_alloc(vocab_size, embedding_dim);
+    if (!token_emb) {
+        return NULL;
+    }
+    token_emb->storage = storage;
+
+    const size_t count = (size_t)vocab_size * embedding_dim;
+    if (storage == EMBEDDING_FP16) {
+        uint16_t* table = (uint16_t*)malloc(count * sizeof(uint16_t));
+        if (!table) {
+            free(token_emb);
+            return NULL;
+        }
+        EmbeddingCompressJob job = {weights, embedding_dim, table, NULL, NULL};
+        thread_pool_parallel_for((long)count, count > 65536 ? 0 : (long)count, embedding_to_half, &job);
+        token_emb->owned_weights = table;
+        token_emb->weights = table;
+        return token_emb;
+    }
+
+    // int8: 每行按最大绝对值对称量化到 [-127, 127]
+    char* buffer = (char*)malloc(vocab_size * sizeof(float) + count * sizeof(int8_t));
+    if (!buffer) {
+        free(token_emb);
+        return NULL;
+    }
+    float* row_scales = (float*)buffer;
+    int8_t* table = (int8_t*)(buffer + vocab_size * sizeof(float));
+
+    EmbeddingCompressJob job = {weights, embedding_dim, NULL, table, row_scales};
+    thread_pool_parallel_for(vocab_size, count > 65536 ? 0 : vocab_size, embedding_to_int8, &job);
+
+    token_emb->owned_weights = buffer;
+    token_emb->row_scales = row_scales;
+    token_emb->weights = table;
+    return token_emb;
+}
+
+TokenEmbedding* token_embedding_map_file(
+    const char* path,
+    int vocab_size,
+    int embedding_dim,
+    EmbeddingStorage storage
+) {
+    TokenEmbedding* token_emb = token_embedding_alloc(vocab_size, embedding_dim);
+    if (!token_emb) {
+        return NULL;
+    }
+    token_emb->storage = storage;
+
+    const size_t count = (size_t)vocab_size * embedding_dim;
+    size_t expected = 0;
+    switch (storage) {
+        case EMBEDDING_FP32: expected = count * sizeof(float); break;
+        case EMBEDDING_FP16: expected = count * sizeof(uint16_t); break;
+        case EMBEDDING_INT8: expected = vocab_size * sizeof(float) + count * sizeof(int8_t); break;
+    }
+
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        fprintf(stderr, "Failed to open embedding file %s\n", path);
+        free(token_emb);
+        return NULL;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0 || (size_t)st.st_size < expected) {
+        fprintf(stderr, "Embedding file %s is smaller than expected %zu bytes\n", path, expected);
+        close(fd);
+        free(token_emb);
+        return NULL;
+    }
+
+    void* mapping = mmap(NULL, expected, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (mapping == MAP_FAILED) {
+        fprintf(stderr, "Failed to mmap embedding file %s\n", path);
+        free(token_emb);
+        return NULL;
+    }
+    // 查找是随机访问, 关闭预读
+    madvise(mapping, expected, MADV_RANDOM);
+
+    token_emb->mapping = mapping;
+    token_emb->mapping_size = expected;
+    if (storage == EMBEDDING_INT8) {
+        token_emb->row_scales = (const float*)mapping;
+        token_emb->weights = (const char*)mapping + vocab_size * sizeof(float);
+    } else {
+        token_emb->weights = mapping;
+    }
+    return token_emb;
+}
+
+TokenEmbedding* token_embedding_retain(TokenEmbedding* token_emb) {
     if (token_emb) {
+        __atomic_add_fetch(&token_emb->ref_count, 1, __ATOMIC_RELAXED);
+    }
+    return token_emb;
+}
+
+void free_token_embedding(TokenEmbedding* token_emb) {
+    if (token_emb && __atomic_sub_fetch(&token_emb->ref_count, 1, __ATOMIC_ACQ_REL) == 0) {
         tensor_free(token_emb->embedding_matrix);
+        tensor_free(token_emb->grad_embedding);
+        free(token_emb->owned_weights);
+        if (token_emb->mapping) {
+            munmap(token_emb->mapping, token_emb->mapping_size);
+        }
         free(token_emb);
     }
 }
 
 // token_embedding forward pass
-// embedding_matrix tensor shape: [vocab_size, embedding_dim], 
+// embedding table shape: [vocab_size, embedding_dim], 
 // embedding_dim is the same as encoding_dim, d_model, is dictionary of embedding vectors for each token
 // input tokens shape: [batch_size, seq_length], entry is the index of the token in the vocabulary, to be generated by tokenizer
 // output tensor shape: [batch_size, seq_length, embedding_dim], entry is the embedding vector of the token
-bool token_embedding_forward(const TokenEmbedding* embedding, const Tensor* tokens, Tensor* output) {
+bool token_embedding_forward(const TokenEmbedding* embedding, const IntTensor* tokens, Tensor* output) {
     if (tokens->num_dims != 2) {
         fprintf(stderr, "Tokens tensor must be 2-dimensional [batch_size, seq_length]\n");
         return false;
@@ -62,7 +242,7 @@ bool token_embedding_forward(const TokenEmbedding* embedding, const Tensor* toke
         return false;
     }
 
-    return perform_embedding_lookup(embedding->embedding_matrix, tokens, output, batch_size, seq_length, embedding_dim);
+    return embedding_gather(embedding->weights, embedding->storage, embedding->row_scales,
+                            embedding->vocab_size, embedding_dim, tokens->data,
+                            batch_size, seq_length, 1.0f, NULL, 0, output->data);
 }
-
-
@@ -1,8 +1,9 @@
-#include "01token_embedding_backward.h"
+#include "01token_embedding_baclward.h"
+#include <stdio.h>
 
 bool token_embedding_backward(
     TokenEmbedding* embedding,
-    const Tensor* tokens,
+    const IntTensor* tokens,
     const Tensor* grad_output
 ) {
     if (!embedding || !tokens || !grad_output) {
@@ -22,21 +23,26 @@ bool token_embedding_backward(
         return false;
     }
 
-    // 创建梯度累积张量（如果还没有）
+    // 只有fp32的可训练表才有梯度
+    if (!embedding->embedding_matrix) {
+        fprintf(stderr, "token_embedding_backward needs a trainable fp32 table\n");
+        return false;
+    }
+
+    // 创建梯度累积张量（如果还没有）, 与嵌入表同为 [vocab_size, embedding_dim]
     if (!embedding->grad_embedding) {
-        int shape[] = {batch_size, embedding->vocab_size, embedding_dim};
-        embedding->grad_embedding = tensor_create(shape, 3);
+        int shape[] = {embedding->vocab_size, embedding_dim};
+        embedding->grad_embedding = tensor_create(shape, 2);
         if (!embedding->grad_embedding) {
             return false;
         }
-        tensor_fill(embedding->grad_embedding, 0.0f); // 初始化为0
     }
 
     // 对每个batch和序列位置
     for (int b = 0; b < batch_size; b++) {
         for (int s = 0; s < seq_length; s++) {
             // 获取当前位置的token id
-            int token_id = (int)tokens->data[b * seq_length + s];
+            int token_id = tokens->data[b * seq_length + s];
             
             // 检查token_id是否有效
             if (token_id < 0 || token_id >= embedding->vocab_size) {
@@ -48,8 +54,7 @@ bool token_embedding_backward(
             for (int d = 0; d < embedding_dim; d++) {
                 int grad_idx = (b * seq_length * embedding_dim) + 
                              (s * embedding_dim) + d;
-                int emb_idx = (b * embedding->vocab_size * embedding_dim) + 
-                             (token_id * embedding_dim) + d;
+                int emb_idx = (token_id * embedding_dim) + d;
                 
                 embedding->grad_embedding->data[emb_idx] += grad_output->data[grad_idx];
             }
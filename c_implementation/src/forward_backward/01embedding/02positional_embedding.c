@@ -1,13 +1,88 @@
 #include "02positional_embedding.h"
 #include "position_lookup.h"
-#include "tensor_add.h"
-#include "model_config.h"
+#include "thread_pool.h"
 #include <stdio.h>
+#include <stdlib.h>
+#include <pthread.h>
 
+// 所有共享位置编码表, 创建/释放/补算行时加锁
+static PositionalTable* g_positional_tables = NULL;
+static pthread_mutex_t g_positional_tables_lock = PTHREAD_MUTEX_INITIALIZER;
 
-// 创建位置编码结构
-// encodings tensor shape: [max_seq_length, encoding_dim]
+// 查找或创建 (max_seq_length, encoding_dim) 对应的共享表, 表中行此时尚未计算
+static PositionalTable* positional_table_acquire(int max_seq_length, int encoding_dim) {
+    pthread_mutex_lock(&g_positional_tables_lock);
+
+    PositionalTable* table = g_positional_tables;
+    while (table && (table->max_seq_length != max_seq_length || table->encoding_dim != encoding_dim)) {
+        table = table->next;
+    }
+
+    if (table) {
+        table->ref_count++;
+    } else {
+        table = (PositionalTable*)malloc(sizeof(PositionalTable));
+        float* data = (float*)malloc((size_t)max_seq_length * encoding_dim * sizeof(float));
+        if (!table || !data) {
+            fprintf(stderr, "Failed to allocate positional encoding table [%d, %d]\n", max_seq_length, encoding_dim);
+            free(table);
+            free(data);
+            table = NULL;
+        } else {
+            table->data = data;
+            table->max_seq_length = max_seq_length;
+            table->encoding_dim = encoding_dim;
+            table->computed_rows = 0;
+            table->ref_count = 1;
+            table->next = g_positional_tables;
+            g_positional_tables = table;
+        }
+    }
+
+    pthread_mutex_unlock(&g_positional_tables_lock);
+    return table;
+}
+
+static void positional_table_release(PositionalTable* table) {
+    if (!table) return;
+
+    pthread_mutex_lock(&g_positional_tables_lock);
+    if (--table->ref_count == 0) {
+        PositionalTable** link = &g_positional_tables;
+        while (*link != table) link = &(*link)->next;
+        *link = table->next;
+        free(table->data);
+        free(table);
+    }
+    pthread_mutex_unlock(&g_positional_tables_lock);
+}
+
+// 保证前rows行已计算. 快路径只做一次原子读, 只有表需要增长时才加锁
+static bool positional_table_ensure(PositionalTable* table, int rows) {
+    if (__atomic_load_n(&table->computed_rows, __ATOMIC_ACQUIRE) >= rows) return true;
+
+    bool ok = true;
+    pthread_mutex_lock(&g_positional_tables_lock);
+    int computed = table->computed_rows;
+    if (computed < rows) {
+        // 一次至少补到两倍, 避免逐行增长时反复加锁
+        int target = computed * 2 > rows ? computed * 2 : rows;
+        if (target > table->max_seq_length) target = table->max_seq_length;
+        ok = compute_positional_encodings(table->data + (size_t)computed * table->encoding_dim,
+                                          computed, target - computed, table->encoding_dim);
+        if (ok) __atomic_store_n(&table->computed_rows, target, __ATOMIC_RELEASE);
+    }
+    pthread_mutex_unlock(&g_positional_tables_lock);
+    return ok;
+}
+
+// 创建位置编码结构, 只记录共享表, 行在第一次使用时计算
 PositionalEncoding* positional_encoding_create(int max_seq_length, int encoding_dim) {
+    if (max_seq_length <= 0 || encoding_dim <= 0) {
+        fprintf(stderr, "Invalid positional encoding size [%d, %d]\n", max_seq_length, encoding_dim);
+        return NULL;
+    }
+
     PositionalEncoding* pos_enc = (PositionalEncoding*)malloc(sizeof(PositionalEncoding));
     if (!pos_enc) {
         fprintf(stderr, "Failed to allocate memory for positional encoding\n");
@@ -17,19 +92,8 @@ PositionalEncoding* positional_encoding_create(int max_seq_length, int encoding_
     // 初始化基本参数
     pos_enc->max_seq_length = max_seq_length;
     pos_enc->encoding_dim = encoding_dim;
-    const int batch_size = g_model_config.batch_size;
-
-    // 创建位置编码张量 [batch_size, max_seq_length, encoding_dim]
-    int shape[] = {batch_size, max_seq_length, encoding_dim};
-    pos_enc->encodings = tensor_create(shape, 3);
-    if (!pos_enc->encodings) {
-        free(pos_enc);
-        return NULL;
-    }
-
-    // 计算位置编码
-    if (!compute_positional_encodings(pos_enc->encodings, batch_size, max_seq_length, encoding_dim)) {
-        tensor_free(pos_enc->encodings);
+    pos_enc->table = positional_table_acquire(max_seq_length, encoding_dim);
+    if (!pos_enc->table) {
         free(pos_enc);
         return NULL;
     }
@@ -39,15 +103,75 @@ PositionalEncoding* positional_encoding_create(int max_seq_length, int encoding_
 
 void free_positional_encoding(PositionalEncoding* pos_enc) {
     if (pos_enc) {
-        tensor_free(pos_enc->encodings);
+        positional_table_release(pos_enc->table);
         free(pos_enc);
     }
 }
 
+const float* positional_encoding_rows(const PositionalEncoding* pos_enc, int start_pos, int count) {
+    if (!pos_enc || start_pos < 0 || count < 0 || start_pos + count > pos_enc->max_seq_length) {
+        return NULL;
+    }
+    if (!positional_table_ensure(pos_enc->table, start_pos + count)) {
+        return NULL;
+    }
+    return pos_enc->table->data + (size_t)start_pos * pos_enc->encoding_dim;
+}
+
+bool positional_encoding_add_position(const PositionalEncoding* pos_enc, int pos, float* x) {
+    const int dim = pos_enc->encoding_dim;
+
+    if (pos < pos_enc->max_seq_length) {
+        const float* row = positional_encoding_rows(pos_enc, pos, 1);
+        if (!row) return false;
+        #pragma omp simd
+        for (int d = 0; d < dim; d++) {
+            x[d] += row[d];
+        }
+        return true;
+    }
+
+    // 超过表长的位置即时生成一行
+    float* row = (float*)malloc(dim * sizeof(float));
+    if (!row || !compute_positional_encodings(row, pos, 1, dim)) {
+        free(row);
+        return false;
+    }
+    for (int d = 0; d < dim; d++) {
+        x[d] += row[d];
+    }
+    free(row);
+    return true;
+}
+
+typedef struct PositionalAddJob {
+    float* data;
+    const float* rows;
+    int seq_length;
+    int table_rows;
+    int encoding_dim;
+} PositionalAddJob;
+
+// 每个单元是一个 (batch, position) 的行, 只覆盖表中的前table_rows个位置
+static void positional_add_rows(void* ctx, long begin, long end) {
+    const PositionalAddJob* job = (const PositionalAddJob*)ctx;
+    const int encoding_dim = job->encoding_dim;
+    for (long unit = begin; unit < end; unit++) {
+        const long b = unit / job->table_rows;
+        const int s = (int)(unit % job->table_rows);
+        float* x = job->data + ((size_t)b * job->seq_length + s) * encoding_dim;
+        const float* row = job->rows + (size_t)s * encoding_dim;
+        #pragma omp simd
+        for (int d = 0; d < encoding_dim; d++) {
+            x[d] += row[d];
+        }
+    }
+}
+
 // positional_encoding forward pass
 // input tensor shape: [batch_size, seq_length, encoding_dim], encoding_dim is the same as embedding_dim, d_model, generated by token_embedding_forward
-// adds positional encoding directly to input tensor, shape remains the same
-bool positional_encoding_forward(const PositionalEncoding* pos_enc, Tensor* input) {
+// adds positional encoding of positions [start_pos, start_pos + seq_length) directly to input tensor, shape remains the same
+bool positional_encoding_forward_at(const PositionalEncoding* pos_enc, Tensor* input, int start_pos) {
     if (input->num_dims != 3) {
         fprintf(stderr, "Input tensor must be 3-dimensional [batch_size, seq_length, encoding_dim]\n");
         return false;
@@ -61,12 +185,37 @@ bool positional_encoding_forward(const PositionalEncoding* pos_enc, Tensor* inpu
         fprintf(stderr, "Encoding dimension mismatch\n");
         return false;
     }
+    if (start_pos < 0) {
+        fprintf(stderr, "Invalid start position %d\n", start_pos);
+        return false;
+    }
+
+    // 只访问实际用到的行; 超过表长的位置逐行即时生成
+    int table_rows = pos_enc->max_seq_length - start_pos;
+    if (table_rows > seq_length) table_rows = seq_length;
+    if (table_rows < 0) table_rows = 0;
 
-    // 确保序列长度不超过最大长度
-    if (seq_length > pos_enc->max_seq_length) {
-        seq_length = pos_enc->max_seq_length;
+    const float* rows = NULL;
+    if (table_rows > 0) {
+        rows = positional_encoding_rows(pos_enc, start_pos, table_rows);
+        if (!rows) return false;
     }
 
-    // 使用tensor_add直接进行张量加法
-    return tensor_add(input, pos_enc->encodings, input);
-}
\ No newline at end of file
+    if (table_rows > 0) {
+        PositionalAddJob job = {input->data, rows, seq_length, table_rows, encoding_dim};
+        const long units = (long)batch_size * table_rows;
+        thread_pool_parallel_for(units, (size_t)units * encoding_dim > 65536 ? 0 : units, positional_add_rows, &job);
+    }
+
+    for (int b = 0; b < batch_size; b++) {
+        for (int s = table_rows; s < seq_length; s++) {
+            float* x = input->data + ((size_t)b * seq_length + s) * encoding_dim;
+            if (!positional_encoding_add_position(pos_enc, start_pos + s, x)) return false;
+        }
+    }
+    return true;
+}
+
+bool positional_encoding_forward(const PositionalEncoding* pos_enc, Tensor* input) {
+    return positional_encoding_forward_at(pos_enc, input, 0);
+}
@@ -3,33 +3,55 @@
 // and finally the transformer embedding layer by adding their outputs together
 #include "03transformer_embedding.h"
 #include "model_config.h"
+#include "lookup.h"
 #include <stdio.h>
+#include <stdlib.h>
 
-TransformerEmbedding* transformer_embedding_create(
-    int vocab_size, 
-    int embedding_dim, 
-    int max_seq_length
+TransformerEmbedding* transformer_embedding_create_shared(
+    TokenEmbedding* token_embedding,
+    int max_seq_length,
+    PositionEncoding position_encoding
 ) {
+    if (!token_embedding) {
+        return NULL;
+    }
+
     TransformerEmbedding* trans_emb = (TransformerEmbedding*)malloc(sizeof(TransformerEmbedding));
     if (!trans_emb) {
         return NULL;
     }
+    trans_emb->token_embedding = token_embedding_retain(token_embedding);
+    trans_emb->embedding_scale = 1.0f;
 
-    // 创建token嵌入
-    trans_emb->token_embedding = token_embedding_create(vocab_size, embedding_dim);
-    if (!trans_emb->token_embedding) {
-        free(trans_emb);
-        return NULL;
+    // 创建位置编码, 使用RoPE时位置信息在注意力中加入, 嵌入层不加位置编码
+    trans_emb->positional_encoding = NULL;
+    if (position_encoding == POSITION_ENCODING_SINUSOIDAL) {
+        trans_emb->positional_encoding = positional_encoding_create(max_seq_length, token_embedding->embedding_dim);
+        if (!trans_emb->positional_encoding) {
+            free_token_embedding(trans_emb->token_embedding);
+            free(trans_emb);
+            return NULL;
+        }
     }
 
-    // 创建位置编码
-    trans_emb->positional_encoding = positional_encoding_create(max_seq_length, embedding_dim);
-    if (!trans_emb->positional_encoding) {
-        free_token_embedding(trans_emb->token_embedding);
-        free(trans_emb);
+    return trans_emb;
+}
+
+TransformerEmbedding* transformer_embedding_create(
+    int vocab_size, 
+    int embedding_dim, 
+    int max_seq_length,
+    PositionEncoding position_encoding
+) {
+    // 创建token嵌入
+    TokenEmbedding* token_embedding = token_embedding_create(vocab_size, embedding_dim);
+    if (!token_embedding) {
         return NULL;
     }
 
+    TransformerEmbedding* trans_emb = transformer_embedding_create_shared(token_embedding, max_seq_length,
+                                                                        position_encoding);
+    free_token_embedding(token_embedding);  // 由trans_emb持有引用
     return trans_emb;
 }
 
@@ -46,19 +68,54 @@ void free_transformer_embedding(TransformerEmbedding* trans_emb) {
 // output tensor shape: [batch_size, seq_length, embedding_dim]
 bool transformer_embedding_forward(
     const TransformerEmbedding* trans_emb,
-    const Tensor* tokens,
+    const IntTensor* tokens,
     Tensor* output
 ) {
-    // 执行token嵌入
-    if (!token_embedding_forward(trans_emb->token_embedding, tokens, output)) {
+    if (tokens->num_dims != 2 || output->num_dims != 3) {
+        fprintf(stderr, "Invalid tokens or output dimensions in transformer_embedding_forward\n");
         return false;
     }
-    
-    // 添加位置编码
-    if (!positional_encoding_forward(trans_emb->positional_encoding, output)) {
+
+    const int batch_size = tokens->shape[0];
+    const int seq_length = tokens->shape[1];
+    const int embedding_dim = trans_emb->token_embedding->embedding_dim;
+    const PositionalEncoding* pos_enc = trans_emb->positional_encoding;
+
+    if (output->shape[0] != batch_size || output->shape[1] != seq_length ||
+        output->shape[2] != embedding_dim) {
+        fprintf(stderr, "Invalid output tensor dimensions\n");
         return false;
     }
 
+    const TokenEmbedding* token_emb = trans_emb->token_embedding;
+
+    // 查找, 缩放与位置编码相加融合为一次遍历, 只访问前seq_length行位置编码
+    int table_rows = 0;
+    const float* position_rows = NULL;
+    if (pos_enc) {
+        table_rows = seq_length < pos_enc->max_seq_length ? seq_length : pos_enc->max_seq_length;
+        position_rows = positional_encoding_rows(pos_enc, 0, table_rows);
+        if (!position_rows) {
+            return false;
+        }
+    }
+    if (!embedding_gather(token_emb->weights, token_emb->storage, token_emb->row_scales,
+                          token_emb->vocab_size, embedding_dim, tokens->data,
+                          batch_size, seq_length, trans_emb->embedding_scale,
+                          position_rows, table_rows, output->data)) {
+        return false;
+    }
+
+    // 超过max_seq_length的位置即时生成编码
+    for (int b = 0; pos_enc && b < batch_size; b++) {
+        for (int s = table_rows; s < seq_length; s++) {
+            float* x = output->data + ((size_t)b * seq_length + s) * embedding_dim;
+            if (!positional_encoding_add_position(pos_enc, s, x)) {
+                return false;
+            }
+        }
+    }
+
     // dropout for training
     
     return true;
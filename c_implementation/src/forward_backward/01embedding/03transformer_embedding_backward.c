@@ -2,7 +2,7 @@
 
 bool transformer_embedding_backward(
     TransformerEmbedding* trans_emb,
-    const Tensor* tokens,
+    const IntTensor* tokens,
     const Tensor* grad_output
 ) {
     if (!trans_emb || !tokens || !grad_output) {
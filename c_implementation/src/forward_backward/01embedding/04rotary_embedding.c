@@ -0,0 +1,98 @@
+#include "04rotary_embedding.h"
+#include "position_lookup.h"
+#include "thread_pool.h"
+#include <stdio.h>
+#include <stdlib.h>
+
+RotaryEmbedding* rotary_embedding_create(int head_dim, int cache_len, double base) {
+    if (head_dim <= 0 || head_dim % 2 != 0 || cache_len < 0) {
+        fprintf(stderr, "Invalid rotary embedding head_dim %d / cache_len %d\n", head_dim, cache_len);
+        return NULL;
+    }
+
+    RotaryEmbedding* rope = (RotaryEmbedding*)malloc(sizeof(RotaryEmbedding));
+    if (!rope) {
+        fprintf(stderr, "Failed to allocate memory for rotary embedding\n");
+        return NULL;
+    }
+
+    rope->head_dim = head_dim;
+    rope->cache_len = cache_len;
+    rope->base = base > 0.0 ? base : 10000.0;
+    rope->sincos = (float*)malloc(((size_t)cache_len * head_dim + 1) * sizeof(float));
+    if (!rope->sincos ||
+        !compute_sinusoid_table(rope->sincos, 0, cache_len, head_dim, rope->base)) {
+        rotary_embedding_free(rope);
+        return NULL;
+    }
+    return rope;
+}
+
+void rotary_embedding_free(RotaryEmbedding* rope) {
+    if (rope) {
+        free(rope->sincos);
+        free(rope);
+    }
+}
+
+const float* rotary_embedding_rows(const RotaryEmbedding* rope, int start_pos, int count, float** owned) {
+    *owned = NULL;
+    if (start_pos < 0 || count < 0) return NULL;
+
+    if (start_pos + count <= rope->cache_len) {
+        return rope->sincos + (size_t)start_pos * rope->head_dim;
+    }
+
+    // 超出缓存的位置即时计算 (解码时通常只有一行)
+    float* rows = (float*)malloc(((size_t)count * rope->head_dim + 1) * sizeof(float));
+    if (!rows || !compute_sinusoid_table(rows, start_pos, count, rope->head_dim, rope->base)) {
+        fprintf(stderr, "Failed to compute rotary rows for positions [%d, %d)\n", start_pos, start_pos + count);
+        free(rows);
+        return NULL;
+    }
+    *owned = rows;
+    return rows;
+}
+
+typedef struct RotaryJob {
+    float* data;
+    const float* rows;
+    int seq_len;
+    int head_dim;
+} RotaryJob;
+
+// 每个单元是一个 (batch * head, position) 的向量
+static void rotary_rows(void* ctx, long begin, long end) {
+    const RotaryJob* job = (const RotaryJob*)ctx;
+    for (long unit = begin; unit < end; unit++) {
+        float* v = job->data + (size_t)unit * job->head_dim;
+        rotary_rotate(v, v, job->rows + (size_t)(unit % job->seq_len) * job->head_dim, job->head_dim);
+    }
+}
+
+bool rotary_embedding_apply(const RotaryEmbedding* rope, Tensor* x, int start_pos) {
+    if (!rope || !x || (x->num_dims != 3 && x->num_dims != 4)) {
+        fprintf(stderr, "rotary_embedding_apply expects [batch, heads, (seq,) head_dim]\n");
+        return false;
+    }
+
+    const int head_dim = x->shape[x->num_dims - 1];
+    if (head_dim != rope->head_dim) {
+        fprintf(stderr, "Rotary head_dim mismatch: %d vs %d\n", head_dim, rope->head_dim);
+        return false;
+    }
+
+    const int num_slices = x->shape[0] * x->shape[1];
+    const int seq_len = x->num_dims == 4 ? x->shape[2] : 1;
+
+    float* owned = NULL;
+    const float* rows = rotary_embedding_rows(rope, start_pos, seq_len, &owned);
+    if (!rows) return false;
+
+    RotaryJob job = {x->data, rows, seq_len, head_dim};
+    const long units = (long)num_slices * seq_len;
+    thread_pool_parallel_for(units, (size_t)units * head_dim > 65536 ? 0 : units, rotary_rows, &job);
+
+    free(owned);
+    return true;
+}
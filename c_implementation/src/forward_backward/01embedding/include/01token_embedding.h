@@ -2,20 +2,57 @@
 #define TOKEN_EMBEDDING_H
 
 #include "tensor_type.h"
+#include "lookup.h"
 #include <stdbool.h>
+#include <stddef.h>
 typedef struct TokenEmbedding TokenEmbedding;
 
 // Token嵌入结构
+// 只有一张 [vocab_size, embedding_dim] 的表, 所有batch共用; 可用引用计数在编码器/解码器之间共享
 struct TokenEmbedding {
-    Tensor* embedding_matrix;    // 嵌入矩阵 [batch_size, vocab_size, embedding_dim]
+    Tensor* embedding_matrix;   // 可训练的fp32嵌入矩阵 [vocab_size, embedding_dim]; 压缩或mmap加载时为NULL
+    Tensor* grad_embedding;     // 梯度 [vocab_size, embedding_dim], 第一次反向传播时创建
     int vocab_size;             // 词汇表大小, number of unique tokens in the vocabulary dictionary
     int embedding_dim;          // 嵌入维度, d_model, number of features to represent a token, same as encoding_dim
-    // no need to store requires_grad, because token embedding need to be trained
+
+    // 查找实际使用的表
+    EmbeddingStorage storage;
+    const void* weights;        // embedding_matrix->data, 压缩副本, 或mmap区域中的数据
+    const float* row_scales;    // EMBEDDING_INT8的每行缩放 [vocab_size]
+    void* owned_weights;        // 压缩副本, 需要free
+    void* mapping;              // mmap区域, 需要munmap
+    size_t mapping_size;
+
+    int ref_count;
 };
 
+// 创建可训练的fp32嵌入表
 TokenEmbedding* token_embedding_create(int vocab_size, int embedding_dim);
-void token_embedding_free(TokenEmbedding* token_embedding);
 
-bool token_embedding_forward(const TokenEmbedding* embedding, const Tensor* tokens, Tensor* output);
+// 由fp32权重 [vocab_size, embedding_dim] 创建只读的压缩表 (fp16或按行int8), 用于推理
+TokenEmbedding* token_embedding_create_compressed(
+    const float* weights,
+    int vocab_size,
+    int embedding_dim,
+    EmbeddingStorage storage
+);
+
+// 以只读方式mmap权重文件, 不复制到堆上, 多个进程可共享页缓存
+// 文件布局: FP32/FP16为行主序的 [vocab_size, embedding_dim];
+//          INT8为 float row_scales[vocab_size] 后接 int8 [vocab_size, embedding_dim]
+TokenEmbedding* token_embedding_map_file(
+    const char* path,
+    int vocab_size,
+    int embedding_dim,
+    EmbeddingStorage storage
+);
+
+// 增加引用计数, 返回同一张表
+TokenEmbedding* token_embedding_retain(TokenEmbedding* token_embedding);
+// 减少引用计数, 为0时释放
+void free_token_embedding(TokenEmbedding* token_embedding);
+
+// tokens: [batch_size, seq_length], output: [batch_size, seq_length, embedding_dim]
+bool token_embedding_forward(const TokenEmbedding* embedding, const IntTensor* tokens, Tensor* output);
 
 #endif // TOKEN_EMBEDDING_H
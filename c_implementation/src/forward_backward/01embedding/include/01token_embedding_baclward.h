@@ -5,7 +5,7 @@
 
 bool token_embedding_backward(
     TokenEmbedding* embedding,
-    const Tensor* tokens,     // [batch_size, seq_length]
+    const IntTensor* tokens,     // [batch_size, seq_length]
     const Tensor* grad_output // [batch_size, seq_length, embedding_dim]
 );
 
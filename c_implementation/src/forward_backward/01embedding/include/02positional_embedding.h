@@ -4,11 +4,24 @@
 #include "tensor_type.h"
 #include <stdbool.h>
 
+typedef struct PositionalTable PositionalTable;
 typedef struct PositionalEncoding PositionalEncoding;
 
+// 共享的正弦位置编码表 [max_seq_length, encoding_dim]
+// 相同 (max_seq_length, encoding_dim) 的所有PositionalEncoding共用一张表 (引用计数),
+// 表中的行按需计算: 只有被访问过的最大位置之前的行才会被填充
+struct PositionalTable {
+    float* data;                // [max_seq_length, encoding_dim]
+    int max_seq_length;
+    int encoding_dim;
+    int computed_rows;          // 已计算的行数, 原子读写
+    int ref_count;
+    PositionalTable* next;      // 全局表链表
+};
+
 // 位置编码结构
 struct PositionalEncoding {
-    Tensor* encodings;          // 位置编码矩阵 [batch_size, max_seq_length, encoding_dim]
+    PositionalTable* table;     // 共享位置编码表, 与batch无关
     int max_seq_length;         // 最大序列长度, for sentence
     int encoding_dim;           // 编码维度, d_model, number of features to represent a position, same as embedding_dim
     // no need to store requires_grad, because it's a fixed value
@@ -17,6 +30,15 @@ struct PositionalEncoding {
 PositionalEncoding* positional_encoding_create(int max_seq_length, int encoding_dim);
 void free_positional_encoding(PositionalEncoding* pos_enc);
 
+// 返回位置 [start_pos, start_pos + count) 在共享表中的行, 必要时先计算这些行
+// 超出 max_seq_length 时返回NULL
+const float* positional_encoding_rows(const PositionalEncoding* pos_enc, int start_pos, int count);
+
+// 把位置pos的编码加到x [encoding_dim] 上; pos >= max_seq_length 时即时生成, 不扩展表
+bool positional_encoding_add_position(const PositionalEncoding* pos_enc, int pos, float* x);
+
+// input: [batch_size, seq_length, encoding_dim], 从位置start_pos开始原地加上位置编码
+bool positional_encoding_forward_at(const PositionalEncoding* pos_enc, Tensor* input, int start_pos);
 bool positional_encoding_forward(const PositionalEncoding* pos_enc, Tensor* input);
 
-#endif // POSITIONAL_ENCODING_H
\ No newline at end of file
+#endif // POSITIONAL_ENCODING_H
@@ -3,6 +3,7 @@
 
 #include "01token_embedding.h"
 #include "02positional_embedding.h"
+#include "model_config.h"
 #include <stdbool.h>
 
 typedef struct TransformerEmbedding TransformerEmbedding;   // to integrate both embedding and positional encoding
@@ -10,12 +11,18 @@ typedef struct TransformerEmbedding TransformerEmbedding;   // to integrate both
 // Transformer嵌入结构
 struct TransformerEmbedding {
     TokenEmbedding* token_embedding;          // Token嵌入层
-    PositionalEncoding* positional_encoding;  // 位置编码层
+    PositionalEncoding* positional_encoding;  // 位置编码层, 使用RoPE时为NULL
+    float embedding_scale;                    // 查找结果的缩放, 默认1 (原论文为sqrt(d_model))
 };
 
-TransformerEmbedding* transformer_embedding_create(int vocab_size, int embedding_dim, int max_seq_length);
+// position_encoding取自模型自己的配置 (Transformer.config), 为POSITION_ENCODING_ROTARY时不创建位置编码
+TransformerEmbedding* transformer_embedding_create(int vocab_size, int embedding_dim, int max_seq_length,
+                                                   PositionEncoding position_encoding);
+// 使用已有的token嵌入表 (增加其引用计数), 例如编码器与解码器共享词表
+TransformerEmbedding* transformer_embedding_create_shared(TokenEmbedding* token_embedding, int max_seq_length,
+                                                          PositionEncoding position_encoding);
 void free_transformer_embedding(TransformerEmbedding* transformer_embedding);
 
-bool transformer_embedding_forward(const TransformerEmbedding* trans_emb, const Tensor* tokens, Tensor* output);
+bool transformer_embedding_forward(const TransformerEmbedding* trans_emb, const IntTensor* tokens, Tensor* output);
 
 #endif // TRANSFORMER_EMBEDDING_H
\ No newline at end of file
@@ -2,10 +2,11 @@
 #define TRANSFORMER_EMBEDDING_BACKWARD_H
 
 #include "03transformer_embedding.h"
+#include "01token_embedding_baclward.h"
 
 bool transformer_embedding_backward(
     TransformerEmbedding* trans_emb,
-    const Tensor* tokens,
+    const IntTensor* tokens,
     const Tensor* grad_output
 );
 
@@ -0,0 +1,42 @@
+#ifndef ROTARY_EMBEDDING_H
+#define ROTARY_EMBEDDING_H
+
+#include "tensor_type.h"
+#include <stdbool.h>
+
+typedef struct RotaryEmbedding RotaryEmbedding;
+
+// 旋转位置编码 (RoPE), 作为加性位置编码的替代
+// 把每个head的 (x[2i], x[2i+1]) 看作复数, 在位置p旋转角度 p * w_i, w_i = base^(-2i / head_dim)
+// 只作用于自注意力的Q和K, 点积 q_m . k_n 只依赖相对位置 m - n
+struct RotaryEmbedding {
+    int head_dim;       // 必须为偶数
+    int cache_len;      // 缓存的位置数, 之后的位置即时计算, 不重新分配
+    double base;
+    float* sincos;      // [cache_len, head_dim], 行内交错存放 sin(p*w_i), cos(p*w_i)
+};
+
+RotaryEmbedding* rotary_embedding_create(int head_dim, int cache_len, double base);
+void rotary_embedding_free(RotaryEmbedding* rope);
+
+// 返回位置 [start_pos, start_pos + count) 的sin/cos行 [count, head_dim]
+// 全部落在缓存内时直接返回缓存指针, *owned为NULL; 否则新分配并计算, 由调用方free(*owned)
+const float* rotary_embedding_rows(const RotaryEmbedding* rope, int start_pos, int count, float** owned);
+
+// 旋转一个head向量: dst = rotate(src, sincos), 允许dst == src
+static inline void rotary_rotate(float* dst, const float* src, const float* sincos, int head_dim) {
+    for (int i = 0; i < head_dim; i += 2) {
+        const float s = sincos[i];
+        const float c = sincos[i + 1];
+        const float x0 = src[i];
+        const float x1 = src[i + 1];
+        dst[i] = x0 * c - x1 * s;
+        dst[i + 1] = x0 * s + x1 * c;
+    }
+}
+
+// 原地旋转 x: [batch_size, num_heads, seq_len, head_dim], 第s行位于位置 start_pos + s
+// 解码时x可为 [batch_size, num_heads, head_dim], 即单个位置start_pos
+bool rotary_embedding_apply(const RotaryEmbedding* rope, Tensor* x, int start_pos);
+
+#endif // ROTARY_EMBEDDING_H
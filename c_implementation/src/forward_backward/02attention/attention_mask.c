@@ -1,6 +1,6 @@
 #include <stdlib.h>
 #include <stdio.h>
-#include "01attention_mask.h"
+#include "attention_mask.h"
 #include "tensor_logic.h"
 #include "tensor_trio.h"
 
@@ -140,4 +140,22 @@ bool apply_attention_mask(
     bool success = tensor_apply_mask(scores, mask->mask, output, MASKING_VALUE);
 
     return success;
-}
\ No newline at end of file
+}
+
+const float* attention_mask_row(const AttentionMask* mask, int b, int h, int i) {
+    if (!mask || !mask->mask) return NULL;
+
+    const Tensor* m = mask->mask;
+    switch (m->num_dims) {
+        case 2:
+            return m->data + (size_t)i * m->shape[1];
+        case 3:
+            return m->data + ((size_t)b * m->shape[1] + i) * m->shape[2];
+        case 4: {
+            int mh = m->shape[1] == 1 ? 0 : h;  // 允许head维度广播
+            return m->data + (((size_t)b * m->shape[1] + mh) * m->shape[2] + i) * m->shape[3];
+        }
+        default:
+            return NULL;
+    }
+}
@@ -0,0 +1,367 @@
+#include "block_sparse_attention.h"
+#include "thread_pool.h"
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <math.h>
+#include <float.h>
+
+// 由块级布尔矩阵 [num_q_blocks, num_k_blocks] 生成CSR布局
+static BlockSparseLayout* layout_from_block_mask(
+    const bool* present,
+    int block_size,
+    int seq_len_q,
+    int seq_len_k,
+    bool is_causal
+) {
+    const int num_q_blocks = (seq_len_q + block_size - 1) / block_size;
+    const int num_k_blocks = (seq_len_k + block_size - 1) / block_size;
+
+    BlockSparseLayout* layout = (BlockSparseLayout*)malloc(sizeof(BlockSparseLayout));
+    if (!layout) {
+        fprintf(stderr, "Failed to allocate memory for block sparse layout\n");
+        return NULL;
+    }
+    layout->block_size = block_size;
+    layout->num_q_blocks = num_q_blocks;
+    layout->num_k_blocks = num_k_blocks;
+    layout->seq_len_q = seq_len_q;
+    layout->seq_len_k = seq_len_k;
+    layout->is_causal = is_causal;
+
+    int nnz = 0;
+    for (int i = 0; i < num_q_blocks * num_k_blocks; i++) {
+        if (present[i]) nnz++;
+    }
+
+    layout->row_ptr = (int*)malloc((num_q_blocks + 1) * sizeof(int));
+    layout->col_idx = (int*)malloc((nnz > 0 ? nnz : 1) * sizeof(int));
+    if (!layout->row_ptr || !layout->col_idx) {
+        block_sparse_layout_free(layout);
+        return NULL;
+    }
+
+    int n = 0;
+    for (int qb = 0; qb < num_q_blocks; qb++) {
+        layout->row_ptr[qb] = n;
+        for (int kb = 0; kb < num_k_blocks; kb++) {
+            if (present[(size_t)qb * num_k_blocks + kb]) layout->col_idx[n++] = kb;
+        }
+    }
+    layout->row_ptr[num_q_blocks] = n;
+    return layout;
+}
+
+BlockSparseLayout* block_sparse_layout_create(
+    const BlockSparsePattern* pattern,
+    int seq_len_q,
+    int seq_len_k
+) {
+    if (!pattern || pattern->block_size <= 0 || seq_len_q <= 0 || seq_len_k <= 0 ||
+        pattern->num_local_blocks < 0 || pattern->block_stride < 0 ||
+        pattern->num_random_blocks < 0 || pattern->num_global_blocks < 0) {
+        fprintf(stderr, "Invalid block sparse pattern\n");
+        return NULL;
+    }
+
+    const int bs = pattern->block_size;
+    const int num_q_blocks = (seq_len_q + bs - 1) / bs;
+    const int num_k_blocks = (seq_len_k + bs - 1) / bs;
+
+    bool* present = (bool*)calloc((size_t)num_q_blocks * num_k_blocks, sizeof(bool));
+    if (!present) {
+        fprintf(stderr, "Failed to allocate block mask\n");
+        return NULL;
+    }
+
+    uint64_t rng = pattern->seed * 0x9E3779B97F4A7C15ULL + 1;
+
+    for (int qb = 0; qb < num_q_blocks; qb++) {
+        bool* row = present + (size_t)qb * num_k_blocks;
+        // 因果时最后一个可见列块为对角块
+        int last = pattern->is_causal ? (qb < num_k_blocks - 1 ? qb : num_k_blocks - 1) : num_k_blocks - 1;
+
+        // 全局块行看所有列
+        if (qb < pattern->num_global_blocks) {
+            for (int kb = 0; kb <= last; kb++) row[kb] = true;
+            continue;
+        }
+
+        // 全局块列
+        for (int kb = 0; kb < pattern->num_global_blocks && kb <= last; kb++) row[kb] = true;
+
+        // 局部块
+        for (int kb = qb - pattern->num_local_blocks; kb <= qb + pattern->num_local_blocks; kb++) {
+            if (kb >= 0 && kb <= last) row[kb] = true;
+        }
+
+        // 跨步块
+        if (pattern->block_stride > 0) {
+            for (int kb = pattern->block_stride - 1; kb <= last; kb += pattern->block_stride) {
+                row[kb] = true;
+            }
+        }
+
+        // 随机块 (xorshift), 可能与已有块重合
+        for (int r = 0; r < pattern->num_random_blocks && last >= 0; r++) {
+            rng ^= rng << 13;
+            rng ^= rng >> 7;
+            rng ^= rng << 17;
+            row[rng % (uint64_t)(last + 1)] = true;
+        }
+    }
+
+    BlockSparseLayout* layout = layout_from_block_mask(present, bs, seq_len_q, seq_len_k,
+                                                       pattern->is_causal);
+    free(present);
+    return layout;
+}
+
+BlockSparseLayout* block_sparse_layout_create_dense(
+    int block_size,
+    int seq_len_q,
+    int seq_len_k,
+    bool is_causal
+) {
+    BlockSparsePattern pattern = {
+        .block_size = block_size,
+        .num_local_blocks = 0,
+        .block_stride = 0,
+        .num_random_blocks = 0,
+        .num_global_blocks = (seq_len_q + block_size - 1) / block_size,
+        .is_causal = is_causal,
+        .seed = 0
+    };
+    return block_sparse_layout_create(&pattern, seq_len_q, seq_len_k);
+}
+
+void block_sparse_layout_free(BlockSparseLayout* layout) {
+    if (layout) {
+        free(layout->row_ptr);
+        free(layout->col_idx);
+        free(layout);
+    }
+}
+
+int block_sparse_layout_nnz(const BlockSparseLayout* layout) {
+    return layout ? layout->row_ptr[layout->num_q_blocks] : 0;
+}
+
+typedef struct BlockSparseJob {
+    const BlockSparseLayout* layout;
+    const Tensor* Q;
+    const Tensor* K;
+    const Tensor* V;
+    Tensor* output;
+    const AttentionMask* mask;
+    float scale;
+    int max_keys;
+    atomic_bool failed;
+} BlockSparseJob;
+
+// [begin, end) 为 (batch, head, query块行) 展平后的编号
+static void block_sparse_rows(void* ctx, long begin, long end) {
+    BlockSparseJob* job = (BlockSparseJob*)ctx;
+    const BlockSparseLayout* layout = job->layout;
+    const int num_heads = job->Q->shape[1];
+    const int seq_len_q = job->Q->shape[2];
+    const int head_dim = job->Q->shape[3];
+    const int seq_len_k = job->K->shape[2];
+    const int bs = layout->block_size;
+    const int max_keys = job->max_keys;
+
+    // 分数块 [block_size, max_keys], 只覆盖当前query块行存在的key块
+    float* scores = (float*)malloc((size_t)bs * (max_keys > 0 ? max_keys : 1) * sizeof(float));
+    if (!scores) {
+        atomic_store(&job->failed, true);
+        return;
+    }
+
+    for (long unit = begin; unit < end; unit++) {
+        const size_t bh = (size_t)unit / layout->num_q_blocks;
+        const int qb = (int)(unit % layout->num_q_blocks);
+        const int b = (int)(bh / num_heads);
+        const int h = (int)(bh % num_heads);
+        const float* q_base = job->Q->data + bh * seq_len_q * head_dim;
+        const float* k_base = job->K->data + bh * seq_len_k * head_dim;
+        const float* v_base = job->V->data + bh * seq_len_k * head_dim;
+        float* o_base = job->output->data + bh * seq_len_q * head_dim;
+
+        const int q_start = qb * bs;
+        const int q_rows = seq_len_q - q_start < bs ? seq_len_q - q_start : bs;
+        const int first = layout->row_ptr[qb];
+        const int count = layout->row_ptr[qb + 1] - first;
+
+        // 1. 分数: 仅存在的块, 对角块内因果屏蔽, padding屏蔽
+        int width = 0;
+        for (int n = 0; n < count; n++) {
+            const int k_start = layout->col_idx[first + n] * bs;
+            const int k_cols = seq_len_k - k_start < bs ? seq_len_k - k_start : bs;
+            for (int i = 0; i < q_rows; i++) {
+                const int qi = q_start + i;
+                const float* qrow = q_base + (size_t)qi * head_dim;
+                const float* row_mask = attention_mask_row(job->mask, b, h, qi);
+                float* srow = scores + (size_t)i * max_keys + width;
+                for (int j = 0; j < k_cols; j++) {
+                    const int kj = k_start + j;
+                    if ((layout->is_causal && kj > qi) || (row_mask && row_mask[kj] == 0.0f)) {
+                        srow[j] = -INFINITY;
+                        continue;
+                    }
+                    const float* krow = k_base + (size_t)kj * head_dim;
+                    float dot = 0.0f;
+                    for (int d = 0; d < head_dim; d++) dot += qrow[d] * krow[d];
+                    srow[j] = dot * job->scale;
+                }
+            }
+            width += k_cols;
+        }
+
+        // 2. 按行softmax
+        for (int i = 0; i < q_rows; i++) {
+            float* srow = scores + (size_t)i * max_keys;
+            float max_val = -INFINITY;
+            for (int j = 0; j < width; j++) max_val = fmaxf(max_val, srow[j]);
+            if (max_val == -INFINITY) {
+                // 整行被屏蔽, 输出0
+                memset(srow, 0, width * sizeof(float));
+                continue;
+            }
+            float sum = 0.0f;
+            for (int j = 0; j < width; j++) {
+                srow[j] = expf(srow[j] - max_val);
+                sum += srow[j];
+            }
+            float inv_sum = 1.0f / sum;
+            for (int j = 0; j < width; j++) srow[j] *= inv_sum;
+        }
+
+        // 3. P·V
+        for (int i = 0; i < q_rows; i++) {
+            memset(o_base + (size_t)(q_start + i) * head_dim, 0, head_dim * sizeof(float));
+        }
+        width = 0;
+        for (int n = 0; n < count; n++) {
+            const int k_start = layout->col_idx[first + n] * bs;
+            const int k_cols = seq_len_k - k_start < bs ? seq_len_k - k_start : bs;
+            for (int i = 0; i < q_rows; i++) {
+                const float* prow = scores + (size_t)i * max_keys + width;
+                float* orow = o_base + (size_t)(q_start + i) * head_dim;
+                for (int j = 0; j < k_cols; j++) {
+                    const float p = prow[j];
+                    if (p == 0.0f) continue;
+                    const float* vrow = v_base + (size_t)(k_start + j) * head_dim;
+                    for (int d = 0; d < head_dim; d++) orow[d] += p * vrow[d];
+                }
+            }
+            width += k_cols;
+        }
+    }
+
+    free(scores);
+}
+
+bool block_sparse_attention(
+    const BlockSparseLayout* layout,
+    const Tensor* Q,
+    const Tensor* K,
+    const Tensor* V,
+    float scale,
+    const AttentionMask* mask,
+    Tensor* output
+) {
+    if (!layout || !Q || !K || !V || !output) {
+        fprintf(stderr, "Null argument passed to block_sparse_attention\n");
+        return false;
+    }
+    if (Q->num_dims != 4 || !check_same_shape(K, V) || !check_same_shape(Q, output)) {
+        fprintf(stderr, "Shape mismatch in block_sparse_attention\n");
+        return false;
+    }
+
+    const int batch_size = Q->shape[0];
+    const int num_heads = Q->shape[1];
+    const int seq_len_q = Q->shape[2];
+    const int seq_len_k = K->shape[2];
+    const int bs = layout->block_size;
+
+    if (layout->seq_len_q != seq_len_q || layout->seq_len_k != seq_len_k) {
+        fprintf(stderr, "Block sparse layout built for %dx%d, got %dx%d\n",
+                layout->seq_len_q, layout->seq_len_k, seq_len_q, seq_len_k);
+        return false;
+    }
+
+    // 每个query块行最多的key数, 决定分数块的列数
+    int max_row_blocks = 0;
+    for (int qb = 0; qb < layout->num_q_blocks; qb++) {
+        int count = layout->row_ptr[qb + 1] - layout->row_ptr[qb];
+        if (count > max_row_blocks) max_row_blocks = count;
+    }
+    const int max_keys = max_row_blocks * bs;
+
+    // 每个 (batch, head, query块行) 一个任务单元, 单个样本单个头时也能并行
+    BlockSparseJob job = {layout, Q, K, V, output, mask, scale, max_keys, false};
+    const long units = (long)batch_size * num_heads * layout->num_q_blocks;
+    thread_pool_parallel_for(units, 1, block_sparse_rows, &job);
+    return !atomic_load(&job.failed);
+}
+
+bool block_sparse_attention_forward(
+    MultiHeadAttention* mha,
+    const Tensor* input_q,
+    const Tensor* input_kv,
+    Tensor* output,
+    const AttentionMask* mask
+) {
+    if (!mha || !input_q || !input_kv || !output) {
+        return false;
+    }
+
+    const int batch_size = input_q->shape[0];
+    const int seq_len_q = input_q->shape[1];
+    const int seq_len_k = input_kv->shape[1];
+    const int num_heads = mha->num_heads;
+    const int head_dim = mha->W_q->shape[1] / num_heads;  // 投影宽度取自W_q, 张量并行分片只有部分头
+    const LayerAttentionConfig* config = &mha->attn_config;
+
+    // 布局只依赖序列长度, 开销为 O(num_blocks^2) 位, 每次前向重新生成
+    BlockSparsePattern pattern = {
+        .block_size = config->block_size,
+        .num_local_blocks = config->window_size,
+        .block_stride = config->block_stride,
+        .num_random_blocks = config->num_random_blocks,
+        .num_global_blocks = config->block_size > 0 ?
+            (config->num_global_tokens + config->block_size - 1) / config->block_size : 0,
+        .is_causal = mha->is_causal,
+        .seed = 0x5EEDu  // 固定种子, 同一序列长度下随机块保持不变
+    };
+    BlockSparseLayout* layout = block_sparse_layout_create(&pattern, seq_len_q, seq_len_k);
+    if (!layout) return false;
+
+    int q_shape[] = {batch_size, num_heads, seq_len_q, head_dim};
+    int kv_shape[] = {batch_size, num_heads, seq_len_k, head_dim};
+    Tensor* q = tensor_create(q_shape, 4);
+    Tensor* k = tensor_create(kv_shape, 4);
+    Tensor* v = tensor_create(kv_shape, 4);
+    Tensor* heads = tensor_create(q_shape, 4);
+
+    bool success = q && k && v && heads &&
+        attention_project_heads_rotary(input_q, mha->W_q, mha->b_q, num_heads, mha->rope, 0, q) &&
+        attention_project_heads_rotary(input_kv, mha->W_k, mha->b_k, num_heads, mha->rope, 0, k) &&
+        attention_project_heads(input_kv, mha->W_v, mha->b_v, num_heads, v) &&
+        block_sparse_attention(layout, q, k, v, 1.0f / sqrtf((float)head_dim), mask, heads) &&
+        attention_merge_heads(heads, mha->W_o, mha->b_o, output);
+
+    if (!success) {
+        fprintf(stderr, "Block sparse attention forward failed\n");
+    }
+
+    block_sparse_layout_free(layout);
+    tensor_free(q);
+    tensor_free(k);
+    tensor_free(v);
+    tensor_free(heads);
+    return success;
+}
@@ -31,4 +31,8 @@ bool apply_attention_mask(
     Tensor* output  // 输出的掩码后的分数
 );
 
+// 获取掩码中 (b, h, i) 这一行的指针, 支持 [q, k], [b, q, k], [b, h, q, k] 三种布局
+// mask为NULL时返回NULL
+const float* attention_mask_row(const AttentionMask* mask, int b, int h, int i);
+
 #endif
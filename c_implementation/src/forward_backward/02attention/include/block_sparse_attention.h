@@ -0,0 +1,77 @@
+#ifndef BLOCK_SPARSE_ATTENTION_H
+#define BLOCK_SPARSE_ATTENTION_H
+
+#include "tensor_type.h"
+#include "attention_mask.h"
+#include "multiattention.h"
+
+// 块稀疏注意力模式 (BigBird/Longformer风格)
+typedef struct BlockSparsePattern {
+    int block_size;          // 块大小 (token数)
+    int num_local_blocks;    // 对角线两侧各取的局部块数
+    int block_stride;        // 跨步块间隔, 列块号为 stride-1, 2*stride-1, ... 的块, 0表示不使用
+    int num_random_blocks;   // 每个query块随机选取的key块数量
+    int num_global_blocks;   // 开头的全局块数, 全局块行看所有列, 所有行看全局块列
+    bool is_causal;          // 只保留不在对角线右侧的块, 对角块内再逐元素做因果屏蔽
+    unsigned int seed;       // 随机块的种子
+} BlockSparsePattern;
+
+// 块级布局, 按query块行压缩存储 (CSR)
+// 第 qb 个query块可见的key块为 col_idx[row_ptr[qb] .. row_ptr[qb+1])
+typedef struct BlockSparseLayout {
+    int block_size;
+    int num_q_blocks;
+    int num_k_blocks;
+    int seq_len_q;
+    int seq_len_k;
+    bool is_causal;
+    int* row_ptr;    // [num_q_blocks + 1]
+    int* col_idx;    // [nnz], 每行内按升序排列
+} BlockSparseLayout;
+
+// 根据模式生成布局
+BlockSparseLayout* block_sparse_layout_create(
+    const BlockSparsePattern* pattern,
+    int seq_len_q,
+    int seq_len_k
+);
+
+// 所有块都存在的布局, 等价于dense注意力
+BlockSparseLayout* block_sparse_layout_create_dense(
+    int block_size,
+    int seq_len_q,
+    int seq_len_k,
+    bool is_causal
+);
+
+void block_sparse_layout_free(BlockSparseLayout* layout);
+
+// 非零块数量
+int block_sparse_layout_nnz(const BlockSparseLayout* layout);
+
+// 块稀疏注意力: 只对布局中存在的块计算分数、softmax和P·V
+// 计算量 O(nnz * block_size^2 * head_dim)
+// Q: [batch_size, num_heads, seq_len_q, head_dim]
+// K, V: [batch_size, num_heads, seq_len_k, head_dim]
+// mask: 可为NULL, 0.0表示屏蔽 (例如padding)
+// output: [batch_size, num_heads, seq_len_q, head_dim]
+bool block_sparse_attention(
+    const BlockSparseLayout* layout,
+    const Tensor* Q,
+    const Tensor* K,
+    const Tensor* V,
+    float scale,
+    const AttentionMask* mask,
+    Tensor* output
+);
+
+// 块稀疏注意力前向: QKV投影 -> 按层配置生成布局 -> 块稀疏注意力 -> 输出投影
+bool block_sparse_attention_forward(
+    MultiHeadAttention* mha,
+    const Tensor* input_q,
+    const Tensor* input_kv,
+    Tensor* output,
+    const AttentionMask* mask
+);
+
+#endif // BLOCK_SPARSE_ATTENTION_H
@@ -0,0 +1,40 @@
+#ifndef LOCAL_ATTENTION_H
+#define LOCAL_ATTENTION_H
+
+#include "tensor_type.h"
+#include "attention_mask.h"
+#include "multiattention.h"
+
+// 滑动窗口(带状)注意力
+// 非全局query i 只看 [i-w, i+w] (因果时为 [i-w, i]) 以及前 num_global_tokens 个全局token
+// 全局query (i < num_global_tokens) 看全部key (因果时为 j <= i)
+// 计算量 O(n * (w + g) * head_dim), 不生成 [seq_len, seq_len] 分数矩阵
+// Q: [batch_size, num_heads, seq_len_q, head_dim]
+// K, V: [batch_size, num_heads, seq_len_k, head_dim]
+// mask: 可为NULL, 0.0表示屏蔽 (例如padding)
+// output: [batch_size, num_heads, seq_len_q, head_dim]
+bool banded_attention(
+    const Tensor* Q,
+    const Tensor* K,
+    const Tensor* V,
+    int window_size,
+    int num_global_tokens,
+    bool is_causal,
+    float scale,
+    const AttentionMask* mask,
+    Tensor* output
+);
+
+// 局部注意力前向: QKV投影 -> 带状注意力 -> 输出投影
+// input_q: [batch_size, seq_len_q, model_dim]
+// input_kv: [batch_size, seq_len_k, model_dim]
+// output: [batch_size, seq_len_q, model_dim]
+bool local_attention_forward(
+    MultiHeadAttention* mha,
+    const Tensor* input_q,
+    const Tensor* input_kv,
+    Tensor* output,
+    const AttentionMask* mask
+);
+
+#endif // LOCAL_ATTENTION_H
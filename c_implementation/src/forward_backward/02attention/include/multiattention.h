@@ -3,29 +3,61 @@
 
 #include "tensor_type.h"
 #include "attention_mask.h"
+#include "model_config.h"
+#include "04rotary_embedding.h"
 
 typedef struct MultiHeadAttention MultiHeadAttention;
 
 struct MultiHeadAttention {
-    int num_heads;
+    int num_heads;  // 本实例的头数, 张量并行的分片中是本进程负责的头数
     int model_dim;  // 模型维度, d_model, not splited by num_heads
-    int head_dim;   // 注意力头维度, d_model / num_heads
+    int head_dim;   // 注意力头维度, d_model / 完整模型的头数
     
-    // QKV投影权重和偏置
-    Tensor* W_q;    // [model_dim, model_dim]
-    Tensor* W_k;    // [model_dim, model_dim]
-    Tensor* W_v;    // [model_dim, model_dim]
-    Tensor* b_q;    // [model_dim]
-    Tensor* b_k;    // [model_dim]
-    Tensor* b_v;    // [model_dim]
+    // QKV投影权重和偏置, 宽度为 num_heads * head_dim (完整模型中等于model_dim)
+    Tensor* W_q;    // [model_dim, num_heads * head_dim]
+    Tensor* W_k;    // [model_dim, num_heads * head_dim]
+    Tensor* W_v;    // [model_dim, num_heads * head_dim]
+    Tensor* b_q;    // [num_heads * head_dim]
+    Tensor* b_k;    // [num_heads * head_dim]
+    Tensor* b_v;    // [num_heads * head_dim]
     
     // 输出投影
-    Tensor* W_o;    // [model_dim, model_dim], 用于将多头注意力结果合并成一个向量
+    Tensor* W_o;    // [num_heads * head_dim, model_dim], 用于将多头注意力结果合并成一个向量
     Tensor* b_o;    // [model_dim], 用于将多头注意力结果合并成一个向量
+
+    // 注意力模式, 由model config按层设置
+    LayerAttentionConfig attn_config;
+    bool is_causal;  // decoder自注意力为true, 局部注意力只看左侧窗口
+
+    // 注意力引擎, performer时feature_map为随机特征矩阵, 否则为NULL
+    AttentionEngine engine;
+    struct RandomFeatureMap* feature_map;
+
+    // 旋转位置编码, 不为NULL时在投影后拆分多头的同时旋转Q/K; 由encoder/decoder持有, 各层共享
+    const RotaryEmbedding* rope;
 };
 
 MultiHeadAttention* multihead_attention_create(int num_heads, int model_dim);
 void multihead_attention_free(MultiHeadAttention* mha);
+
+// 设置注意力模式 (dense/local), 在create之后由encoder/decoder按层调用
+void multihead_attention_set_config(
+    MultiHeadAttention* mha,
+    const LayerAttentionConfig* config,
+    bool is_causal
+);
+
+// 设置注意力引擎 (softmax/performer), performer时创建随机特征矩阵
+bool multihead_attention_set_engine(
+    MultiHeadAttention* mha,
+    AttentionEngine engine,
+    int num_random_features,
+    unsigned int seed
+);
+
+// 设置旋转位置编码 (只用于自注意力), NULL表示不使用
+void multihead_attention_set_rotary(MultiHeadAttention* mha, const RotaryEmbedding* rope);
+
 bool multihead_attention_forward(
     MultiHeadAttention* mha,
     Tensor* input,        // [batch_size, seq_len, model_dim]
@@ -46,16 +78,52 @@ bool project_qkv(
     const Tensor* input_q,      // [batch_size, seq_len, model_dim]
     const Tensor* input_k,      // [batch_size, seq_len, model_dim]
     const Tensor* input_v,      // [batch_size, seq_len, model_dim]
-    const Tensor* weight_q,   // [model_dim, model_dim]  
-    const Tensor* weight_k,   // [model_dim, model_dim]
-    const Tensor* weight_v,   // [model_dim, model_dim]
-    const Tensor* weight_combine, // [model_dim, model_dim]
-    const Tensor* bias_q,     // [model_dim]
-    const Tensor* bias_k,     // [model_dim] 
-    const Tensor* bias_v,     // [model_dim]
+    const Tensor* weight_q,   // [model_dim, num_heads * head_dim], 列数决定投影宽度
+    const Tensor* weight_k,   // [model_dim, num_heads * head_dim]
+    const Tensor* weight_v,   // [model_dim, num_heads * head_dim]
+    const Tensor* weight_combine, // [num_heads * head_dim, model_dim]
+    const Tensor* bias_q,     // [num_heads * head_dim]
+    const Tensor* bias_k,     // [num_heads * head_dim]
+    const Tensor* bias_v,     // [num_heads * head_dim]
     const Tensor* bias_combine, // [model_dim]
     const AttentionMask* mask,
+    int num_heads,                // 注意力头数, 取自调用方的MultiHeadAttention
+    const RotaryEmbedding* rope,  // 不为NULL时旋转Q/K
     Tensor* output           // [batch_size, num_heads, seq_len, head_dim]
 );
 
+// 将3D输入投影并拆分为多头
+// input: [batch_size, seq_len, model_dim]
+// weight: [model_dim, model_dim], bias: [model_dim]
+// output: [batch_size, num_heads, seq_len, head_dim]
+bool attention_project_heads(
+    const Tensor* input,
+    const Tensor* weight,
+    const Tensor* bias,
+    int num_heads,
+    Tensor* output
+);
+
+// 同上, 拆分多头的同时做旋转位置编码 (融合在投影的收尾中, 不额外遍历一次)
+// 第s个位置为 start_pos + s, rope为NULL时等同attention_project_heads
+bool attention_project_heads_rotary(
+    const Tensor* input,
+    const Tensor* weight,
+    const Tensor* bias,
+    int num_heads,
+    const RotaryEmbedding* rope,
+    int start_pos,
+    Tensor* output
+);
+
+// 合并多头并做输出投影
+// heads: [batch_size, num_heads, seq_len, head_dim]
+// output: [batch_size, seq_len, model_dim]
+bool attention_merge_heads(
+    const Tensor* heads,
+    const Tensor* weight,
+    const Tensor* bias,
+    Tensor* output
+);
+
 #endif // MULTIATTENTION_H
\ No newline at end of file
@@ -0,0 +1,62 @@
+#ifndef PERFORMER_ATTENTION_H
+#define PERFORMER_ATTENTION_H
+
+#include "tensor_type.h"
+#include "attention_mask.h"
+#include "multiattention.h"
+
+// 正随机特征映射 (FAVOR+)
+// phi(x) = exp(w·x - |x|^2 / 2) / sqrt(r), 使 E[phi(q)·phi(k)] = exp(q·k)
+// omega 按 head_dim 大小的块正交化, 降低估计方差
+typedef struct RandomFeatureMap {
+    int head_dim;
+    int num_features;   // r
+    Tensor* omega;      // [num_features, head_dim]
+} RandomFeatureMap;
+
+RandomFeatureMap* random_feature_map_create(int head_dim, int num_features, unsigned int seed);
+void random_feature_map_free(RandomFeatureMap* map);
+
+// 计算特征 phi(x * data_scale)
+// x: [batch_size, num_heads, seq_len, head_dim]
+// phi: [batch_size, num_heads, seq_len, num_features]
+// is_query: query按行做数值稳定, key在整个head内做数值稳定 (保证归一化时相互抵消)
+bool random_feature_map_apply(
+    const RandomFeatureMap* map,
+    const Tensor* x,
+    float data_scale,
+    bool is_query,
+    Tensor* phi
+);
+
+// 核化注意力 out_i = phi(q_i)·(sum_j phi(k_j) v_j^T) / phi(q_i)·(sum_j phi(k_j))
+// 非因果: 先求 phi(K)^T V [r, head_dim], 再乘 phi(Q), O(n * r * head_dim)
+// 因果: 按位置累加前缀和, 内存 O(r * head_dim)
+// mask 只支持key padding: 形状为 [q, k], [b, q, k] 或 [b, 1|h, q, k], 每个 (b, h) 的各行必须相同
+// (因果时第i行只看 j <= i, 所以带padding的因果掩码也可以); 其他掩码返回false. 因果结构由is_causal控制
+// Q: [batch_size, num_heads, seq_len_q, head_dim]
+// K, V: [batch_size, num_heads, seq_len_k, head_dim]
+// output: [batch_size, num_heads, seq_len_q, head_dim]
+bool performer_attention(
+    const RandomFeatureMap* map,
+    const Tensor* Q,
+    const Tensor* K,
+    const Tensor* V,
+    bool is_causal,
+    const AttentionMask* mask,
+    Tensor* output
+);
+
+// performer前向: QKV投影 -> 核化注意力 -> 输出投影, 可直接替换project_qkv的softmax注意力
+// input_q: [batch_size, seq_len_q, model_dim]
+// input_kv: [batch_size, seq_len_k, model_dim]
+// output: [batch_size, seq_len_q, model_dim]
+bool performer_attention_forward(
+    MultiHeadAttention* mha,
+    const Tensor* input_q,
+    const Tensor* input_kv,
+    Tensor* output,
+    const AttentionMask* mask
+);
+
+#endif // PERFORMER_ATTENTION_H
@@ -0,0 +1,34 @@
+#ifndef SPLIT_KV_ATTENTION_H
+#define SPLIT_KV_ATTENTION_H
+
+#include "tensor_type.h"
+#include <stdbool.h>
+
+// 解码时单个query对长KV缓存的注意力 (flash-decoding)
+// 把key维度切成num_splits段, 每段由不同线程计算局部 max / sum / 未归一化输出,
+// 最后按log-sum-exp合并. batch为1时并行度从num_heads提升到num_heads * num_splits
+//
+// q: [batch_size, num_heads, head_dim], 当前token的query
+// k_cache, v_cache: [batch_size, num_heads, max_len, head_dim], 前kv_len个位置有效
+// num_splits: <= 0 时根据线程数和kv_len自动选择
+// output: [batch_size, num_heads, head_dim]
+bool split_kv_decode_attention(
+    const Tensor* q,
+    const Tensor* k_cache,
+    const Tensor* v_cache,
+    int kv_len,
+    float scale,
+    int num_splits,
+    Tensor* output
+);
+
+// 按log-sum-exp合并一个 (batch, head) 的num_splits段局部结果, 写入output[head_dim]
+// part_max / part_sum: [num_splits], part_out: [num_splits][head_dim] 未归一化的输出; sum为0的段是空段
+// 增量解码器对分页缓存和编码结果分段计算后也用它合并
+void split_kv_merge_parts(const float* part_max, const float* part_sum, const float* part_out,
+                          int num_splits, int head_dim, float* output);
+
+// 自动选择分段数: 使 batch*heads*splits 覆盖约两倍线程数, 且每段不少于min_chunk个key
+int split_kv_choose_splits(int batch_size, int num_heads, int kv_len, int num_threads);
+
+#endif // SPLIT_KV_ATTENTION_H
@@ -0,0 +1,228 @@
+#include "local_attention.h"
+#include "thread_pool.h"
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include <float.h>
+
+// 收集query i 可见的key下标, 返回数量
+static int collect_band_keys(
+    int i,
+    int seq_len_k,
+    int window_size,
+    int num_global_tokens,
+    bool is_causal,
+    const float* row_mask,
+    int* keys
+) {
+    int last = is_causal ? (i < seq_len_k - 1 ? i : seq_len_k - 1) : seq_len_k - 1;
+    int count = 0;
+
+    if (i < num_global_tokens) {
+        // 全局query看全部位置
+        for (int j = 0; j <= last; j++) {
+            if (!row_mask || row_mask[j] != 0.0f) keys[count++] = j;
+        }
+        return count;
+    }
+
+    // 先取全局key, 再取窗口内的key, 窗口与全局区重叠部分只取一次
+    int global_end = num_global_tokens < last + 1 ? num_global_tokens : last + 1;
+    for (int j = 0; j < global_end; j++) {
+        if (!row_mask || row_mask[j] != 0.0f) keys[count++] = j;
+    }
+
+    int lo = i - window_size;
+    if (lo < num_global_tokens) lo = num_global_tokens;
+    int hi = i + window_size;
+    if (hi > last) hi = last;
+    for (int j = lo; j <= hi; j++) {
+        if (!row_mask || row_mask[j] != 0.0f) keys[count++] = j;
+    }
+    return count;
+}
+
+// 对一组给定的key做softmax注意力, 结果写入out[head_dim]
+// k_rows/v_rows: 每个key的行指针
+static void attend_rows(
+    const float* q,
+    const float* const* k_rows,
+    const float* const* v_rows,
+    int num_keys,
+    int head_dim,
+    float scale,
+    float* scores,
+    float* out
+) {
+    memset(out, 0, head_dim * sizeof(float));
+    if (num_keys == 0) return;  // 全部被屏蔽, 输出0
+
+    float max_val = -FLT_MAX;
+    for (int n = 0; n < num_keys; n++) {
+        float score = 0.0f;
+        for (int d = 0; d < head_dim; d++) {
+            score += q[d] * k_rows[n][d];
+        }
+        scores[n] = score * scale;
+        max_val = fmaxf(max_val, scores[n]);
+    }
+
+    float sum = 0.0f;
+    for (int n = 0; n < num_keys; n++) {
+        scores[n] = expf(scores[n] - max_val);
+        sum += scores[n];
+    }
+
+    float inv_sum = 1.0f / sum;
+    for (int n = 0; n < num_keys; n++) {
+        float p = scores[n] * inv_sum;
+        for (int d = 0; d < head_dim; d++) {
+            out[d] += p * v_rows[n][d];
+        }
+    }
+}
+
+typedef struct BandedJob {
+    const Tensor* Q;
+    const Tensor* K;
+    const Tensor* V;
+    Tensor* output;
+    const AttentionMask* mask;
+    int window_size;
+    int num_global_tokens;
+    bool is_causal;
+    float scale;
+    atomic_bool failed;
+} BandedJob;
+
+// [begin, end) 为 (batch, head) 编号, 临时缓冲区按最坏情况(全局query)分配, 每个任务分配一次
+static void banded_heads(void* ctx, long begin, long end) {
+    BandedJob* job = (BandedJob*)ctx;
+    const int num_heads = job->Q->shape[1];
+    const int seq_len_q = job->Q->shape[2];
+    const int head_dim = job->Q->shape[3];
+    const int seq_len_k = job->K->shape[2];
+
+    int* keys = (int*)malloc(seq_len_k * sizeof(int));
+    float* scores = (float*)malloc(seq_len_k * sizeof(float));
+    const float** k_rows = (const float**)malloc(seq_len_k * sizeof(float*));
+    const float** v_rows = (const float**)malloc(seq_len_k * sizeof(float*));
+    if (!keys || !scores || !k_rows || !v_rows) {
+        atomic_store(&job->failed, true);
+    } else {
+        for (long bh = begin; bh < end; bh++) {
+            const int b = (int)(bh / num_heads);
+            const int h = (int)(bh % num_heads);
+            const size_t head_offset_q = (size_t)bh * seq_len_q * head_dim;
+            const size_t head_offset_k = (size_t)bh * seq_len_k * head_dim;
+            const float* k_base = job->K->data + head_offset_k;
+            const float* v_base = job->V->data + head_offset_k;
+
+            for (int i = 0; i < seq_len_q; i++) {
+                int num_keys = collect_band_keys(i, seq_len_k, job->window_size, job->num_global_tokens,
+                                                 job->is_causal, attention_mask_row(job->mask, b, h, i), keys);
+                for (int n = 0; n < num_keys; n++) {
+                    k_rows[n] = k_base + (size_t)keys[n] * head_dim;
+                    v_rows[n] = v_base + (size_t)keys[n] * head_dim;
+                }
+                attend_rows(job->Q->data + head_offset_q + (size_t)i * head_dim,
+                            k_rows, v_rows, num_keys, head_dim, job->scale, scores,
+                            job->output->data + head_offset_q + (size_t)i * head_dim);
+            }
+        }
+    }
+    free(keys);
+    free(scores);
+    free(k_rows);
+    free(v_rows);
+}
+
+bool banded_attention(
+    const Tensor* Q,
+    const Tensor* K,
+    const Tensor* V,
+    int window_size,
+    int num_global_tokens,
+    bool is_causal,
+    float scale,
+    const AttentionMask* mask,
+    Tensor* output
+) {
+    if (!Q || !K || !V || !output) {
+        fprintf(stderr, "Null tensor passed to banded_attention\n");
+        return false;
+    }
+    if (Q->num_dims != 4 || K->num_dims != 4 || V->num_dims != 4 || output->num_dims != 4) {
+        fprintf(stderr, "banded_attention expects 4D tensors\n");
+        return false;
+    }
+    if (window_size < 0 || num_global_tokens < 0) {
+        fprintf(stderr, "Invalid window size %d or global tokens %d\n", window_size, num_global_tokens);
+        return false;
+    }
+
+    const int batch_size = Q->shape[0];
+    const int num_heads = Q->shape[1];
+    const int head_dim = Q->shape[3];
+
+    if (!check_same_shape(K, V) || !check_same_shape(Q, output) ||
+        K->shape[0] != batch_size || K->shape[1] != num_heads || K->shape[3] != head_dim) {
+        fprintf(stderr, "Shape mismatch in banded_attention\n");
+        return false;
+    }
+
+    // 每个 (batch, head) 一个任务
+    BandedJob job = {Q, K, V, output, mask, window_size, num_global_tokens, is_causal, scale, false};
+    const long units = (long)batch_size * num_heads;
+    thread_pool_parallel_for(units, 1, banded_heads, &job);
+    return !atomic_load(&job.failed);
+}
+
+bool local_attention_forward(
+    MultiHeadAttention* mha,
+    const Tensor* input_q,
+    const Tensor* input_kv,
+    Tensor* output,
+    const AttentionMask* mask
+) {
+    if (!mha || !input_q || !input_kv || !output) {
+        return false;
+    }
+
+    const int batch_size = input_q->shape[0];
+    const int seq_len_q = input_q->shape[1];
+    const int seq_len_k = input_kv->shape[1];
+    const int num_heads = mha->num_heads;
+    const int head_dim = mha->W_q->shape[1] / num_heads;  // 投影宽度取自W_q, 张量并行分片只有部分头
+
+    int q_shape[] = {batch_size, num_heads, seq_len_q, head_dim};
+    int kv_shape[] = {batch_size, num_heads, seq_len_k, head_dim};
+    Tensor* q = tensor_create(q_shape, 4);
+    Tensor* k = tensor_create(kv_shape, 4);
+    Tensor* v = tensor_create(kv_shape, 4);
+    Tensor* heads = tensor_create(q_shape, 4);
+
+    bool success = q && k && v && heads &&
+        attention_project_heads_rotary(input_q, mha->W_q, mha->b_q, num_heads, mha->rope, 0, q) &&
+        attention_project_heads_rotary(input_kv, mha->W_k, mha->b_k, num_heads, mha->rope, 0, k) &&
+        attention_project_heads(input_kv, mha->W_v, mha->b_v, num_heads, v) &&
+        banded_attention(q, k, v,
+                         mha->attn_config.window_size,
+                         mha->attn_config.num_global_tokens,
+                         mha->is_causal,
+                         1.0f / sqrtf((float)head_dim),
+                         mask, heads) &&
+        attention_merge_heads(heads, mha->W_o, mha->b_o, output);
+
+    if (!success) {
+        fprintf(stderr, "Local attention forward failed\n");
+    }
+
+    tensor_free(q);
+    tensor_free(k);
+    tensor_free(v);
+    tensor_free(heads);
+    return success;
+}
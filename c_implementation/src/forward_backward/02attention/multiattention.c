@@ -1,10 +1,16 @@
-#include "02multiattention.h"
+#include "multiattention.h"
+#include "local_attention.h"
+#include "performer_attention.h"
+#include "block_sparse_attention.h"
 #include "model_config.h"
 #include "tensor_mul.h"
 #include "tensor_add.h"
 #include "tensor_reshape.h"
 #include "softmax.h"
+#include "thread_pool.h"
 #include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
 
 MultiHeadAttention* multihead_attention_create(int num_heads, int model_dim) {
     MultiHeadAttention* mha = (MultiHeadAttention*)malloc(sizeof(MultiHeadAttention));
@@ -15,9 +21,9 @@ MultiHeadAttention* multihead_attention_create(int num_heads, int model_dim) {
     mha->head_dim = model_dim / num_heads;
 
     // 初始化QKV投影权重和偏置
-    // 注意：权重维度现在是 [model_dim, head_dim]
-    int qkv_weight_shape[] = {model_dim, mha->head_dim};
-    int qkv_bias_shape[] = {mha->head_dim};
+    // 所有头的投影拼在一起: [model_dim, num_heads * head_dim], 与project_qkv和增量解码的用法一致
+    int qkv_weight_shape[] = {model_dim, num_heads * mha->head_dim};
+    int qkv_bias_shape[] = {num_heads * mha->head_dim};
     
     mha->W_q = tensor_create(qkv_weight_shape, 2);
     mha->W_k = tensor_create(qkv_weight_shape, 2);
@@ -26,14 +32,69 @@ MultiHeadAttention* multihead_attention_create(int num_heads, int model_dim) {
     mha->b_k = tensor_create(qkv_bias_shape, 1);
     mha->b_v = tensor_create(qkv_bias_shape, 1);
     
-    // 初始化输出投影
-    mha->W_o = tensor_create(qkv_weight_shape, 2);
-    mha->b_o = tensor_create(qkv_bias_shape, 1);
+    // 初始化输出投影 [num_heads * head_dim, model_dim]
+    int out_weight_shape[] = {num_heads * mha->head_dim, model_dim};
+    int out_bias_shape[] = {model_dim};
+    mha->W_o = tensor_create(out_weight_shape, 2);
+    mha->b_o = tensor_create(out_bias_shape, 1);
 
+    // 默认使用全量注意力
+    mha->attn_config.mode = ATTENTION_DENSE;
+    mha->attn_config.window_size = 0;
+    mha->attn_config.num_global_tokens = 0;
+    mha->attn_config.block_size = 0;
+    mha->attn_config.block_stride = 0;
+    mha->attn_config.num_random_blocks = 0;
+    mha->is_causal = false;
+    mha->engine = ATTENTION_ENGINE_SOFTMAX;
+    mha->feature_map = NULL;
+    mha->rope = NULL;
 
     return mha;
 }
 
+void multihead_attention_set_config(
+    MultiHeadAttention* mha,
+    const LayerAttentionConfig* config,
+    bool is_causal
+) {
+    if (!mha || !config) return;
+    mha->attn_config = *config;
+    mha->is_causal = is_causal;
+}
+
+bool multihead_attention_set_engine(
+    MultiHeadAttention* mha,
+    AttentionEngine engine,
+    int num_random_features,
+    unsigned int seed
+) {
+    if (!mha) return false;
+
+    random_feature_map_free(mha->feature_map);
+    mha->feature_map = NULL;
+    mha->engine = engine;
+
+    if (engine == ATTENTION_ENGINE_PERFORMER) {
+        mha->feature_map = random_feature_map_create(mha->head_dim, num_random_features, seed);
+        if (!mha->feature_map) {
+            mha->engine = ATTENTION_ENGINE_SOFTMAX;
+            return false;
+        }
+    }
+    return true;
+}
+
+void multihead_attention_set_rotary(MultiHeadAttention* mha, const RotaryEmbedding* rope) {
+    if (!mha) return;
+    if (rope && rope->head_dim != mha->head_dim) {
+        fprintf(stderr, "Rotary head_dim %d does not match attention head_dim %d\n",
+                rope->head_dim, mha->head_dim);
+        return;
+    }
+    mha->rope = rope;
+}
+
 void multihead_attention_free(MultiHeadAttention* mha) {
     if (!mha) return;
     
@@ -45,6 +106,7 @@ void multihead_attention_free(MultiHeadAttention* mha) {
     tensor_free(mha->b_v);
     tensor_free(mha->W_o);
     tensor_free(mha->b_o);
+    random_feature_map_free(mha->feature_map);
     
     free(mha);
 }
@@ -55,10 +117,17 @@ bool multihead_attention_forward(
     Tensor* output,       // [batch_size, seq_len, model_dim]
     AttentionMask* mask         // [batch_size, num_heads, seq_len, seq_len]
 ) {
-    int batch_size = input->shape[0];
-    int seq_len = input->shape[1];
-    int model_dim = input->shape[2];
-    
+    // 局部/块稀疏注意力走稀疏计算路径, 不生成 [seq_len, seq_len] 分数矩阵
+    if (mha->attn_config.mode == ATTENTION_LOCAL) {
+        return local_attention_forward(mha, input, input, output, mask);
+    }
+    if (mha->attn_config.mode == ATTENTION_BLOCK_SPARSE) {
+        return block_sparse_attention_forward(mha, input, input, output, mask);
+    }
+    if (mha->engine == ATTENTION_ENGINE_PERFORMER) {
+        return performer_attention_forward(mha, input, input, output, mask);
+    }
+
     // 执行多头注意力计算
     bool success = project_qkv(
         input,          // 输入
@@ -73,13 +142,16 @@ bool multihead_attention_forward(
         mha->b_v,      // V偏置
         mha->b_o,      // 输出偏置
         (AttentionMask*)mask,  // 注意力掩码
+        mha->num_heads, // 注意力头数
+        mha->rope,     // 旋转位置编码
         output         // 输出
     );
 
     if (!success) {
         fprintf(stderr, "多头注意力计算失败\n");
-        return;
+        return false;
     }
+    return true;
 }
 
 bool cross_attention_forward(
@@ -90,10 +162,10 @@ bool cross_attention_forward(
     Tensor* output,       // [batch_size, seq_len, model_dim]
     AttentionMask* mask         // [batch_size, num_heads, seq_len, seq_len]
 ) {
-    int batch_size = input_q->shape[0];
-    int seq_len = input_q->shape[1];
-    int model_dim = input_q->shape[2];
-    
+    if (mha->engine == ATTENTION_ENGINE_PERFORMER) {
+        return performer_attention_forward(mha, input_q, input_k, output, mask);
+    }
+
     // 执行多头注意力计算
     bool success = project_qkv(
         input_q,          // 输入
@@ -108,129 +180,266 @@ bool cross_attention_forward(
         mha->b_v,      // V偏置
         mha->b_o,      // 输出偏置
         (AttentionMask*)mask,  // 注意力掩码
+        mha->num_heads, // 注意力头数
+        NULL,          // 交叉注意力不做旋转位置编码
         output         // 输出
     );
 
     if (!success) {
         fprintf(stderr, "多头注意力计算失败\n");
-        return;
+        return false;
+    }
+    return true;
+}
+
+
+typedef struct RotarySplitJob {
+    const float* input;
+    const float* rows;
+    float* output;
+    int seq_len;
+    int num_heads;
+    int head_dim;
+} RotarySplitJob;
+
+// 每个单元是一个 (batch, position) 的行, 拆成num_heads个向量
+static void rotary_split_rows(void* ctx, long begin, long end) {
+    const RotarySplitJob* job = (const RotarySplitJob*)ctx;
+    const int seq_len = job->seq_len;
+    const int num_heads = job->num_heads;
+    const int head_dim = job->head_dim;
+    for (long unit = begin; unit < end; unit++) {
+        const long b = unit / seq_len;
+        const int s = (int)(unit % seq_len);
+        const float* src = job->input + (size_t)unit * num_heads * head_dim;
+        const float* sincos = job->rows + (size_t)s * head_dim;
+        for (int h = 0; h < num_heads; h++) {
+            float* dst = job->output + (((size_t)b * num_heads + h) * seq_len + s) * head_dim;
+            rotary_rotate(dst, src + h * head_dim, sincos, head_dim);
+        }
     }
 }
 
+// [batch_size, seq_len, num_heads * head_dim] -> [batch_size, num_heads, seq_len, head_dim]
+// rope不为NULL时在搬运的同时旋转, 第s个位置为 start_pos + s
+static bool split_heads_rotary(
+    const Tensor* input,
+    int num_heads,
+    const RotaryEmbedding* rope,
+    int start_pos,
+    Tensor* output
+) {
+    if (!rope) {
+        return tensor_reshape_3d_to_4d(input, num_heads, output);
+    }
+
+    const int batch_size = input->shape[0];
+    const int seq_len = input->shape[1];
+    const int model_dim = input->shape[2];
+    const int head_dim = model_dim / num_heads;
+    if (head_dim != rope->head_dim || output->num_dims != 4 ||
+        output->shape[0] != batch_size || output->shape[1] != num_heads ||
+        output->shape[2] != seq_len || output->shape[3] != head_dim) {
+        fprintf(stderr, "Shape mismatch in rotary head split\n");
+        return false;
+    }
+
+    float* owned = NULL;
+    const float* rows = rotary_embedding_rows(rope, start_pos, seq_len, &owned);
+    if (!rows) return false;
+
+    RotarySplitJob job = {input->data, rows, output->data, seq_len, num_heads, head_dim};
+    const long units = (long)batch_size * seq_len;
+    thread_pool_parallel_for(units, (size_t)units * model_dim > 65536 ? 0 : units, rotary_split_rows, &job);
+
+    free(owned);
+    return true;
+}
+
+// Q/K/V中的一个投影: output = input × weight + bias
+typedef struct QkvProjection {
+    const Tensor* input;
+    const Tensor* weight;
+    const Tensor* bias;
+    Tensor* output;
+    bool ok;
+} QkvProjection;
+
+static void qkv_project_run(void* arg) {
+    QkvProjection* proj = (QkvProjection*)arg;
+    proj->ok = proj->output &&
+               tensor_mul_3_2(proj->input, proj->weight, proj->output) &&
+               tensor_add_bias_3d(proj->output, proj->bias, proj->output);
+}
 
 // 辅助函数：将3D输入与2D权重相乘并重塑为4D输出
 // input: [batch_size, seq_len, model_dim]
-// weight: [model_dim, model_dim]
-// bias: [model_dim]
+// weight: [model_dim, num_heads * head_dim]
+// bias: [num_heads * head_dim]
 // output: [batch_size, num_heads, seq_len, head_dim]
+// 投影宽度取自weight_q的列数, 张量并行的分片只有一部分头, 宽度小于model_dim
 bool project_qkv(
     const Tensor* input_q,      // [batch_size, seq_len, model_dim]
     const Tensor* input_k,      // [batch_size, seq_len, model_dim]
     const Tensor* input_v,      // [batch_size, seq_len, model_dim]
-    const Tensor* weight_q,   // [model_dim, model_dim]
-    const Tensor* weight_k,   // [model_dim, model_dim]
-    const Tensor* weight_v,   // [model_dim, model_dim]
-    const Tensor* weight_combine, // [model_dim, model_dim]
-    const Tensor* bias_q,     // [model_dim]
-    const Tensor* bias_k,     // [model_dim]
-    const Tensor* bias_v,     // [model_dim]
+    const Tensor* weight_q,   // [model_dim, num_heads * head_dim]
+    const Tensor* weight_k,   // [model_dim, num_heads * head_dim]
+    const Tensor* weight_v,   // [model_dim, num_heads * head_dim]
+    const Tensor* weight_combine, // [num_heads * head_dim, model_dim]
+    const Tensor* bias_q,     // [num_heads * head_dim]
+    const Tensor* bias_k,     // [num_heads * head_dim]
+    const Tensor* bias_v,     // [num_heads * head_dim]
     const Tensor* bias_combine, // [model_dim]
     const AttentionMask* mask,    // [batch_size, num_heads, seq_len, seq_len]
-    Tensor* output           // [batch_size, num_heads, seq_len, head_dim]
+    int num_heads,
+    const RotaryEmbedding* rope,
+    Tensor* output           // [batch_size, seq_len, model_dim]
 ) {
     int batch_size = input_q->shape[0];
     int seq_len = input_q->shape[1];
-    int model_dim = input_q->shape[2];
-    int num_heads = g_model_config.num_heads;
-    int head_dim = model_dim / num_heads;
+    int width = weight_q->shape[1];
+    int head_dim = width / num_heads;
+    int kv_len = input_k->shape[1];
+    if (num_heads <= 0 || width % num_heads != 0 ||
+        weight_k->shape[1] != width || weight_v->shape[1] != width || weight_combine->shape[0] != width) {
+        fprintf(stderr, "Projection width %d does not split into %d heads\n", width, num_heads);
+        return false;
+    }
 
-    // 1. 首先进行批量矩阵乘法: [batch_size, seq_len, model_dim] @ [model_dim, model_dim]
-    int temp_shape[] = {batch_size, seq_len, model_dim};
+    // 1. 首先进行批量矩阵乘法: [batch_size, seq_len, model_dim] @ [model_dim, width]
+    int temp_shape[] = {batch_size, seq_len, width};
+    int temp_kv_shape[] = {batch_size, kv_len, width};
     Tensor* temp_q = tensor_create(temp_shape, 3);
-    Tensor* temp_k = tensor_create(temp_shape, 3);
-    Tensor* temp_v = tensor_create(temp_shape, 3);
-
-    // 执行3D矩阵乘法
-    if (!tensor_mul_3_2(input_q, weight_q, temp_q) ||
-        !tensor_mul_3_2(input_k, weight_k, temp_k) ||
-        !tensor_mul_3_2(input_v, weight_v, temp_v)) {
-        tensor_free(temp_q);
-        tensor_free(temp_k);
-        tensor_free(temp_v);
-        return false;
+    Tensor* temp_k = tensor_create(temp_kv_shape, 3);
+    Tensor* temp_v = tensor_create(temp_kv_shape, 3);
+
+    // 2. 多头形式的Q/K/V, 注意力分数 [batch_size, num_heads, seq_len, kv_len] 和各头的输出
+    int q_shape[] = {batch_size, num_heads, seq_len, head_dim};
+    int kv_shape[] = {batch_size, num_heads, kv_len, head_dim};
+    int scores_shape[] = {batch_size, num_heads, seq_len, kv_len};
+    Tensor* reshaped_q = tensor_create(q_shape, 4);
+    Tensor* reshaped_k = tensor_create(kv_shape, 4);
+    Tensor* reshaped_v = tensor_create(kv_shape, 4);
+    Tensor* scores = tensor_create(scores_shape, 4);
+    Tensor* context = tensor_create(q_shape, 4);
+    bool success = false;
+    if (!temp_q || !temp_k || !temp_v || !reshaped_q || !reshaped_k || !reshaped_v || !scores || !context) {
+        goto cleanup;
     }
 
-    // 添加偏置
-    if (!tensor_add_bias_3d(temp_q, bias_q, temp_q) ||
-        !tensor_add_bias_3d(temp_k, bias_k, temp_k) ||
-        !tensor_add_bias_3d(temp_v, bias_v, temp_v)) {
-        tensor_free(temp_q);
-        tensor_free(temp_k);
-        tensor_free(temp_v);
-        return false;
+    // 三个投影互相独立: K和V作为线程池任务提交, Q在当前线程计算
+    QkvProjection proj_q = {input_q, weight_q, bias_q, temp_q, false};
+    QkvProjection proj_k = {input_k, weight_k, bias_k, temp_k, false};
+    QkvProjection proj_v = {input_v, weight_v, bias_v, temp_v, false};
+    TaskGroup projections;
+    task_group_init(&projections);
+    task_group_spawn(&projections, qkv_project_run, &proj_k);
+    task_group_spawn(&projections, qkv_project_run, &proj_v);
+    qkv_project_run(&proj_q);
+    task_group_wait(&projections);
+
+    if (!proj_q.ok || !proj_k.ok || !proj_v.ok) {
+        goto cleanup;
     }
-    
-    // 2. 重塑结果为4D: [batch_size, num_heads, seq_len, head_dim]
-    int new_shape[] = {batch_size, num_heads, seq_len, head_dim};
-    
-    Tensor* reshaped_q = tensor_create(new_shape, 4);
-    Tensor* reshaped_k = tensor_create(new_shape, 4);
-    Tensor* reshaped_v = tensor_create(new_shape, 4);
-    
-    if (!tensor_reshape_3d_to_4d(temp_q, num_heads, reshaped_q) ||
-        !tensor_reshape_3d_to_4d(temp_k, num_heads, reshaped_k) ||
+
+    if (!split_heads_rotary(temp_q, num_heads, rope, 0, reshaped_q) ||
+        !split_heads_rotary(temp_k, num_heads, rope, 0, reshaped_k) ||
         !tensor_reshape_3d_to_4d(temp_v, num_heads, reshaped_v)) {
-        return false;
+        goto cleanup;
     }
-    // 计算注意力分数: Q * K^T / sqrt(head_dim)
+
+    // 3. 注意力分数: Q * K^T, 缩放放到softmax内核中完成
+    // 分数单独存放: output是 [batch_size, seq_len, model_dim], 放不下 [seq_len, kv_len] 的分数
     float scale = 1.0f / sqrt(head_dim);
-    
-    // 调用4D张量乘法函数,K的最后两个维度需要转置
-    if (!tensor_mul_4d_transpose(reshaped_q, reshaped_k, scale, output)) {
-        return false;
+    if (!tensor_mul_4d_transpose(reshaped_q, reshaped_k, 1.0f, scores)) {
+        goto cleanup;
     }
 
-    // 应用注意力掩码
-    if (mask) {
-        if (!apply_attention_mask(output, mask, output)) {
-            return false;
-        }
+    // 融合的 缩放 + 掩码 + softmax, 原地计算, 不再单独复制一遍分数做掩码
+    if (!attention_scores_softmax_fused(scores, scale, mask, false, false)) {
+        goto cleanup;
     }
 
-    // 应用softmax
-    if (!attention_scores_softmax(output, output)) {
-        return false;
-    }
-    // 将softmax后的注意力分数与V相乘
-    // output: [batch_size, num_heads, seq_len, seq_len]
-    // reshaped_v: [batch_size, num_heads, seq_len, head_dim]
-    // 结果仍存在output中: [batch_size, num_heads, seq_len, head_dim]
-    if (!tensor_matmul_4d(output, reshaped_v, output)) {
-        return false;
+    // 4. softmax后的分数乘V: [batch_size, num_heads, seq_len, head_dim]
+    if (!tensor_matmul_4d(scores, reshaped_v, context)) {
+        goto cleanup;
     }
 
-    // 4. 将4D张量重塑为3D张量
-    if (!tensor_reshape_4d_to_3d(output, output)) {
-        return false;
-    }
+    // 5. 合并多头并做输出投影: [batch_size, seq_len, model_dim]
+    success = attention_merge_heads(context, weight_combine, bias_combine, output);
+
+cleanup:
+    tensor_free(reshaped_q);
+    tensor_free(reshaped_k);
+    tensor_free(reshaped_v);
+    tensor_free(scores);
+    tensor_free(context);
+    tensor_free(temp_q);
+    tensor_free(temp_k);
+    tensor_free(temp_v);
+    return success;
+}
 
-    // 计算最终的多头注意力输出: [batch_size, seq_len, model_dim]
-    if (!tensor_mul_3_2(output, weight_combine, output)) {
+
+// 将3D输入投影并拆分为多头
+// input: [batch_size, seq_len, model_dim]
+// output: [batch_size, num_heads, seq_len, head_dim]
+bool attention_project_heads(
+    const Tensor* input,
+    const Tensor* weight,
+    const Tensor* bias,
+    int num_heads,
+    Tensor* output
+) {
+    return attention_project_heads_rotary(input, weight, bias, num_heads, NULL, 0, output);
+}
+
+bool attention_project_heads_rotary(
+    const Tensor* input,
+    const Tensor* weight,
+    const Tensor* bias,
+    int num_heads,
+    const RotaryEmbedding* rope,
+    int start_pos,
+    Tensor* output
+) {
+    if (!input || !weight || !bias || !output || num_heads <= 0) {
         return false;
     }
 
-    // 添加输出偏置
-    if (!tensor_add_bias_3d(output, bias_combine, output)) {
+    int temp_shape[] = {input->shape[0], input->shape[1], weight->shape[1]};
+    Tensor* temp = tensor_create(temp_shape, 3);
+    if (!temp) return false;
+
+    bool success = tensor_mul_3_2(input, weight, temp) &&
+                   tensor_add_bias_3d(temp, bias, temp) &&
+                   split_heads_rotary(temp, num_heads, rope, start_pos, output);
+
+    tensor_free(temp);
+    return success;
+}
+
+// 合并多头并做输出投影
+// heads: [batch_size, num_heads, seq_len, head_dim]
+// output: [batch_size, seq_len, model_dim]
+bool attention_merge_heads(
+    const Tensor* heads,
+    const Tensor* weight,
+    const Tensor* bias,
+    Tensor* output
+) {
+    if (!heads || !weight || !bias || !output) {
         return false;
     }
 
-    // 5. 释放临时张量
-    tensor_free(reshaped_q);
-    tensor_free(reshaped_k); 
-    tensor_free(reshaped_v);
-    
-    tensor_free(temp_q);
-    tensor_free(temp_k);
-    tensor_free(temp_v);
-    return true;
-}
\ No newline at end of file
+    int merged_shape[] = {heads->shape[0], heads->shape[2], heads->shape[1] * heads->shape[3]};
+    Tensor* merged = tensor_create(merged_shape, 3);
+    if (!merged) return false;
+
+    bool success = tensor_reshape_4d_to_3d(heads, merged) &&
+                   tensor_mul_3_2(merged, weight, output) &&
+                   tensor_add_bias_3d(output, bias, output);
+
+    tensor_free(merged);
+    return success;
+}
@@ -0,0 +1,411 @@
+#include "performer_attention.h"
+#include "thread_pool.h"
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <math.h>
+#include <float.h>
+
+// splitmix64, 只用于生成随机特征矩阵
+static uint64_t splitmix64_next(uint64_t* state) {
+    uint64_t z = (*state += 0x9E3779B97F4A7C15ULL);
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+    return z ^ (z >> 31);
+}
+
+// Box-Muller 标准正态分布
+static float gaussian_next(uint64_t* state) {
+    double u1 = ((splitmix64_next(state) >> 11) + 1.0) * (1.0 / 9007199254740993.0);
+    double u2 = (splitmix64_next(state) >> 11) * (1.0 / 9007199254740992.0);
+    return (float)(sqrt(-2.0 * log(u1)) * cos(2.0 * M_PI * u2));
+}
+
+RandomFeatureMap* random_feature_map_create(int head_dim, int num_features, unsigned int seed) {
+    if (head_dim <= 0 || num_features <= 0) {
+        fprintf(stderr, "Invalid random feature map size %d x %d\n", num_features, head_dim);
+        return NULL;
+    }
+
+    RandomFeatureMap* map = (RandomFeatureMap*)malloc(sizeof(RandomFeatureMap));
+    if (!map) {
+        fprintf(stderr, "Failed to allocate memory for random feature map\n");
+        return NULL;
+    }
+    map->head_dim = head_dim;
+    map->num_features = num_features;
+
+    int shape[] = {num_features, head_dim};
+    map->omega = tensor_create(shape, 2);
+    if (!map->omega) {
+        free(map);
+        return NULL;
+    }
+
+    uint64_t state = seed;
+    float* omega = map->omega->data;
+
+    // 每 head_dim 行为一块, 块内Gram-Schmidt正交化
+    for (int block = 0; block < num_features; block += head_dim) {
+        int rows = num_features - block < head_dim ? num_features - block : head_dim;
+        for (int r = 0; r < rows; r++) {
+            float* row = omega + (size_t)(block + r) * head_dim;
+            for (int d = 0; d < head_dim; d++) {
+                row[d] = gaussian_next(&state);
+            }
+            for (int p = 0; p < r; p++) {
+                const float* prev = omega + (size_t)(block + p) * head_dim;
+                float dot = 0.0f;
+                for (int d = 0; d < head_dim; d++) dot += row[d] * prev[d];
+                for (int d = 0; d < head_dim; d++) row[d] -= dot * prev[d];
+            }
+            float norm = 0.0f;
+            for (int d = 0; d < head_dim; d++) norm += row[d] * row[d];
+            norm = sqrtf(norm);
+            for (int d = 0; d < head_dim; d++) row[d] /= norm;
+        }
+
+        // 行长度按chi(head_dim)分布重新缩放, 使每行边缘分布仍为高斯
+        for (int r = 0; r < rows; r++) {
+            float chi = 0.0f;
+            for (int d = 0; d < head_dim; d++) {
+                float g = gaussian_next(&state);
+                chi += g * g;
+            }
+            chi = sqrtf(chi);
+            float* row = omega + (size_t)(block + r) * head_dim;
+            for (int d = 0; d < head_dim; d++) row[d] *= chi;
+        }
+    }
+
+    return map;
+}
+
+void random_feature_map_free(RandomFeatureMap* map) {
+    if (map) {
+        tensor_free(map->omega);
+        free(map);
+    }
+}
+
+typedef struct FeatureMapJob {
+    const Tensor* x;
+    Tensor* phi;
+    const float* omega;
+    float data_scale;
+    float norm_r;
+    bool is_query;
+} FeatureMapJob;
+
+// [begin, end) 为 (batch, head) 编号
+static void feature_map_heads(void* ctx, long begin, long end) {
+    const FeatureMapJob* job = (const FeatureMapJob*)ctx;
+    const int seq_len = job->x->shape[2];
+    const int head_dim = job->x->shape[3];
+    const int r = job->phi->shape[3];
+
+    for (long bh = begin; bh < end; bh++) {
+        const float* xs = job->x->data + bh * seq_len * head_dim;
+        float* ps = job->phi->data + bh * seq_len * r;
+
+        // 先写入指数部分 w·x - |x|^2/2
+        float head_max = -FLT_MAX;
+        for (int i = 0; i < seq_len; i++) {
+            const float* xi = xs + (size_t)i * head_dim;
+            float* pi = ps + (size_t)i * r;
+            float sq = 0.0f;
+            for (int d = 0; d < head_dim; d++) sq += xi[d] * xi[d];
+            sq *= 0.5f * job->data_scale * job->data_scale;
+
+            float row_max = -FLT_MAX;
+            for (int m = 0; m < r; m++) {
+                const float* w = job->omega + (size_t)m * head_dim;
+                float dot = 0.0f;
+                for (int d = 0; d < head_dim; d++) dot += w[d] * xi[d];
+                pi[m] = dot * job->data_scale - sq;
+                row_max = fmaxf(row_max, pi[m]);
+            }
+
+            // query按行减去最大值, 分子分母同时缩放, 不影响结果
+            if (job->is_query) {
+                for (int m = 0; m < r; m++) pi[m] = expf(pi[m] - row_max) * job->norm_r;
+            } else {
+                head_max = fmaxf(head_max, row_max);
+            }
+        }
+
+        // key必须对所有位置使用同一个偏移量
+        if (!job->is_query) {
+            for (size_t idx = 0; idx < (size_t)seq_len * r; idx++) {
+                ps[idx] = expf(ps[idx] - head_max) * job->norm_r;
+            }
+        }
+    }
+}
+
+bool random_feature_map_apply(
+    const RandomFeatureMap* map,
+    const Tensor* x,
+    float data_scale,
+    bool is_query,
+    Tensor* phi
+) {
+    if (!map || !x || !phi || x->num_dims != 4 || phi->num_dims != 4) {
+        return false;
+    }
+
+    const int batch_size = x->shape[0];
+    const int num_heads = x->shape[1];
+    const int seq_len = x->shape[2];
+    const int head_dim = x->shape[3];
+    const int r = map->num_features;
+
+    if (head_dim != map->head_dim || phi->shape[2] != seq_len || phi->shape[3] != r) {
+        fprintf(stderr, "Shape mismatch in random_feature_map_apply\n");
+        return false;
+    }
+
+    const float* omega = map->omega->data;
+    const float norm_r = 1.0f / sqrtf((float)r);
+
+    FeatureMapJob job = {x, phi, omega, data_scale, norm_r, is_query};
+    const long units = (long)batch_size * num_heads;
+    thread_pool_parallel_for(units, units > 1 ? 0 : units, feature_map_heads, &job);
+    return true;
+}
+
+typedef struct PerformerJob {
+    const Tensor* phi_q;
+    const Tensor* phi_k;
+    const Tensor* V;
+    Tensor* output;
+    const AttentionMask* mask;
+    bool is_causal;
+    atomic_bool failed;
+} PerformerJob;
+
+// 一个 (batch, head) 的线性注意力
+static void performer_head(PerformerJob* job, size_t bh) {
+    const int num_heads = job->V->shape[1];
+    const int seq_len_q = job->phi_q->shape[2];
+    const int seq_len_k = job->phi_k->shape[2];
+    const int head_dim = job->V->shape[3];
+    const int r = job->phi_q->shape[3];
+    const int b = (int)(bh / num_heads);
+    const int h = (int)(bh % num_heads);
+
+    const float* pq = job->phi_q->data + bh * seq_len_q * r;
+    const float* pk = job->phi_k->data + bh * seq_len_k * r;
+    const float* vs = job->V->data + bh * seq_len_k * head_dim;
+    float* out = job->output->data + bh * seq_len_q * head_dim;
+
+    // padding key: 非因果取掩码第0行, 因果取最后一行 (因果掩码只有最后一行包含所有key),
+    // 被屏蔽的key不参与求和; performer_attention已检查过各行一致
+    const float* key_mask = attention_mask_row(job->mask, b, h, job->is_causal ? seq_len_q - 1 : 0);
+
+    float* kv = (float*)calloc((size_t)r * head_dim, sizeof(float));  // sum phi(k) v^T
+    float* z = (float*)calloc(r, sizeof(float));                      // sum phi(k)
+    if (!kv || !z) {
+        atomic_store(&job->failed, true);
+        free(kv);
+        free(z);
+        return;
+    }
+
+    if (!job->is_causal) {
+        for (int j = 0; j < seq_len_k; j++) {
+            if (key_mask && key_mask[j] == 0.0f) continue;
+            const float* pkj = pk + (size_t)j * r;
+            const float* vj = vs + (size_t)j * head_dim;
+            for (int m = 0; m < r; m++) {
+                float* kv_row = kv + (size_t)m * head_dim;
+                for (int d = 0; d < head_dim; d++) kv_row[d] += pkj[m] * vj[d];
+                z[m] += pkj[m];
+            }
+        }
+    }
+
+    for (int i = 0; i < seq_len_q; i++) {
+        // 因果: 先把位置i的key加入前缀和, 再计算query i
+        if (job->is_causal && !(key_mask && key_mask[i] == 0.0f)) {
+            const float* pki = pk + (size_t)i * r;
+            const float* vi = vs + (size_t)i * head_dim;
+            for (int m = 0; m < r; m++) {
+                float* kv_row = kv + (size_t)m * head_dim;
+                for (int d = 0; d < head_dim; d++) kv_row[d] += pki[m] * vi[d];
+                z[m] += pki[m];
+            }
+        }
+
+        const float* pqi = pq + (size_t)i * r;
+        float* oi = out + (size_t)i * head_dim;
+        memset(oi, 0, head_dim * sizeof(float));
+        float denom = 0.0f;
+        for (int m = 0; m < r; m++) {
+            const float* kv_row = kv + (size_t)m * head_dim;
+            for (int d = 0; d < head_dim; d++) oi[d] += pqi[m] * kv_row[d];
+            denom += pqi[m] * z[m];
+        }
+        if (denom > FLT_MIN) {
+            float inv = 1.0f / denom;
+            for (int d = 0; d < head_dim; d++) oi[d] *= inv;
+        } else {
+            memset(oi, 0, head_dim * sizeof(float));
+        }
+    }
+
+    free(kv);
+    free(z);
+}
+
+static void performer_heads(void* ctx, long begin, long end) {
+    for (long bh = begin; bh < end; bh++) {
+        performer_head((PerformerJob*)ctx, (size_t)bh);
+    }
+}
+
+// 核化注意力只能按key屏蔽: 检查掩码的形状, 以及每个 (b, h) 的各行都是同一个key padding行
+// 因果时第i行只比较 j <= i 的部分, 带padding的因果掩码也可以使用
+static bool key_padding_mask_valid(const AttentionMask* mask, int batch_size, int num_heads,
+                                   int seq_len_q, int seq_len_k, bool is_causal) {
+    const Tensor* m = mask->mask;
+    const int dims = m->num_dims;
+    bool shape_ok = (dims == 2 || dims == 3 || dims == 4) &&
+                    m->shape[dims - 1] == seq_len_k && m->shape[dims - 2] == seq_len_q;
+    if (shape_ok && dims >= 3) shape_ok = m->shape[0] == batch_size;
+    if (shape_ok && dims == 4) shape_ok = m->shape[1] == 1 || m->shape[1] == num_heads;
+    if (!shape_ok) {
+        fprintf(stderr, "Performer attention mask must be [%d, %d], [%d, %d, %d] or [%d, 1|%d, %d, %d]\n",
+                seq_len_q, seq_len_k, batch_size, seq_len_q, seq_len_k,
+                batch_size, num_heads, seq_len_q, seq_len_k);
+        return false;
+    }
+
+    const int mask_batch = dims >= 3 ? batch_size : 1;
+    const int mask_heads = dims == 4 ? m->shape[1] : 1;
+    const int key_row = is_causal ? seq_len_q - 1 : 0;
+    for (int b = 0; b < mask_batch; b++) {
+        for (int h = 0; h < mask_heads; h++) {
+            const float* key_mask = attention_mask_row(mask, b, h, key_row);
+            for (int i = 0; i < seq_len_q; i++) {
+                const float* row = attention_mask_row(mask, b, h, i);
+                const int visible = is_causal ? i + 1 : seq_len_k;
+                for (int j = 0; j < visible; j++) {
+                    if ((row[j] != 0.0f) != (key_mask[j] != 0.0f)) {
+                        fprintf(stderr, "Performer attention only supports key padding masks "
+                                "(row %d differs from the key row at key %d)\n", i, j);
+                        return false;
+                    }
+                }
+            }
+        }
+    }
+    return true;
+}
+
+bool performer_attention(
+    const RandomFeatureMap* map,
+    const Tensor* Q,
+    const Tensor* K,
+    const Tensor* V,
+    bool is_causal,
+    const AttentionMask* mask,
+    Tensor* output
+) {
+    if (!map || !Q || !K || !V || !output) {
+        fprintf(stderr, "Null argument passed to performer_attention\n");
+        return false;
+    }
+    if (Q->num_dims != 4 || !check_same_shape(K, V) || !check_same_shape(Q, output)) {
+        fprintf(stderr, "Shape mismatch in performer_attention\n");
+        return false;
+    }
+
+    const int batch_size = Q->shape[0];
+    const int num_heads = Q->shape[1];
+    const int seq_len_q = Q->shape[2];
+    const int head_dim = Q->shape[3];
+    const int seq_len_k = K->shape[2];
+    const int r = map->num_features;
+
+    if (is_causal && seq_len_q != seq_len_k) {
+        fprintf(stderr, "Causal performer attention needs seq_len_q == seq_len_k\n");
+        return false;
+    }
+    if (mask && mask->mask &&
+        !key_padding_mask_valid(mask, batch_size, num_heads, seq_len_q, seq_len_k, is_causal)) {
+        return false;
+    }
+
+    int phi_q_shape[] = {batch_size, num_heads, seq_len_q, r};
+    int phi_k_shape[] = {batch_size, num_heads, seq_len_k, r};
+    Tensor* phi_q = tensor_create(phi_q_shape, 4);
+    Tensor* phi_k = tensor_create(phi_k_shape, 4);
+    if (!phi_q || !phi_k) {
+        tensor_free(phi_q);
+        tensor_free(phi_k);
+        return false;
+    }
+
+    // q·k / sqrt(d) = (q d^{-1/4})·(k d^{-1/4})
+    const float data_scale = 1.0f / sqrtf(sqrtf((float)head_dim));
+    if (!random_feature_map_apply(map, Q, data_scale, true, phi_q) ||
+        !random_feature_map_apply(map, K, data_scale, false, phi_k)) {
+        tensor_free(phi_q);
+        tensor_free(phi_k);
+        return false;
+    }
+
+    PerformerJob job = {phi_q, phi_k, V, output, mask, is_causal, false};
+    const long units = (long)batch_size * num_heads;
+    thread_pool_parallel_for(units, units > 1 ? 0 : units, performer_heads, &job);
+    const bool success = !atomic_load(&job.failed);
+
+    tensor_free(phi_q);
+    tensor_free(phi_k);
+    return success;
+}
+
+bool performer_attention_forward(
+    MultiHeadAttention* mha,
+    const Tensor* input_q,
+    const Tensor* input_kv,
+    Tensor* output,
+    const AttentionMask* mask
+) {
+    if (!mha || !mha->feature_map || !input_q || !input_kv || !output) {
+        return false;
+    }
+
+    const int batch_size = input_q->shape[0];
+    const int seq_len_q = input_q->shape[1];
+    const int seq_len_k = input_kv->shape[1];
+    const int num_heads = mha->num_heads;
+    const int head_dim = mha->W_q->shape[1] / num_heads;  // 投影宽度取自W_q, 张量并行分片只有部分头
+
+    int q_shape[] = {batch_size, num_heads, seq_len_q, head_dim};
+    int kv_shape[] = {batch_size, num_heads, seq_len_k, head_dim};
+    Tensor* q = tensor_create(q_shape, 4);
+    Tensor* k = tensor_create(kv_shape, 4);
+    Tensor* v = tensor_create(kv_shape, 4);
+    Tensor* heads = tensor_create(q_shape, 4);
+
+    bool success = q && k && v && heads &&
+        attention_project_heads_rotary(input_q, mha->W_q, mha->b_q, num_heads, mha->rope, 0, q) &&
+        attention_project_heads_rotary(input_kv, mha->W_k, mha->b_k, num_heads, mha->rope, 0, k) &&
+        attention_project_heads(input_kv, mha->W_v, mha->b_v, num_heads, v) &&
+        performer_attention(mha->feature_map, q, k, v, mha->is_causal, mask, heads) &&
+        attention_merge_heads(heads, mha->W_o, mha->b_o, output);
+
+    if (!success) {
+        fprintf(stderr, "Performer attention forward failed\n");
+    }
+
+    tensor_free(q);
+    tensor_free(k);
+    tensor_free(v);
+    tensor_free(heads);
+    return success;
+}
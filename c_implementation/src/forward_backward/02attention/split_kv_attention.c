@@ -0,0 +1,172 @@
+#include "split_kv_attention.h"
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include <float.h>
+#include "thread_pool.h"
+
+// 每段最少的key数, 太短的段合并开销大于并行收益
+#define SPLIT_KV_MIN_CHUNK 64
+
+int split_kv_choose_splits(int batch_size, int num_heads, int kv_len, int num_threads) {
+    const int units = batch_size * num_heads;
+    if (units <= 0 || kv_len <= 0) return 1;
+
+    int splits = (2 * num_threads + units - 1) / units;
+    int max_splits = (kv_len + SPLIT_KV_MIN_CHUNK - 1) / SPLIT_KV_MIN_CHUNK;
+    if (splits > max_splits) splits = max_splits;
+    return splits > 0 ? splits : 1;
+}
+
+typedef struct SplitKvJob {
+    const float* q;
+    const float* k_cache;
+    const float* v_cache;
+    float* output;
+    int num_heads;
+    int head_dim;
+    int max_len;
+    int kv_len;
+    int num_splits;
+    int chunk;
+    float scale;
+    float* part_max;
+    float* part_sum;
+    float* part_out;
+} SplitKvJob;
+
+// 1. 各段独立计算, [begin, end) 为 (batch, head, split) 展平后的段编号
+static void split_kv_parts(void* ctx, long begin, long end) {
+    const SplitKvJob* job = (const SplitKvJob*)ctx;
+    const int head_dim = job->head_dim;
+    for (long part = begin; part < end; part++) {
+        const size_t bh = (size_t)part / job->num_splits;
+        const int s = (int)(part % job->num_splits);
+        const float* qv = job->q + bh * head_dim;
+        const float* ks = job->k_cache + bh * job->max_len * head_dim;
+        const float* vs = job->v_cache + bh * job->max_len * head_dim;
+        float* o = job->part_out + (size_t)part * head_dim;
+
+        const int start = s * job->chunk;
+        const int end_key = start + job->chunk < job->kv_len ? start + job->chunk : job->kv_len;
+
+        memset(o, 0, head_dim * sizeof(float));
+        // 在线softmax: 最大值变大时按比例缩小已有的和与输出
+        float m = -FLT_MAX;
+        float l = 0.0f;
+        for (int j = start; j < end_key; j++) {
+            const float* kj = ks + (size_t)j * head_dim;
+            float score = 0.0f;
+            for (int d = 0; d < head_dim; d++) score += qv[d] * kj[d];
+            score *= job->scale;
+
+            const float* vj = vs + (size_t)j * head_dim;
+            if (score > m) {
+                float correction = expf(m - score);
+                l = l * correction + 1.0f;
+                for (int d = 0; d < head_dim; d++) o[d] = o[d] * correction + vj[d];
+                m = score;
+            } else {
+                float p = expf(score - m);
+                l += p;
+                for (int d = 0; d < head_dim; d++) o[d] += p * vj[d];
+            }
+        }
+        job->part_max[part] = m;
+        job->part_sum[part] = l;
+    }
+}
+
+void split_kv_merge_parts(const float* part_max, const float* part_sum, const float* part_out,
+                          int num_splits, int head_dim, float* output) {
+    float global_max = -FLT_MAX;
+    for (int s = 0; s < num_splits; s++) {
+        if (part_sum[s] > 0.0f) global_max = fmaxf(global_max, part_max[s]);
+    }
+
+    memset(output, 0, head_dim * sizeof(float));
+    float total = 0.0f;
+    for (int s = 0; s < num_splits; s++) {
+        if (part_sum[s] == 0.0f) continue;  // 空段
+        float w = expf(part_max[s] - global_max);
+        total += part_sum[s] * w;
+        const float* o = part_out + (size_t)s * head_dim;
+        for (int d = 0; d < head_dim; d++) output[d] += o[d] * w;
+    }
+
+    float inv_total = total > 0.0f ? 1.0f / total : 0.0f;
+    for (int d = 0; d < head_dim; d++) output[d] *= inv_total;
+}
+
+// 2. 按log-sum-exp合并各段, [begin, end) 为 (batch, head) 编号
+static void split_kv_merge(void* ctx, long begin, long end) {
+    const SplitKvJob* job = (const SplitKvJob*)ctx;
+    const int head_dim = job->head_dim;
+    const int num_splits = job->num_splits;
+    for (long bh = begin; bh < end; bh++) {
+        const size_t first = (size_t)bh * num_splits;
+        split_kv_merge_parts(job->part_max + first, job->part_sum + first, job->part_out + first * head_dim,
+                             num_splits, head_dim, job->output + (size_t)bh * head_dim);
+    }
+}
+
+bool split_kv_decode_attention(
+    const Tensor* q,
+    const Tensor* k_cache,
+    const Tensor* v_cache,
+    int kv_len,
+    float scale,
+    int num_splits,
+    Tensor* output
+) {
+    if (!q || !k_cache || !v_cache || !output) {
+        fprintf(stderr, "Null tensor passed to split_kv_decode_attention\n");
+        return false;
+    }
+    if (q->num_dims != 3 || k_cache->num_dims != 4 || !check_same_shape(k_cache, v_cache) ||
+        !check_same_shape(q, output)) {
+        fprintf(stderr, "Shape mismatch in split_kv_decode_attention\n");
+        return false;
+    }
+
+    const int batch_size = q->shape[0];
+    const int num_heads = q->shape[1];
+    const int head_dim = q->shape[2];
+    const int max_len = k_cache->shape[2];
+
+    if (k_cache->shape[0] != batch_size || k_cache->shape[1] != num_heads ||
+        k_cache->shape[3] != head_dim || kv_len <= 0 || kv_len > max_len) {
+        fprintf(stderr, "Invalid kv cache shape or length %d\n", kv_len);
+        return false;
+    }
+
+    if (num_splits <= 0) {
+        num_splits = split_kv_choose_splits(batch_size, num_heads, kv_len, thread_pool_num_threads());
+    }
+    if (num_splits > kv_len) num_splits = kv_len;
+    const int chunk = (kv_len + num_splits - 1) / num_splits;
+
+    // 每段的局部结果: 最大值m, 指数和l, 未归一化输出o[head_dim]
+    const size_t num_parts = (size_t)batch_size * num_heads * num_splits;
+    float* part_max = (float*)malloc(num_parts * sizeof(float));
+    float* part_sum = (float*)malloc(num_parts * sizeof(float));
+    float* part_out = (float*)malloc(num_parts * head_dim * sizeof(float));
+    if (!part_max || !part_sum || !part_out) {
+        free(part_max);
+        free(part_sum);
+        free(part_out);
+        return false;
+    }
+
+    SplitKvJob job = {q->data, k_cache->data, v_cache->data, output->data, num_heads, head_dim,
+                      max_len, kv_len, num_splits, chunk, scale, part_max, part_sum, part_out};
+    const long units = (long)batch_size * num_heads;
+    thread_pool_parallel_for((long)num_parts, 1, split_kv_parts, &job);
+    thread_pool_parallel_for(units, units > 4 ? 0 : units, split_kv_merge, &job);
+
+    free(part_max);
+    free(part_sum);
+    free(part_out);
+    return true;
+}
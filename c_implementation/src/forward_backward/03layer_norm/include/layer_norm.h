@@ -2,6 +2,7 @@
 #define LAYER_NORM_H
 
 #include "tensor_type.h"
+#include "dropout.h"
 
 typedef struct LayerNorm {
     float eps;          // 用于数值稳定性的小值
@@ -17,4 +18,17 @@ void layer_norm_free(LayerNorm* ln);
 // 前向计算函数
 bool layer_norm_forward(LayerNorm* ln, Tensor* input, Tensor* output);
 
+// 子层输出的 dropout + 残差连接 + 层归一化: output = LayerNorm(residual + dropout(input))
+// 按行计算, 每行的残差和留在缓存中完成均值/方差/归一化, 不单独写出中间张量
+// 掩码与对整个张量调用 dropout_forward(input, ..., prob, key) 相同, 反向传播用同一个key
+// 形状 [..., normalized_dim], output可以与input或residual相同
+bool layer_norm_residual_dropout_forward(
+    LayerNorm* ln,
+    const Tensor* input,
+    const Tensor* residual,
+    Tensor* output,
+    float prob,
+    DropoutKey key
+);
+
 #endif
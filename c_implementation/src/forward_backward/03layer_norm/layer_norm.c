@@ -1,7 +1,8 @@
 #include "layer_norm.h"
-#include "tensor_std.h"
+#include "thread_pool.h"
 #include <stdlib.h>
 #include <math.h>
+#include <stdio.h>
 
 LayerNorm* layer_norm_create(int normalized_shape, float eps) {
     LayerNorm* ln = (LayerNorm*)malloc(sizeof(LayerNorm));
@@ -33,16 +34,95 @@ void layer_norm_free(LayerNorm* ln) {
     }
 }
 
+typedef struct ResidualNormJob {
+    const LayerNorm* ln;
+    const float* input;
+    const float* residual;          // NULL时只做层归一化
+    float* output;
+    int dim;
+    float prob;
+    DropoutKey key;
+} ResidualNormJob;
+
+static void residual_norm_rows(void* ctx, long begin, long end) {
+    const ResidualNormJob* job = (const ResidualNormJob*)ctx;
+    const int dim = job->dim;
+    const float* gamma = job->ln->gamma->data;
+    const float* beta = job->ln->beta->data;
+
+    for (long r = begin; r < end; r++) {
+        const size_t offset = (size_t)r * dim;
+        float* y = job->output + offset;
+
+        const float* x = job->input + offset;
+
+        // 1. y = residual + dropout(x), 下标用整个张量中的位置以保持掩码一致
+        if (job->residual) {
+            dropout_residual_add(x, job->residual + offset, y, dim, offset, job->prob, job->key);
+            x = y;
+        }
+
+        // 2. 均值和方差
+        float sum = 0.0f;
+        #pragma omp simd reduction(+:sum)
+        for (int h = 0; h < dim; h++) sum += x[h];
+        const float mean = sum / dim;
+
+        float sum_sq = 0.0f;
+        #pragma omp simd reduction(+:sum_sq)
+        for (int h = 0; h < dim; h++) {
+            float diff = x[h] - mean;
+            sum_sq += diff * diff;
+        }
+        const float inv_std = 1.0f / sqrtf(sum_sq / dim + job->ln->eps);
+
+        // 3. 归一化和缩放
+        #pragma omp simd
+        for (int h = 0; h < dim; h++) {
+            y[h] = gamma[h] * ((x[h] - mean) * inv_std) + beta[h];
+        }
+    }
+}
+
+// 与 layer_norm_residual_dropout_forward 共用按行并行的实现, 输出可以就是输入
 bool layer_norm_forward(LayerNorm* ln, Tensor* input, Tensor* output) {
     if (!input || !output || !ln) {
         return false;
     }
 
-    return layer_norm_forward_3d(
-        input,
-        output, 
-        ln->gamma,
-        ln->beta,
-        ln->eps
-    );
+    const int dim = ln->normalized_dim;
+    if (input->shape[input->num_dims - 1] != dim || !check_same_shape(input, output)) {
+        fprintf(stderr, "Layer norm expects matching [..., %d] tensors\n", dim);
+        return false;
+    }
+
+    const long rows = (long)(calculate_total_size(input->shape, input->num_dims) / dim);
+    ResidualNormJob job = {ln, input->data, NULL, output->data, dim, 0.0f, {0}};
+    thread_pool_parallel_for(rows, rows > 16 ? 0 : rows, residual_norm_rows, &job);
+    return true;
+}
+
+bool layer_norm_residual_dropout_forward(
+    LayerNorm* ln,
+    const Tensor* input,
+    const Tensor* residual,
+    Tensor* output,
+    float prob,
+    DropoutKey key
+) {
+    if (!ln || !input || !residual || !output) {
+        return false;
+    }
+
+    const int dim = ln->normalized_dim;
+    if (input->shape[input->num_dims - 1] != dim ||
+        !check_same_shape(input, residual) || !check_same_shape(input, output)) {
+        fprintf(stderr, "Residual layer norm expects matching [..., %d] tensors\n", dim);
+        return false;
+    }
+
+    const long rows = (long)(calculate_total_size(input->shape, input->num_dims) / dim);
+    ResidualNormJob job = {ln, input->data, residual->data, output->data, dim, prob, key};
+    thread_pool_parallel_for(rows, rows > 16 ? 0 : rows, residual_norm_rows, &job);
+    return true;
 }
@@ -1,12 +1,29 @@
 #include "feed_forward.h"
-#include "relu.h"
-#include "tensor_mul.h"
-#include "tensor_add.h"
+#include "tensor_gemm.h"
+#include "thread_pool.h"
+#include <stdatomic.h>
 #include <stdlib.h>
+#include <stdio.h>
 
 FeedForward* feed_forward_create(int input_dim, int hidden_dim) {
-    FeedForward* ff = (FeedForward*)malloc(sizeof(FeedForward));
+    return feed_forward_create_with_activation(input_dim, hidden_dim, ACTIVATION_RELU, false);
+}
+
+FeedForward* feed_forward_create_with_activation(
+    int input_dim,
+    int hidden_dim,
+    ActivationType activation,
+    bool gated
+) {
+    if (gated && activation != ACTIVATION_SILU) {
+        fprintf(stderr, "Gated feed forward only supports SiLU (SwiGLU), got %s\n",
+                activation_name(activation));
+        return NULL;
+    }
+
+    FeedForward* ff = (FeedForward*)calloc(1, sizeof(FeedForward));
     if (!ff) return NULL;
+    ff->activation = activation;
 
     // 创建权重矩阵
     int w1_shape[] = {input_dim, hidden_dim};  // [input_dim, hidden_dim]
@@ -18,36 +35,127 @@ FeedForward* feed_forward_create(int input_dim, int hidden_dim) {
     ff->w2 = tensor_create(w2_shape, 2);
     ff->b1 = tensor_create(b1_shape, 1);
     ff->b2 = tensor_create(b2_shape, 1);
+    if (gated) {
+        ff->w_up = tensor_create(w1_shape, 2);
+        ff->b_up = tensor_create(b1_shape, 1);
+    }
 
+    if (!ff->w1 || !ff->w2 || !ff->b1 || !ff->b2 || (gated && (!ff->w_up || !ff->b_up))) {
+        feed_forward_free(ff);
+        return NULL;
+    }
     return ff;
 }
 
-bool feed_forward_forward(FeedForward* ff, const Tensor* input, Tensor* output) {
-    // input shape: [batch_size, input_dim]
-    int batch_size = input->shape[0];
-    int input_dim = input->shape[1];
-    int hidden_dim = ff->w1->shape[0];
+static GemmEpilogue ffn_epilogue(ActivationType activation) {
+    switch (activation) {
+        case ACTIVATION_GELU_TANH: return GEMM_EPILOGUE_GELU_TANH;
+        case ACTIVATION_GELU_ERF: return GEMM_EPILOGUE_GELU_ERF;
+        case ACTIVATION_SILU: return GEMM_EPILOGUE_SILU;
+        default: return GEMM_EPILOGUE_RELU;
+    }
+}
+
+// 每块的token数: 隐藏层块 (门控时为gate/up共用的一块) 不超过FFN_CHUNK_BYTES, 取GEMM行块(4)的倍数;
+// token较少时缩小块让每个线程都有活干
+static int ffn_chunk_tokens(int num_tokens, int hidden_dim) {
+    int chunk = FFN_CHUNK_BYTES / (int)(hidden_dim * sizeof(float));
+    chunk = chunk / 4 * 4;
+    if (chunk < 4) chunk = 4;
+
+    const int num_threads = thread_pool_num_threads();
+    int per_thread = (num_tokens + num_threads - 1) / num_threads;
+    per_thread = (per_thread + 3) / 4 * 4;
+    return per_thread < chunk ? per_thread : chunk;
+}
+
+typedef struct FfnJob {
+    const FeedForward* ff;
+    const float* input;
+    float* output;
+    int num_tokens;
+    int chunk;
+    atomic_bool failed;
+} FfnJob;
+
+// 处理 [begin, end) 号token块, 每个任务自己分配一块隐藏层
+static void ffn_chunks(void* ctx, long begin, long end) {
+    FfnJob* job = (FfnJob*)ctx;
+    const FeedForward* ff = job->ff;
+    const int input_dim = ff->w1->shape[0];
+    const int hidden_dim = ff->w1->shape[1];
+    const int chunk = job->chunk;
 
-    // 第一个线性变换: intermediate = x * W1 + b1 (注意这里是x乘以W1,而不是W1乘以x)
-    if (!tensor_matmul_2d(input, ff->w1, output)) return false;
-    if (!tensor_add(output, ff->b1, output)) return false;
+    float* hidden = (float*)malloc((size_t)chunk * hidden_dim * sizeof(float));
+    if (!hidden) {
+        atomic_store(&job->failed, true);
+        return;
+    }
+
+    for (long c = begin; c < end; c++) {
+        const int start = (int)c * chunk;
+        const int rows = job->num_tokens - start < chunk ? job->num_tokens - start : chunk;
+        const float* x = job->input + (size_t)start * input_dim;
+        float* y = job->output + (size_t)start * input_dim;
+
+        // 先读完本块的输入得到隐藏层, 再写本块输出, 所以可以原地计算
+        // 门控: 先把up投影写入隐藏层块, gate GEMM写回时做 SiLU(gate) * up
+        if (ff->w_up) {
+            gemm_bias_act(x, input_dim, ff->w_up->data, hidden_dim, ff->b_up->data,
+                          hidden, hidden_dim, rows, hidden_dim, input_dim, GEMM_EPILOGUE_NONE);
+        }
+        gemm_bias_act(x, input_dim, ff->w1->data, hidden_dim, ff->b1->data,
+                      hidden, hidden_dim, rows, hidden_dim, input_dim,
+                      ff->w_up ? GEMM_EPILOGUE_SWIGLU : ffn_epilogue(ff->activation));
+        gemm_bias_act(hidden, hidden_dim, ff->w2->data, input_dim, ff->b2->data,
+                      y, input_dim, rows, input_dim, hidden_dim, GEMM_EPILOGUE_NONE);
+    }
+    free(hidden);
+}
+
+bool feed_forward_fused(const FeedForward* ff, const float* input, int num_tokens, float* output) {
+    if (!ff || !input || !output || num_tokens <= 0) {
+        fprintf(stderr, "Invalid arguments to feed_forward_fused\n");
+        return false;
+    }
 
-    // ReLU激活
-    relu_forward(output, output);
+    const int hidden_dim = ff->w1->shape[1];
+    const int chunk = ffn_chunk_tokens(num_tokens, hidden_dim);
+    const int num_chunks = (num_tokens + chunk - 1) / chunk;
 
-    // 第二个线性变换: output = relu_output * W2 + b2
-    if (!tensor_matmul_2d(output, ff->w2, output)) return false;
-    if (!tensor_add(output, ff->b2, output)) return false;
+    // 块之间互相独立, 每块一个任务; 块内的GEMM在空闲线程多时继续拆分
+    FfnJob job = {ff, input, output, num_tokens, chunk, false};
+    thread_pool_parallel_for(num_chunks, 1, ffn_chunks, &job);
 
+    if (atomic_load(&job.failed)) {
+        fprintf(stderr, "Failed to allocate feed forward hidden chunk\n");
+        return false;
+    }
     return true;
 }
 
+bool feed_forward_forward(FeedForward* ff, const Tensor* input, Tensor* output) {
+    if (!ff || !input || !output) return false;
+
+    // input shape: [..., input_dim], 前面的维度合并为token数
+    const int input_dim = ff->w1->shape[0];
+    if (input->shape[input->num_dims - 1] != input_dim || !check_same_shape(input, output)) {
+        fprintf(stderr, "Feed forward expects [..., %d] input and output of the same shape\n", input_dim);
+        return false;
+    }
+
+    const int num_tokens = (int)(calculate_total_size(input->shape, input->num_dims) / input_dim);
+    return feed_forward_fused(ff, input->data, num_tokens, output->data);
+}
+
 void feed_forward_free(FeedForward* ff) {
     if (ff) {
         tensor_free(ff->w1);
         tensor_free(ff->b1);
         tensor_free(ff->w2);
         tensor_free(ff->b2);
+        tensor_free(ff->w_up);
+        tensor_free(ff->b_up);
         free(ff);
     }
 }
@@ -2,22 +2,45 @@
 #define FEED_FORWARD_H
 
 #include "tensor_type.h"
+#include "activation.h"
+
+// 融合前馈每次处理的token块, 隐藏层块 [chunk, hidden_dim] 控制在这个字节数内以留在L2中
+#define FFN_CHUNK_BYTES (256 * 1024)
 
 typedef struct FeedForward FeedForward;
 
 struct FeedForward {
-    Tensor* w1;  // 第一个线性变换的权重
-    Tensor* b1;  // 第一个线性变换的偏置
-    Tensor* w2;  // 第二个线性变换的权重
-    Tensor* b2;  // 第二个线性变换的偏置
+    Tensor* w1;  // 第一个线性变换的权重 [input_dim, hidden_dim], 门控时为gate投影
+    Tensor* b1;  // 第一个线性变换的偏置 [hidden_dim]
+    Tensor* w2;  // 第二个线性变换的权重 [hidden_dim, input_dim]
+    Tensor* b2;  // 第二个线性变换的偏置 [input_dim]
+    Tensor* w_up;  // 门控FFN的up投影 [input_dim, hidden_dim], 非门控为NULL
+    Tensor* b_up;  // [hidden_dim], 非门控为NULL
+    ActivationType activation;
 };
 
-// 创建前馈层
+// 创建前馈层, ReLU激活
 FeedForward* feed_forward_create(int input_dim, int hidden_dim);
 
-// 前向传播
+// 指定激活函数; gated为true时是门控FFN: hidden = act(x W1 + b1) * (x W_up + b_up),
+// 目前门控只支持SiLU (SwiGLU)
+FeedForward* feed_forward_create_with_activation(
+    int input_dim,
+    int hidden_dim,
+    ActivationType activation,
+    bool gated
+);
+
+// 前向传播, input/output: [..., input_dim], 可以原地计算
 bool feed_forward_forward(FeedForward* ff, const Tensor* input, Tensor* output);
 
+// 融合前馈: output = act(input × W1 + b1) × W2 + b2, input/output: [num_tokens, input_dim]
+// 门控时 act(input × W1 + b1) 再乘 (input × W_up + b_up), 乘法同样在gate GEMM写回时完成
+// 按token块计算, 块的隐藏层在W1和W2两次GEMM之间留在缓存中, 偏置与激活在GEMM写回时完成,
+// 完整的 [num_tokens, hidden_dim] 中间结果不会写到内存; 多个块时各线程各处理一块,
+// 只有一块时 (如逐token解码) 由GEMM内部按列并行. 允许input == output
+bool feed_forward_fused(const FeedForward* ff, const float* input, int num_tokens, float* output);
+
 // 释放资源
 void feed_forward_free(FeedForward* ff);
 
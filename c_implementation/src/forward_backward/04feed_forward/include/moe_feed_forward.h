@@ -0,0 +1,63 @@
+#ifndef MOE_FEED_FORWARD_H
+#define MOE_FEED_FORWARD_H
+
+#include "feed_forward.h"
+#include <pthread.h>
+#include <stdio.h>
+
+typedef struct MoEFeedForward MoEFeedForward;
+
+// 最近一次前向的专家负载, 用于调整capacity_factor和观察路由是否失衡
+typedef struct MoELoadReport {
+    int num_tokens;
+    int capacity;                // 每个专家的容量, 0表示不限
+    int* assigned;               // [num_experts] 路由到该专家的 (token, 槽位) 数, 含被丢弃的
+    int* dropped;                // [num_experts] 超过容量被丢弃的数目
+    float* mean_router_prob;     // [num_experts] 该专家在所有token上的平均路由概率
+    // Switch Transformer负载均衡损失 E * sum_e f_e * P_e, f_e为分到专家e的槽位比例, P_e为平均路由概率
+    // 完全均衡时为1
+    float balance_loss;
+} MoELoadReport;
+
+// 专家混合前馈: 路由线性层给每个token选top_k个专家, 输出为所选专家输出的门控加权和
+// 门控为路由softmax在所选专家上重新归一化的概率
+struct MoEFeedForward {
+    int input_dim;
+    int hidden_dim;
+    int num_experts;
+    int top_k;
+    // 每个专家最多处理 ceil(capacity_factor * num_tokens * top_k / num_experts) 个槽位,
+    // 按token顺序先到先得, 超出的槽位被丢弃 (该专家对这个token的贡献为0); <= 0 表示不限
+    float capacity_factor;
+
+    Tensor* router_weight;       // [input_dim, num_experts]
+    FeedForward** experts;       // [num_experts]
+    // 前向在局部缓冲中统计负载, 结束时加锁整体写入; 多个线程同时前向时保留最后完成的一次
+    MoELoadReport load;
+    pthread_mutex_t load_lock;
+};
+
+MoEFeedForward* moe_feed_forward_create(
+    int input_dim,
+    int hidden_dim,
+    int num_experts,
+    int top_k,
+    float capacity_factor,
+    ActivationType activation,
+    bool gated
+);
+
+// input/output: [..., input_dim], 可以原地计算
+// 1. 路由GEMM, 每个token选top_k个专家
+// 2. 按专家对 (token, 槽位) 做计数排序, 把token行按专家连续地收集到一起
+// 3. 每个专家对自己的连续行块调用一次融合前馈 (一次批量GEMM), 专家之间并行
+// 4. 按token把各槽位的专家输出乘门控后累加回输出
+bool moe_feed_forward_forward(MoEFeedForward* moe, const Tensor* input, Tensor* output);
+bool moe_feed_forward_fused(MoEFeedForward* moe, const float* input, int num_tokens, float* output);
+
+// 打印最近一次前向的负载统计
+void moe_feed_forward_print_load(const MoEFeedForward* moe, FILE* stream);
+
+void moe_feed_forward_free(MoEFeedForward* moe);
+
+#endif // MOE_FEED_FORWARD_H
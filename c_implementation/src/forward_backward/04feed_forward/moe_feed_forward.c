@@ -0,0 +1,337 @@
+#include "moe_feed_forward.h"
+#include "tensor_gemm.h"
+#include "thread_pool.h"
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <float.h>
+
+MoEFeedForward* moe_feed_forward_create(
+    int input_dim,
+    int hidden_dim,
+    int num_experts,
+    int top_k,
+    float capacity_factor,
+    ActivationType activation,
+    bool gated
+) {
+    if (input_dim <= 0 || hidden_dim <= 0 || num_experts <= 0 || top_k <= 0 || top_k > num_experts) {
+        fprintf(stderr, "Invalid MoE configuration: %d experts, top %d\n", num_experts, top_k);
+        return NULL;
+    }
+
+    MoEFeedForward* moe = (MoEFeedForward*)calloc(1, sizeof(MoEFeedForward));
+    if (!moe) return NULL;
+
+    moe->input_dim = input_dim;
+    moe->hidden_dim = hidden_dim;
+    moe->num_experts = num_experts;
+    moe->top_k = top_k;
+    moe->capacity_factor = capacity_factor;
+    pthread_mutex_init(&moe->load_lock, NULL);
+
+    int router_shape[] = {input_dim, num_experts};
+    moe->router_weight = tensor_create(router_shape, 2);
+    moe->experts = (FeedForward**)calloc(num_experts, sizeof(FeedForward*));
+    moe->load.assigned = (int*)calloc(num_experts, sizeof(int));
+    moe->load.dropped = (int*)calloc(num_experts, sizeof(int));
+    moe->load.mean_router_prob = (float*)calloc(num_experts, sizeof(float));
+    if (!moe->router_weight || !moe->experts || !moe->load.assigned ||
+        !moe->load.dropped || !moe->load.mean_router_prob) {
+        moe_feed_forward_free(moe);
+        return NULL;
+    }
+
+    for (int e = 0; e < num_experts; e++) {
+        moe->experts[e] = feed_forward_create_with_activation(input_dim, hidden_dim, activation, gated);
+        if (!moe->experts[e]) {
+            moe_feed_forward_free(moe);
+            return NULL;
+        }
+    }
+    return moe;
+}
+
+void moe_feed_forward_free(MoEFeedForward* moe) {
+    if (!moe) return;
+    if (moe->experts) {
+        for (int e = 0; e < moe->num_experts; e++) feed_forward_free(moe->experts[e]);
+        free(moe->experts);
+    }
+    tensor_free(moe->router_weight);
+    free(moe->load.assigned);
+    free(moe->load.dropped);
+    free(moe->load.mean_router_prob);
+    pthread_mutex_destroy(&moe->load_lock);
+    free(moe);
+}
+
+// 路由logits原地变为softmax概率, 选出概率最大的top_k个专家, 门控在所选专家上重新归一化
+static void route_token(float* probs, int num_experts, int top_k, int* experts, float* gates) {
+    float max_val = -FLT_MAX;
+    for (int e = 0; e < num_experts; e++) max_val = fmaxf(max_val, probs[e]);
+    float sum = 0.0f;
+    for (int e = 0; e < num_experts; e++) {
+        probs[e] = expf(probs[e] - max_val);
+        sum += probs[e];
+    }
+    for (int e = 0; e < num_experts; e++) probs[e] /= sum;
+
+    // top_k很小, 插入排序; 概率相同时编号小的优先
+    int count = 0;
+    for (int e = 0; e < num_experts; e++) {
+        if (count == top_k && probs[e] <= gates[count - 1]) continue;
+        int pos = count < top_k ? count++ : top_k - 1;
+        while (pos > 0 && gates[pos - 1] < probs[e]) {
+            gates[pos] = gates[pos - 1];
+            experts[pos] = experts[pos - 1];
+            pos--;
+        }
+        gates[pos] = probs[e];
+        experts[pos] = e;
+    }
+
+    float gate_sum = 0.0f;
+    for (int j = 0; j < top_k; j++) gate_sum += gates[j];
+    for (int j = 0; j < top_k; j++) gates[j] /= gate_sum;
+}
+
+typedef struct MoEExpertTask {
+    const FeedForward* expert;
+    const float* input;
+    float* output;
+    int rows;
+    atomic_bool* failed;
+} MoEExpertTask;
+
+static void moe_expert_run(void* arg) {
+    MoEExpertTask* task = (MoEExpertTask*)arg;
+    if (!feed_forward_fused(task->expert, task->input, task->rows, task->output)) {
+        atomic_store(task->failed, true);
+    }
+}
+
+// 路由、分组拷贝和按token合并三步共用的缓冲
+typedef struct MoERowsJob {
+    const MoEFeedForward* moe;
+    const float* input;
+    float* output;
+    float* probs;
+    int* slot_expert;
+    float* slot_gate;
+    const int* slot_row;
+    const int* row_token;
+    float* grouped_in;
+    const float* grouped_out;
+} MoERowsJob;
+
+static void moe_route_tokens(void* ctx, long begin, long end) {
+    const MoERowsJob* job = (const MoERowsJob*)ctx;
+    const int num_experts = job->moe->num_experts;
+    const int top_k = job->moe->top_k;
+    for (long t = begin; t < end; t++) {
+        route_token(job->probs + (size_t)t * num_experts, num_experts, top_k,
+                    job->slot_expert + (size_t)t * top_k, job->slot_gate + (size_t)t * top_k);
+    }
+}
+
+static void moe_gather_rows(void* ctx, long begin, long end) {
+    const MoERowsJob* job = (const MoERowsJob*)ctx;
+    const int dim = job->moe->input_dim;
+    for (long row = begin; row < end; row++) {
+        memcpy(job->grouped_in + (size_t)row * dim, job->input + (size_t)job->row_token[row] * dim,
+               dim * sizeof(float));
+    }
+}
+
+// 按token累加门控加权的专家输出, 每个token只写自己的行
+static void moe_combine_tokens(void* ctx, long begin, long end) {
+    const MoERowsJob* job = (const MoERowsJob*)ctx;
+    const int dim = job->moe->input_dim;
+    const int top_k = job->moe->top_k;
+    for (long t = begin; t < end; t++) {
+        float* out = job->output + (size_t)t * dim;
+        memset(out, 0, dim * sizeof(float));
+        for (int j = 0; j < top_k; j++) {
+            const size_t s = (size_t)t * top_k + j;
+            if (job->slot_row[s] < 0) continue;
+            const float gate = job->slot_gate[s];
+            const float* y = job->grouped_out + (size_t)job->slot_row[s] * dim;
+            #pragma omp simd
+            for (int d = 0; d < dim; d++) out[d] += gate * y[d];
+        }
+    }
+}
+
+bool moe_feed_forward_fused(MoEFeedForward* moe, const float* input, int num_tokens, float* output) {
+    if (!moe || !input || !output || num_tokens <= 0) {
+        fprintf(stderr, "Invalid arguments to moe_feed_forward_fused\n");
+        return false;
+    }
+
+    const int dim = moe->input_dim;
+    const int num_experts = moe->num_experts;
+    const int top_k = moe->top_k;
+    const size_t num_slots = (size_t)num_tokens * top_k;
+
+    float* probs = (float*)malloc((size_t)num_tokens * num_experts * sizeof(float));
+    int* slot_expert = (int*)malloc(num_slots * sizeof(int));
+    float* slot_gate = (float*)malloc(num_slots * sizeof(float));
+    int* slot_row = (int*)malloc(num_slots * sizeof(int));     // 槽位在分组缓冲中的行, 被丢弃为-1
+    int* row_token = (int*)malloc(num_slots * sizeof(int));    // 分组缓冲每行对应的token
+    int* offsets = (int*)calloc(num_experts + 1, sizeof(int));
+    int* fill = (int*)calloc(num_experts, sizeof(int));
+    int* order = (int*)malloc(num_experts * sizeof(int));
+    float* grouped_in = (float*)malloc(num_slots * dim * sizeof(float));
+    float* grouped_out = (float*)malloc(num_slots * dim * sizeof(float));
+    int* assigned = (int*)calloc(num_experts, sizeof(int));
+    int* dropped = (int*)calloc(num_experts, sizeof(int));
+    float* mean_router_prob = (float*)malloc(num_experts * sizeof(float));
+    bool success = probs && slot_expert && slot_gate && slot_row && row_token && offsets &&
+                   fill && order && grouped_in && grouped_out && assigned && dropped && mean_router_prob;
+    if (!success) {
+        fprintf(stderr, "Failed to allocate MoE routing buffers\n");
+        goto cleanup;
+    }
+
+    // 1. 路由
+    gemm_bias_act(input, dim, moe->router_weight->data, num_experts, NULL,
+                  probs, num_experts, num_tokens, num_experts, dim, GEMM_EPILOGUE_NONE);
+
+    MoERowsJob rows_job = {moe, input, output, probs, slot_expert, slot_gate, slot_row, row_token,
+                           grouped_in, grouped_out};
+    thread_pool_parallel_for(num_tokens, num_tokens > 64 ? 0 : num_tokens, moe_route_tokens, &rows_job);
+
+    // 2. 计数排序, 容量之外的槽位丢弃 (按token顺序, 结果与线程数无关)
+    const int capacity = moe->capacity_factor > 0.0f ?
+        (int)ceilf(moe->capacity_factor * (float)num_slots / num_experts) : 0;
+    for (size_t s = 0; s < num_slots; s++) assigned[slot_expert[s]]++;
+
+    for (int e = 0; e < num_experts; e++) {
+        int kept = assigned[e];
+        if (capacity > 0 && kept > capacity) {
+            dropped[e] = kept - capacity;
+            kept = capacity;
+        }
+        offsets[e + 1] = offsets[e] + kept;
+    }
+    for (size_t s = 0; s < num_slots; s++) {
+        const int e = slot_expert[s];
+        if (offsets[e] + fill[e] < offsets[e + 1]) {
+            const int row = offsets[e] + fill[e]++;
+            slot_row[s] = row;
+            row_token[row] = (int)(s / top_k);
+        } else {
+            slot_row[s] = -1;
+        }
+    }
+
+    // 负载统计: 平均路由概率与负载均衡损失
+    float balance = 0.0f;
+    for (int e = 0; e < num_experts; e++) {
+        double p = 0.0;
+        for (int t = 0; t < num_tokens; t++) p += probs[(size_t)t * num_experts + e];
+        mean_router_prob[e] = (float)(p / num_tokens);
+        balance += (float)assigned[e] / num_slots * mean_router_prob[e];
+    }
+
+    pthread_mutex_lock(&moe->load_lock);
+    moe->load.num_tokens = num_tokens;
+    moe->load.capacity = capacity;
+    memcpy(moe->load.assigned, assigned, num_experts * sizeof(int));
+    memcpy(moe->load.dropped, dropped, num_experts * sizeof(int));
+    memcpy(moe->load.mean_router_prob, mean_router_prob, num_experts * sizeof(float));
+    moe->load.balance_loss = balance * num_experts;
+    pthread_mutex_unlock(&moe->load_lock);
+
+    const int total_rows = offsets[num_experts];
+    thread_pool_parallel_for(total_rows, total_rows > 64 ? 0 : total_rows, moe_gather_rows, &rows_job);
+
+    // 3. 每个专家对自己的连续行块做一次融合前馈
+    // 每个有负载的专家一个任务, 负载大的先提交; 专家内部的GEMM在空闲线程多时继续拆分
+    int active = 0;
+    for (int e = 0; e < num_experts; e++) {
+        if (offsets[e + 1] > offsets[e]) order[active++] = e;
+    }
+    for (int i = 1; i < active; i++) {
+        int e = order[i];
+        int rows = offsets[e + 1] - offsets[e];
+        int j = i;
+        while (j > 0 && offsets[order[j - 1] + 1] - offsets[order[j - 1]] < rows) {
+            order[j] = order[j - 1];
+            j--;
+        }
+        order[j] = e;
+    }
+
+    TaskGroup experts_done;
+    task_group_init(&experts_done);
+    MoEExpertTask* tasks = (MoEExpertTask*)malloc(active * sizeof(MoEExpertTask));
+    if (!tasks) {
+        fprintf(stderr, "Failed to allocate MoE expert tasks\n");
+        success = false;
+        goto cleanup;
+    }
+    atomic_bool failed = false;
+    for (int i = 0; i < active; i++) {
+        const int e = order[i];
+        const int start = offsets[e];
+        tasks[i] = (MoEExpertTask){moe->experts[e], grouped_in + (size_t)start * dim,
+                                   grouped_out + (size_t)start * dim, offsets[e + 1] - start, &failed};
+        task_group_spawn(&experts_done, moe_expert_run, &tasks[i]);
+    }
+    task_group_wait(&experts_done);
+    free(tasks);
+    success = !atomic_load(&failed);
+    if (!success) goto cleanup;
+
+    // 4. 合并专家输出
+    thread_pool_parallel_for(num_tokens, num_tokens > 64 ? 0 : num_tokens, moe_combine_tokens, &rows_job);
+
+cleanup:
+    free(probs);
+    free(slot_expert);
+    free(slot_gate);
+    free(slot_row);
+    free(row_token);
+    free(offsets);
+    free(fill);
+    free(order);
+    free(grouped_in);
+    free(grouped_out);
+    free(assigned);
+    free(dropped);
+    free(mean_router_prob);
+    return success;
+}
+
+bool moe_feed_forward_forward(MoEFeedForward* moe, const Tensor* input, Tensor* output) {
+    if (!moe || !input || !output) return false;
+
+    const int dim = moe->input_dim;
+    if (input->shape[input->num_dims - 1] != dim || !check_same_shape(input, output)) {
+        fprintf(stderr, "MoE feed forward expects [..., %d] input and output of the same shape\n", dim);
+        return false;
+    }
+
+    const int num_tokens = (int)(calculate_total_size(input->shape, input->num_dims) / dim);
+    return moe_feed_forward_fused(moe, input->data, num_tokens, output->data);
+}
+
+void moe_feed_forward_print_load(const MoEFeedForward* moe, FILE* stream) {
+    if (!moe || !stream) return;
+    pthread_mutex_t* lock = (pthread_mutex_t*)&moe->load_lock;
+    pthread_mutex_lock(lock);
+    const MoELoadReport* load = &moe->load;
+    const double ideal = (double)load->num_tokens * moe->top_k / moe->num_experts;
+
+    fprintf(stream, "MoE load: %d tokens, top-%d of %d experts, capacity %d, balance loss %.4f\n",
+            load->num_tokens, moe->top_k, moe->num_experts, load->capacity, load->balance_loss);
+    fprintf(stream, "%8s %10s %10s %10s %10s\n", "expert", "assigned", "dropped", "load", "mean_prob");
+    for (int e = 0; e < moe->num_experts; e++) {
+        fprintf(stream, "%8d %10d %10d %9.2fx %10.4f\n", e, load->assigned[e], load->dropped[e],
+                ideal > 0.0 ? load->assigned[e] / ideal : 0.0, load->mean_router_prob[e]);
+    }
+    pthread_mutex_unlock(lock);
+}
@@ -1,21 +1,57 @@
 #include "encoder.h"
+#include "model_config.h"
 #include <stdlib.h>
+#include <stdio.h>
 
-Encoder* encoder_create(int num_layers, int num_heads, int model_dim, 
+Encoder* encoder_create(const ModelConfig* config, int num_layers, int num_heads, int model_dim, 
                        int ff_dim, float dropout_prob) {
+    // 每层的注意力配置存放在长度为MAX_NUM_LAYERS的数组中
+    if (num_layers <= 0 || num_layers > MAX_NUM_LAYERS) {
+        fprintf(stderr, "Encoder needs 1 to %d layers, got %d\n", MAX_NUM_LAYERS, num_layers);
+        return NULL;
+    }
+
     Encoder* encoder = (Encoder*)malloc(sizeof(Encoder));
     if (!encoder) return NULL;
 
     encoder->num_layers = num_layers;
-    encoder->layers = (EncoderLayer**)malloc(sizeof(EncoderLayer*) * num_layers);
-    
+    encoder->rope = NULL;
+    if (config->position_encoding == POSITION_ENCODING_ROTARY) {
+        encoder->rope = rotary_embedding_create(model_dim / num_heads, config->max_seq_length,
+                                                config->rope_base);
+        if (!encoder->rope) {
+            free(encoder);
+            return NULL;
+        }
+    }
+    // calloc: 中途创建失败时encoder_free可以安全跳过还没创建的层
+    encoder->layers = (EncoderLayer**)calloc(num_layers, sizeof(EncoderLayer*));
+    if (!encoder->layers) {
+        rotary_embedding_free(encoder->rope);
+        free(encoder);
+        return NULL;
+    }
+
     for (int i = 0; i < num_layers; i++) {
-        encoder->layers[i] = encoder_layer_create(num_heads, model_dim, 
+        encoder->layers[i] = encoder_layer_create(config, num_heads, model_dim, 
                                                 ff_dim, dropout_prob);
         if (!encoder->layers[i]) {
             encoder_free(encoder);
             return NULL;
         }
+        // 按层设置自注意力模式 (dense/local)
+        multihead_attention_set_config(encoder->layers[i]->self_attn,
+                                       &config->encoder_attention[i], false);
+        multihead_attention_set_rotary(encoder->layers[i]->self_attn, encoder->rope);
+        encoder->layers[i]->dropout_rng = dropout_rng_init(config->dropout_seed, i);
+        // 按模型选择注意力引擎, 每层使用不同的随机特征
+        if (!multihead_attention_set_engine(encoder->layers[i]->self_attn,
+                                            config->attention_engine,
+                                            config->num_random_features,
+                                            config->random_feature_seed + i)) {
+            encoder_free(encoder);
+            return NULL;
+        }
     }
     
     return encoder;
@@ -38,12 +74,19 @@ bool encoder_forward(Encoder* encoder, Tensor* input, Tensor* output,
     return true;
 }
 
+void encoder_set_training(Encoder* encoder, bool is_training) {
+    for (int i = 0; i < encoder->num_layers; i++) {
+        encoder->layers[i]->is_training = is_training;
+    }
+}
+
 void encoder_free(Encoder* encoder) {
     if (encoder) {
         for (int i = 0; i < encoder->num_layers; i++) {
             encoder_layer_free(encoder->layers[i]);
         }
         free(encoder->layers);
+        rotary_embedding_free(encoder->rope);
         free(encoder);
     }
 }
@@ -20,6 +20,9 @@ bool encoder_layer_backward(
         return false;
     }
 
+    // 与前向相同的概率和key重新生成dropout掩码
+    const float prob = layer->is_training ? layer->dropout_prob : 0.0f;
+
     // 1. 前馈网络层的反向传播
     if (!layer_norm_backward(layer->norm2, grad_output, temp_grad)) {
         goto cleanup;
@@ -31,7 +34,7 @@ bool encoder_layer_backward(
         goto cleanup;
     }
 
-    if (!dropout_backward(temp_grad, temp_grad, layer->dropout_prob)) {
+    if (!dropout_backward(temp_grad, temp_grad, prob, layer->dropout_keys[1])) {
         goto cleanup;
     }
 
@@ -55,7 +58,7 @@ bool encoder_layer_backward(
         goto cleanup;
     }
 
-    if (!dropout_backward(grad_input, grad_input, layer->dropout_prob)) {
+    if (!dropout_backward(grad_input, grad_input, prob, layer->dropout_keys[0])) {
         goto cleanup;
     }
 
@@ -6,10 +6,12 @@
 typedef struct Encoder {
     int num_layers;           // 编码器层数量
     EncoderLayer** layers;    // 编码器层数组
+    RotaryEmbedding* rope;    // 旋转位置编码, 各层自注意力共享; 使用正弦位置编码时为NULL
 } Encoder;
 
-// 创建编码器
+// 创建编码器, 注意力模式/引擎、位置编码、前馈类型和随机数种子都取自config, 不读全局配置
 Encoder* encoder_create(
+    const ModelConfig* config,
     int num_layers,
     int num_heads,
     int model_dim,
@@ -25,6 +27,9 @@ bool encoder_forward(
     AttentionMask* mask     // 注意力掩码
 );
 
+// 切换训练/推理模式; 推理模式下前向不做dropout, 也不修改层上的状态
+void encoder_set_training(Encoder* encoder, bool is_training);
+
 // 释放资源
 void encoder_free(Encoder* encoder);
 
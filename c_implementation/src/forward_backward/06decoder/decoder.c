@@ -1,27 +1,63 @@
 #include "decoder.h"
+#include "model_config.h"
 #include <stdlib.h>
 #include <stdio.h>
 
-Decoder* decoder_create(int num_layers, int num_heads, int model_dim, 
+Decoder* decoder_create(const ModelConfig* config, int num_layers, int num_heads, int model_dim, 
                        int ff_dim, float dropout_prob) {
+    // 每层的注意力配置存放在长度为MAX_NUM_LAYERS的数组中
+    if (num_layers <= 0 || num_layers > MAX_NUM_LAYERS) {
+        fprintf(stderr, "Decoder needs 1 to %d layers, got %d\n", MAX_NUM_LAYERS, num_layers);
+        return NULL;
+    }
+
     Decoder* decoder = (Decoder*)malloc(sizeof(Decoder));
     if (!decoder) return NULL;
 
     decoder->num_layers = num_layers;
-    decoder->layers = (DecoderLayer**)malloc(sizeof(DecoderLayer*) * num_layers);
+    decoder->output_linear = NULL;
+    decoder->rope = NULL;
+    if (config->position_encoding == POSITION_ENCODING_ROTARY) {
+        decoder->rope = rotary_embedding_create(model_dim / num_heads, config->max_seq_length,
+                                                config->rope_base);
+        if (!decoder->rope) {
+            free(decoder);
+            return NULL;
+        }
+    }
+    decoder->layers = (DecoderLayer**)calloc(num_layers, sizeof(DecoderLayer*));
     if (!decoder->layers) {
+        rotary_embedding_free(decoder->rope);
         free(decoder);
         return NULL;
     }
     
     // 创建每一层解码器
     for (int i = 0; i < num_layers; i++) {
-        decoder->layers[i] = decoder_layer_create(num_heads, model_dim, 
+        decoder->layers[i] = decoder_layer_create(config, num_heads, model_dim, 
                                                 ff_dim, dropout_prob);
         if (!decoder->layers[i]) {
             decoder_free(decoder);
             return NULL;
         }
+        // 按层设置自注意力模式, decoder自注意力为因果注意力; 交叉注意力保持dense
+        multihead_attention_set_config(decoder->layers[i]->self_attn,
+                                       &config->decoder_attention[i], true);
+        // 旋转位置编码只作用于自注意力, 交叉注意力的Q/K来自不同序列
+        multihead_attention_set_rotary(decoder->layers[i]->self_attn, decoder->rope);
+        // stream接在编码器各层之后
+        decoder->layers[i]->dropout_rng = dropout_rng_init(config->dropout_seed, MAX_NUM_LAYERS + i);
+        // 按模型选择注意力引擎, 自注意力和交叉注意力使用不同的随机特征
+        unsigned int seed = config->random_feature_seed + 2 * (MAX_NUM_LAYERS + i);
+        if (!multihead_attention_set_engine(decoder->layers[i]->self_attn,
+                                            config->attention_engine,
+                                            config->num_random_features, seed) ||
+            !multihead_attention_set_engine(decoder->layers[i]->cross_attn,
+                                            config->attention_engine,
+                                            config->num_random_features, seed + 1)) {
+            decoder_free(decoder);
+            return NULL;
+        }
     }
 
     // 添加最后的线性层
@@ -68,6 +104,12 @@ bool decoder_forward(
     return true;
 }
 
+void decoder_set_training(Decoder* decoder, bool is_training) {
+    for (int i = 0; i < decoder->num_layers; i++) {
+        decoder->layers[i]->is_training = is_training;
+    }
+}
+
 void decoder_free(Decoder* decoder) {
     if (decoder) {
         if (decoder->layers) {
@@ -79,6 +121,7 @@ void decoder_free(Decoder* decoder) {
         if (decoder->output_linear) {
             linear_free(decoder->output_linear);
         }
+        rotary_embedding_free(decoder->rope);
         free(decoder);
     }
 }
\ No newline at end of file
@@ -1,9 +1,10 @@
 #include "decoder_layer.h"
 #include "tensor_logic.h"
 #include "tensor_add.h"
+#include "model_config.h"
 #include <stdlib.h>
 
-DecoderLayer* decoder_layer_create(int num_heads, int model_dim, 
+DecoderLayer* decoder_layer_create(const ModelConfig* config, int num_heads, int model_dim,
                                  int ff_dim, float dropout_prob) {
     DecoderLayer* layer = (DecoderLayer*)malloc(sizeof(DecoderLayer));
     if (!layer) return NULL;
@@ -14,12 +15,38 @@ DecoderLayer* decoder_layer_create(int num_heads, int model_dim,
     layer->norm1 = layer_norm_create(model_dim, 1e-5);
     layer->norm2 = layer_norm_create(model_dim, 1e-5);
     layer->norm3 = layer_norm_create(model_dim, 1e-5);
-    layer->ff = feed_forward_create(model_dim, ff_dim);
+    layer->ff = NULL;
+    layer->moe = NULL;
+    if (config->num_experts > 0) {
+        layer->moe = moe_feed_forward_create(model_dim, ff_dim,
+                                             config->num_experts,
+                                             config->moe_top_k,
+                                             config->moe_capacity_factor,
+                                             config->ffn_activation,
+                                             config->ffn_gated);
+    } else {
+        layer->ff = feed_forward_create_with_activation(model_dim, ff_dim,
+                                                       config->ffn_activation,
+                                                       config->ffn_gated);
+    }
     layer->dropout_prob = dropout_prob;
+    layer->is_training = config->is_training;
+    layer->dropout_rng = dropout_rng_init(0, 0);
 
     return layer;
 }
 
+// 第site处dropout的key, 记录在层上供反向传播使用
+// 推理时不做dropout, 也不写层上的任何状态, 多个线程可以同时用同一个模型做前向
+static DropoutKey decoder_dropout_key(DecoderLayer* layer, int site, const Tensor* tensor, float prob) {
+    if (prob <= 0.0f) {
+        return (DropoutKey){0};
+    }
+    size_t n = calculate_total_size(tensor->shape, tensor->num_dims);
+    layer->dropout_keys[site] = dropout_rng_next(&layer->dropout_rng, n);
+    return layer->dropout_keys[site];
+}
+
 void decoder_layer_free(DecoderLayer* layer) {
     if (layer) {
         multihead_attention_free(layer->self_attn);
@@ -28,6 +55,7 @@ void decoder_layer_free(DecoderLayer* layer) {
         layer_norm_free(layer->norm2);
         layer_norm_free(layer->norm3);
         feed_forward_free(layer->ff);
+        moe_feed_forward_free(layer->moe);
         free(layer);
     }
 }
@@ -35,21 +63,27 @@ void decoder_layer_free(DecoderLayer* layer) {
 bool decoder_layer_forward(DecoderLayer* layer, Tensor* input, 
                          Tensor* encoder_output, Tensor* output,
                          AttentionMask* self_mask, AttentionMask* cross_mask) {
+    // 逐层原地计算时 (input == output) 注意力输出会覆盖输入, 先保存一份作为残差
+    Tensor* residual = input;
+    if (input == output) {
+        residual = tensor_create(input->shape, input->num_dims);
+        if (!residual) return false;
+        tensor_copy(residual, input);
+    }
+
     // 1. 自注意力子层
     if (!multihead_attention_forward(layer->self_attn, input, output, self_mask)) {
+        if (residual != input) tensor_free(residual);
         return false;
     }
     
-    // Dropout
-    if (!dropout_forward(output, output, layer->dropout_prob)) {
-        return false;
-    }
-    
-    // 残差连接和层归一化
-    if (!tensor_add(output, input, output)) {  // 残差连接
-        return false;
-    }
-    if (!layer_norm_forward(layer->norm1, output, output)) {
+    // Dropout + 残差连接 + 层归一化
+    const float prob = layer->is_training ? layer->dropout_prob : 0.0f;
+    const DropoutKey key0 = decoder_dropout_key(layer, 0, output, prob);
+    const bool norm_ok = layer_norm_residual_dropout_forward(layer->norm1, output, residual, output,
+                                                             prob, key0);
+    if (residual != input) tensor_free(residual);
+    if (!norm_ok) {
         return false;
     }
     
@@ -63,16 +97,10 @@ bool decoder_layer_forward(DecoderLayer* layer, Tensor* input,
         return false;
     }
     
-    if (!dropout_forward(temp, temp, layer->dropout_prob)) {
-        tensor_free(temp);
-        return false;
-    }
-    
-    if (!tensor_add(output, temp, temp)) {  // 残差连接
-        tensor_free(temp);
-        return false;
-    }
-    if (!layer_norm_forward(layer->norm2, temp, temp)) {
+    // Dropout + 残差连接 + 层归一化
+    const DropoutKey key1 = decoder_dropout_key(layer, 1, temp, prob);
+    if (!layer_norm_residual_dropout_forward(layer->norm2, temp, output, temp,
+                                             prob, key1)) {
         tensor_free(temp);
         return false;
     }
@@ -81,21 +109,17 @@ bool decoder_layer_forward(DecoderLayer* layer, Tensor* input,
     // 3. 前馈网络子层
 
     tensor_copy(output, temp);
-    if (!feed_forward_forward(layer->ff, output, output)) {
-        tensor_free(temp);
-        return false;
-    }
-    
-    if (!dropout_forward(output, output, layer->dropout_prob)) {
+    bool ff_ok = layer->moe ? moe_feed_forward_forward(layer->moe, output, output)
+                            : feed_forward_forward(layer->ff, output, output);
+    if (!ff_ok) {
         tensor_free(temp);
         return false;
     }
     
-    if (!tensor_add(output, temp, output)) {  // 残差连接
-        tensor_free(temp);
-        return false;
-    }
-    if (!layer_norm_forward(layer->norm3, output, output)) {
+    // Dropout + 残差连接 + 层归一化
+    const DropoutKey key2 = decoder_dropout_key(layer, 2, output, prob);
+    if (!layer_norm_residual_dropout_forward(layer->norm3, output, temp, output,
+                                             prob, key2)) {
         tensor_free(temp);
         return false;
     }
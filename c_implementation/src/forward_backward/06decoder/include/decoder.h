@@ -8,10 +8,12 @@ typedef struct Decoder {
     int num_layers;           // 解码器层数量
     DecoderLayer** layers;    // 解码器层数组
     Linear* output_linear;    // 输出线性层
+    RotaryEmbedding* rope;    // 旋转位置编码, 各层自注意力共享; 使用正弦位置编码时为NULL
 } Decoder;
 
-// 创建解码器
+// 创建解码器, 注意力模式/引擎、位置编码、前馈类型和随机数种子都取自config, 不读全局配置
 Decoder* decoder_create(
+    const ModelConfig* config,
     int num_layers,
     int num_heads,
     int model_dim,
@@ -29,6 +31,9 @@ bool decoder_forward(
     AttentionMask* cross_mask  // 交叉注意力掩码
 );
 
+// 切换训练/推理模式; 推理模式下前向不做dropout, 也不修改层上的状态
+void decoder_set_training(Decoder* decoder, bool is_training);
+
 // 释放资源
 void decoder_free(Decoder* decoder);
 
@@ -4,6 +4,7 @@
 #include "tensor_type.h"
 #include "multiattention.h"
 #include "feed_forward.h"
+#include "moe_feed_forward.h"
 #include "layer_norm.h"
 
 typedef struct DecoderLayer {
@@ -12,12 +13,17 @@ typedef struct DecoderLayer {
     LayerNorm* norm1;                 // 第一个层归一化
     LayerNorm* norm2;                 // 第二个层归一化
     LayerNorm* norm3;                 // 第三个层归一化
-    FeedForward* ff;                  // 前馈网络
+    FeedForward* ff;                  // 前馈网络, 使用专家混合时为NULL
+    MoEFeedForward* moe;              // 专家混合前馈, 未启用为NULL
     float dropout_prob;                // dropout概率
+    bool is_training;                  // 训练模式才做dropout, 由所属模型设置
+    DropoutRng dropout_rng;            // 本层dropout的Philox生成器, 由decoder按层设置stream
+    DropoutKey dropout_keys[3];        // 最近一次训练前向三处dropout使用的key, 反向传播据此重新生成掩码
 } DecoderLayer;
 
-// 创建解码器层
+// 创建解码器层, 前馈类型 (普通/门控/专家混合) 和训练模式取自config
 DecoderLayer* decoder_layer_create(
+    const ModelConfig* config,
     int num_heads,
     int model_dim,
     int ff_dim,
@@ -5,6 +5,9 @@
 #include "decoder.h"
 #include "tensor_type.h"
 #include "attention_mask.h"
+#include "model_config.h"
+#include "numa_placement.h"
+#include "huge_page_arena.h"
 
 typedef struct Transformer {
     Encoder* encoder;
@@ -14,9 +17,17 @@ typedef struct Transformer {
     int num_layers;
     int ff_dim;
     float dropout_prob;
+    ModelConfig config;   // 创建时的配置副本, 模型只读这一份, 不再依赖g_model_config
+    NumaPolicy weight_placement;  // transformer_place_weights 设置的权重放置方式
+    HugePageArena* weight_arena;  // transformer_use_huge_pages 之后权重矩阵所在的大页内存区
 } Transformer;
 
-// 创建transformer
+// 按给定配置创建transformer, 维度/头数/dropout取自config的d_model, num_heads, ff_dim, dropout_prob
+// config被复制, 调用返回后可以修改或释放; 不同配置的多个模型可以在同一进程中共存,
+// 推理模式下多个线程可以同时对同一个模型调用transformer_forward (各自传入自己的输入/输出张量)
+Transformer* transformer_create_from_config(const ModelConfig* config, int num_layers);
+
+// 创建transformer, 其余配置取自当前的g_model_config
 Transformer* transformer_create(
     int num_layers,
     int num_heads,
@@ -36,6 +47,25 @@ bool transformer_forward(
     AttentionMask* cross_mask  // decoder的交叉注意力掩码
 );
 
+// 按NUMA策略放置已加载好的权重矩阵, 在权重加载完成、开始推理之前调用
+// NUMA_POLICY_REPLICATE: 注意力投影 (增量解码中由GEMM读取) 和前馈/专家/路由矩阵在每个节点复制一份,
+// 其余矩阵 (输出线性层) 交错放置
+// NUMA_POLICY_INTERLEAVE: 所有矩阵交错放置; 偏置和层归一化参数很小, 保持原样
+// 复制后再修改权重 (如继续训练) 不会同步到副本; transformer_free 时自动撤销
+bool transformer_place_weights(Transformer* transformer, NumaPolicy policy);
+
+// 把权重矩阵搬到一块大页内存区中 (mode见huge_page_arena.h, 通常取 huge_page_mode_from_env()),
+// 在权重加载完成后调用; 已经放置过NUMA的权重会按原策略重新放置. 偏置和层归一化参数很小, 不搬
+// 大页不可用时退回普通页, 只有映射失败才返回false; 实际覆盖率用 huge_arena_print_report 查看
+bool transformer_use_huge_pages(Transformer* transformer, HugePageMode mode);
+
+// 随机初始化所有权重矩阵: 均匀分布, 方差为1/fan_in (fan_in为矩阵的行数), 偏置和层归一化参数不变
+// 还没有权重加载时供服务和测量使用; 在transformer_place_weights / transformer_use_huge_pages之前调用
+void transformer_init_random(Transformer* transformer, uint64_t seed);
+
+// 切换训练/推理模式, 训练时不要与其他线程的前向同时调用
+void transformer_set_training(Transformer* transformer, bool is_training);
+
 // 释放资源
 void transformer_free(Transformer* transformer);
 
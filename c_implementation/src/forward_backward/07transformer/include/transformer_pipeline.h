@@ -0,0 +1,91 @@
+#ifndef TRANSFORMER_PIPELINE_H
+#define TRANSFORMER_PIPELINE_H
+
+#include "transformer.h"
+#include "spsc_queue.h"
+#include "thread_pool.h"
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdio.h>
+
+// 按层流水线并行的批量推理
+// 编码器层、解码器层和输出线性层按顺序切成若干阶段, 每个阶段有自己的线程和独立线程池,
+// 绑定到不相交的CPU组; 微批次通过单生产者/单消费者队列从一个阶段流到下一个阶段.
+// 同一时刻不同的微批次在不同的层上计算, 每个阶段只反复读取自己那几层的权重, 缓存命中率更高
+//
+// 只用于推理: 各阶段同时对不同的微批次调用层的前向, 依赖推理模式下前向可重入
+// 提交和取回结果各自只能由一个线程调用 (可以是同一个线程)
+
+typedef struct PipelineBatch {
+    Tensor* encoder_input;      // [batch_size, enc_seq_len, model_dim]
+    Tensor* decoder_input;      // [batch_size, dec_seq_len, model_dim]
+    Tensor* output;             // [batch_size, dec_seq_len, model_dim]
+    AttentionMask* enc_mask;
+    AttentionMask* dec_mask;
+    AttentionMask* cross_mask;
+    void* user_data;            // 调用方自用
+    bool ok;                    // 取回后有效, 任何一层失败为false
+
+    Tensor* encoder_output;     // 流水线内部使用, 在最后一个阶段释放
+} PipelineBatch;
+
+typedef struct TransformerPipeline TransformerPipeline;
+
+typedef struct PipelineStage {
+    TransformerPipeline* pipeline;
+    int index;
+    int first_unit;             // 负责的层 [first_unit, end_unit): 先是编码器各层, 再是解码器各层
+    int end_unit;
+    int* cpus;                  // 绑定的CPU组, 没有绑定时为NULL
+    int num_threads;
+    ThreadPool* pool;
+    SpscQueue* input;
+    SpscQueue* output;
+    pthread_t thread;
+    bool started;
+
+    _Atomic uint64_t batches;   // 处理的微批次数
+    _Atomic uint64_t busy_ns;   // 计算耗时
+} PipelineStage;
+
+struct TransformerPipeline {
+    Transformer* transformer;
+    int num_stages;
+    int num_units;              // 编码器层数 + 解码器层数
+    PipelineStage* stages;
+    SpscQueue** queues;         // [num_stages + 1], 第0个是提交队列, 最后一个是完成队列
+    PipelineBatch stop;         // 停止标记, 依次流过所有阶段
+    atomic_int in_flight;       // 已提交还没取回的微批次数
+    bool pinned;
+};
+
+// 创建num_stages个阶段, 每个阶段threads_per_stage个线程 (<= 0 时平分在线CPU)
+// 各层按计算量 (编码器层2份, 解码器层3份) 连续地分到各阶段;
+// CPU足够时每个阶段绑定到一组连续的CPU (按NUMA节点排列), 不够时不绑定
+TransformerPipeline* transformer_pipeline_create(Transformer* transformer, int num_stages,
+                                                 int threads_per_stage);
+
+// 提交一个微批次, 第一个阶段的队列满时阻塞; 张量在取回之前必须保持有效
+bool transformer_pipeline_submit(TransformerPipeline* pipeline, PipelineBatch* batch);
+
+// 按提交顺序取回下一个完成的微批次, 没有在途的微批次时返回NULL
+PipelineBatch* transformer_pipeline_next(TransformerPipeline* pipeline);
+
+// 提交并等待全部完成, 边提交边取回, 所以batches可以多于队列容量; 全部成功时返回true
+bool transformer_pipeline_run(TransformerPipeline* pipeline, PipelineBatch** batches, int num_batches);
+
+// 与 transformer_forward 相同的接口, 把batch维切成micro_batch_size大小的微批次流过流水线
+// 掩码可以是 [q, k] (所有样本共享) 或者以batch维开头
+bool transformer_pipeline_forward(TransformerPipeline* pipeline,
+                                  Tensor* encoder_input, Tensor* decoder_input, Tensor* output,
+                                  AttentionMask* enc_mask, AttentionMask* dec_mask,
+                                  AttentionMask* cross_mask, int micro_batch_size);
+
+// 打印各阶段负责的层、CPU组和忙碌时间, 用于发现最慢的阶段
+void transformer_pipeline_print_report(TransformerPipeline* pipeline, FILE* stream);
+
+// 停止各阶段并回收线程; 还没取回的微批次被丢弃
+void transformer_pipeline_free(TransformerPipeline* pipeline);
+
+#endif // TRANSFORMER_PIPELINE_H
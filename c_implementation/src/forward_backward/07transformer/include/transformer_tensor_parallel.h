@@ -0,0 +1,70 @@
+#ifndef TRANSFORMER_TENSOR_PARALLEL_H
+#define TRANSFORMER_TENSOR_PARALLEL_H
+
+#include "transformer.h"
+#include "shm_collective.h"
+#include "thread_pool.h"
+#include <stdio.h>
+
+// 单机多进程张量并行推理
+// 每个编码器/解码器层的注意力按头、前馈按隐藏层列切成num_ranks份, 每个进程只保存并计算自己那一份:
+//   注意力: W_q/W_k/W_v取对应头的列, W_o取对应的行; 前馈: W1 (和门控的W_up) 取列, W2取行
+//   输出偏置 b_o/b2 只在rank 0上加, 其余进程为0
+// 每个子层得到 [tokens, model_dim] 的部分和, 经共享内存all-reduce相加后, 各进程各自做残差和层归一化
+// (都是逐token的小计算, 复制计算比再通信一次更便宜); 编码器层两次、解码器层三次all-reduce
+//
+// 进程: 调用方是rank 0, 其余num_ranks - 1个工作进程在创建时fork出来, 继承已加载的模型;
+// 每个进程有自己的线程池, CPU足够时按NUMA顺序绑定到不相交的CPU组.
+// 工作进程在命令上休眠, rank 0把输入和掩码写进共享内存后唤醒它们, 所有进程一起执行一次前向
+//
+// 只用于推理, 不支持专家混合前馈; 创建之后修改模型权重不会同步到各进程的分片
+// 同一时刻只能有一个线程调用 transformer_tensor_parallel_forward
+
+// 工作进程的命令
+typedef enum TensorParallelCommand {
+    TP_COMMAND_FORWARD = 1,
+    TP_COMMAND_EXIT = 2
+} TensorParallelCommand;
+
+// 一个层在本进程上的分片
+typedef struct TensorParallelShard {
+    MultiHeadAttention* self_attn;
+    MultiHeadAttention* cross_attn;   // 编码器层为NULL
+    FeedForward* ff;
+} TensorParallelShard;
+
+typedef struct TensorParallel {
+    Transformer* transformer;
+    ShmGroup* group;
+    int num_ranks;
+    int num_threads;                  // 每个进程的线程数
+    int max_batch;                    // 共享内存按这两个上限分配
+    int max_seq_len;
+    size_t mask_capacity;             // 每个掩码最多的元素数
+    TensorParallelShard* encoder_shards;
+    TensorParallelShard* decoder_shards;
+    ThreadPool* pool;                 // 本进程的线程池
+    int* cpus;                        // 本进程绑定的CPU组, 没有绑定时为NULL
+    bool pinned;
+    bool broken;                      // 有进程失败后组已中止, 不能再用
+} TensorParallel;
+
+// 把模型切成num_ranks份并fork出工作进程; 要求num_heads和ff_dim能被num_ranks整除
+// threads_per_rank <= 0 时平分在线CPU; 输入的batch和序列长度不能超过max_batch/max_seq_len
+TensorParallel* transformer_tensor_parallel_create(Transformer* transformer, int num_ranks,
+                                                   int threads_per_rank, int max_batch, int max_seq_len);
+
+// 与 transformer_forward 相同的接口, 结果在浮点误差内一致 (求和顺序不同)
+// 掩码可以是 [q, k]、[b, q, k] 或head维为1的 [b, 1, q, k]; 任何一个进程失败时返回false, 之后的调用都返回false
+bool transformer_tensor_parallel_forward(TensorParallel* tp,
+                                         Tensor* encoder_input, Tensor* decoder_input, Tensor* output,
+                                         AttentionMask* enc_mask, AttentionMask* dec_mask,
+                                         AttentionMask* cross_mask);
+
+// 打印进程数、每个进程的分片大小和CPU组
+void transformer_tensor_parallel_print_report(const TensorParallel* tp, FILE* stream);
+
+// 通知工作进程退出并回收, 释放本进程的分片
+void transformer_tensor_parallel_free(TensorParallel* tp);
+
+#endif // TRANSFORMER_TENSOR_PARALLEL_H
@@ -1,29 +1,45 @@
 #include "transformer.h"
+#include <math.h>
+#include <stdio.h>
 #include <stdlib.h>
 
-Transformer* transformer_create(int num_layers, int num_heads, int model_dim,
-                              int ff_dim, float dropout_prob) {
+Transformer* transformer_create_from_config(const ModelConfig* config, int num_layers) {
+    if (!config || num_layers <= 0 || config->num_heads <= 0 ||
+        config->d_model % config->num_heads != 0) {
+        fprintf(stderr, "Invalid transformer config: %d layers, d_model %d, %d heads\n",
+                num_layers, config ? config->d_model : 0, config ? config->num_heads : 0);
+        return NULL;
+    }
+
     Transformer* transformer = (Transformer*)malloc(sizeof(Transformer));
     if (!transformer) return NULL;
     
     // 保存配置
-    transformer->model_dim = model_dim;
-    transformer->num_heads = num_heads;
+    transformer->config = *config;
+    transformer->model_dim = config->d_model;
+    transformer->num_heads = config->num_heads;
     transformer->num_layers = num_layers;
-    transformer->ff_dim = ff_dim;
-    transformer->dropout_prob = dropout_prob;
+    transformer->ff_dim = config->ff_dim;
+    transformer->dropout_prob = config->dropout_prob;
+    transformer->encoder = NULL;
+    transformer->decoder = NULL;
+    transformer->weight_placement = NUMA_POLICY_NONE;
+    transformer->weight_arena = NULL;
     
-    // 创建编码器
-    transformer->encoder = encoder_create(num_layers, num_heads, model_dim,
-                                       ff_dim, dropout_prob);
+    // 创建编码器, 各层只看模型自己的配置副本
+    const ModelConfig* model_config = &transformer->config;
+    transformer->encoder = encoder_create(model_config, num_layers, model_config->num_heads,
+                                          model_config->d_model, model_config->ff_dim,
+                                          model_config->dropout_prob);
     if (!transformer->encoder) {
         transformer_free(transformer);
         return NULL;
     }
     
     // 创建解码器
-    transformer->decoder = decoder_create(num_layers, num_heads, model_dim,
-                                       ff_dim, dropout_prob);
+    transformer->decoder = decoder_create(model_config, num_layers, model_config->num_heads,
+                                          model_config->d_model, model_config->ff_dim,
+                                          model_config->dropout_prob);
     if (!transformer->decoder) {
         transformer_free(transformer);
         return NULL;
@@ -32,6 +48,22 @@ Transformer* transformer_create(int num_layers, int num_heads, int model_dim,
     return transformer;
 }
 
+Transformer* transformer_create(int num_layers, int num_heads, int model_dim,
+                              int ff_dim, float dropout_prob) {
+    ModelConfig config = g_model_config;
+    config.num_heads = num_heads;
+    config.d_model = model_dim;
+    config.ff_dim = ff_dim;
+    config.dropout_prob = dropout_prob;
+    return transformer_create_from_config(&config, num_layers);
+}
+
+void transformer_set_training(Transformer* transformer, bool is_training) {
+    transformer->config.is_training = is_training;
+    encoder_set_training(transformer->encoder, is_training);
+    decoder_set_training(transformer->decoder, is_training);
+}
+
 bool transformer_forward(Transformer* transformer,
                        Tensor* encoder_input, Tensor* decoder_input,
                        Tensor* output,
@@ -62,10 +94,168 @@ bool transformer_forward(Transformer* transformer,
     return true;
 }
 
+// 对模型中的每个权重矩阵调用fn, gemm_operand表示该矩阵作为GEMM的B操作数读取
+typedef void (*TransformerWeightFn)(Tensor* weight, bool gemm_operand, void* ctx);
+
+// 增量解码的投影用gemm_bias_act读取注意力矩阵, 按节点选择副本
+static void attention_weights(MultiHeadAttention* mha, TransformerWeightFn fn, void* ctx) {
+    if (!mha) return;
+    fn(mha->W_q, true, ctx);
+    fn(mha->W_k, true, ctx);
+    fn(mha->W_v, true, ctx);
+    fn(mha->W_o, true, ctx);
+}
+
+static void feed_forward_weights(FeedForward* ff, TransformerWeightFn fn, void* ctx) {
+    if (!ff) return;
+    fn(ff->w1, true, ctx);
+    fn(ff->w2, true, ctx);
+    fn(ff->w_up, true, ctx);
+}
+
+static void moe_weights(MoEFeedForward* moe, TransformerWeightFn fn, void* ctx) {
+    if (!moe) return;
+    fn(moe->router_weight, true, ctx);
+    for (int e = 0; e < moe->num_experts; e++) {
+        feed_forward_weights(moe->experts[e], fn, ctx);
+    }
+}
+
+static void transformer_for_each_weight(Transformer* transformer, TransformerWeightFn fn, void* ctx) {
+    for (int i = 0; transformer->encoder && i < transformer->encoder->num_layers; i++) {
+        EncoderLayer* layer = transformer->encoder->layers[i];
+        if (!layer) continue;
+        attention_weights(layer->self_attn, fn, ctx);
+        feed_forward_weights(layer->ff, fn, ctx);
+        moe_weights(layer->moe, fn, ctx);
+    }
+    for (int i = 0; transformer->decoder && i < transformer->decoder->num_layers; i++) {
+        DecoderLayer* layer = transformer->decoder->layers[i];
+        if (!layer) continue;
+        attention_weights(layer->self_attn, fn, ctx);
+        attention_weights(layer->cross_attn, fn, ctx);
+        feed_forward_weights(layer->ff, fn, ctx);
+        moe_weights(layer->moe, fn, ctx);
+    }
+    if (transformer->decoder && transformer->decoder->output_linear) {
+        fn(transformer->decoder->output_linear->weight, false, ctx);
+    }
+}
+
+static void init_weight_random(Tensor* weight, bool gemm_operand, void* ctx) {
+    (void)gemm_operand;
+    if (!weight || !weight->data) return;
+    uint64_t* state = (uint64_t*)ctx;
+    const float amplitude = sqrtf(3.0f / (float)weight->shape[0]);
+    const size_t total = calculate_total_size(weight->shape, weight->num_dims);
+    for (size_t i = 0; i < total; i++) {
+        // 64位LCG, 取高24位
+        *state = *state * 6364136223846793005ULL + 1442695040888963407ULL;
+        const float u = (float)(*state >> 40) * (1.0f / 16777216.0f);
+        weight->data[i] = amplitude * (2.0f * u - 1.0f);
+    }
+}
+
+void transformer_init_random(Transformer* transformer, uint64_t seed) {
+    if (!transformer) return;
+    uint64_t state = seed;
+    transformer_for_each_weight(transformer, init_weight_random, &state);
+}
+
+typedef struct WeightPlacement {
+    NumaPolicy policy;
+    bool ok;
+} WeightPlacement;
+
+static void place_weight(Tensor* weight, bool gemm_operand, void* ctx) {
+    WeightPlacement* placement = (WeightPlacement*)ctx;
+    if (!weight || !weight->data) return;
+    // 只有GEMM会按节点选择副本, 其他内核读取的矩阵复制了也用不上
+    NumaPolicy policy = placement->policy;
+    if (policy == NUMA_POLICY_REPLICATE && !gemm_operand) {
+        policy = NUMA_POLICY_INTERLEAVE;
+    }
+    if (!numa_place_weights(weight->data, calculate_total_size(weight->shape, weight->num_dims), policy)) {
+        placement->ok = false;
+    }
+}
+
+static void forget_weight(Tensor* weight, bool gemm_operand, void* ctx) {
+    (void)gemm_operand;
+    (void)ctx;
+    if (weight && weight->data) {
+        numa_forget_weights(weight->data);
+    }
+}
+
+bool transformer_place_weights(Transformer* transformer, NumaPolicy policy) {
+    if (!transformer) return false;
+    transformer_for_each_weight(transformer, forget_weight, NULL);
+    transformer->weight_placement = policy;
+    if (policy == NUMA_POLICY_NONE) return true;
+
+    WeightPlacement placement = {policy, true};
+    transformer_for_each_weight(transformer, place_weight, &placement);
+    return placement.ok;
+}
+
+static void count_weight_bytes(Tensor* weight, bool gemm_operand, void* ctx) {
+    (void)gemm_operand;
+    if (weight && weight->data) {
+        const size_t bytes = calculate_total_size(weight->shape, weight->num_dims) * sizeof(float);
+        *(size_t*)ctx += (bytes + HUGE_ARENA_ALIGNMENT - 1) / HUGE_ARENA_ALIGNMENT * HUGE_ARENA_ALIGNMENT;
+    }
+}
+
+typedef struct WeightAdoption {
+    HugePageArena* arena;
+    bool ok;
+} WeightAdoption;
+
+static void adopt_weight(Tensor* weight, bool gemm_operand, void* ctx) {
+    (void)gemm_operand;
+    WeightAdoption* adoption = (WeightAdoption*)ctx;
+    if (weight && weight->data && !huge_arena_adopt_tensor(adoption->arena, weight)) {
+        adoption->ok = false;
+    }
+}
+
+bool transformer_use_huge_pages(Transformer* transformer, HugePageMode mode) {
+    if (!transformer) return false;
+    if (transformer->weight_arena) return true;
+
+    // 一次映射放下所有矩阵
+    size_t bytes = 0;
+    transformer_for_each_weight(transformer, count_weight_bytes, &bytes);
+    HugePageArena* arena = huge_arena_create("weights", bytes, mode);
+    if (!arena) return false;
+
+    // NUMA登记按旧地址, 先撤销, 搬完后重新放置
+    const NumaPolicy placement = transformer->weight_placement;
+    if (placement != NUMA_POLICY_NONE) {
+        transformer_for_each_weight(transformer, forget_weight, NULL);
+    }
+    WeightAdoption adoption = {arena, true};
+    transformer_for_each_weight(transformer, adopt_weight, &adoption);
+    // 部分矩阵失败时已经搬过去的仍在内存区中, 内存区随模型一起释放
+    transformer->weight_arena = arena;
+    if (!adoption.ok) {
+        fprintf(stderr, "Failed to move transformer weights to huge pages\n");
+    }
+    if (placement != NUMA_POLICY_NONE && !transformer_place_weights(transformer, placement)) {
+        return false;
+    }
+    return adoption.ok;
+}
+
 void transformer_free(Transformer* transformer) {
     if (transformer) {
+        if (transformer->weight_placement != NUMA_POLICY_NONE) {
+            transformer_for_each_weight(transformer, forget_weight, NULL);
+        }
         encoder_free(transformer->encoder);
         decoder_free(transformer->decoder);
+        huge_arena_free(transformer->weight_arena);
         free(transformer);
     }
 }
\ No newline at end of file
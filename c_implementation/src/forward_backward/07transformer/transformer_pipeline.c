@@ -0,0 +1,358 @@
+#include "transformer_pipeline.h"
+#include "numa_placement.h"
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+// 相邻阶段之间最多排队的微批次数; 两个就能让上游算下一个时下游不空等, 再多只增加在途内存
+#define PIPELINE_QUEUE_DEPTH 2
+
+// 各层的相对计算量: 编码器层 = 自注意力 + 前馈, 解码器层再多一个交叉注意力
+#define PIPELINE_ENCODER_LAYER_COST 2
+#define PIPELINE_DECODER_LAYER_COST 3
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+static int unit_cost(const TransformerPipeline* pipeline, int unit) {
+    return unit < pipeline->transformer->encoder->num_layers ? PIPELINE_ENCODER_LAYER_COST
+                                                             : PIPELINE_DECODER_LAYER_COST;
+}
+
+// 第unit层: 编码器层原地累积在encoder_output中, 解码器层原地累积在output中, 最后接输出线性层
+static bool run_unit(TransformerPipeline* pipeline, PipelineBatch* batch, int unit) {
+    Encoder* encoder = pipeline->transformer->encoder;
+    Decoder* decoder = pipeline->transformer->decoder;
+
+    if (unit < encoder->num_layers) {
+        if (unit == 0) {
+            batch->encoder_output = tensor_create(batch->encoder_input->shape, batch->encoder_input->num_dims);
+            if (!batch->encoder_output) return false;
+        }
+        Tensor* input = unit == 0 ? batch->encoder_input : batch->encoder_output;
+        return encoder_layer_forward(encoder->layers[unit], input, batch->encoder_output, batch->enc_mask);
+    }
+
+    const int layer = unit - encoder->num_layers;
+    Tensor* input = layer == 0 ? batch->decoder_input : batch->output;
+    if (!decoder_layer_forward(decoder->layers[layer], input, batch->encoder_output,
+                               batch->output, batch->dec_mask, batch->cross_mask)) {
+        return false;
+    }
+    if (layer == decoder->num_layers - 1) {
+        return linear_forward(decoder->output_linear, batch->output, batch->output);
+    }
+    return true;
+}
+
+static void* stage_main(void* arg) {
+    PipelineStage* stage = (PipelineStage*)arg;
+    TransformerPipeline* pipeline = stage->pipeline;
+    const bool last = stage->index == pipeline->num_stages - 1;
+
+    if (stage->cpus && numa_pin_thread_to_cpu(stage->cpus[0]) < 0) {
+        fprintf(stderr, "Failed to pin pipeline stage %d to cpu %d\n", stage->index, stage->cpus[0]);
+    }
+    // 阶段内各层的并行内核只使用本阶段的线程
+    thread_pool_attach(stage->pool);
+
+    for (;;) {
+        PipelineBatch* batch = (PipelineBatch*)spsc_queue_pop_wait(stage->input);
+        if (batch != &pipeline->stop) {
+            const uint64_t start = now_ns();
+            for (int unit = stage->first_unit; unit < stage->end_unit && batch->ok; unit++) {
+                batch->ok = run_unit(pipeline, batch, unit);
+            }
+            if (last) {
+                tensor_free(batch->encoder_output);
+                batch->encoder_output = NULL;
+            }
+            atomic_fetch_add_explicit(&stage->busy_ns, now_ns() - start, memory_order_relaxed);
+            atomic_fetch_add_explicit(&stage->batches, 1, memory_order_relaxed);
+        }
+        spsc_queue_push_wait(stage->output, batch);
+        if (batch == &pipeline->stop) break;
+    }
+    thread_pool_attach(NULL);
+    return NULL;
+}
+
+// 第s个阶段的结束位置: 累计计算量第一次达到总量的 (s+1)/S, 并保证每个阶段至少一层
+static void partition_units(TransformerPipeline* pipeline) {
+    int total = 0;
+    for (int u = 0; u < pipeline->num_units; u++) total += unit_cost(pipeline, u);
+
+    int unit = 0;
+    int prefix = 0;
+    for (int s = 0; s < pipeline->num_stages; s++) {
+        PipelineStage* stage = &pipeline->stages[s];
+        stage->first_unit = unit;
+        const int target = (int)(((long)total * (s + 1) + pipeline->num_stages / 2) / pipeline->num_stages);
+        const int last_allowed = pipeline->num_units - (pipeline->num_stages - 1 - s);
+        do {
+            prefix += unit_cost(pipeline, unit);
+            unit++;
+        } while (unit < last_allowed && prefix + unit_cost(pipeline, unit) / 2 < target);
+        if (s == pipeline->num_stages - 1) unit = pipeline->num_units;
+        stage->end_unit = unit;
+    }
+}
+
+TransformerPipeline* transformer_pipeline_create(Transformer* transformer, int num_stages,
+                                                 int threads_per_stage) {
+    if (!transformer || !transformer->encoder || !transformer->decoder || num_stages <= 0) {
+        return NULL;
+    }
+    if (transformer->config.is_training) {
+        fprintf(stderr, "Pipeline inference requires the transformer in inference mode\n");
+        return NULL;
+    }
+
+    TransformerPipeline* pipeline = (TransformerPipeline*)calloc(1, sizeof(TransformerPipeline));
+    if (!pipeline) return NULL;
+    pipeline->transformer = transformer;
+    pipeline->num_units = transformer->encoder->num_layers + transformer->decoder->num_layers;
+    pipeline->num_stages = num_stages < pipeline->num_units ? num_stages : pipeline->num_units;
+    atomic_init(&pipeline->in_flight, 0);
+    pipeline->stages = (PipelineStage*)calloc(pipeline->num_stages, sizeof(PipelineStage));
+    pipeline->queues = (SpscQueue**)calloc(pipeline->num_stages + 1, sizeof(SpscQueue*));
+    if (!pipeline->stages || !pipeline->queues) goto fail;
+    for (int q = 0; q <= pipeline->num_stages; q++) {
+        pipeline->queues[q] = spsc_queue_create(PIPELINE_QUEUE_DEPTH);
+        if (!pipeline->queues[q]) goto fail;
+    }
+    partition_units(pipeline);
+
+    // 按NUMA节点排列的CPU依次分组, 相邻阶段尽量在同一节点上
+    const NumaTopology* topo = numa_topology();
+    if (threads_per_stage <= 0) {
+        threads_per_stage = topo->num_cpus / pipeline->num_stages;
+        if (threads_per_stage < 1) threads_per_stage = 1;
+    }
+    pipeline->pinned = topo->num_cpus >= pipeline->num_stages * threads_per_stage;
+    if (!pipeline->pinned) {
+        fprintf(stderr, "Pipeline needs %d cpus for %d stages x %d threads, only %d online; not pinning\n",
+                pipeline->num_stages * threads_per_stage, pipeline->num_stages, threads_per_stage,
+                topo->num_cpus);
+    }
+
+    for (int s = 0; s < pipeline->num_stages; s++) {
+        PipelineStage* stage = &pipeline->stages[s];
+        stage->pipeline = pipeline;
+        stage->index = s;
+        stage->num_threads = threads_per_stage;
+        stage->input = pipeline->queues[s];
+        stage->output = pipeline->queues[s + 1];
+        atomic_init(&stage->batches, 0);
+        atomic_init(&stage->busy_ns, 0);
+        if (pipeline->pinned) {
+            stage->cpus = (int*)malloc(threads_per_stage * sizeof(int));
+            if (!stage->cpus) goto fail;
+            memcpy(stage->cpus, topo->cpus + s * threads_per_stage, threads_per_stage * sizeof(int));
+        }
+        stage->pool = thread_pool_create(threads_per_stage, stage->cpus, stage->cpus ? threads_per_stage : 0);
+        if (!stage->pool) goto fail;
+        if (pthread_create(&stage->thread, NULL, stage_main, stage) != 0) {
+            fprintf(stderr, "Failed to start pipeline stage %d\n", s);
+            goto fail;
+        }
+        stage->started = true;
+    }
+    return pipeline;
+
+fail:
+    transformer_pipeline_free(pipeline);
+    return NULL;
+}
+
+bool transformer_pipeline_submit(TransformerPipeline* pipeline, PipelineBatch* batch) {
+    if (!pipeline || !batch || !batch->encoder_input || !batch->decoder_input || !batch->output) {
+        return false;
+    }
+    batch->ok = true;
+    batch->encoder_output = NULL;
+    atomic_fetch_add(&pipeline->in_flight, 1);
+    spsc_queue_push_wait(pipeline->queues[0], batch);
+    return true;
+}
+
+PipelineBatch* transformer_pipeline_next(TransformerPipeline* pipeline) {
+    if (!pipeline || atomic_load(&pipeline->in_flight) == 0) return NULL;
+    PipelineBatch* batch = (PipelineBatch*)spsc_queue_pop_wait(pipeline->queues[pipeline->num_stages]);
+    atomic_fetch_sub(&pipeline->in_flight, 1);
+    return batch;
+}
+
+bool transformer_pipeline_run(TransformerPipeline* pipeline, PipelineBatch** batches, int num_batches) {
+    if (!pipeline || (!batches && num_batches > 0)) return false;
+    bool ok = true;
+    int submitted = 0;
+    int done = 0;
+    while (done < num_batches) {
+        // 能提交就先提交; 提交队列满时取回一个, 流水线一定有在途的微批次
+        if (submitted < num_batches) {
+            PipelineBatch* batch = batches[submitted];
+            batch->ok = true;
+            batch->encoder_output = NULL;
+            if (spsc_queue_push(pipeline->queues[0], batch)) {
+                atomic_fetch_add(&pipeline->in_flight, 1);
+                submitted++;
+                continue;
+            }
+        }
+        PipelineBatch* finished = transformer_pipeline_next(pipeline);
+        if (!finished) break;
+        ok = ok && finished->ok;
+        done++;
+    }
+    return ok && done == num_batches;
+}
+
+// 沿batch维取 [begin, begin + count) 的视图, 数据不复制, tensor_free不释放原数据
+static Tensor* batch_view(const Tensor* tensor, int begin, int count) {
+    Tensor* view = (Tensor*)malloc(sizeof(Tensor));
+    int* shape = (int*)malloc(tensor->num_dims * sizeof(int));
+    if (!view || !shape) {
+        free(view);
+        free(shape);
+        return NULL;
+    }
+    memcpy(shape, tensor->shape, tensor->num_dims * sizeof(int));
+    shape[0] = count;
+    const size_t stride = calculate_total_size(tensor->shape + 1, tensor->num_dims - 1);
+    view->data = tensor->data + (size_t)begin * stride;
+    view->shape = shape;
+    view->num_dims = tensor->num_dims;
+    view->borrowed_data = true;
+    return view;
+}
+
+// 二维掩码所有样本共享, 直接使用; 否则取batch维的视图
+static bool mask_view(AttentionMask* mask, int begin, int count, AttentionMask** view) {
+    *view = mask;
+    if (!mask || !mask->mask || mask->mask->num_dims <= 2) return true;
+    *view = (AttentionMask*)malloc(sizeof(AttentionMask));
+    if (!*view) return false;
+    (*view)->seq_length = mask->seq_length;
+    (*view)->mask = batch_view(mask->mask, begin, count);
+    if (!(*view)->mask) {
+        free(*view);
+        *view = NULL;
+        return false;
+    }
+    return true;
+}
+
+static void micro_batch_release(PipelineBatch* batch, AttentionMask* const* shared_masks) {
+    tensor_free(batch->encoder_input);
+    tensor_free(batch->decoder_input);
+    tensor_free(batch->output);
+    AttentionMask* masks[3] = {batch->enc_mask, batch->dec_mask, batch->cross_mask};
+    for (int i = 0; i < 3; i++) {
+        if (masks[i] != shared_masks[i]) attention_mask_free(masks[i]);
+    }
+}
+
+bool transformer_pipeline_forward(TransformerPipeline* pipeline,
+                                  Tensor* encoder_input, Tensor* decoder_input, Tensor* output,
+                                  AttentionMask* enc_mask, AttentionMask* dec_mask,
+                                  AttentionMask* cross_mask, int micro_batch_size) {
+    if (!pipeline || !encoder_input || !decoder_input || !output || micro_batch_size <= 0 ||
+        encoder_input->shape[0] != decoder_input->shape[0] || decoder_input->shape[0] != output->shape[0]) {
+        return false;
+    }
+    const int batch_size = encoder_input->shape[0];
+    const int num_batches = (batch_size + micro_batch_size - 1) / micro_batch_size;
+    AttentionMask* shared_masks[3] = {enc_mask, dec_mask, cross_mask};
+
+    PipelineBatch* micro = (PipelineBatch*)calloc(num_batches, sizeof(PipelineBatch));
+    PipelineBatch** order = (PipelineBatch**)malloc(num_batches * sizeof(PipelineBatch*));
+    bool ok = micro && order;
+    int prepared = 0;
+    for (; ok && prepared < num_batches; prepared++) {
+        PipelineBatch* batch = &micro[prepared];
+        const int begin = prepared * micro_batch_size;
+        const int count = begin + micro_batch_size <= batch_size ? micro_batch_size : batch_size - begin;
+        batch->enc_mask = enc_mask;
+        batch->dec_mask = dec_mask;
+        batch->cross_mask = cross_mask;
+        batch->encoder_input = batch_view(encoder_input, begin, count);
+        batch->decoder_input = batch_view(decoder_input, begin, count);
+        batch->output = batch_view(output, begin, count);
+        ok = batch->encoder_input && batch->decoder_input && batch->output &&
+             mask_view(enc_mask, begin, count, &batch->enc_mask) &&
+             mask_view(dec_mask, begin, count, &batch->dec_mask) &&
+             mask_view(cross_mask, begin, count, &batch->cross_mask);
+        order[prepared] = batch;
+    }
+
+    if (ok) {
+        ok = transformer_pipeline_run(pipeline, order, num_batches);
+    }
+    for (int i = 0; micro && i < prepared; i++) {
+        micro_batch_release(&micro[i], shared_masks);
+    }
+    free(micro);
+    free(order);
+    return ok;
+}
+
+void transformer_pipeline_print_report(TransformerPipeline* pipeline, FILE* stream) {
+    if (!pipeline) return;
+    const int encoder_layers = pipeline->transformer->encoder->num_layers;
+    uint64_t max_busy = 1;
+    for (int s = 0; s < pipeline->num_stages; s++) {
+        const uint64_t busy = atomic_load(&pipeline->stages[s].busy_ns);
+        if (busy > max_busy) max_busy = busy;
+    }
+    fprintf(stream, "pipeline: %d stages, %s\n", pipeline->num_stages,
+            pipeline->pinned ? "pinned to disjoint cpu groups" : "not pinned");
+    for (int s = 0; s < pipeline->num_stages; s++) {
+        const PipelineStage* stage = &pipeline->stages[s];
+        char layers[64];
+        int length = 0;
+        for (int u = stage->first_unit; u < stage->end_unit && length < (int)sizeof(layers) - 8; u++) {
+            length += snprintf(layers + length, sizeof(layers) - length, "%s%c%d", u > stage->first_unit ? " " : "",
+                               u < encoder_layers ? 'E' : 'D', u < encoder_layers ? u : u - encoder_layers);
+        }
+        const uint64_t busy = atomic_load(&stage->busy_ns);
+        const uint64_t batches = atomic_load(&stage->batches);
+        fprintf(stream, "  stage %d: layers [%s]%s, %d threads from cpu %d, %llu batches, busy %.3f s (%.0f%% of slowest)\n",
+                s, layers, s == pipeline->num_stages - 1 ? " + output" : "", stage->num_threads,
+                stage->cpus ? stage->cpus[0] : -1, (unsigned long long)batches, busy * 1e-9,
+                100.0 * busy / max_busy);
+    }
+}
+
+void transformer_pipeline_free(TransformerPipeline* pipeline) {
+    if (!pipeline) return;
+    if (pipeline->stages && pipeline->queues) {
+        // 停止标记依次流过所有已启动的阶段; 等待期间取走完成队列中的结果, 防止最后一个阶段阻塞
+        int running = 0;
+        while (running < pipeline->num_stages && pipeline->stages[running].started) running++;
+        if (running > 0) {
+            SpscQueue* done = pipeline->queues[running];
+            while (!spsc_queue_push(pipeline->queues[0], &pipeline->stop)) {
+                spsc_queue_pop(done);
+            }
+            while (spsc_queue_pop_wait(done) != &pipeline->stop) {
+            }
+        }
+        for (int s = 0; s < running; s++) {
+            pthread_join(pipeline->stages[s].thread, NULL);
+        }
+    }
+    for (int s = 0; pipeline->stages && s < pipeline->num_stages; s++) {
+        thread_pool_free(pipeline->stages[s].pool);
+        free(pipeline->stages[s].cpus);
+    }
+    for (int q = 0; pipeline->queues && q <= pipeline->num_stages; q++) {
+        spsc_queue_free(pipeline->queues[q]);
+    }
+    free(pipeline->stages);
+    free(pipeline->queues);
+    free(pipeline);
+}
@@ -0,0 +1,497 @@
+#include "transformer_tensor_parallel.h"
+#include "numa_placement.h"
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+// 共享内存中一个掩码的形状, 数据在数据区中
+typedef struct TensorParallelMaskDesc {
+    int present;
+    int seq_length;
+    int num_dims;
+    int shape[4];
+} TensorParallelMaskDesc;
+
+// rank 0每次前向写入数据区开头的参数, 后面依次是编码器输入、解码器输入和三个掩码
+typedef struct TensorParallelRequest {
+    int batch_size;
+    int enc_seq_len;
+    int dec_seq_len;
+    TensorParallelMaskDesc masks[3];   // enc / dec / cross
+} TensorParallelRequest;
+
+#define TP_REQUEST_BYTES ((sizeof(TensorParallelRequest) + 63) / 64 * 64)
+
+static size_t max_tokens(const TensorParallel* tp) {
+    return (size_t)tp->max_batch * tp->max_seq_len;
+}
+
+static TensorParallelRequest* request_of(const TensorParallel* tp) {
+    return (TensorParallelRequest*)tp->group->payload;
+}
+
+static float* encoder_input_of(const TensorParallel* tp) {
+    return (float*)((char*)tp->group->payload + TP_REQUEST_BYTES);
+}
+
+static float* decoder_input_of(const TensorParallel* tp) {
+    return encoder_input_of(tp) + max_tokens(tp) * tp->transformer->model_dim;
+}
+
+static float* mask_data_of(const TensorParallel* tp, int index) {
+    return decoder_input_of(tp) + max_tokens(tp) * tp->transformer->model_dim + tp->mask_capacity * index;
+}
+
+// ---- 切分权重 ----
+
+// 取 [rows, cols] 矩阵的第 [col0, col0 + count) 列
+static Tensor* slice_columns(const Tensor* weight, int col0, int count) {
+    const int rows = weight->shape[0];
+    const int cols = weight->shape[1];
+    int shape[] = {rows, count};
+    Tensor* slice = tensor_create(shape, 2);
+    if (!slice) return NULL;
+    for (int r = 0; r < rows; r++) {
+        memcpy(slice->data + (size_t)r * count, weight->data + (size_t)r * cols + col0, count * sizeof(float));
+    }
+    return slice;
+}
+
+// 取矩阵的第 [row0, row0 + count) 行; 一维张量 (偏置) 取对应的元素
+static Tensor* slice_rows(const Tensor* weight, int row0, int count) {
+    if (!weight) return NULL;
+    const size_t row_size = weight->num_dims > 1 ? (size_t)weight->shape[1] : 1;
+    int shape[] = {count, weight->num_dims > 1 ? weight->shape[1] : 0};
+    Tensor* slice = tensor_create(shape, weight->num_dims > 1 ? 2 : 1);
+    if (!slice) return NULL;
+    memcpy(slice->data, weight->data + (size_t)row0 * row_size, count * row_size * sizeof(float));
+    return slice;
+}
+
+// 输出偏置只在rank 0上加一次, 其余进程用同形状的0
+static Tensor* output_bias(const Tensor* bias, int rank) {
+    if (!bias) return NULL;
+    Tensor* copy = tensor_create(bias->shape, bias->num_dims);
+    if (!copy) return NULL;
+    if (rank == 0) tensor_copy(copy, bias);
+    return copy;
+}
+
+static void shard_attention_free(MultiHeadAttention* shard) {
+    if (!shard) return;
+    shard->feature_map = NULL;   // 随机特征矩阵与完整模型共享
+    multihead_attention_free(shard);
+}
+
+// 第rank份的注意力头: 配置、旋转编码和performer的随机特征矩阵与完整模型相同 (头维度不变)
+static MultiHeadAttention* shard_attention(const MultiHeadAttention* full, int rank, int num_ranks) {
+    const int width = full->num_heads * full->head_dim;
+    if (full->W_q->shape[1] != width || full->W_k->shape[1] != width || full->W_v->shape[1] != width ||
+        full->W_o->shape[0] != width) {
+        fprintf(stderr, "Tensor parallel attention expects projections of width %d\n", width);
+        return NULL;
+    }
+    MultiHeadAttention* shard = (MultiHeadAttention*)malloc(sizeof(MultiHeadAttention));
+    if (!shard) return NULL;
+    *shard = *full;
+    shard->num_heads = full->num_heads / num_ranks;
+    const int count = shard->num_heads * shard->head_dim;
+    const int col0 = rank * count;
+    shard->W_q = slice_columns(full->W_q, col0, count);
+    shard->W_k = slice_columns(full->W_k, col0, count);
+    shard->W_v = slice_columns(full->W_v, col0, count);
+    shard->b_q = slice_rows(full->b_q, col0, count);
+    shard->b_k = slice_rows(full->b_k, col0, count);
+    shard->b_v = slice_rows(full->b_v, col0, count);
+    shard->W_o = slice_rows(full->W_o, col0, count);
+    shard->b_o = output_bias(full->b_o, rank);
+    if (!shard->W_q || !shard->W_k || !shard->W_v || !shard->W_o ||
+        (full->b_q && !shard->b_q) || (full->b_k && !shard->b_k) || (full->b_v && !shard->b_v) ||
+        (full->b_o && !shard->b_o)) {
+        shard_attention_free(shard);
+        return NULL;
+    }
+    return shard;
+}
+
+// 第rank份的隐藏层: W1/W_up取列, W2取行
+static FeedForward* shard_feed_forward(const FeedForward* full, int rank, int num_ranks) {
+    FeedForward* shard = (FeedForward*)calloc(1, sizeof(FeedForward));
+    if (!shard) return NULL;
+    const int count = full->w1->shape[1] / num_ranks;
+    const int col0 = rank * count;
+    shard->activation = full->activation;
+    shard->w1 = slice_columns(full->w1, col0, count);
+    shard->b1 = slice_rows(full->b1, col0, count);
+    shard->w2 = slice_rows(full->w2, col0, count);
+    shard->b2 = output_bias(full->b2, rank);
+    if (full->w_up) {
+        shard->w_up = slice_columns(full->w_up, col0, count);
+        shard->b_up = slice_rows(full->b_up, col0, count);
+    }
+    if (!shard->w1 || !shard->b1 || !shard->w2 || !shard->b2 || (full->w_up && (!shard->w_up || !shard->b_up))) {
+        feed_forward_free(shard);
+        return NULL;
+    }
+    return shard;
+}
+
+static void shards_free(TensorParallelShard* shards, int count) {
+    if (!shards) return;
+    for (int i = 0; i < count; i++) {
+        shard_attention_free(shards[i].self_attn);
+        shard_attention_free(shards[i].cross_attn);
+        feed_forward_free(shards[i].ff);
+    }
+    free(shards);
+}
+
+static bool build_shards(TensorParallel* tp, int rank) {
+    Encoder* encoder = tp->transformer->encoder;
+    Decoder* decoder = tp->transformer->decoder;
+    tp->encoder_shards = (TensorParallelShard*)calloc(encoder->num_layers, sizeof(TensorParallelShard));
+    tp->decoder_shards = (TensorParallelShard*)calloc(decoder->num_layers, sizeof(TensorParallelShard));
+    if (!tp->encoder_shards || !tp->decoder_shards) return false;
+    for (int i = 0; i < encoder->num_layers; i++) {
+        EncoderLayer* layer = encoder->layers[i];
+        TensorParallelShard* shard = &tp->encoder_shards[i];
+        shard->self_attn = shard_attention(layer->self_attn, rank, tp->num_ranks);
+        shard->ff = shard_feed_forward(layer->ff, rank, tp->num_ranks);
+        if (!shard->self_attn || !shard->ff) return false;
+    }
+    for (int i = 0; i < decoder->num_layers; i++) {
+        DecoderLayer* layer = decoder->layers[i];
+        TensorParallelShard* shard = &tp->decoder_shards[i];
+        shard->self_attn = shard_attention(layer->self_attn, rank, tp->num_ranks);
+        shard->cross_attn = shard_attention(layer->cross_attn, rank, tp->num_ranks);
+        shard->ff = shard_feed_forward(layer->ff, rank, tp->num_ranks);
+        if (!shard->self_attn || !shard->cross_attn || !shard->ff) return false;
+    }
+    return true;
+}
+
+// ---- 前向 ----
+
+// 共享内存上的 [batch, seq, model_dim] 视图, shape由调用方提供
+static Tensor shm_view(float* data, int* shape, int batch_size, int seq_len, int model_dim) {
+    shape[0] = batch_size;
+    shape[1] = seq_len;
+    shape[2] = model_dim;
+    return (Tensor){data, shape, 3, true};
+}
+
+// 本进程算出子层的部分和写进共享内存, 与其他进程的相加后作为残差层归一化的输入, 结果写回x
+// ok为false时不计算但仍参与all-reduce, 各进程调用次数保持一致
+typedef bool (*TensorParallelSublayer)(void* ctx, Tensor* x, Tensor* partial);
+
+static bool reduce_sublayer(TensorParallel* tp, LayerNorm* norm, Tensor* x, TensorParallelSublayer sublayer,
+                            void* ctx, bool ok) {
+    const int batch_size = x ? x->shape[0] : 0;
+    const int seq_len = x ? x->shape[1] : 0;
+    const int model_dim = tp->transformer->model_dim;
+    int partial_shape[3];
+    int reduced_shape[3];
+    Tensor partial = shm_view(shm_group_partial(tp->group), partial_shape, batch_size, seq_len, model_dim);
+    Tensor reduced = shm_view(tp->group->reduced, reduced_shape, batch_size, seq_len, model_dim);
+
+    ok = ok && sublayer(ctx, x, &partial);
+    ok = shm_group_all_reduce(tp->group, (size_t)batch_size * seq_len * model_dim, ok);
+    return ok && layer_norm_residual_dropout_forward(norm, &reduced, x, x, 0.0f, (DropoutKey){0});
+}
+
+typedef struct SublayerArgs {
+    TensorParallelShard* shard;
+    Tensor* memory;             // 交叉注意力的编码器输出
+    AttentionMask* mask;
+} SublayerArgs;
+
+static bool self_attention_sublayer(void* ctx, Tensor* x, Tensor* partial) {
+    SublayerArgs* args = (SublayerArgs*)ctx;
+    return multihead_attention_forward(args->shard->self_attn, x, partial, args->mask);
+}
+
+static bool cross_attention_sublayer(void* ctx, Tensor* x, Tensor* partial) {
+    SublayerArgs* args = (SublayerArgs*)ctx;
+    return cross_attention_forward(args->shard->cross_attn, x, args->memory, args->memory, partial, args->mask);
+}
+
+static bool feed_forward_sublayer(void* ctx, Tensor* x, Tensor* partial) {
+    SublayerArgs* args = (SublayerArgs*)ctx;
+    return feed_forward_forward(args->shard->ff, x, partial);
+}
+
+// 共享内存中的掩码, 不存在时返回NULL
+static AttentionMask* mask_from_request(const TensorParallel* tp, int index, AttentionMask* mask, Tensor* tensor) {
+    const TensorParallelMaskDesc* desc = &request_of(tp)->masks[index];
+    if (!desc->present) return NULL;
+    *tensor = (Tensor){mask_data_of(tp, index), (int*)desc->shape, desc->num_dims, true};
+    mask->seq_length = desc->seq_length;
+    mask->mask = tensor;
+    return mask;
+}
+
+// 所有进程执行同一次前向; output不为NULL时 (rank 0) 最后接输出线性层
+static bool rank_forward(TensorParallel* tp, Tensor* output) {
+    const TensorParallelRequest* request = request_of(tp);
+    const int model_dim = tp->transformer->model_dim;
+    Encoder* encoder = tp->transformer->encoder;
+    Decoder* decoder = tp->transformer->decoder;
+
+    int enc_shape[] = {request->batch_size, request->enc_seq_len, model_dim};
+    int dec_shape[] = {request->batch_size, request->dec_seq_len, model_dim};
+    Tensor* enc_x = tensor_create(enc_shape, 3);
+    Tensor* dec_x = tensor_create(dec_shape, 3);
+    bool ok = enc_x && dec_x;
+    if (ok) {
+        memcpy(enc_x->data, encoder_input_of(tp), calculate_total_size(enc_shape, 3) * sizeof(float));
+        memcpy(dec_x->data, decoder_input_of(tp), calculate_total_size(dec_shape, 3) * sizeof(float));
+    }
+
+    AttentionMask masks[3];
+    Tensor mask_tensors[3];
+    AttentionMask* enc_mask = mask_from_request(tp, 0, &masks[0], &mask_tensors[0]);
+    AttentionMask* dec_mask = mask_from_request(tp, 1, &masks[1], &mask_tensors[1]);
+    AttentionMask* cross_mask = mask_from_request(tp, 2, &masks[2], &mask_tensors[2]);
+
+    for (int i = 0; i < encoder->num_layers; i++) {
+        EncoderLayer* layer = encoder->layers[i];
+        SublayerArgs args = {&tp->encoder_shards[i], NULL, enc_mask};
+        ok = reduce_sublayer(tp, layer->norm1, enc_x, self_attention_sublayer, &args, ok);
+        ok = reduce_sublayer(tp, layer->norm2, enc_x, feed_forward_sublayer, &args, ok);
+    }
+    for (int i = 0; i < decoder->num_layers; i++) {
+        DecoderLayer* layer = decoder->layers[i];
+        SublayerArgs args = {&tp->decoder_shards[i], enc_x, dec_mask};
+        ok = reduce_sublayer(tp, layer->norm1, dec_x, self_attention_sublayer, &args, ok);
+        args.mask = cross_mask;
+        ok = reduce_sublayer(tp, layer->norm2, dec_x, cross_attention_sublayer, &args, ok);
+        ok = reduce_sublayer(tp, layer->norm3, dec_x, feed_forward_sublayer, &args, ok);
+    }
+    if (output) {
+        ok = ok && linear_forward(decoder->output_linear, dec_x, output);
+    }
+
+    tensor_free(enc_x);
+    tensor_free(dec_x);
+    return ok;
+}
+
+// 工作进程: 处理命令直到退出, 不返回到调用方的代码
+static void worker_main(TensorParallel* tp, int rank) {
+    if (tp->cpus) numa_pin_thread_to_cpu(tp->cpus[0]);
+    tp->pool = thread_pool_create(tp->num_threads, tp->cpus, tp->cpus ? tp->num_threads : 0);
+    thread_pool_attach(tp->pool);
+    const bool ready = tp->pool && build_shards(tp, rank);
+    if (shm_group_all_reduce(tp->group, 0, ready)) {
+        for (;;) {
+            const int command = shm_group_wait_command(tp->group);
+            if (command != TP_COMMAND_FORWARD) break;
+            rank_forward(tp, NULL);
+        }
+    }
+    // 不释放继承的模型, 也不运行调用方注册的atexit
+    _exit(shm_group_aborted(tp->group) ? 1 : 0);
+}
+
+TensorParallel* transformer_tensor_parallel_create(Transformer* transformer, int num_ranks,
+                                                   int threads_per_rank, int max_batch, int max_seq_len) {
+    if (!transformer || !transformer->encoder || !transformer->decoder || num_ranks <= 0 ||
+        max_batch <= 0 || max_seq_len <= 0) {
+        return NULL;
+    }
+    if (transformer->config.is_training) {
+        fprintf(stderr, "Tensor parallel inference requires the transformer in inference mode\n");
+        return NULL;
+    }
+    if (transformer->config.num_experts > 0) {
+        fprintf(stderr, "Tensor parallel inference does not support mixture-of-experts layers\n");
+        return NULL;
+    }
+    if (transformer->num_heads % num_ranks != 0 || transformer->ff_dim % num_ranks != 0) {
+        fprintf(stderr, "num_heads (%d) and ff_dim (%d) must be divisible by %d ranks\n",
+                transformer->num_heads, transformer->ff_dim, num_ranks);
+        return NULL;
+    }
+
+    TensorParallel* tp = (TensorParallel*)calloc(1, sizeof(TensorParallel));
+    if (!tp) return NULL;
+    tp->transformer = transformer;
+    tp->num_ranks = num_ranks;
+    tp->max_batch = max_batch;
+    tp->max_seq_len = max_seq_len;
+    tp->mask_capacity = (size_t)max_batch * max_seq_len * max_seq_len;
+
+    const NumaTopology* topo = numa_topology();
+    if (threads_per_rank <= 0) {
+        threads_per_rank = topo->num_cpus / num_ranks;
+        if (threads_per_rank < 1) threads_per_rank = 1;
+    }
+    tp->num_threads = threads_per_rank;
+    tp->pinned = topo->num_cpus >= num_ranks * threads_per_rank;
+    if (!tp->pinned) {
+        fprintf(stderr, "Tensor parallel needs %d cpus for %d ranks x %d threads, only %d online; not pinning\n",
+                num_ranks * threads_per_rank, num_ranks, threads_per_rank, topo->num_cpus);
+    }
+
+    const size_t reduce_floats = max_tokens(tp) * transformer->model_dim;
+    const size_t payload_bytes = TP_REQUEST_BYTES + 2 * reduce_floats * sizeof(float) +
+                                 3 * tp->mask_capacity * sizeof(float);
+    tp->group = shm_group_create(num_ranks, reduce_floats, payload_bytes);
+    if (!tp->group) goto fail;
+
+    // 按NUMA节点排列的CPU依次分组, 第r组给rank r
+    const int rank = shm_group_fork(tp->group);
+    if (rank < 0) goto fail;
+    if (tp->pinned) {
+        tp->cpus = (int*)malloc(threads_per_rank * sizeof(int));
+        if (tp->cpus) memcpy(tp->cpus, topo->cpus + rank * threads_per_rank, threads_per_rank * sizeof(int));
+    }
+    if (rank > 0) worker_main(tp, rank);
+
+    // rank 0的调用方线程不绑定, 只有它的线程池的工作线程绑定
+    tp->pool = thread_pool_create(threads_per_rank, tp->cpus, tp->cpus ? threads_per_rank : 0);
+    thread_pool_attach(tp->pool);
+    const bool ready = tp->pool && build_shards(tp, 0);
+    const bool all_ready = shm_group_all_reduce(tp->group, 0, ready);
+    thread_pool_attach(NULL);
+    if (!all_ready) {
+        fprintf(stderr, "Failed to build tensor parallel shards on all %d ranks\n", num_ranks);
+        shm_group_abort(tp->group);
+        goto fail;
+    }
+    return tp;
+
+fail:
+    tp->broken = true;
+    transformer_tensor_parallel_free(tp);
+    return NULL;
+}
+
+static bool copy_mask(TensorParallel* tp, int index, const AttentionMask* mask) {
+    TensorParallelMaskDesc* desc = &request_of(tp)->masks[index];
+    memset(desc, 0, sizeof(*desc));
+    if (!mask || !mask->mask) return true;
+    const Tensor* tensor = mask->mask;
+    const size_t count = calculate_total_size(tensor->shape, tensor->num_dims);
+    if (tensor->num_dims > 4 || count > tp->mask_capacity) {
+        fprintf(stderr, "Attention mask with %d dims and %zu elements exceeds tensor parallel capacity %zu\n",
+                tensor->num_dims, count, tp->mask_capacity);
+        return false;
+    }
+    // 分片中的第h个头是完整模型的第 rank * num_heads / num_ranks + h 个, 掩码不能按头区分
+    if (tensor->num_dims == 4 && tensor->shape[1] != 1) {
+        fprintf(stderr, "Tensor parallel forward needs attention masks shared by all heads\n");
+        return false;
+    }
+    desc->present = 1;
+    desc->seq_length = mask->seq_length;
+    desc->num_dims = tensor->num_dims;
+    memcpy(desc->shape, tensor->shape, tensor->num_dims * sizeof(int));
+    memcpy(mask_data_of(tp, index), tensor->data, count * sizeof(float));
+    return true;
+}
+
+bool transformer_tensor_parallel_forward(TensorParallel* tp,
+                                         Tensor* encoder_input, Tensor* decoder_input, Tensor* output,
+                                         AttentionMask* enc_mask, AttentionMask* dec_mask,
+                                         AttentionMask* cross_mask) {
+    if (!tp || tp->broken || !encoder_input || !decoder_input || !output) {
+        return false;
+    }
+    const int model_dim = tp->transformer->model_dim;
+    if (encoder_input->num_dims != 3 || decoder_input->num_dims != 3 || output->num_dims != 3 ||
+        encoder_input->shape[2] != model_dim || decoder_input->shape[2] != model_dim ||
+        encoder_input->shape[0] != decoder_input->shape[0] || !check_same_shape(decoder_input, output)) {
+        fprintf(stderr, "Tensor parallel forward: inputs must be [batch, seq, %d]\n", model_dim);
+        return false;
+    }
+    if (encoder_input->shape[0] > tp->max_batch || encoder_input->shape[1] > tp->max_seq_len ||
+        decoder_input->shape[1] > tp->max_seq_len) {
+        fprintf(stderr, "Tensor parallel forward: batch %d x seq %d/%d exceeds capacity %d x %d\n",
+                encoder_input->shape[0], encoder_input->shape[1], decoder_input->shape[1],
+                tp->max_batch, tp->max_seq_len);
+        return false;
+    }
+
+    // 上一次前向的最后一次all-reduce之后没有进程再读数据区, 可以直接覆盖
+    TensorParallelRequest* request = request_of(tp);
+    if (!copy_mask(tp, 0, enc_mask) || !copy_mask(tp, 1, dec_mask) || !copy_mask(tp, 2, cross_mask)) {
+        return false;
+    }
+    request->batch_size = encoder_input->shape[0];
+    request->enc_seq_len = encoder_input->shape[1];
+    request->dec_seq_len = decoder_input->shape[1];
+    memcpy(encoder_input_of(tp), encoder_input->data,
+           calculate_total_size(encoder_input->shape, 3) * sizeof(float));
+    memcpy(decoder_input_of(tp), decoder_input->data,
+           calculate_total_size(decoder_input->shape, 3) * sizeof(float));
+
+    shm_group_post_command(tp->group, TP_COMMAND_FORWARD);
+    thread_pool_attach(tp->pool);
+    const bool ok = rank_forward(tp, output);
+    thread_pool_attach(NULL);
+    if (!ok && shm_group_aborted(tp->group)) {
+        fprintf(stderr, "Tensor parallel group aborted, a worker process is gone\n");
+        tp->broken = true;
+    }
+    return ok;
+}
+
+static size_t tensor_bytes(const Tensor* tensor) {
+    return tensor ? calculate_total_size(tensor->shape, tensor->num_dims) * sizeof(float) : 0;
+}
+
+static size_t attention_shard_bytes(const MultiHeadAttention* mha) {
+    if (!mha) return 0;
+    return tensor_bytes(mha->W_q) + tensor_bytes(mha->W_k) + tensor_bytes(mha->W_v) + tensor_bytes(mha->W_o) +
+           tensor_bytes(mha->b_q) + tensor_bytes(mha->b_k) + tensor_bytes(mha->b_v) + tensor_bytes(mha->b_o);
+}
+
+static size_t feed_forward_shard_bytes(const FeedForward* ff) {
+    if (!ff) return 0;
+    return tensor_bytes(ff->w1) + tensor_bytes(ff->b1) + tensor_bytes(ff->w2) + tensor_bytes(ff->b2) +
+           tensor_bytes(ff->w_up) + tensor_bytes(ff->b_up);
+}
+
+void transformer_tensor_parallel_print_report(const TensorParallel* tp, FILE* stream) {
+    if (!tp || !stream) return;
+    size_t shard_bytes = 0;
+    for (int i = 0; i < tp->transformer->encoder->num_layers; i++) {
+        shard_bytes += attention_shard_bytes(tp->encoder_shards[i].self_attn) +
+                       feed_forward_shard_bytes(tp->encoder_shards[i].ff);
+    }
+    for (int i = 0; i < tp->transformer->decoder->num_layers; i++) {
+        shard_bytes += attention_shard_bytes(tp->decoder_shards[i].self_attn) +
+                       attention_shard_bytes(tp->decoder_shards[i].cross_attn) +
+                       feed_forward_shard_bytes(tp->decoder_shards[i].ff);
+    }
+    const NumaTopology* topo = numa_topology();
+    fprintf(stream, "Tensor parallel: %d ranks x %d threads, %s%s\n", tp->num_ranks, tp->num_threads,
+            tp->pinned ? "pinned" : "not pinned", tp->broken ? ", aborted" : "");
+    fprintf(stream, "  layer shard per rank: %.2f MB (heads %d/%d, ff columns %d/%d)\n",
+            shard_bytes / (1024.0 * 1024.0), tp->transformer->num_heads / tp->num_ranks,
+            tp->transformer->num_heads, tp->transformer->ff_dim / tp->num_ranks, tp->transformer->ff_dim);
+    fprintf(stream, "  shared memory: %.2f MB (capacity %d x %d tokens)\n",
+            tp->group->mapped_bytes / (1024.0 * 1024.0), tp->max_batch, tp->max_seq_len);
+    for (int r = 0; r < tp->num_ranks; r++) {
+        fprintf(stream, "  rank %d: pid %d", r, r == 0 ? (int)getpid() : (int)tp->group->workers[r]);
+        if (tp->pinned) {
+            fprintf(stream, ", cpus %d-%d", topo->cpus[r * tp->num_threads],
+                    topo->cpus[(r + 1) * tp->num_threads - 1]);
+        }
+        fprintf(stream, "\n");
+    }
+}
+
+void transformer_tensor_parallel_free(TensorParallel* tp) {
+    if (!tp) return;
+    if (tp->group) {
+        if (!tp->broken) shm_group_post_command(tp->group, TP_COMMAND_EXIT);
+        shm_group_free(tp->group);
+    }
+    shards_free(tp->encoder_shards, tp->transformer->encoder->num_layers);
+    shards_free(tp->decoder_shards, tp->transformer->decoder->num_layers);
+    thread_pool_free(tp->pool);
+    free(tp->cpus);
+    free(tp);
+}
@@ -0,0 +1,470 @@
+#include "adaptive_softmax.h"
+#include "topk_heap.h"
+#include "fast_math.h"
+#include "thread_pool.h"
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <float.h>
+
+// 训练时每次处理的行数
+#define ADAPTIVE_ROW_CHUNK 64
+
+static int cluster_size(const AdaptiveSoftmax* as, int c) {
+    return as->cutoffs[c + 1] - as->cutoffs[c];
+}
+
+AdaptiveSoftmax* adaptive_softmax_create(
+    int model_dim,
+    int vocab_size,
+    const int* cutoffs,
+    int num_cutoffs,
+    float div_value
+) {
+    if (model_dim <= 0 || vocab_size <= 0 || !cutoffs || num_cutoffs <= 0 ||
+        num_cutoffs > ADAPTIVE_MAX_CLUSTERS || div_value < 1.0f) {
+        fprintf(stderr, "Invalid adaptive softmax configuration\n");
+        return NULL;
+    }
+    for (int i = 0; i < num_cutoffs; i++) {
+        if (cutoffs[i] <= (i > 0 ? cutoffs[i - 1] : 0) || cutoffs[i] >= vocab_size) {
+            fprintf(stderr, "Adaptive softmax cutoffs must be increasing and below vocab size %d\n", vocab_size);
+            return NULL;
+        }
+    }
+
+    AdaptiveSoftmax* as = (AdaptiveSoftmax*)calloc(1, sizeof(AdaptiveSoftmax));
+    if (!as) return NULL;
+
+    as->model_dim = model_dim;
+    as->vocab_size = vocab_size;
+    as->num_clusters = num_cutoffs;
+    memcpy(as->cutoffs, cutoffs, num_cutoffs * sizeof(int));
+    as->cutoffs[num_cutoffs] = vocab_size;
+    as->head_size = cutoffs[0] + num_cutoffs;
+
+    int head_shape[] = {as->head_size, model_dim};
+    as->head_weight = tensor_create(head_shape, 2);
+    if (!as->head_weight) {
+        adaptive_softmax_free(as);
+        return NULL;
+    }
+
+    float divisor = div_value;
+    for (int c = 0; c < num_cutoffs; c++) {
+        int dim = (int)(model_dim / divisor);
+        as->tail_dims[c] = dim > 0 ? dim : 1;
+        divisor *= div_value;
+
+        int proj_shape[] = {as->tail_dims[c], model_dim};
+        int weight_shape[] = {cluster_size(as, c), as->tail_dims[c]};
+        as->tail_proj[c] = tensor_create(proj_shape, 2);
+        as->tail_weight[c] = tensor_create(weight_shape, 2);
+        if (!as->tail_proj[c] || !as->tail_weight[c]) {
+            adaptive_softmax_free(as);
+            return NULL;
+        }
+    }
+    return as;
+}
+
+void adaptive_softmax_free(AdaptiveSoftmax* as) {
+    if (!as) return;
+    tensor_free(as->head_weight);
+    tensor_free(as->grad_head_weight);
+    for (int c = 0; c < as->num_clusters; c++) {
+        tensor_free(as->tail_proj[c]);
+        tensor_free(as->tail_weight[c]);
+        tensor_free(as->grad_tail_proj[c]);
+        tensor_free(as->grad_tail_weight[c]);
+    }
+    free(as);
+}
+
+// 行并行的几个基本运算共用的参数
+typedef struct AdaptiveRowsJob {
+    const float* X;             // [n, in_dim]
+    const float* W;             // [out_dim, in_dim]
+    float* Y;                   // [n, out_dim], 投影的输出, 或反向时的梯度G
+    float* grad;                // 权重梯度gW [out_dim, in_dim] 或输入梯度gX [n, in_dim]
+    int n;
+    int in_dim;
+    int out_dim;
+    const int* targets;
+    float scale;
+    double* row_loss;
+} AdaptiveRowsJob;
+
+// 计算量足够大时才拆分
+static long rows_grain(long units, size_t work) {
+    return work > 65536 ? 0 : units;
+}
+
+static void project_range(void* ctx, long begin, long end) {
+    const AdaptiveRowsJob* job = (const AdaptiveRowsJob*)ctx;
+    for (long unit = begin; unit < end; unit++) {
+        const long r = unit / job->out_dim;
+        const long o = unit % job->out_dim;
+        job->Y[unit] = vf_dot(job->X + (size_t)r * job->in_dim, job->W + (size_t)o * job->in_dim, job->in_dim);
+    }
+}
+
+// Y[r][o] = X[r] . W[o], X: [n, in_dim], W: [out_dim, in_dim]
+static void rows_project(const float* X, int n, int in_dim, const float* W, int out_dim, float* Y) {
+    AdaptiveRowsJob job = {X, W, Y, NULL, n, in_dim, out_dim, NULL, 0.0f, NULL};
+    const long units = (long)n * out_dim;
+    thread_pool_parallel_for(units, rows_grain(units, (size_t)units * in_dim), project_range, &job);
+}
+
+// 对数softmax行
+static void log_softmax_row(float* y, int cols) {
+    float max_val = -FLT_MAX;
+    for (int j = 0; j < cols; j++) max_val = fmaxf(max_val, y[j]);
+    float sum = 0.0f;
+    for (int j = 0; j < cols; j++) sum += fast_expf(y[j] - max_val);
+    const float lse = max_val + logf(sum);
+    for (int j = 0; j < cols; j++) y[j] -= lse;
+}
+
+static void nll_grad_range(void* ctx, long begin, long end) {
+    const AdaptiveRowsJob* job = (const AdaptiveRowsJob*)ctx;
+    const int cols = job->out_dim;
+    const float scale = job->scale;
+    for (long r = begin; r < end; r++) {
+        float* y = job->Y + (size_t)r * cols;
+        const int target = job->targets[r];
+        log_softmax_row(y, cols);
+        job->row_loss[r] = -y[target];
+        for (int j = 0; j < cols; j++) y[j] = fast_expf(y[j]) * scale;
+        y[target] -= scale;
+    }
+}
+
+// 每行的NLL, 并把logits原地替换为 (softmax - onehot) * scale, 返回损失和
+// n不超过ADAPTIVE_ROW_CHUNK, 各行的损失按行号顺序相加, 结果与线程数无关
+static double rows_nll_grad(float* Y, int n, int cols, const int* targets, float scale) {
+    double row_loss[ADAPTIVE_ROW_CHUNK];
+    AdaptiveRowsJob job = {NULL, NULL, Y, NULL, n, 0, cols, targets, scale, row_loss};
+    thread_pool_parallel_for(n, rows_grain(n, (size_t)n * cols), nll_grad_range, &job);
+
+    double loss = 0.0;
+    for (int r = 0; r < n; r++) loss += row_loss[r];
+    return loss;
+}
+
+static void weight_grad_range(void* ctx, long begin, long end) {
+    const AdaptiveRowsJob* job = (const AdaptiveRowsJob*)ctx;
+    const int in_dim = job->in_dim;
+    for (long o = begin; o < end; o++) {
+        float* gw = job->grad + (size_t)o * in_dim;
+        for (int r = 0; r < job->n; r++) {
+            const float g = job->Y[(size_t)r * job->out_dim + o];
+            const float* x = job->X + (size_t)r * in_dim;
+            #pragma omp simd
+            for (int d = 0; d < in_dim; d++) gw[d] += g * x[d];
+        }
+    }
+}
+
+// gW[o] += sum_r G[r][o] * X[r], 按输出行并行, 互不冲突
+static void accumulate_weight_grad(float* gW, const float* G, const float* X, int n, int out_dim, int in_dim) {
+    AdaptiveRowsJob job = {X, NULL, (float*)G, gW, n, in_dim, out_dim, NULL, 0.0f, NULL};
+    thread_pool_parallel_for(out_dim, rows_grain(out_dim, (size_t)n * out_dim * in_dim), weight_grad_range, &job);
+}
+
+static void backprop_range(void* ctx, long begin, long end) {
+    const AdaptiveRowsJob* job = (const AdaptiveRowsJob*)ctx;
+    const int in_dim = job->in_dim;
+    for (long r = begin; r < end; r++) {
+        float* gx = job->grad + (size_t)r * in_dim;
+        for (int o = 0; o < job->out_dim; o++) {
+            const float g = job->Y[(size_t)r * job->out_dim + o];
+            const float* w = job->W + (size_t)o * in_dim;
+            #pragma omp simd
+            for (int d = 0; d < in_dim; d++) gx[d] += g * w[d];
+        }
+    }
+}
+
+// gX[r] += sum_o G[r][o] * W[o], 按行并行
+static void backprop_rows(float* gX, const float* G, const float* W, int n, int out_dim, int in_dim) {
+    AdaptiveRowsJob job = {NULL, W, (float*)G, gX, n, in_dim, out_dim, NULL, 0.0f, NULL};
+    thread_pool_parallel_for(n, rows_grain(n, (size_t)n * out_dim * in_dim), backprop_range, &job);
+}
+
+static Tensor* zero_like(const Tensor* t) {
+    return tensor_create(t->shape, t->num_dims);
+}
+
+static bool ensure_grads(AdaptiveSoftmax* as) {
+    if (!as->grad_head_weight && !(as->grad_head_weight = zero_like(as->head_weight))) return false;
+    for (int c = 0; c < as->num_clusters; c++) {
+        if (!as->grad_tail_proj[c] && !(as->grad_tail_proj[c] = zero_like(as->tail_proj[c]))) return false;
+        if (!as->grad_tail_weight[c] && !(as->grad_tail_weight[c] = zero_like(as->tail_weight[c]))) return false;
+    }
+    return true;
+}
+
+// 目标词所在的簇, 头部词返回-1
+static int target_cluster(const AdaptiveSoftmax* as, int word) {
+    if (word < as->cutoffs[0]) return -1;
+    int c = 0;
+    while (word >= as->cutoffs[c + 1]) c++;
+    return c;
+}
+
+bool adaptive_softmax_loss(
+    AdaptiveSoftmax* as,
+    const float* hidden,
+    const int32_t* targets,
+    int num_rows,
+    int ignore_index,
+    float* loss,
+    float* grad_hidden
+) {
+    if (!as || !hidden || !targets || !loss || num_rows <= 0) {
+        fprintf(stderr, "Invalid arguments to adaptive_softmax_loss\n");
+        return false;
+    }
+
+    const int model_dim = as->model_dim;
+    int num_valid = 0;
+    for (int r = 0; r < num_rows; r++) {
+        if (targets[r] == ignore_index) continue;
+        if (targets[r] < 0 || targets[r] >= as->vocab_size) {
+            fprintf(stderr, "Target id %d exceeds vocabulary size %d\n", targets[r], as->vocab_size);
+            return false;
+        }
+        num_valid++;
+    }
+    if (grad_hidden) memset(grad_hidden, 0, (size_t)num_rows * model_dim * sizeof(float));
+    if (num_valid == 0) {
+        *loss = 0.0f;
+        return true;
+    }
+    if (!ensure_grads(as)) return false;
+
+    const float scale = 1.0f / num_valid;
+    int max_cluster = 0;
+    int max_tail_dim = 0;
+    for (int c = 0; c < as->num_clusters; c++) {
+        if (cluster_size(as, c) > max_cluster) max_cluster = cluster_size(as, c);
+        if (as->tail_dims[c] > max_tail_dim) max_tail_dim = as->tail_dims[c];
+    }
+
+    // 每块: 有效行的隐状态与梯度, 头部logits, 尾部投影/logits
+    const size_t chunk = ADAPTIVE_ROW_CHUNK;
+    float* x = (float*)malloc(chunk * model_dim * sizeof(float));
+    float* gx = (float*)malloc(chunk * model_dim * sizeof(float));
+    float* xi = (float*)malloc(chunk * model_dim * sizeof(float));
+    float* gxi = (float*)malloc(chunk * model_dim * sizeof(float));
+    float* z = (float*)malloc(chunk * as->head_size * sizeof(float));
+    float* u = (float*)malloc(chunk * max_tail_dim * sizeof(float));
+    float* gu = (float*)malloc(chunk * max_tail_dim * sizeof(float));
+    float* y = (float*)malloc(chunk * max_cluster * sizeof(float));
+    int* rows = (int*)malloc(chunk * sizeof(int));
+    int* head_targets = (int*)malloc(chunk * sizeof(int));
+    int* members = (int*)malloc(chunk * sizeof(int));
+    int* tail_targets = (int*)malloc(chunk * sizeof(int));
+    bool ok = x && gx && xi && gxi && z && u && gu && y && rows && head_targets && members && tail_targets;
+
+    double total_loss = 0.0;
+    for (int r0 = 0; ok && r0 < num_rows; r0 += ADAPTIVE_ROW_CHUNK) {
+        // 收集本块的有效行
+        int n = 0;
+        for (int r = r0; r < num_rows && r < r0 + ADAPTIVE_ROW_CHUNK; r++) {
+            if (targets[r] == ignore_index) continue;
+            rows[n] = r;
+            int c = target_cluster(as, targets[r]);
+            head_targets[n] = c < 0 ? targets[r] : as->cutoffs[0] + c;
+            memcpy(x + (size_t)n * model_dim, hidden + (size_t)r * model_dim, model_dim * sizeof(float));
+            n++;
+        }
+        if (n == 0) continue;
+        memset(gx, 0, (size_t)n * model_dim * sizeof(float));
+
+        // 头部
+        rows_project(x, n, model_dim, as->head_weight->data, as->head_size, z);
+        total_loss += rows_nll_grad(z, n, as->head_size, head_targets, scale);
+        accumulate_weight_grad(as->grad_head_weight->data, z, x, n, as->head_size, model_dim);
+        backprop_rows(gx, z, as->head_weight->data, n, as->head_size, model_dim);
+
+        // 尾部簇, 只计算有目标落入的簇
+        for (int c = 0; c < as->num_clusters; c++) {
+            int m = 0;
+            for (int i = 0; i < n; i++) {
+                if (head_targets[i] != as->cutoffs[0] + c) continue;
+                members[m] = i;
+                tail_targets[m] = targets[rows[i]] - as->cutoffs[c];
+                memcpy(xi + (size_t)m * model_dim, x + (size_t)i * model_dim, model_dim * sizeof(float));
+                m++;
+            }
+            if (m == 0) continue;
+
+            const int dim = as->tail_dims[c];
+            const int size = cluster_size(as, c);
+            rows_project(xi, m, model_dim, as->tail_proj[c]->data, dim, u);
+            rows_project(u, m, dim, as->tail_weight[c]->data, size, y);
+            total_loss += rows_nll_grad(y, m, size, tail_targets, scale);
+
+            accumulate_weight_grad(as->grad_tail_weight[c]->data, y, u, m, size, dim);
+            memset(gu, 0, (size_t)m * dim * sizeof(float));
+            backprop_rows(gu, y, as->tail_weight[c]->data, m, size, dim);
+            accumulate_weight_grad(as->grad_tail_proj[c]->data, gu, xi, m, dim, model_dim);
+            memset(gxi, 0, (size_t)m * model_dim * sizeof(float));
+            backprop_rows(gxi, gu, as->tail_proj[c]->data, m, dim, model_dim);
+
+            for (int j = 0; j < m; j++) {
+                float* dst = gx + (size_t)members[j] * model_dim;
+                const float* src = gxi + (size_t)j * model_dim;
+                for (int d = 0; d < model_dim; d++) dst[d] += src[d];
+            }
+        }
+
+        if (grad_hidden) {
+            for (int i = 0; i < n; i++) {
+                memcpy(grad_hidden + (size_t)rows[i] * model_dim, gx + (size_t)i * model_dim, model_dim * sizeof(float));
+            }
+        }
+    }
+
+    if (!ok) fprintf(stderr, "Failed to allocate adaptive softmax buffers\n");
+    *loss = (float)(total_loss * scale);
+
+    free(x); free(gx); free(xi); free(gxi); free(z); free(u); free(gu); free(y);
+    free(rows); free(head_targets); free(members); free(tail_targets);
+    return ok;
+}
+
+// 一行在尾部簇c内的条件对数概率, 写入y [簇大小], u为 [tail_dims[c]] 的临时空间
+static void tail_log_prob(const AdaptiveSoftmax* as, int c, const float* h, float* u, float* y) {
+    rows_project(h, 1, as->model_dim, as->tail_proj[c]->data, as->tail_dims[c], u);
+    rows_project(u, 1, as->tail_dims[c], as->tail_weight[c]->data, cluster_size(as, c), y);
+    log_softmax_row(y, cluster_size(as, c));
+}
+
+bool adaptive_softmax_log_prob(
+    const AdaptiveSoftmax* as,
+    const float* hidden,
+    int num_rows,
+    float* log_probs
+) {
+    if (!as || !hidden || !log_probs || num_rows <= 0) return false;
+
+    float* head = (float*)malloc(as->head_size * sizeof(float));
+    float* u = (float*)malloc(as->model_dim * sizeof(float));
+    if (!head || !u) {
+        free(head);
+        free(u);
+        return false;
+    }
+
+    for (int r = 0; r < num_rows; r++) {
+        const float* h = hidden + (size_t)r * as->model_dim;
+        float* out = log_probs + (size_t)r * as->vocab_size;
+
+        rows_project(h, 1, as->model_dim, as->head_weight->data, as->head_size, head);
+        log_softmax_row(head, as->head_size);
+        memcpy(out, head, as->cutoffs[0] * sizeof(float));
+
+        for (int c = 0; c < as->num_clusters; c++) {
+            float* y = out + as->cutoffs[c];
+            tail_log_prob(as, c, h, u, y);
+            const float cluster_lp = head[as->cutoffs[0] + c];
+            for (int j = 0; j < cluster_size(as, c); j++) y[j] += cluster_lp;
+        }
+    }
+
+    free(head);
+    free(u);
+    return true;
+}
+
+typedef struct AdaptiveTopkJob {
+    const AdaptiveSoftmax* as;
+    const float* hidden;
+    int k;
+    int max_cluster;
+    int* top_indices;
+    float* top_log_probs;
+    atomic_bool failed;
+} AdaptiveTopkJob;
+
+static void adaptive_topk_rows(void* ctx, long begin, long end) {
+    AdaptiveTopkJob* job = (AdaptiveTopkJob*)ctx;
+    const AdaptiveSoftmax* as = job->as;
+    const int k = job->k;
+    float* head = (float*)malloc(as->head_size * sizeof(float));
+    float* u = (float*)malloc(as->model_dim * sizeof(float));
+    float* y = (float*)malloc(job->max_cluster * sizeof(float));
+    if (!head || !u || !y) {
+        atomic_store(&job->failed, true);
+        end = begin;
+    }
+
+    for (long r = begin; r < end; r++) {
+        const float* h = job->hidden + (size_t)r * as->model_dim;
+        float* values = job->top_log_probs + (size_t)r * k;
+        int* indices = job->top_indices + (size_t)r * k;
+        int size = 0;
+
+        rows_project(h, 1, as->model_dim, as->head_weight->data, as->head_size, head);
+        log_softmax_row(head, as->head_size);
+        for (int w = 0; w < as->cutoffs[0]; w++) {
+            topk_push(values, indices, &size, k, head[w], w);
+        }
+
+        // 按簇token的概率从高到低访问尾部簇, 可以尽早剪枝
+        int order[ADAPTIVE_MAX_CLUSTERS];
+        for (int c = 0; c < as->num_clusters; c++) {
+            int pos = c;
+            while (pos > 0 && head[as->cutoffs[0] + order[pos - 1]] < head[as->cutoffs[0] + c]) {
+                order[pos] = order[pos - 1];
+                pos--;
+            }
+            order[pos] = c;
+        }
+
+        for (int i = 0; i < as->num_clusters; i++) {
+            const int c = order[i];
+            const float cluster_lp = head[as->cutoffs[0] + c];
+            if (size == k && cluster_lp <= values[0]) continue;
+
+            tail_log_prob(as, c, h, u, y);
+            for (int j = 0; j < cluster_size(as, c); j++) {
+                topk_push(values, indices, &size, k, y[j] + cluster_lp, as->cutoffs[c] + j);
+            }
+        }
+        topk_sort_desc(values, indices, size);
+    }
+
+    free(head);
+    free(u);
+    free(y);
+}
+
+bool adaptive_softmax_topk(
+    const AdaptiveSoftmax* as,
+    const float* hidden,
+    int num_rows,
+    int k,
+    int* top_indices,
+    float* top_log_probs
+) {
+    if (!as || !hidden || !top_indices || !top_log_probs || num_rows <= 0 || k <= 0 || k > as->vocab_size) {
+        fprintf(stderr, "Invalid arguments to adaptive_softmax_topk\n");
+        return false;
+    }
+
+    int max_cluster = 0;
+    for (int c = 0; c < as->num_clusters; c++) {
+        if (cluster_size(as, c) > max_cluster) max_cluster = cluster_size(as, c);
+    }
+
+    // 各行剪枝后的计算量不同, 每块一行, 空闲线程窃取剩下的行
+    AdaptiveTopkJob job = {as, hidden, k, max_cluster, top_indices, top_log_probs, false};
+    thread_pool_parallel_for(num_rows, 1, adaptive_topk_rows, &job);
+    return !atomic_load(&job.failed);
+}
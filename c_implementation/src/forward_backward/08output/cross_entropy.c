@@ -0,0 +1,253 @@
+#include "cross_entropy.h"
+#include "fast_math.h"
+#include "thread_pool.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <float.h>
+
+// 每次处理的行数, 每个线程需要 [CE_ROW_CHUNK, model_dim] 的隐状态梯度缓冲
+#define CE_ROW_CHUNK 64
+// 词表块大小
+#define CE_VOCAB_TILE 64
+
+typedef struct CrossEntropyJob {
+    const float* weight;
+    const float* bias;
+    int vocab_size;
+    int model_dim;
+    int ignore_index;
+    float inv_count;
+    int num_tiles;
+    int tiles_per_part;
+    int num_parts;
+    float* part_max;
+    float* part_sum;
+    float* part_grad;
+    float* row_lse;
+    float* target_logit;
+    float* grad_weight;
+    float* grad_bias;
+    // 当前的行块
+    const float* h;
+    const int32_t* tgt;
+    int rows;
+    float* gh;
+} CrossEntropyJob;
+
+// 第一遍: 各区间的 (max, sum), 目标logit由包含它的区间写入
+static void ce_forward_parts(void* ctx, long begin, long end) {
+    const CrossEntropyJob* job = (const CrossEntropyJob*)ctx;
+    const int model_dim = job->model_dim;
+    const int32_t* tgt = job->tgt;
+    float tile[CE_VOCAB_TILE];
+
+    for (long part = begin; part < end; part++) {
+        float* pmax = job->part_max + (size_t)part * CE_ROW_CHUNK;
+        float* psum = job->part_sum + (size_t)part * CE_ROW_CHUNK;
+        for (int r = 0; r < job->rows; r++) {
+            pmax[r] = -FLT_MAX;
+            psum[r] = 0.0f;
+        }
+
+        const int first_tile = (int)part * job->tiles_per_part;
+        const int last_tile = first_tile + job->tiles_per_part < job->num_tiles ? first_tile + job->tiles_per_part
+                                                                                : job->num_tiles;
+        for (int t = first_tile; t < last_tile; t++) {
+            const int start = t * CE_VOCAB_TILE;
+            const int count = start + CE_VOCAB_TILE < job->vocab_size ? CE_VOCAB_TILE : job->vocab_size - start;
+            for (int r = 0; r < job->rows; r++) {
+                if (tgt[r] == job->ignore_index) continue;
+                const float* hr = job->h + (size_t)r * model_dim;
+                float tile_max = -FLT_MAX;
+                for (int j = 0; j < count; j++) {
+                    float logit = vf_dot(hr, job->weight + (size_t)(start + j) * model_dim, model_dim);
+                    if (job->bias) logit += job->bias[start + j];
+                    tile[j] = logit;
+                    tile_max = fmaxf(tile_max, logit);
+                }
+                if (tgt[r] >= start && tgt[r] < start + count) {
+                    job->target_logit[r] = tile[tgt[r] - start];
+                }
+
+                const float new_max = fmaxf(pmax[r], tile_max);
+                float tile_sum = 0.0f;
+                for (int j = 0; j < count; j++) tile_sum += fast_expf(tile[j] - new_max);
+                psum[r] = psum[r] * fast_expf(pmax[r] - new_max) + tile_sum;
+                pmax[r] = new_max;
+            }
+        }
+    }
+}
+
+// 第二遍: 重新计算logits块, g = (softmax - onehot) / num_valid
+// 每个区间独占自己的权重梯度行, 隐状态梯度先写到区间私有缓冲
+static void ce_backward_parts(void* ctx, long begin, long end) {
+    const CrossEntropyJob* job = (const CrossEntropyJob*)ctx;
+    const int model_dim = job->model_dim;
+    const int32_t* tgt = job->tgt;
+    const float inv_count = job->inv_count;
+    float g[CE_VOCAB_TILE];
+
+    for (long part = begin; part < end; part++) {
+        float* pgrad = job->part_grad ? job->part_grad + (size_t)part * CE_ROW_CHUNK * model_dim : NULL;
+        if (pgrad) memset(pgrad, 0, (size_t)job->rows * model_dim * sizeof(float));
+
+        const int first_tile = (int)part * job->tiles_per_part;
+        const int last_tile = first_tile + job->tiles_per_part < job->num_tiles ? first_tile + job->tiles_per_part
+                                                                                : job->num_tiles;
+        for (int t = first_tile; t < last_tile; t++) {
+            const int start = t * CE_VOCAB_TILE;
+            const int count = start + CE_VOCAB_TILE < job->vocab_size ? CE_VOCAB_TILE : job->vocab_size - start;
+            for (int r = 0; r < job->rows; r++) {
+                if (tgt[r] == job->ignore_index) continue;
+                const float* hr = job->h + (size_t)r * model_dim;
+                for (int j = 0; j < count; j++) {
+                    float logit = vf_dot(hr, job->weight + (size_t)(start + j) * model_dim, model_dim);
+                    if (job->bias) logit += job->bias[start + j];
+                    g[j] = fast_expf(logit - job->row_lse[r]) * inv_count;
+                }
+                if (tgt[r] >= start && tgt[r] < start + count) {
+                    g[tgt[r] - start] -= inv_count;
+                }
+
+                for (int j = 0; j < count; j++) {
+                    const float gj = g[j];
+                    const float* wv = job->weight + (size_t)(start + j) * model_dim;
+                    if (pgrad) {
+                        float* gh = pgrad + (size_t)r * model_dim;
+                        #pragma omp simd
+                        for (int d = 0; d < model_dim; d++) gh[d] += gj * wv[d];
+                    }
+                    if (job->grad_weight) {
+                        float* gw = job->grad_weight + (size_t)(start + j) * model_dim;
+                        #pragma omp simd
+                        for (int d = 0; d < model_dim; d++) gw[d] += gj * hr[d];
+                    }
+                    if (job->grad_bias) job->grad_bias[start + j] += gj;
+                }
+            }
+        }
+    }
+}
+
+// 合并各区间的隐状态梯度
+static void ce_sum_grad(void* ctx, long begin, long end) {
+    const CrossEntropyJob* job = (const CrossEntropyJob*)ctx;
+    const size_t part_stride = (size_t)CE_ROW_CHUNK * job->model_dim;
+    for (long i = begin; i < end; i++) {
+        float sum = 0.0f;
+        for (int part = 0; part < job->num_parts; part++) {
+            sum += job->part_grad[part * part_stride + i];
+        }
+        job->gh[i] = sum;
+    }
+}
+
+bool fused_cross_entropy(
+    const VocabProjection* proj,
+    const float* hidden,
+    const int32_t* targets,
+    int num_rows,
+    int ignore_index,
+    float* loss,
+    float* grad_hidden,
+    float* grad_weight,
+    float* grad_bias
+) {
+    if (!proj || !hidden || !targets || !loss || num_rows <= 0) {
+        fprintf(stderr, "Invalid arguments to fused_cross_entropy\n");
+        return false;
+    }
+
+    const int vocab_size = proj->vocab_size;
+    const int model_dim = proj->model_dim;
+    const float* weight = vocab_projection_weight_data(proj);
+    const float* bias = proj->bias ? proj->bias->data : NULL;
+
+    int num_valid = 0;
+    for (int r = 0; r < num_rows; r++) {
+        if (targets[r] == ignore_index) continue;
+        if (targets[r] < 0 || targets[r] >= vocab_size) {
+            fprintf(stderr, "Target id %d exceeds vocabulary size %d\n", targets[r], vocab_size);
+            return false;
+        }
+        num_valid++;
+    }
+    if (grad_hidden) {
+        memset(grad_hidden, 0, (size_t)num_rows * model_dim * sizeof(float));
+    }
+    if (num_valid == 0) {
+        *loss = 0.0f;
+        return true;
+    }
+    const float inv_count = 1.0f / num_valid;
+
+    const int num_tiles = (vocab_size + CE_VOCAB_TILE - 1) / CE_VOCAB_TILE;
+    int num_parts = thread_pool_num_threads();
+    if (num_parts > num_tiles) num_parts = num_tiles;
+    const int tiles_per_part = (num_tiles + num_parts - 1) / num_parts;
+
+    // 各区间的在线log-sum-exp状态和隐状态梯度缓冲
+    float* part_max = (float*)malloc((size_t)num_parts * CE_ROW_CHUNK * sizeof(float));
+    float* part_sum = (float*)malloc((size_t)num_parts * CE_ROW_CHUNK * sizeof(float));
+    float* part_grad = grad_hidden ? (float*)malloc((size_t)num_parts * CE_ROW_CHUNK * model_dim * sizeof(float)) : NULL;
+    float* row_lse = (float*)malloc(CE_ROW_CHUNK * sizeof(float));
+    float* target_logit = (float*)malloc(CE_ROW_CHUNK * sizeof(float));
+    if (!part_max || !part_sum || (grad_hidden && !part_grad) || !row_lse || !target_logit) {
+        fprintf(stderr, "Failed to allocate cross entropy buffers\n");
+        free(part_max); free(part_sum); free(part_grad); free(row_lse); free(target_logit);
+        return false;
+    }
+
+    CrossEntropyJob job = {weight, bias, vocab_size, model_dim, ignore_index, inv_count,
+                           num_tiles, tiles_per_part, num_parts, part_max, part_sum, part_grad, row_lse, target_logit,
+                           grad_weight, grad_bias, NULL, NULL, 0, NULL};
+    double total_loss = 0.0;
+
+    for (int r0 = 0; r0 < num_rows; r0 += CE_ROW_CHUNK) {
+        const int rows = r0 + CE_ROW_CHUNK < num_rows ? CE_ROW_CHUNK : num_rows - r0;
+        const int32_t* tgt = targets + r0;
+        job.h = hidden + (size_t)r0 * model_dim;
+        job.tgt = tgt;
+        job.rows = rows;
+
+        thread_pool_parallel_for(num_parts, 1, ce_forward_parts, &job);
+
+        // 合并各区间得到每行的log-sum-exp
+        for (int r = 0; r < rows; r++) {
+            if (tgt[r] == ignore_index) continue;
+            float global_max = -FLT_MAX;
+            for (int part = 0; part < num_parts; part++) {
+                global_max = fmaxf(global_max, part_max[(size_t)part * CE_ROW_CHUNK + r]);
+            }
+            float total = 0.0f;
+            for (int part = 0; part < num_parts; part++) {
+                const size_t state = (size_t)part * CE_ROW_CHUNK + r;
+                total += part_sum[state] * fast_expf(part_max[state] - global_max);
+            }
+            row_lse[r] = global_max + logf(total);
+            total_loss += row_lse[r] - target_logit[r];
+        }
+
+        if (!grad_hidden && !grad_weight && !grad_bias) continue;
+
+        thread_pool_parallel_for(num_parts, 1, ce_backward_parts, &job);
+
+        if (grad_hidden) {
+            const long chunk_size = (long)rows * model_dim;
+            job.gh = grad_hidden + (size_t)r0 * model_dim;
+            thread_pool_parallel_for(chunk_size, chunk_size > 65536 ? 0 : chunk_size, ce_sum_grad, &job);
+        }
+    }
+
+    *loss = (float)(total_loss * inv_count);
+
+    free(part_max);
+    free(part_sum);
+    free(part_grad);
+    free(row_lse);
+    free(target_logit);
+    return true;
+}
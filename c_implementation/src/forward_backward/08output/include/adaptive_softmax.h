@@ -0,0 +1,77 @@
+#ifndef ADAPTIVE_SOFTMAX_H
+#define ADAPTIVE_SOFTMAX_H
+
+#include "tensor_type.h"
+#include <stdbool.h>
+#include <stdint.h>
+
+#define ADAPTIVE_MAX_CLUSTERS 8
+
+typedef struct AdaptiveSoftmax AdaptiveSoftmax;
+
+// 两级自适应softmax (Grave et al.), 词表需按词频降序编号
+// 头部: [0, cutoffs[0]) 的高频词加上每个尾部簇各一个"簇token", 用完整维度打分
+// 尾部簇i: [cutoffs[i], cutoffs[i+1]) 的词, 先把隐状态投影到 model_dim / div_value^(i+1) 维再打分
+// log p(w) = log p_head(w)                       (w在头部)
+//          = log p_head(簇i) + log p_i(w | 簇i)   (w在尾部簇i)
+// 权重均为 [输出, 输入] 行主序
+struct AdaptiveSoftmax {
+    int model_dim;
+    int vocab_size;
+    int num_clusters;                           // 尾部簇数
+    int cutoffs[ADAPTIVE_MAX_CLUSTERS + 1];     // cutoffs[num_clusters] == vocab_size
+    int head_size;                              // cutoffs[0] + num_clusters
+    int tail_dims[ADAPTIVE_MAX_CLUSTERS];
+
+    Tensor* head_weight;                        // [head_size, model_dim]
+    Tensor* tail_proj[ADAPTIVE_MAX_CLUSTERS];   // [tail_dims[i], model_dim]
+    Tensor* tail_weight[ADAPTIVE_MAX_CLUSTERS]; // [簇大小, tail_dims[i]]
+
+    // 梯度, 与参数同形状, 第一次调用adaptive_softmax_loss时创建, 之后累加
+    Tensor* grad_head_weight;
+    Tensor* grad_tail_proj[ADAPTIVE_MAX_CLUSTERS];
+    Tensor* grad_tail_weight[ADAPTIVE_MAX_CLUSTERS];
+};
+
+// cutoffs: 升序的num_cutoffs个分界点, 都小于vocab_size; 尾部簇数为num_cutoffs
+AdaptiveSoftmax* adaptive_softmax_create(
+    int model_dim,
+    int vocab_size,
+    const int* cutoffs,
+    int num_cutoffs,
+    float div_value
+);
+void adaptive_softmax_free(AdaptiveSoftmax* as);
+
+// 训练: 平均NLL损失, 参数梯度累加到as的grad_*中, grad_hidden [num_rows, model_dim] 覆盖写 (可为NULL)
+// 只有目标所在的簇会被计算, 尾部簇的计算量与落入该簇的行数成正比
+bool adaptive_softmax_loss(
+    AdaptiveSoftmax* as,
+    const float* hidden,
+    const int32_t* targets,
+    int num_rows,
+    int ignore_index,
+    float* loss,
+    float* grad_hidden
+);
+
+// 完整的对数概率 [num_rows, vocab_size], 用于评估
+bool adaptive_softmax_log_prob(
+    const AdaptiveSoftmax* as,
+    const float* hidden,
+    int num_rows,
+    float* log_probs
+);
+
+// 解码: 每行对数概率最大的k个词, 按降序写入 top_indices / top_log_probs [num_rows, k]
+// 尾部簇中任何词的概率都不超过簇token的概率, 所以簇token已低于当前第k名时整个簇跳过
+bool adaptive_softmax_topk(
+    const AdaptiveSoftmax* as,
+    const float* hidden,
+    int num_rows,
+    int k,
+    int* top_indices,
+    float* top_log_probs
+);
+
+#endif // ADAPTIVE_SOFTMAX_H
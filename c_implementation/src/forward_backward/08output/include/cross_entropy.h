@@ -0,0 +1,31 @@
+#ifndef CROSS_ENTROPY_H
+#define CROSS_ENTROPY_H
+
+#include "vocab_projection.h"
+#include <stdbool.h>
+#include <stdint.h>
+
+// 融合的 输出投影 + log-softmax + NLL损失 + 梯度, 不生成 [num_rows, vocab_size] 的logits矩阵
+// 行按CE_ROW_CHUNK分块, 词表按块分给各线程:
+//   第一遍: 在线log-sum-exp, 同时取出目标词的logit
+//   第二遍: 重新计算logits块, g = softmax - onehot, 直接累加到权重梯度并写出隐状态梯度
+// 与PyTorch的 CrossEntropyLoss(ignore_index, reduction='mean') 一致
+//
+// hidden: [num_rows, model_dim], targets: [num_rows], 等于ignore_index的行不计入损失也没有梯度
+// loss: 非忽略行的平均损失
+// grad_hidden: [num_rows, model_dim], 覆盖写, 可为NULL
+// grad_weight: [vocab_size, model_dim], 累加, 可为NULL (权重冻结时)
+// grad_bias: [vocab_size], 累加, 可为NULL
+bool fused_cross_entropy(
+    const VocabProjection* proj,
+    const float* hidden,
+    const int32_t* targets,
+    int num_rows,
+    int ignore_index,
+    float* loss,
+    float* grad_hidden,
+    float* grad_weight,
+    float* grad_bias
+);
+
+#endif // CROSS_ENTROPY_H
@@ -0,0 +1,40 @@
+#ifndef SHORTLIST_H
+#define SHORTLIST_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+typedef struct LexicalShortlist LexicalShortlist;
+
+// 词汇候选表: 每个源词对应若干可能的目标词 (如词对齐/翻译概率前m个), CSR存储
+// 每个请求根据源序列收集候选, 再加上总是保留的高频词, 解码时只对这些词打分
+struct LexicalShortlist {
+    int source_vocab_size;
+    int target_vocab_size;
+    int* row_ptr;               // [source_vocab_size + 1]
+    int32_t* candidates;        // [row_ptr[source_vocab_size]], 目标词id
+    int32_t* always_include;    // 总是保留的目标词 (特殊token, 高频词)
+    int num_always_include;
+};
+
+// 复制传入的CSR数组
+LexicalShortlist* lexical_shortlist_create(
+    int source_vocab_size,
+    int target_vocab_size,
+    const int* row_ptr,
+    const int32_t* candidates,
+    const int32_t* always_include,
+    int num_always_include
+);
+void lexical_shortlist_free(LexicalShortlist* shortlist);
+
+// 收集源序列所有token的候选并去重, 升序写入out (容量至少target_vocab_size), 返回候选数, 失败返回-1
+// 结果用于 vocab_projection_topk_shortlist
+int lexical_shortlist_build(
+    const LexicalShortlist* shortlist,
+    const int32_t* source_tokens,
+    int num_source_tokens,
+    int32_t* out
+);
+
+#endif // SHORTLIST_H
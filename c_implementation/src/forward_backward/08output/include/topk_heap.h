@@ -0,0 +1,55 @@
+#ifndef TOPK_HEAP_H
+#define TOPK_HEAP_H
+
+#include <stdbool.h>
+
+// 输出层共用的有界top-k选择: values / indices 两个并行数组组成小顶堆
+// 堆顶是当前保留的最差候选; 值相同时下标小的更优 (与argmax取第一个一致)
+static inline bool topk_worse(float a, int ia, float b, int ib) {
+    return a < b || (a == b && ia > ib);
+}
+
+static inline void topk_sift_down(float* values, int* indices, int size, int i) {
+    for (;;) {
+        int smallest = i;
+        int left = 2 * i + 1;
+        int right = left + 1;
+        if (left < size && topk_worse(values[left], indices[left], values[smallest], indices[smallest])) smallest = left;
+        if (right < size && topk_worse(values[right], indices[right], values[smallest], indices[smallest])) smallest = right;
+        if (smallest == i) return;
+        float tv = values[i]; values[i] = values[smallest]; values[smallest] = tv;
+        int ti = indices[i]; indices[i] = indices[smallest]; indices[smallest] = ti;
+        i = smallest;
+    }
+}
+
+static inline void topk_push(float* values, int* indices, int* size, int k, float value, int index) {
+    if (*size < k) {
+        // 未满时上浮插入
+        int i = (*size)++;
+        values[i] = value;
+        indices[i] = index;
+        while (i > 0) {
+            int parent = (i - 1) / 2;
+            if (!topk_worse(values[i], indices[i], values[parent], indices[parent])) break;
+            float tv = values[i]; values[i] = values[parent]; values[parent] = tv;
+            int ti = indices[i]; indices[i] = indices[parent]; indices[parent] = ti;
+            i = parent;
+        }
+    } else if (topk_worse(values[0], indices[0], value, index)) {
+        values[0] = value;
+        indices[0] = index;
+        topk_sift_down(values, indices, k, 0);
+    }
+}
+
+// 堆排序为降序输出
+static inline void topk_sort_desc(float* values, int* indices, int size) {
+    for (int end = size - 1; end > 0; end--) {
+        float tv = values[0]; values[0] = values[end]; values[end] = tv;
+        int ti = indices[0]; indices[0] = indices[end]; indices[end] = ti;
+        topk_sift_down(values, indices, end, 0);
+    }
+}
+
+#endif // TOPK_HEAP_H
@@ -0,0 +1,77 @@
+#ifndef VOCAB_PROJECTION_H
+#define VOCAB_PROJECTION_H
+
+#include "tensor_type.h"
+#include "01token_embedding.h"
+#include <stdbool.h>
+#include <stdint.h>
+
+typedef struct VocabProjection VocabProjection;
+
+// 输出词表投影: logits[v] = hidden . weight[v] + bias[v]
+// weight与嵌入表同为 [vocab_size, model_dim] 行主序, 每个词是连续的一行, 可直接与嵌入表绑定
+struct VocabProjection {
+    Tensor* weight;                 // [vocab_size, model_dim], 绑定嵌入表时为NULL
+    Tensor* bias;                   // [vocab_size], 可为NULL
+    TokenEmbedding* tied_embedding; // 绑定的嵌入表 (持有一个引用), 否则为NULL
+    int vocab_size;
+    int model_dim;
+};
+
+VocabProjection* vocab_projection_create(int vocab_size, int model_dim, bool use_bias);
+// 与fp32嵌入表共享权重
+VocabProjection* vocab_projection_create_tied(TokenEmbedding* embedding);
+void vocab_projection_free(VocabProjection* proj);
+
+// 权重行指针 [vocab_size, model_dim]
+const float* vocab_projection_weight_data(const VocabProjection* proj);
+
+// 按词表分块流式计算, 不保存整行logits
+// hidden: [num_rows, model_dim], 每行独立
+// 每个块算完后更新该行的 top-k (小顶堆) 和在线log-sum-exp, 各线程处理词表的不同区间后合并
+// temperature: logits先除以temperature (1为不变), top_logits和log_sum_exp都是除后的值
+// top_indices / top_logits: [num_rows, k], 按logit降序; log_sum_exp: [num_rows], 可为NULL
+// 概率 p(v) = exp(top_logits - log_sum_exp), 可直接用于greedy / top-k / top-p采样
+bool vocab_projection_topk(
+    const VocabProjection* proj,
+    const float* hidden,
+    int num_rows,
+    int k,
+    float temperature,
+    int* top_indices,
+    float* top_logits,
+    float* log_sum_exp
+);
+
+// 只对候选词表shortlist [shortlist_size] 打分, 计算量与shortlist_size成正比
+// 返回的top_indices是原词表中的id, log_sum_exp只在shortlist内归一化
+bool vocab_projection_topk_shortlist(
+    const VocabProjection* proj,
+    const float* hidden,
+    int num_rows,
+    const int32_t* shortlist,
+    int shortlist_size,
+    int k,
+    float temperature,
+    int* top_indices,
+    float* top_logits,
+    float* log_sum_exp
+);
+
+// greedy解码: 每行logit最大的词, 即k=1的vocab_projection_topk
+bool vocab_projection_argmax(
+    const VocabProjection* proj,
+    const float* hidden,
+    int num_rows,
+    int* tokens
+);
+
+// 计算完整logits [num_rows, vocab_size], 只用于需要整行的场合 (调试/对照)
+bool vocab_projection_logits(
+    const VocabProjection* proj,
+    const float* hidden,
+    int num_rows,
+    float* logits
+);
+
+#endif // VOCAB_PROJECTION_H
@@ -0,0 +1,117 @@
+#include "shortlist.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+LexicalShortlist* lexical_shortlist_create(
+    int source_vocab_size,
+    int target_vocab_size,
+    const int* row_ptr,
+    const int32_t* candidates,
+    const int32_t* always_include,
+    int num_always_include
+) {
+    if (source_vocab_size <= 0 || target_vocab_size <= 0 || !row_ptr ||
+        (row_ptr[source_vocab_size] > 0 && !candidates) || num_always_include < 0 ||
+        (num_always_include > 0 && !always_include)) {
+        fprintf(stderr, "Invalid arguments to lexical_shortlist_create\n");
+        return NULL;
+    }
+
+    const int num_candidates = row_ptr[source_vocab_size];
+    for (int i = 0; i < num_candidates; i++) {
+        if (candidates[i] < 0 || candidates[i] >= target_vocab_size) {
+            fprintf(stderr, "Shortlist candidate %d exceeds target vocabulary size %d\n",
+                    candidates[i], target_vocab_size);
+            return NULL;
+        }
+    }
+
+    for (int i = 0; i < num_always_include; i++) {
+        if (always_include[i] < 0 || always_include[i] >= target_vocab_size) {
+            fprintf(stderr, "Always-include id %d exceeds target vocabulary size %d\n",
+                    always_include[i], target_vocab_size);
+            return NULL;
+        }
+    }
+
+    LexicalShortlist* shortlist = (LexicalShortlist*)calloc(1, sizeof(LexicalShortlist));
+    if (!shortlist) return NULL;
+
+    shortlist->source_vocab_size = source_vocab_size;
+    shortlist->target_vocab_size = target_vocab_size;
+    shortlist->num_always_include = num_always_include;
+    shortlist->row_ptr = (int*)malloc((source_vocab_size + 1) * sizeof(int));
+    shortlist->candidates = (int32_t*)malloc((num_candidates + 1) * sizeof(int32_t));
+    shortlist->always_include = (int32_t*)malloc((num_always_include + 1) * sizeof(int32_t));
+    if (!shortlist->row_ptr || !shortlist->candidates || !shortlist->always_include) {
+        lexical_shortlist_free(shortlist);
+        return NULL;
+    }
+
+    memcpy(shortlist->row_ptr, row_ptr, (source_vocab_size + 1) * sizeof(int));
+    if (num_candidates > 0) {
+        memcpy(shortlist->candidates, candidates, num_candidates * sizeof(int32_t));
+    }
+    if (num_always_include > 0) {
+        memcpy(shortlist->always_include, always_include, num_always_include * sizeof(int32_t));
+    }
+    return shortlist;
+}
+
+void lexical_shortlist_free(LexicalShortlist* shortlist) {
+    if (shortlist) {
+        free(shortlist->row_ptr);
+        free(shortlist->candidates);
+        free(shortlist->always_include);
+        free(shortlist);
+    }
+}
+
+static int compare_int32(const void* a, const void* b) {
+    int32_t x = *(const int32_t*)a;
+    int32_t y = *(const int32_t*)b;
+    return (x > y) - (x < y);
+}
+
+// 用位图去重, 只排序收集到的候选, 开销与候选数成正比 (位图清零为 vocab/8 字节)
+int lexical_shortlist_build(
+    const LexicalShortlist* shortlist,
+    const int32_t* source_tokens,
+    int num_source_tokens,
+    int32_t* out
+) {
+    if (!shortlist || (!source_tokens && num_source_tokens > 0) || !out) {
+        fprintf(stderr, "Invalid arguments to lexical_shortlist_build\n");
+        return -1;
+    }
+
+    uint64_t* seen = (uint64_t*)calloc((shortlist->target_vocab_size + 63) / 64, sizeof(uint64_t));
+    if (!seen) return -1;
+
+    int count = 0;
+    for (int i = 0; i < shortlist->num_always_include; i++) {
+        const int32_t word = shortlist->always_include[i];
+        if (!(seen[word >> 6] & (1ull << (word & 63)))) {
+            seen[word >> 6] |= 1ull << (word & 63);
+            out[count++] = word;
+        }
+    }
+
+    for (int i = 0; i < num_source_tokens; i++) {
+        const int32_t token = source_tokens[i];
+        if (token < 0 || token >= shortlist->source_vocab_size) continue;
+        for (int c = shortlist->row_ptr[token]; c < shortlist->row_ptr[token + 1]; c++) {
+            const int32_t word = shortlist->candidates[c];
+            if (!(seen[word >> 6] & (1ull << (word & 63)))) {
+                seen[word >> 6] |= 1ull << (word & 63);
+                out[count++] = word;
+            }
+        }
+    }
+
+    free(seen);
+    // 升序后按权重行的顺序访问内存
+    qsort(out, count, sizeof(int32_t), compare_int32);
+    return count;
+}
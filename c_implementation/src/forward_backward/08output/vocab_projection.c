@@ -0,0 +1,342 @@
+#include "vocab_projection.h"
+#include "fast_math.h"
+#include "topk_heap.h"
+#include "thread_pool.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <float.h>
+
+// 每次计算的词表块大小, [VOCAB_TILE, model_dim] 的权重块在各行之间复用时应能留在L2中
+#define VOCAB_TILE 128
+
+VocabProjection* vocab_projection_create(int vocab_size, int model_dim, bool use_bias) {
+    if (vocab_size <= 0 || model_dim <= 0) {
+        fprintf(stderr, "Invalid vocab projection size [%d, %d]\n", vocab_size, model_dim);
+        return NULL;
+    }
+
+    VocabProjection* proj = (VocabProjection*)calloc(1, sizeof(VocabProjection));
+    if (!proj) return NULL;
+
+    proj->vocab_size = vocab_size;
+    proj->model_dim = model_dim;
+
+    int weight_shape[] = {vocab_size, model_dim};
+    proj->weight = tensor_create(weight_shape, 2);
+    if (!proj->weight) {
+        vocab_projection_free(proj);
+        return NULL;
+    }
+    if (use_bias) {
+        int bias_shape[] = {vocab_size};
+        proj->bias = tensor_create(bias_shape, 1);
+        if (!proj->bias) {
+            vocab_projection_free(proj);
+            return NULL;
+        }
+    }
+    return proj;
+}
+
+VocabProjection* vocab_projection_create_tied(TokenEmbedding* embedding) {
+    if (!embedding || embedding->storage != EMBEDDING_FP32) {
+        fprintf(stderr, "Vocab projection can only be tied to an fp32 embedding table\n");
+        return NULL;
+    }
+
+    VocabProjection* proj = (VocabProjection*)calloc(1, sizeof(VocabProjection));
+    if (!proj) return NULL;
+
+    proj->vocab_size = embedding->vocab_size;
+    proj->model_dim = embedding->embedding_dim;
+    proj->tied_embedding = token_embedding_retain(embedding);
+    return proj;
+}
+
+void vocab_projection_free(VocabProjection* proj) {
+    if (proj) {
+        tensor_free(proj->weight);
+        tensor_free(proj->bias);
+        free_token_embedding(proj->tied_embedding);
+        free(proj);
+    }
+}
+
+const float* vocab_projection_weight_data(const VocabProjection* proj) {
+    return proj->tied_embedding ? (const float*)proj->tied_embedding->weights : proj->weight->data;
+}
+
+// 第j个候选对应的词, subset为NULL时就是j本身
+static inline int vocab_word(const int32_t* subset, int j) {
+    return subset ? subset[j] : j;
+}
+
+// 计算一个词表块的logits: out[j] = (hidden . weight[w] + bias[w]) * inv_temperature, w = vocab_word(start + j)
+static void vocab_tile_logits(
+    const VocabProjection* proj,
+    const float* weight,
+    const int32_t* subset,
+    const float* h,
+    int start,
+    int count,
+    float inv_temperature,
+    float* out
+) {
+    const int model_dim = proj->model_dim;
+    const float* bias = proj->bias ? proj->bias->data : NULL;
+    for (int j = 0; j < count; j++) {
+        const int word = vocab_word(subset, start + j);
+        float logit = vf_dot(h, weight + (size_t)word * model_dim, model_dim);
+        if (bias) logit += bias[word];
+        out[j] = logit * inv_temperature;
+    }
+}
+
+// 用一个块的logits更新在线log-sum-exp状态 (max, sum)
+static void lse_update(float* running_max, float* running_sum, const float* logits, int count) {
+    float tile_max = -FLT_MAX;
+    for (int j = 0; j < count; j++) tile_max = fmaxf(tile_max, logits[j]);
+
+    const float new_max = fmaxf(*running_max, tile_max);
+    float tile_sum = 0.0f;
+    for (int j = 0; j < count; j++) tile_sum += fast_expf(logits[j] - new_max);
+
+    *running_sum = *running_sum * fast_expf(*running_max - new_max) + tile_sum;
+    *running_max = new_max;
+}
+
+typedef struct VocabTopkJob {
+    const VocabProjection* proj;
+    const float* weight;
+    const float* hidden;
+    const int32_t* subset;
+    int vocab_size;                 // 参与打分的词数
+    int num_rows;
+    int k;
+    float inv_temperature;
+    int num_tiles;
+    int tiles_per_part;
+    int num_parts;
+    // 每个 (part, row) 的局部状态: k个候选, 候选数, max, sum
+    float* part_values;
+    int* part_indices;
+    int* part_sizes;
+    float* part_max;
+    float* part_sum;
+    // 合并后的结果
+    int* top_indices;
+    float* top_logits;
+    float* log_sum_exp;
+} VocabTopkJob;
+
+static void vocab_topk_parts(void* ctx, long begin, long end) {
+    const VocabTopkJob* job = (const VocabTopkJob*)ctx;
+    const int num_rows = job->num_rows;
+    const int k = job->k;
+    float tile[VOCAB_TILE];
+
+    for (long part = begin; part < end; part++) {
+        const int first_tile = (int)part * job->tiles_per_part;
+        const int last_tile = first_tile + job->tiles_per_part < job->num_tiles ? first_tile + job->tiles_per_part
+                                                                                : job->num_tiles;
+
+        for (int t = first_tile; t < last_tile; t++) {
+            const int start = t * VOCAB_TILE;
+            const int count = start + VOCAB_TILE < job->vocab_size ? VOCAB_TILE : job->vocab_size - start;
+
+            // 同一个权重块依次用于所有行
+            for (int r = 0; r < num_rows; r++) {
+                const size_t state = (size_t)part * num_rows + r;
+                vocab_tile_logits(job->proj, job->weight, job->subset, job->hidden + (size_t)r * job->proj->model_dim,
+                                  start, count, job->inv_temperature, tile);
+                lse_update(&job->part_max[state], &job->part_sum[state], tile, count);
+
+                float* values = job->part_values + state * k;
+                int* indices = job->part_indices + state * k;
+                for (int j = 0; j < count; j++) {
+                    topk_push(values, indices, &job->part_sizes[state], k, tile[j], vocab_word(job->subset, start + j));
+                }
+            }
+        }
+    }
+}
+
+// 合并各区间: log-sum-exp按最大值对齐相加, 候选重新选top-k
+static void vocab_topk_merge(void* ctx, long begin, long end) {
+    const VocabTopkJob* job = (const VocabTopkJob*)ctx;
+    const int num_rows = job->num_rows;
+    const int k = job->k;
+
+    for (long r = begin; r < end; r++) {
+        float* values = job->top_logits + (size_t)r * k;
+        int* indices = job->top_indices + (size_t)r * k;
+        int size = 0;
+
+        float global_max = -FLT_MAX;
+        for (int part = 0; part < job->num_parts; part++) {
+            global_max = fmaxf(global_max, job->part_max[(size_t)part * num_rows + r]);
+        }
+        float total = 0.0f;
+        for (int part = 0; part < job->num_parts; part++) {
+            const size_t state = (size_t)part * num_rows + r;
+            total += job->part_sum[state] * fast_expf(job->part_max[state] - global_max);
+            for (int j = 0; j < job->part_sizes[state]; j++) {
+                topk_push(values, indices, &size, k, job->part_values[state * k + j], job->part_indices[state * k + j]);
+            }
+        }
+        topk_sort_desc(values, indices, size);
+        if (job->log_sum_exp) job->log_sum_exp[r] = global_max + logf(total);
+    }
+}
+
+// subset不为NULL时只对其中的subset_size个词打分
+static bool vocab_topk_impl(
+    const VocabProjection* proj,
+    const float* hidden,
+    int num_rows,
+    const int32_t* subset,
+    int subset_size,
+    int k,
+    float temperature,
+    int* top_indices,
+    float* top_logits,
+    float* log_sum_exp
+) {
+    if (!proj || !hidden || !top_indices || !top_logits || num_rows <= 0) {
+        fprintf(stderr, "Invalid arguments to vocab_projection_topk\n");
+        return false;
+    }
+
+    const int vocab_size = subset ? subset_size : proj->vocab_size;
+    if (k <= 0 || k > vocab_size || temperature <= 0.0f) {
+        fprintf(stderr, "Invalid top-k %d or temperature %f\n", k, temperature);
+        return false;
+    }
+
+    const float* weight = vocab_projection_weight_data(proj);
+    const float inv_temperature = 1.0f / temperature;
+
+    // 词表按线程切成若干区间, 解码时行数很少, 并行度来自词表维度
+    const int num_tiles = (vocab_size + VOCAB_TILE - 1) / VOCAB_TILE;
+    int num_parts = thread_pool_num_threads();
+    if (num_parts > num_tiles) num_parts = num_tiles;
+    const int tiles_per_part = (num_tiles + num_parts - 1) / num_parts;
+
+    const size_t num_states = (size_t)num_parts * num_rows;
+    float* part_values = (float*)malloc(num_states * k * sizeof(float));
+    int* part_indices = (int*)malloc(num_states * k * sizeof(int));
+    int* part_sizes = (int*)calloc(num_states, sizeof(int));
+    float* part_max = (float*)malloc(num_states * sizeof(float));
+    float* part_sum = (float*)calloc(num_states, sizeof(float));
+    if (!part_values || !part_indices || !part_sizes || !part_max || !part_sum) {
+        fprintf(stderr, "Failed to allocate top-k state\n");
+        free(part_values); free(part_indices); free(part_sizes); free(part_max); free(part_sum);
+        return false;
+    }
+    for (size_t i = 0; i < num_states; i++) part_max[i] = -FLT_MAX;
+
+    VocabTopkJob job = {proj, weight, hidden, subset, vocab_size, num_rows, k, inv_temperature,
+                        num_tiles, tiles_per_part, num_parts,
+                        part_values, part_indices, part_sizes, part_max, part_sum,
+                        top_indices, top_logits, log_sum_exp};
+    thread_pool_parallel_for(num_parts, 1, vocab_topk_parts, &job);
+    thread_pool_parallel_for(num_rows, num_rows > 1 ? 1 : num_rows, vocab_topk_merge, &job);
+
+    free(part_values);
+    free(part_indices);
+    free(part_sizes);
+    free(part_max);
+    free(part_sum);
+    return true;
+}
+
+bool vocab_projection_topk(
+    const VocabProjection* proj,
+    const float* hidden,
+    int num_rows,
+    int k,
+    float temperature,
+    int* top_indices,
+    float* top_logits,
+    float* log_sum_exp
+) {
+    return vocab_topk_impl(proj, hidden, num_rows, NULL, 0, k, temperature,
+                           top_indices, top_logits, log_sum_exp);
+}
+
+bool vocab_projection_topk_shortlist(
+    const VocabProjection* proj,
+    const float* hidden,
+    int num_rows,
+    const int32_t* shortlist,
+    int shortlist_size,
+    int k,
+    float temperature,
+    int* top_indices,
+    float* top_logits,
+    float* log_sum_exp
+) {
+    if (!shortlist || shortlist_size <= 0) {
+        fprintf(stderr, "Empty shortlist passed to vocab_projection_topk_shortlist\n");
+        return false;
+    }
+    for (int i = 0; i < shortlist_size; i++) {
+        if (shortlist[i] < 0 || shortlist[i] >= proj->vocab_size) {
+            fprintf(stderr, "Shortlist id %d exceeds vocabulary size %d\n", shortlist[i], proj->vocab_size);
+            return false;
+        }
+    }
+    return vocab_topk_impl(proj, hidden, num_rows, shortlist, shortlist_size, k, temperature,
+                           top_indices, top_logits, log_sum_exp);
+}
+
+bool vocab_projection_argmax(
+    const VocabProjection* proj,
+    const float* hidden,
+    int num_rows,
+    int* tokens
+) {
+    float* best = (float*)malloc(num_rows * sizeof(float));
+    if (!best) return false;
+    bool ok = vocab_projection_topk(proj, hidden, num_rows, 1, 1.0f, tokens, best, NULL);
+    free(best);
+    return ok;
+}
+
+typedef struct VocabLogitsJob {
+    const VocabProjection* proj;
+    const float* weight;
+    const float* hidden;
+    float* logits;
+    int num_tiles;
+} VocabLogitsJob;
+
+// 每个单元是一行的一个词表块
+static void vocab_logits_tiles(void* ctx, long begin, long end) {
+    const VocabLogitsJob* job = (const VocabLogitsJob*)ctx;
+    const VocabProjection* proj = job->proj;
+    for (long unit = begin; unit < end; unit++) {
+        const long r = unit / job->num_tiles;
+        const int start = (int)(unit % job->num_tiles) * VOCAB_TILE;
+        const int count = start + VOCAB_TILE < proj->vocab_size ? VOCAB_TILE : proj->vocab_size - start;
+        vocab_tile_logits(proj, job->weight, NULL, job->hidden + (size_t)r * proj->model_dim, start, count, 1.0f,
+                          job->logits + (size_t)r * proj->vocab_size + start);
+    }
+}
+
+bool vocab_projection_logits(
+    const VocabProjection* proj,
+    const float* hidden,
+    int num_rows,
+    float* logits
+) {
+    if (!proj || !hidden || !logits) return false;
+
+    const int num_tiles = (proj->vocab_size + VOCAB_TILE - 1) / VOCAB_TILE;
+    VocabLogitsJob job = {proj, vocab_projection_weight_data(proj), hidden, logits, num_tiles};
+    const long units = (long)num_rows * num_tiles;
+    thread_pool_parallel_for(units, units > 4 ? 0 : units, vocab_logits_tiles, &job);
+    return true;
+}
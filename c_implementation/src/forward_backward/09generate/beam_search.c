@@ -0,0 +1,257 @@
+#include "beam_search.h"
+#include "topk_heap.h"
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// 一条存活的beam
+typedef struct Beam {
+    DecodeSequence seq;
+    int32_t* tokens;        // [max_length + 1], tokens[0]为bos
+    int length;             // 含bos的token数, 最后一个是下一步的输入
+    float log_prob;
+} Beam;
+
+// GNMT的长度惩罚 ((5 + length) / 6)^alpha
+static float length_penalty(int length, float alpha) {
+    return alpha == 0.0f ? 1.0f : powf((5.0f + (float)length) / 6.0f, alpha);
+}
+
+BeamSearch* beam_search_create(Transformer* transformer, const TransformerEmbedding* decoder_embedding,
+                               const VocabProjection* vocab, KVCachePool* pool, const BeamSearchConfig* config) {
+    if (!transformer || !decoder_embedding || !vocab || !pool || !config) return NULL;
+    if (config->beam_width <= 0 || config->max_length <= 0) {
+        fprintf(stderr, "Invalid beam search config (beam_width %d, max_length %d)\n",
+                config->beam_width, config->max_length);
+        return NULL;
+    }
+    if (vocab->model_dim != transformer->model_dim ||
+        decoder_embedding->token_embedding->embedding_dim != transformer->model_dim) {
+        fprintf(stderr, "Beam search: embedding/vocab dims do not match model_dim %d\n", transformer->model_dim);
+        return NULL;
+    }
+
+    BeamSearch* search = (BeamSearch*)calloc(1, sizeof(BeamSearch));
+    if (!search) return NULL;
+    search->transformer = transformer;
+    search->embedding = decoder_embedding;
+    search->vocab = vocab;
+    search->pool = pool;
+    search->config = *config;
+    search->candidates = 2 * config->beam_width < vocab->vocab_size ? 2 * config->beam_width : vocab->vocab_size;
+    search->decoder = incremental_decoder_create(transformer, pool, config->beam_width);
+    if (!search->decoder) goto fail;
+
+    const size_t rows = (size_t)config->beam_width;
+    search->inputs = (float*)malloc(rows * transformer->model_dim * sizeof(float));
+    search->hidden = (float*)malloc(rows * transformer->model_dim * sizeof(float));
+    search->top_indices = (int*)malloc(rows * search->candidates * sizeof(int));
+    search->top_logits = (float*)malloc(rows * search->candidates * sizeof(float));
+    search->log_sum_exp = (float*)malloc(rows * sizeof(float));
+    if (!search->inputs || !search->hidden || !search->top_indices || !search->top_logits || !search->log_sum_exp) {
+        goto fail;
+    }
+    return search;
+
+fail:
+    beam_search_free(search);
+    return NULL;
+}
+
+void beam_search_free(BeamSearch* search) {
+    if (search) {
+        incremental_decoder_free(search->decoder);
+        free(search->inputs);
+        free(search->hidden);
+        free(search->top_indices);
+        free(search->top_logits);
+        free(search->log_sum_exp);
+        free(search);
+    }
+}
+
+void beam_search_result_free(BeamSearchResult* result) {
+    if (result) {
+        for (int i = 0; i < result->num_hypotheses; i++) {
+            free(result->hypotheses[i].tokens);
+        }
+        free(result->hypotheses);
+        memset(result, 0, sizeof(*result));
+    }
+}
+
+// 最差分数: 未满时为负无穷
+static float worst_finished(const BeamSearchResult* result, int capacity) {
+    return result->num_hypotheses < capacity ? -INFINITY : result->hypotheses[capacity - 1].score;
+}
+
+// 按分数插入完成的假设, 最多保留capacity个
+static bool add_hypothesis(BeamSearchResult* result, int capacity, const int32_t* tokens, int length,
+                           float log_prob, float score, bool finished) {
+    if (score <= worst_finished(result, capacity)) return true;
+    int32_t* copy = (int32_t*)malloc((length > 0 ? length : 1) * sizeof(int32_t));
+    if (!copy) return false;
+    memcpy(copy, tokens, length * sizeof(int32_t));
+
+    int pos = result->num_hypotheses < capacity ? result->num_hypotheses++ : capacity - 1;
+    if (pos == capacity - 1 && result->num_hypotheses == capacity) {
+        free(result->hypotheses[pos].tokens);
+    }
+    while (pos > 0 && result->hypotheses[pos - 1].score < score) {
+        result->hypotheses[pos] = result->hypotheses[pos - 1];
+        pos--;
+    }
+    result->hypotheses[pos] = (BeamHypothesis){copy, length, log_prob, score, finished};
+    return true;
+}
+
+static void release_beams(KVCachePool* pool, Beam* beams, int count) {
+    for (int i = 0; i < count; i++) {
+        decode_sequence_release(pool, &beams[i].seq);
+    }
+}
+
+bool beam_search_run(BeamSearch* search, Tensor* encoder_input, AttentionMask* enc_mask, BeamSearchResult* result) {
+    if (!search || !result) return false;
+    memset(result, 0, sizeof(*result));
+    const BeamSearchConfig* config = &search->config;
+    const int width = config->beam_width;
+    const int k = search->candidates;
+    KVCachePool* pool = search->pool;
+
+    EncoderMemory* memory = encoder_memory_create(search->transformer, encoder_input, enc_mask);
+    if (!memory) return false;
+
+    bool ok = false;
+    Beam* live = (Beam*)calloc(width, sizeof(Beam));
+    Beam* next = (Beam*)calloc(width, sizeof(Beam));
+    DecodeSequence** seqs = (DecodeSequence**)malloc(width * sizeof(DecodeSequence*));
+    int32_t* step_tokens = (int32_t*)malloc(width * sizeof(int32_t));
+    int* positions = (int*)malloc(width * sizeof(int));
+    float* cand_scores = (float*)malloc(k * sizeof(float));
+    int* cand_index = (int*)malloc(k * sizeof(int));
+    result->hypotheses = (BeamHypothesis*)calloc(width, sizeof(BeamHypothesis));
+    int num_live = 0;
+    int num_next = 0;
+    if (!live || !next || !seqs || !step_tokens || !positions || !cand_scores || !cand_index || !result->hypotheses) {
+        goto done;
+    }
+    for (int i = 0; i < width; i++) {
+        live[i].tokens = (int32_t*)malloc((config->max_length + 1) * sizeof(int32_t));
+        next[i].tokens = (int32_t*)malloc((config->max_length + 1) * sizeof(int32_t));
+        if (!live[i].tokens || !next[i].tokens) goto done;
+    }
+
+    decode_sequence_init(&live[0].seq, memory);
+    live[0].tokens[0] = config->bos_token;
+    live[0].length = 1;
+    live[0].log_prob = 0.0f;
+    num_live = 1;
+
+    // 到达max_length的beam没有下一步, 所以上界用max_length的惩罚 (alpha >= 0 时惩罚随长度增大)
+    const float bound_penalty = length_penalty(config->length_penalty >= 0.0f ? config->max_length : 1,
+                                               config->length_penalty);
+
+    for (int step = 0; step < config->max_length && num_live > 0; step++) {
+        for (int i = 0; i < num_live; i++) {
+            seqs[i] = &live[i].seq;
+            step_tokens[i] = live[i].tokens[live[i].length - 1];
+            positions[i] = live[i].seq.length;
+        }
+        if (!decode_embed_tokens(search->embedding, step_tokens, positions, num_live, search->inputs) ||
+            !incremental_decoder_step(search->decoder, seqs, num_live, search->inputs, search->hidden) ||
+            !vocab_projection_topk(search->vocab, search->hidden, num_live, k, 1.0f,
+                                   search->top_indices, search->top_logits, search->log_sum_exp)) {
+            goto done;
+        }
+        result->steps++;
+
+        // 全局前k个候选: 每条beam的前k个已经包含了它可能进入全局前k的所有词
+        int num_cand = 0;
+        for (int i = 0; i < num_live; i++) {
+            for (int j = 0; j < k; j++) {
+                const float log_prob = search->top_logits[i * k + j] - search->log_sum_exp[i];
+                topk_push(cand_scores, cand_index, &num_cand, k, live[i].log_prob + log_prob, i * k + j);
+            }
+        }
+        topk_sort_desc(cand_scores, cand_index, num_cand);
+
+        num_next = 0;
+        for (int c = 0; c < num_cand && num_next < width; c++) {
+            Beam* parent = &live[cand_index[c] / k];
+            const int32_t token = search->top_indices[cand_index[c]];
+            const float log_prob = cand_scores[c];
+            if (token == config->eos_token) {
+                // 完成的假设含eos, 不含bos; tokens[length]是空闲位置, 先把eos放在那里
+                const int length = parent->length;
+                parent->tokens[length] = token;
+                const float score = log_prob / length_penalty(length, config->length_penalty);
+                if (!add_hypothesis(result, width, parent->tokens + 1, length, log_prob, score, true)) goto done;
+                continue;
+            }
+            Beam* child = &next[num_next++];
+            if (!decode_sequence_fork(pool, &parent->seq, &child->seq)) {
+                num_next--;
+                goto done;
+            }
+            memcpy(child->tokens, parent->tokens, parent->length * sizeof(int32_t));
+            child->tokens[parent->length] = token;
+            child->length = parent->length + 1;
+            child->log_prob = log_prob;
+        }
+
+        // 父beam的块引用交给了子beam, 没有子beam的父beam在这里归还全部块
+        release_beams(pool, live, num_live);
+        Beam* swap = live;
+        live = next;
+        next = swap;
+        num_live = num_next;
+        num_next = 0;
+
+        if (result->num_hypotheses == width) {
+            const float worst = worst_finished(result, width);
+            int kept = 0;
+            for (int i = 0; i < num_live; i++) {
+                if (live[i].log_prob / bound_penalty <= worst) {
+                    decode_sequence_release(pool, &live[i].seq);
+                    result->pruned++;
+                    continue;
+                }
+                if (kept != i) {
+                    Beam tmp = live[kept];
+                    live[kept] = live[i];
+                    live[i] = tmp;
+                }
+                kept++;
+            }
+            num_live = kept;
+        }
+    }
+
+    // 到达max_length仍未结束的beam作为未完成的假设参与排序
+    for (int i = 0; i < num_live; i++) {
+        const int length = live[i].length - 1;
+        const float score = live[i].log_prob / length_penalty(length, config->length_penalty);
+        if (!add_hypothesis(result, width, live[i].tokens + 1, length, live[i].log_prob, score, false)) goto done;
+    }
+    ok = true;
+
+done:
+    if (live) release_beams(pool, live, num_live);
+    if (next) release_beams(pool, next, num_next);
+    for (int i = 0; i < width; i++) {
+        if (live) free(live[i].tokens);
+        if (next) free(next[i].tokens);
+    }
+    free(live);
+    free(next);
+    free(seqs);
+    free(step_tokens);
+    free(positions);
+    free(cand_scores);
+    free(cand_index);
+    encoder_memory_free(memory);
+    if (!ok) beam_search_result_free(result);
+    return ok;
+}
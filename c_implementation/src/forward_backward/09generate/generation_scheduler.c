@@ -0,0 +1,504 @@
+#include "generation_scheduler.h"
+#include <limits.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+// tokens_per_second 的统计窗口; 超过一个窗口没有step时速度记为0
+#define SCHEDULER_RATE_WINDOW 1.0
+
+struct ScheduledRequest {
+    uint64_t id;
+    GenerationRequest request;          // token指针指向下面自己持有的数组
+    int32_t* source;
+    int32_t* tokens;                    // [prompt_length + max_new_tokens] prompt和已生成的token
+    int length;                         // tokens中已知的个数
+    int generated;
+    int reserved_blocks;
+    EncoderMemory* memory;
+    DecodeSequence seq;
+    SampleRng rng;
+    GenerationTiming timing;
+    atomic_bool cancelled;
+    ScheduledRequest* next;             // 等待队列
+    ScheduledRequest* live_prev;
+    ScheduledRequest* live_next;
+};
+
+static double now_seconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+GenerationScheduler* generation_scheduler_create(Transformer* transformer,
+                                                 const TransformerEmbedding* encoder_embedding,
+                                                 const TransformerEmbedding* decoder_embedding,
+                                                 const VocabProjection* vocab, KVCachePool* pool, int max_batch) {
+    if (!transformer || !encoder_embedding || !decoder_embedding || !vocab || !pool || max_batch <= 0) return NULL;
+    const int model_dim = transformer->model_dim;
+    if (vocab->model_dim != model_dim || encoder_embedding->token_embedding->embedding_dim != model_dim ||
+        decoder_embedding->token_embedding->embedding_dim != model_dim) {
+        fprintf(stderr, "Generation scheduler: embedding/vocab dims do not match model_dim %d\n", model_dim);
+        return NULL;
+    }
+
+    GenerationScheduler* scheduler = (GenerationScheduler*)calloc(1, sizeof(GenerationScheduler));
+    if (!scheduler) return NULL;
+    scheduler->transformer = transformer;
+    scheduler->encoder_embedding = encoder_embedding;
+    scheduler->decoder_embedding = decoder_embedding;
+    scheduler->vocab = vocab;
+    scheduler->pool = pool;
+    scheduler->max_batch = max_batch;
+    scheduler->next_id = 1;
+    pthread_mutex_init(&scheduler->lock, NULL);
+    pthread_cond_init(&scheduler->work_available, NULL);
+    scheduler->metrics.max_batch = max_batch;
+    scheduler->metrics.total_blocks = pool->num_blocks;
+    scheduler->idle = true;
+
+    const SamplerConfig greedy = {0.0f, 0, 1.0f, 1.0f};
+    scheduler->decoder = incremental_decoder_create(transformer, pool, max_batch);
+    scheduler->sampler = sampler_create(vocab->vocab_size, &greedy);
+    scheduler->running = (ScheduledRequest**)calloc(max_batch, sizeof(ScheduledRequest*));
+    scheduler->seqs = (DecodeSequence**)malloc(max_batch * sizeof(DecodeSequence*));
+    scheduler->step_tokens = (int32_t*)malloc(max_batch * sizeof(int32_t));
+    scheduler->positions = (int*)malloc(max_batch * sizeof(int));
+    scheduler->sample_rows = (int*)malloc(max_batch * sizeof(int));
+    scheduler->inputs = (float*)malloc((size_t)max_batch * model_dim * sizeof(float));
+    scheduler->hidden = (float*)malloc((size_t)max_batch * model_dim * sizeof(float));
+    scheduler->sample_hidden = (float*)malloc((size_t)max_batch * model_dim * sizeof(float));
+    scheduler->logits = (float*)malloc((size_t)max_batch * vocab->vocab_size * sizeof(float));
+    if (!scheduler->decoder || !scheduler->sampler || !scheduler->running || !scheduler->seqs ||
+        !scheduler->step_tokens || !scheduler->positions || !scheduler->sample_rows || !scheduler->inputs ||
+        !scheduler->hidden || !scheduler->sample_hidden || !scheduler->logits) {
+        generation_scheduler_free(scheduler);
+        return NULL;
+    }
+    return scheduler;
+}
+
+// 最多写入 prompt_length + max_new_tokens - 1 个位置 (最后一个采出的token不再输入解码器);
+// 局部注意力的模型回收窗口外的块, 预留按同时持有的上限计算
+static int blocks_for_request(const GenerationScheduler* scheduler, const GenerationRequest* request) {
+    const int positions = request->prompt_length + request->max_new_tokens - 1;
+    return incremental_decoder_max_blocks(scheduler->decoder, positions);
+}
+
+static bool tokens_in_range(const int32_t* tokens, int length, int vocab_size) {
+    for (int i = 0; i < length; i++) {
+        if (tokens[i] < 0 || tokens[i] >= vocab_size) return false;
+    }
+    return true;
+}
+
+// 提交时逐条检查, 不合法的请求直接拒绝, 不会进入批次里拖累其他序列:
+// token在编码器/解码器/输出词表范围内, 位置数不溢出, 预留的块数不超过整个缓存池
+static bool request_valid(const GenerationScheduler* scheduler, const GenerationRequest* request) {
+    if (!request->source_tokens || request->source_length <= 0 || !request->prompt_tokens ||
+        request->prompt_length <= 0 || request->max_new_tokens <= 0 ||
+        request->max_new_tokens > INT_MAX - request->prompt_length) {
+        return false;
+    }
+    const int decoder_vocab = scheduler->decoder_embedding->token_embedding->vocab_size;
+    return tokens_in_range(request->source_tokens, request->source_length,
+                           scheduler->encoder_embedding->token_embedding->vocab_size) &&
+           tokens_in_range(request->prompt_tokens, request->prompt_length, decoder_vocab) &&
+           tokens_in_range(request->prompt_tokens, request->prompt_length, scheduler->vocab->vocab_size) &&
+           blocks_for_request(scheduler, request) <= scheduler->pool->num_blocks;
+}
+
+static void free_request(ScheduledRequest* r) {
+    free(r->source);
+    free(r->tokens);
+    free(r);
+}
+
+uint64_t generation_scheduler_submit(GenerationScheduler* scheduler, const GenerationRequest* request) {
+    if (!scheduler || !request) return 0;
+    const GenerationCallbacks* callbacks = &request->callbacks;
+    const double submitted = now_seconds();
+    ScheduledRequest* r = request_valid(scheduler, request) ? (ScheduledRequest*)calloc(1, sizeof(ScheduledRequest))
+                                                            : NULL;
+    if (r) {
+        r->source = (int32_t*)malloc(request->source_length * sizeof(int32_t));
+        r->tokens = (int32_t*)malloc((request->prompt_length + request->max_new_tokens) * sizeof(int32_t));
+        if (!r->source || !r->tokens) {
+            free_request(r);
+            r = NULL;
+        }
+    }
+
+    pthread_mutex_lock(&scheduler->lock);
+    if (!r || scheduler->shutdown) {
+        scheduler->metrics.rejected++;
+        pthread_mutex_unlock(&scheduler->lock);
+        if (r) free_request(r);
+        if (callbacks->on_finish) {
+            GenerationTiming timing = {submitted, 0.0, 0.0, 0.0, now_seconds()};
+            callbacks->on_finish(callbacks->user_data, 0, GENERATION_FINISHED_REJECTED, &timing, 0);
+        }
+        return 0;
+    }
+    r->id = scheduler->next_id++;
+    scheduler->metrics.submitted++;
+    pthread_mutex_unlock(&scheduler->lock);
+
+    memcpy(r->source, request->source_tokens, request->source_length * sizeof(int32_t));
+    memcpy(r->tokens, request->prompt_tokens, request->prompt_length * sizeof(int32_t));
+    r->request = *request;
+    r->request.source_tokens = r->source;
+    r->request.prompt_tokens = r->tokens;
+    r->length = request->prompt_length;
+    r->reserved_blocks = blocks_for_request(scheduler, request);
+    r->rng = sample_rng_init(request->seed, r->id);
+    r->timing.submitted = submitted;
+    atomic_init(&r->cancelled, false);
+
+    pthread_mutex_lock(&scheduler->lock);
+    if (scheduler->pending_tail) {
+        scheduler->pending_tail->next = r;
+    } else {
+        scheduler->pending_head = r;
+    }
+    scheduler->pending_tail = r;
+    r->live_next = scheduler->live;
+    if (scheduler->live) scheduler->live->live_prev = r;
+    scheduler->live = r;
+    scheduler->queue_depth++;
+    const uint64_t id = r->id;
+    pthread_cond_signal(&scheduler->work_available);
+    pthread_mutex_unlock(&scheduler->lock);
+    return id;
+}
+
+bool generation_scheduler_cancel(GenerationScheduler* scheduler, uint64_t request_id) {
+    bool found = false;
+    pthread_mutex_lock(&scheduler->lock);
+    for (ScheduledRequest* r = scheduler->live; r; r = r->live_next) {
+        if (r->id == request_id) {
+            atomic_store(&r->cancelled, true);
+            found = true;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&scheduler->lock);
+    return found;
+}
+
+// 归还缓存和预留, 回调on_finish并释放; 只在计算线程中调用
+static void finish_request(GenerationScheduler* scheduler, ScheduledRequest* r, GenerationFinishReason reason) {
+    decode_sequence_release(scheduler->pool, &r->seq);
+    encoder_memory_free(r->memory);
+    r->memory = NULL;
+
+    pthread_mutex_lock(&scheduler->lock);
+    if (r->timing.admitted > 0.0) scheduler->reserved_blocks -= r->reserved_blocks;
+    if (r->live_prev) {
+        r->live_prev->live_next = r->live_next;
+    } else {
+        scheduler->live = r->live_next;
+    }
+    if (r->live_next) r->live_next->live_prev = r->live_prev;
+    if (reason == GENERATION_FINISHED_CANCELLED) {
+        scheduler->metrics.cancelled++;
+    } else if (reason == GENERATION_FINISHED_EOS || reason == GENERATION_FINISHED_LENGTH) {
+        scheduler->metrics.completed++;
+    }
+    pthread_mutex_unlock(&scheduler->lock);
+
+    r->timing.finished = now_seconds();
+    if (r->request.callbacks.on_finish) {
+        r->request.callbacks.on_finish(r->request.callbacks.user_data, r->id, reason, &r->timing, r->generated);
+    }
+    free_request(r);
+}
+
+// 运行编码器, 准备解码器的空序列
+static bool encode_request(GenerationScheduler* scheduler, ScheduledRequest* r) {
+    int token_shape[] = {1, r->request.source_length};
+    int input_shape[] = {1, r->request.source_length, scheduler->transformer->model_dim};
+    IntTensor* tokens = int_tensor_create(token_shape, 2);
+    Tensor* input = tensor_create(input_shape, 3);
+    bool ok = tokens && input;
+    if (ok) {
+        memcpy(tokens->data, r->source, r->request.source_length * sizeof(int32_t));
+        ok = transformer_embedding_forward(scheduler->encoder_embedding, tokens, input);
+    }
+    if (ok) {
+        r->memory = encoder_memory_create(scheduler->transformer, input, NULL);
+        ok = r->memory != NULL;
+    }
+    int_tensor_free(tokens);
+    tensor_free(input);
+    if (ok) {
+        decode_sequence_init(&r->seq, r->memory);
+        r->timing.encoded = now_seconds();
+    }
+    return ok;
+}
+
+// 缓存池中还能预留给新请求的块: 空闲块减去运行中的序列按预留还会再取的块.
+// 池可能和其他解码器共用, 只看调度器自己的预留总数会把别人占用的块也算成可用
+static int available_blocks(GenerationScheduler* scheduler) {
+    int owed = 0;
+    for (int i = 0; i < scheduler->num_running; i++) {
+        const ScheduledRequest* r = scheduler->running[i];
+        const int held = decode_sequence_held_blocks(&r->seq);
+        if (r->reserved_blocks > held) owed += r->reserved_blocks - held;
+    }
+    return kv_cache_pool_free_blocks(scheduler->pool) - owed;
+}
+
+// 按提交顺序接纳: 队首的预留放不下时停止, 不让后面的短请求插队 (避免长请求饿死)
+static void admit_requests(GenerationScheduler* scheduler) {
+    ScheduledRequest* dropped = NULL;
+    const int first = scheduler->num_running;
+    int available = available_blocks(scheduler);
+
+    pthread_mutex_lock(&scheduler->lock);
+    while (scheduler->pending_head && scheduler->num_running < scheduler->max_batch) {
+        ScheduledRequest* r = scheduler->pending_head;
+        const bool cancelled = atomic_load(&r->cancelled);
+        if (!cancelled && (scheduler->reserved_blocks + r->reserved_blocks > scheduler->pool->num_blocks ||
+                           r->reserved_blocks > available)) {
+            break;
+        }
+        scheduler->pending_head = r->next;
+        if (!scheduler->pending_head) scheduler->pending_tail = NULL;
+        scheduler->queue_depth--;
+        if (cancelled) {
+            r->next = dropped;
+            dropped = r;
+            continue;
+        }
+        r->next = NULL;
+        scheduler->reserved_blocks += r->reserved_blocks;
+        available -= r->reserved_blocks;
+        r->timing.admitted = now_seconds();
+        scheduler->running[scheduler->num_running++] = r;
+    }
+    pthread_mutex_unlock(&scheduler->lock);
+
+    while (dropped) {
+        ScheduledRequest* next = dropped->next;
+        finish_request(scheduler, dropped, GENERATION_FINISHED_CANCELLED);
+        dropped = next;
+    }
+    // 编码器在锁外运行, 不阻塞其他线程提交请求
+    for (int i = first; i < scheduler->num_running; i++) {
+        if (!encode_request(scheduler, scheduler->running[i])) {
+            finish_request(scheduler, scheduler->running[i], GENERATION_FINISHED_ERROR);
+            scheduler->running[i] = NULL;
+        }
+    }
+}
+
+// 去掉已结束 (running[i]为NULL) 的位置, 保持其余顺序
+static void compact_running(GenerationScheduler* scheduler) {
+    int kept = 0;
+    for (int i = 0; i < scheduler->num_running; i++) {
+        if (scheduler->running[i]) scheduler->running[kept++] = scheduler->running[i];
+    }
+    scheduler->num_running = kept;
+}
+
+// 批量计算失败时逐条重试, 只结束自己失败的序列; 失败的step不改变序列的length, 可以安全重做
+// 返回失败的序列数
+static int decode_rows_separately(GenerationScheduler* scheduler, int rows) {
+    const int model_dim = scheduler->transformer->model_dim;
+    int failed = 0;
+    for (int i = 0; i < rows; i++) {
+        if (!decode_embed_tokens(scheduler->decoder_embedding, scheduler->step_tokens + i, scheduler->positions + i,
+                                 1, scheduler->inputs + (size_t)i * model_dim) ||
+            !incremental_decoder_step(scheduler->decoder, scheduler->seqs + i, 1,
+                                      scheduler->inputs + (size_t)i * model_dim,
+                                      scheduler->hidden + (size_t)i * model_dim)) {
+            finish_request(scheduler, scheduler->running[i], GENERATION_FINISHED_ERROR);
+            scheduler->running[i] = NULL;
+            failed++;
+        }
+    }
+    return failed;
+}
+
+int generation_scheduler_step(GenerationScheduler* scheduler) {
+    const double start = now_seconds();
+    admit_requests(scheduler);
+    for (int i = 0; i < scheduler->num_running; i++) {
+        if (scheduler->running[i] && atomic_load(&scheduler->running[i]->cancelled)) {
+            finish_request(scheduler, scheduler->running[i], GENERATION_FINISHED_CANCELLED);
+            scheduler->running[i] = NULL;
+        }
+    }
+    compact_running(scheduler);
+    const int rows = scheduler->num_running;
+    if (rows == 0) {
+        pthread_mutex_lock(&scheduler->lock);
+        scheduler->metrics.running = 0;
+        scheduler->idle = true;
+        pthread_mutex_unlock(&scheduler->lock);
+        return 0;
+    }
+
+    // 每条序列输入它的下一个已知token: 预填充时是prompt中的token, 之后是上一步采出的token
+    for (int i = 0; i < rows; i++) {
+        ScheduledRequest* r = scheduler->running[i];
+        scheduler->seqs[i] = &r->seq;
+        scheduler->positions[i] = r->seq.length;
+        scheduler->step_tokens[i] = r->tokens[r->seq.length];
+    }
+    const int model_dim = scheduler->transformer->model_dim;
+    int failed = 0;
+    if (!decode_embed_tokens(scheduler->decoder_embedding, scheduler->step_tokens, scheduler->positions, rows,
+                             scheduler->inputs) ||
+        !incremental_decoder_step(scheduler->decoder, scheduler->seqs, rows, scheduler->inputs, scheduler->hidden)) {
+        failed = decode_rows_separately(scheduler, rows);
+    }
+
+    // 已经读完所有已知token的序列需要采样, 把它们的隐藏状态排在一起批量计算logits
+    int num_samples = 0;
+    for (int i = 0; i < rows; i++) {
+        const ScheduledRequest* r = scheduler->running[i];
+        if (r && r->seq.length == r->length) {
+            memcpy(scheduler->sample_hidden + (size_t)num_samples * model_dim,
+                   scheduler->hidden + (size_t)i * model_dim, model_dim * sizeof(float));
+            scheduler->sample_rows[num_samples++] = i;
+        }
+    }
+    bool ok = num_samples == 0 ||
+              vocab_projection_logits(scheduler->vocab, scheduler->sample_hidden, num_samples, scheduler->logits);
+    for (int j = 0; ok && j < num_samples; j++) {
+        const int row = scheduler->sample_rows[j];
+        ScheduledRequest* r = scheduler->running[row];
+        const int32_t token = sampler_sample_row(scheduler->sampler, &r->request.sampling,
+                                                 scheduler->logits + (size_t)j * scheduler->vocab->vocab_size,
+                                                 r->tokens, r->length, &r->rng);
+        r->tokens[r->length++] = token;
+        if (r->generated++ == 0) r->timing.first_token = now_seconds();
+        if (r->request.callbacks.on_token) {
+            r->request.callbacks.on_token(r->request.callbacks.user_data, r->id, token);
+        }
+        if (token == r->request.eos_token) {
+            finish_request(scheduler, r, GENERATION_FINISHED_EOS);
+            scheduler->running[row] = NULL;
+        } else if (r->generated == r->request.max_new_tokens) {
+            finish_request(scheduler, r, GENERATION_FINISHED_LENGTH);
+            scheduler->running[row] = NULL;
+        }
+    }
+    // logits失败只影响这一步要采样的序列, 还在预填充的序列照常继续
+    for (int j = 0; !ok && j < num_samples; j++) {
+        const int row = scheduler->sample_rows[j];
+        finish_request(scheduler, scheduler->running[row], GENERATION_FINISHED_ERROR);
+        scheduler->running[row] = NULL;
+    }
+    if (!ok) {
+        failed += num_samples;
+        num_samples = 0;
+    }
+    compact_running(scheduler);
+
+    const double end = now_seconds();
+    pthread_mutex_lock(&scheduler->lock);
+    GenerationSchedulerMetrics* metrics = &scheduler->metrics;
+    metrics->running = scheduler->num_running;
+    metrics->steps++;
+    metrics->generated_tokens += num_samples;
+    metrics->busy_seconds += end - start;
+    scheduler->decoded_rows += rows;
+    // 空闲之后的第一次step开始新窗口, 空闲的时间不计入速度
+    if (scheduler->idle) {
+        scheduler->idle = false;
+        scheduler->window_start = start;
+        scheduler->window_tokens = 0;
+        metrics->tokens_per_second = 0.0;
+    }
+    scheduler->last_step_end = end;
+    scheduler->window_tokens += num_samples;
+    if (end - scheduler->window_start >= SCHEDULER_RATE_WINDOW) {
+        metrics->tokens_per_second = scheduler->window_tokens / (end - scheduler->window_start);
+        scheduler->window_start = end;
+        scheduler->window_tokens = 0;
+    }
+    pthread_mutex_unlock(&scheduler->lock);
+    return failed == rows ? -1 : rows;
+}
+
+bool generation_scheduler_wait(GenerationScheduler* scheduler) {
+    pthread_mutex_lock(&scheduler->lock);
+    while (!scheduler->shutdown && !scheduler->pending_head) {
+        pthread_cond_wait(&scheduler->work_available, &scheduler->lock);
+    }
+    const bool running = !scheduler->shutdown;
+    pthread_mutex_unlock(&scheduler->lock);
+    return running;
+}
+
+void generation_scheduler_shutdown(GenerationScheduler* scheduler) {
+    pthread_mutex_lock(&scheduler->lock);
+    scheduler->shutdown = true;
+    pthread_cond_broadcast(&scheduler->work_available);
+    pthread_mutex_unlock(&scheduler->lock);
+}
+
+GenerationSchedulerMetrics generation_scheduler_metrics(GenerationScheduler* scheduler) {
+    pthread_mutex_lock(&scheduler->lock);
+    GenerationSchedulerMetrics metrics = scheduler->metrics;
+    metrics.queue_depth = scheduler->queue_depth;
+    metrics.reserved_blocks = scheduler->reserved_blocks;
+    metrics.mean_batch = metrics.steps > 0 ? (double)scheduler->decoded_rows / metrics.steps : 0.0;
+    // 最近一个窗口内没有step时速度为0; 第一个窗口还没结束时用到最后一次step为止的部分
+    const double elapsed = scheduler->last_step_end - scheduler->window_start;
+    if (now_seconds() - scheduler->last_step_end > SCHEDULER_RATE_WINDOW) {
+        metrics.tokens_per_second = 0.0;
+    } else if (metrics.tokens_per_second == 0.0 && elapsed > 0.0) {
+        metrics.tokens_per_second = scheduler->window_tokens / elapsed;
+    }
+    pthread_mutex_unlock(&scheduler->lock);
+    pthread_mutex_lock(&scheduler->pool->lock);
+    metrics.used_blocks = scheduler->pool->num_blocks - scheduler->pool->num_free;
+    pthread_mutex_unlock(&scheduler->pool->lock);
+    return metrics;
+}
+
+void generation_scheduler_print_metrics(GenerationScheduler* scheduler, FILE* stream) {
+    const GenerationSchedulerMetrics m = generation_scheduler_metrics(scheduler);
+    fprintf(stream, "Generation scheduler: queue %d, running %d / %d, KV blocks used %d reserved %d of %d\n",
+            m.queue_depth, m.running, m.max_batch, m.used_blocks, m.reserved_blocks, m.total_blocks);
+    fprintf(stream, "  requests: %llu submitted, %llu completed, %llu cancelled, %llu rejected\n",
+            (unsigned long long)m.submitted, (unsigned long long)m.completed,
+            (unsigned long long)m.cancelled, (unsigned long long)m.rejected);
+    fprintf(stream, "  %llu steps, %llu tokens, mean batch %.2f, %.1f tokens/s (busy %.2f s)\n",
+            (unsigned long long)m.steps, (unsigned long long)m.generated_tokens, m.mean_batch,
+            m.tokens_per_second, m.busy_seconds);
+}
+
+void generation_scheduler_free(GenerationScheduler* scheduler) {
+    if (!scheduler) return;
+    for (int i = 0; i < scheduler->num_running; i++) {
+        finish_request(scheduler, scheduler->running[i], GENERATION_FINISHED_CANCELLED);
+    }
+    scheduler->num_running = 0;
+    while (scheduler->pending_head) {
+        ScheduledRequest* r = scheduler->pending_head;
+        scheduler->pending_head = r->next;
+        finish_request(scheduler, r, GENERATION_FINISHED_CANCELLED);
+    }
+    incremental_decoder_free(scheduler->decoder);
+    sampler_free(scheduler->sampler);
+    free(scheduler->running);
+    free(scheduler->seqs);
+    free(scheduler->step_tokens);
+    free(scheduler->positions);
+    free(scheduler->sample_rows);
+    free(scheduler->inputs);
+    free(scheduler->hidden);
+    free(scheduler->sample_hidden);
+    free(scheduler->logits);
+    pthread_mutex_destroy(&scheduler->lock);
+    pthread_cond_destroy(&scheduler->work_available);
+    free(scheduler);
+}
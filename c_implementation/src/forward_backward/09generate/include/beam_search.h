@@ -0,0 +1,67 @@
+#ifndef BEAM_SEARCH_H
+#define BEAM_SEARCH_H
+
+#include "incremental_decoder.h"
+#include "vocab_projection.h"
+#include <stdbool.h>
+#include <stdint.h>
+
+// 束搜索解码, beam_width为1时即greedy解码
+// 编码器和交叉注意力的K/V只算一次 (EncoderMemory), 所有beam共用.
+// 每一步所有存活的beam作为一批送进增量解码器; 选出下一步的beam后, 子beam只fork父beam的块表
+// (增加块引用), 不复制KV缓存; 只有同一个父beam的几个子beam写各自的新位置时才复制最后那一块中已写入的部分
+//
+// 候选: 每条beam取前2*beam_width个词, 再从所有beam的候选中取全局前2*beam_width个,
+// 按分数依次处理: eos结束一个候选假设, 其他的成为下一步的beam, 直到凑满beam_width条
+// 剪枝: 已有beam_width个完成的假设后, 上界 (length_penalty >= 0 时按max_length算惩罚) 不超过
+// 其中最差分数的beam不会再变好, 直接丢弃; 没有存活的beam时提前结束
+
+typedef struct BeamSearchConfig {
+    int beam_width;
+    int max_length;         // 最多生成的token数 (不含bos)
+    int32_t bos_token;      // 解码器的第一个输入
+    int32_t eos_token;
+    float length_penalty;   // 分数 = log_prob / ((5 + length) / 6)^length_penalty, 0为不做长度归一化
+} BeamSearchConfig;
+
+typedef struct BeamHypothesis {
+    int32_t* tokens;        // 生成的token, 不含bos; 以eos结束, 或到达max_length
+    int length;
+    float log_prob;         // 各token对数概率之和
+    float score;            // 长度惩罚后的分数
+    bool finished;          // 以eos结束
+} BeamHypothesis;
+
+typedef struct BeamSearchResult {
+    int num_hypotheses;
+    BeamHypothesis* hypotheses;   // 最多beam_width个, 按score降序
+    int steps;                    // 增量解码的步数
+    int pruned;                   // 因不可能超过已完成假设而提前丢弃的beam数
+} BeamSearchResult;
+
+typedef struct BeamSearch {
+    Transformer* transformer;
+    const TransformerEmbedding* embedding;   // 解码器输入的嵌入
+    const VocabProjection* vocab;
+    KVCachePool* pool;
+    IncrementalDecoder* decoder;
+    BeamSearchConfig config;
+    int candidates;                          // 每条beam和全局保留的候选数 min(2 * beam_width, vocab_size)
+    float* inputs;                           // [beam_width, model_dim]
+    float* hidden;                           // [beam_width, model_dim]
+    int* top_indices;                        // [beam_width, candidates]
+    float* top_logits;                       // [beam_width, candidates]
+    float* log_sum_exp;                      // [beam_width]
+} BeamSearch;
+
+// 模型需满足 incremental_decoder_create 的要求, 缓存池的层数/头数/头维度与解码器一致
+BeamSearch* beam_search_create(Transformer* transformer, const TransformerEmbedding* decoder_embedding,
+                               const VocabProjection* vocab, KVCachePool* pool, const BeamSearchConfig* config);
+void beam_search_free(BeamSearch* search);
+
+// 对一个源序列 encoder_input [1, seq_len, model_dim] 做束搜索, 结果写入result (用 beam_search_result_free 释放)
+// 缓存池中的块在返回前全部归还; 缓存池耗尽时返回false
+bool beam_search_run(BeamSearch* search, Tensor* encoder_input, AttentionMask* enc_mask, BeamSearchResult* result);
+void beam_search_result_free(BeamSearchResult* result);
+
+#endif // BEAM_SEARCH_H
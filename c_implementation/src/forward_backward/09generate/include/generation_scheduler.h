@@ -0,0 +1,155 @@
+#ifndef GENERATION_SCHEDULER_H
+#define GENERATION_SCHEDULER_H
+
+#include "incremental_decoder.h"
+#include "sampler.h"
+#include "vocab_projection.h"
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+
+// 连续批处理的生成调度器
+// 维护一组正在运行的序列, 每次迭代 (generation_scheduler_step):
+//   1. 按提交顺序接纳等待中的请求, 对每个新请求运行一次编码器 (EncoderMemory)
+//   2. 所有运行中的序列各取一个token组成一批做一次增量解码:
+//      还在预填充解码器前缀 (prompt) 的序列输入下一个prompt token, 其他序列输入上一步采出的token
+//   3. 读完prompt的序列计算logits并按各自的采样配置采样, 回调on_token
+//   4. 遇到eos、达到max_new_tokens或被取消的序列立即退出, 空出的位置下一次迭代就能接纳新请求
+// 不同请求的长度互不影响, 一个长序列不会让整个batch等待它
+//
+// 接纳控制: 每个请求按 prompt_length + max_new_tokens 预留KV缓存块 (所有层都是局部注意力时
+// 按 全局前缀 + 窗口 的上限, 见 incremental_decoder_max_blocks), 预留总数不超过缓存池的块数,
+// 也不超过池中空闲块减去运行中的序列还会再取的块 (池可能和其他解码器共用),
+// 因此运行中的序列不会因缓存池耗尽而失败; 序列结束后归还实际使用的块和预留
+// 出错隔离: 不合法的请求在submit时拒绝; 某条序列计算失败时只有它以ERROR结束, 同批的其他序列继续
+// 线程: submit / cancel / metrics 可以在任意线程调用, step 只能由一个计算线程调用, 回调在计算线程中执行
+
+typedef enum GenerationFinishReason {
+    GENERATION_FINISHED_EOS = 0,
+    GENERATION_FINISHED_LENGTH = 1,     // 达到max_new_tokens
+    GENERATION_FINISHED_CANCELLED = 2,
+    GENERATION_FINISHED_REJECTED = 3,   // 参数无效, 或预留的块数超过整个缓存池
+    GENERATION_FINISHED_ERROR = 4
+} GenerationFinishReason;
+
+// 一个请求各阶段的时间点 (CLOCK_MONOTONIC秒), 未到达的阶段为0
+typedef struct GenerationTiming {
+    double submitted;
+    double admitted;                    // 离开等待队列
+    double encoded;                     // 编码器完成
+    double first_token;
+    double finished;
+} GenerationTiming;
+
+typedef struct GenerationCallbacks {
+    // 每采出一个token调用一次 (包括eos)
+    void (*on_token)(void* user_data, uint64_t request_id, int32_t token);
+    // 请求结束时调用一次, 之后不会再有这个请求的回调
+    void (*on_finish)(void* user_data, uint64_t request_id, GenerationFinishReason reason,
+                      const GenerationTiming* timing, int generated_tokens);
+    void* user_data;
+} GenerationCallbacks;
+
+typedef struct GenerationRequest {
+    const int32_t* source_tokens;       // 编码器输入
+    int source_length;
+    const int32_t* prompt_tokens;       // 解码器前缀, 至少一个 (通常是bos)
+    int prompt_length;
+    int max_new_tokens;
+    int32_t eos_token;                  // < 0 时只按长度结束
+    SamplerConfig sampling;
+    uint64_t seed;                      // 与请求id一起决定随机数流
+    GenerationCallbacks callbacks;
+} GenerationRequest;
+
+typedef struct GenerationSchedulerMetrics {
+    int queue_depth;                    // 等待接纳的请求数
+    int running;                        // 运行中的序列数
+    int max_batch;
+    int reserved_blocks;                // 运行中的序列预留的KV块
+    int used_blocks;                    // 缓存池中实际已分配的块
+    int total_blocks;
+    uint64_t submitted;
+    uint64_t completed;                 // 以eos或长度结束
+    uint64_t cancelled;
+    uint64_t rejected;
+    uint64_t steps;
+    uint64_t generated_tokens;
+    double busy_seconds;                // step累计耗时
+    double tokens_per_second;           // 最近一个统计窗口 (不含空闲时间) 的生成速度, 空闲超过一个窗口后为0
+    double mean_batch;                  // 每次解码的平均序列数
+} GenerationSchedulerMetrics;
+
+typedef struct ScheduledRequest ScheduledRequest;
+
+typedef struct GenerationScheduler {
+    Transformer* transformer;
+    const TransformerEmbedding* encoder_embedding;
+    const TransformerEmbedding* decoder_embedding;
+    const VocabProjection* vocab;
+    KVCachePool* pool;
+    IncrementalDecoder* decoder;
+    Sampler* sampler;                   // 只用作草稿空间, 每个请求用自己的SamplerConfig
+    int max_batch;
+
+    // 计算线程独占
+    ScheduledRequest** running;         // [max_batch]
+    int num_running;
+    DecodeSequence** seqs;              // [max_batch] 本次step的序列
+    int32_t* step_tokens;
+    int* positions;
+    int* sample_rows;                   // 本次需要采样的行
+    float* inputs;                      // [max_batch, model_dim]
+    float* hidden;                      // [max_batch, model_dim]
+    float* sample_hidden;               // [max_batch, model_dim] 需要采样的行
+    float* logits;                      // [max_batch, vocab_size]
+
+    // 以下由lock保护
+    pthread_mutex_t lock;
+    pthread_cond_t work_available;
+    ScheduledRequest* pending_head;     // 等待队列, 先进先出
+    ScheduledRequest* pending_tail;
+    ScheduledRequest* live;             // 所有未结束的请求 (等待中和运行中), 供cancel查找
+    int queue_depth;
+    int reserved_blocks;
+    uint64_t next_id;
+    bool shutdown;
+    GenerationSchedulerMetrics metrics;
+    uint64_t decoded_rows;              // 累计解码的行数, 用于mean_batch
+    double window_start;                // tokens_per_second的统计窗口, 空闲后的第一次step重新开始
+    uint64_t window_tokens;
+    double last_step_end;               // 最近一次解码了序列的step结束的时间
+    bool idle;                          // 上一次step没有运行中的序列
+} GenerationScheduler;
+
+// 模型需满足 incremental_decoder_create 的要求; max_batch为一次解码的序列数上限
+GenerationScheduler* generation_scheduler_create(Transformer* transformer,
+                                                 const TransformerEmbedding* encoder_embedding,
+                                                 const TransformerEmbedding* decoder_embedding,
+                                                 const VocabProjection* vocab, KVCachePool* pool, int max_batch);
+
+// 复制请求 (token数组在返回后可以释放) 放进等待队列, 返回请求id (从1开始)
+// 参数无效时立即以REJECTED结束 (在调用线程中回调) 并返回0
+uint64_t generation_scheduler_submit(GenerationScheduler* scheduler, const GenerationRequest* request);
+
+// 标记取消, 下一次step时结束; 请求已结束或id不存在时返回false
+bool generation_scheduler_cancel(GenerationScheduler* scheduler, uint64_t request_id);
+
+// 一次迭代: 接纳、解码一步、采样、退出; 返回本次解码的序列数 (没有工作时为0),
+// 本次所有序列都失败时返回-1
+int generation_scheduler_step(GenerationScheduler* scheduler);
+
+// 计算线程在没有运行中的序列时调用: 等到有新请求或shutdown; 返回false表示已shutdown
+bool generation_scheduler_wait(GenerationScheduler* scheduler);
+
+// 让wait返回false, 之后submit的请求直接REJECTED
+void generation_scheduler_shutdown(GenerationScheduler* scheduler);
+
+GenerationSchedulerMetrics generation_scheduler_metrics(GenerationScheduler* scheduler);
+void generation_scheduler_print_metrics(GenerationScheduler* scheduler, FILE* stream);
+
+// 结束所有未完成的请求 (CANCELLED回调) 并释放; 调用时计算线程不能再调用step
+void generation_scheduler_free(GenerationScheduler* scheduler);
+
+#endif // GENERATION_SCHEDULER_H
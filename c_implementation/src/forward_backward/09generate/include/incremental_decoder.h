@@ -0,0 +1,101 @@
+#ifndef INCREMENTAL_DECODER_H
+#define INCREMENTAL_DECODER_H
+
+#include "transformer.h"
+#include "03transformer_embedding.h"
+#include "kv_cache_pool.h"
+#include <stdbool.h>
+#include <stdint.h>
+
+// 逐token的增量解码
+// 编码器对一个源序列只运行一次, 结果和每个解码器层交叉注意力的K/V保存在EncoderMemory中,
+// 由同一源序列的所有候选 (束搜索的各条beam, 或多个采样) 共享.
+// 解码器自注意力的K/V写在KV缓存池的块中, 每条序列只持有一张块表:
+// fork一条序列只增加块的引用计数, 不复制缓存; 之后写入仍被共享的最后一块时才复制这一块 (写时复制)
+//
+// 一次step为任意多条序列 (可以来自不同的源序列、处于不同的位置) 各计算一个新token,
+// 投影和前馈对所有序列一起做GEMM, 注意力按 (序列, 头) 并行; 序列少、缓存长时再把key切段 (flash-decoding),
+// 自注意力的分页缓存和交叉注意力的编码结果都按段并行, 各段的 (max, sum, acc) 用 split_kv_merge_parts 合并
+// 支持softmax引擎的dense和局部注意力 (自注意力总是因果的); 结果与对整个前缀做因果前向后的最后一个位置相同
+// 所有自注意力层都是局部注意力时, 窗口之外 (全局前缀除外) 的块在之后的step中归还缓存池,
+// 一条序列最多持有 全局前缀 + 最大窗口 的位置, 长度不再受缓存池大小限制
+
+// 一个源序列的编码结果
+typedef struct EncoderMemory {
+    int seq_len;
+    int num_layers;
+    int num_heads;
+    int head_dim;
+    Tensor* output;         // [1, seq_len, model_dim] 编码器输出
+    float* cross_keys;      // [num_layers][num_heads][seq_len][head_dim] 各解码器层交叉注意力的K
+    float* cross_values;    // 同上, V
+} EncoderMemory;
+
+// 运行编码器并预先计算所有解码器层的交叉注意力K/V; encoder_input: [1, seq_len, model_dim]
+EncoderMemory* encoder_memory_create(Transformer* transformer, Tensor* encoder_input, AttentionMask* enc_mask);
+void encoder_memory_free(EncoderMemory* memory);
+
+// 一条解码中的序列
+typedef struct DecodeSequence {
+    const EncoderMemory* memory;
+    int length;             // 已缓存的位置数, 也是下一个token的位置
+    int num_blocks;
+    int block_capacity;
+    int* blocks;            // 块表, 第i块保存位置 [i * block_tokens, (i + 1) * block_tokens); 已回收的块为-1
+    int window_block;       // 局部注意力: 全局前缀之后第一个还没有回收的块
+} DecodeSequence;
+
+// 空序列, 还没有缓存任何位置
+void decode_sequence_init(DecodeSequence* seq, const EncoderMemory* memory);
+
+// dst成为src的副本, 与src共享所有块 (只增加引用计数); dst必须是未使用或已释放的序列
+bool decode_sequence_fork(KVCachePool* pool, const DecodeSequence* src, DecodeSequence* dst);
+
+// 释放块的引用并清空块表
+void decode_sequence_release(KVCachePool* pool, DecodeSequence* seq);
+
+// 序列当前持有的块数 (不含已回收的块)
+int decode_sequence_held_blocks(const DecodeSequence* seq);
+
+// 下一次step需要从池中新取的块数 (0或1): 刚好用完一块, 或者最后一块仍被共享
+int decode_sequence_blocks_needed(KVCachePool* pool, const DecodeSequence* seq);
+
+typedef struct IncrementalDecoder {
+    Transformer* transformer;
+    KVCachePool* pool;
+    int max_rows;           // 一次step最多的序列数
+    int retain_window;      // 所有层都是局部注意力时为最大窗口, 否则为-1 (保留所有位置)
+    int retain_globals;     // 局部注意力的全局token数, 这些位置一直保留
+    float* x;               // [max_rows, model_dim] 当前隐藏状态
+    float* q;
+    float* k;
+    float* v;
+    float* attn;            // [max_rows, num_heads * head_dim] 拼接的各头输出
+    float* sublayer;        // [max_rows, model_dim] 子层输出
+    long part_capacity;     // 分段注意力的段数上限
+    float* part_max;        // [part_capacity] 各段的局部最大值
+    float* part_sum;        // [part_capacity] 各段的指数和
+    float* part_out;        // [part_capacity, head_dim] 各段未归一化的输出
+} IncrementalDecoder;
+
+// 检查模型 (推理模式, 注意力引擎和模式, 投影形状) 与缓存池的层数/头数/头维度是否匹配
+IncrementalDecoder* incremental_decoder_create(Transformer* transformer, KVCachePool* pool, int max_rows);
+void incremental_decoder_free(IncrementalDecoder* decoder);
+
+// 一条序列缓存positions个位置的过程中最多同时持有的块数, 用于接纳控制
+int incremental_decoder_max_blocks(const IncrementalDecoder* decoder, int positions);
+
+// 查找num_rows个token的嵌入, 第i个token位于positions[i], 加上该位置的正弦位置编码 (如果有)
+// output: [num_rows, model_dim]
+bool decode_embed_tokens(const TransformerEmbedding* embedding, const int32_t* tokens,
+                         const int* positions, int num_rows, float* output);
+
+// 为每条序列输入一个token的嵌入 inputs[i] (位于 seqs[i]->length), 输出解码器最后一层经输出线性层后的
+// 隐藏状态 hidden[i], 并把这个位置的K/V写入各序列的缓存, length加1
+// inputs / hidden: [num_rows, model_dim], num_rows <= max_rows; 缓存池没有空闲块或计算失败时返回false,
+// 各序列的length不变, 可以对同样的输入重新调用 (例如逐条重试, 找出失败的序列)
+// 同一时刻只能有一个线程使用同一个IncrementalDecoder
+bool incremental_decoder_step(IncrementalDecoder* decoder, DecodeSequence* const* seqs, int num_rows,
+                              const float* inputs, float* hidden);
+
+#endif // INCREMENTAL_DECODER_H
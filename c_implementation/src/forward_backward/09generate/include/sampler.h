@@ -0,0 +1,61 @@
+#ifndef SAMPLER_H
+#define SAMPLER_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// 从logits采样下一个token: 重复惩罚 -> 温度 -> top-k -> top-p (核采样) -> 按概率抽取
+// 不对整个词表排序:
+//   top-k: 一次扫描维护k个元素的小顶堆 (topk_heap.h), 只对这k个排序, 在它们之内重新归一化
+//   只有top-p: 按概率把词分进固定的桶, 累计概率越过top_p的那个桶以上的词整个在核内,
+//     只对边界桶里的少数词排序; 采样只需要核内的概率和, 与核内的顺序无关
+//   都不限制: 按词表顺序累加概率直到超过随机数, 不需要排序
+// 随机数用Philox计数器: 每条序列一个 (seed, stream) 的流, 结果与batch的组成和顺序无关
+
+typedef struct SamplerConfig {
+    float temperature;          // <= 0 时取logit最大的词 (greedy)
+    int top_k;                  // 只在logit最大的top_k个词中采样, <= 0 为不限制
+    float top_p;                // 只在累计概率达到top_p的最少几个词中采样, >= 1 为不限制
+    float repetition_penalty;   // 已出现的词: logit > 0 时除以它, 否则乘以它 (CTRL); 1为不惩罚
+} SamplerConfig;
+
+// 一条序列的随机数流
+typedef struct SampleRng {
+    uint64_t seed;
+    uint64_t stream;            // 区分不同的序列/请求
+    uint64_t counter;           // 已用的次数
+} SampleRng;
+
+SampleRng sample_rng_init(uint64_t seed, uint64_t stream);
+// [0, 1) 均匀分布
+float sample_rng_uniform(SampleRng* rng);
+
+typedef struct Sampler {
+    SamplerConfig config;
+    int vocab_size;
+    float* cand_logits;         // [vocab_size] 候选的logit (已除以温度)
+    int* cand_indices;          // [vocab_size]
+    float* probs;               // [vocab_size] 只有top-p时各词未归一化的概率
+    uint32_t* seen;             // [vocab_size] 重复惩罚去重用的标记
+    uint32_t seen_mark;
+} Sampler;
+
+Sampler* sampler_create(int vocab_size, const SamplerConfig* config);
+void sampler_free(Sampler* sampler);
+
+// 用给定的config对一行logits [vocab_size] 采样; history为已生成的token (可为NULL), 只用于重复惩罚
+// 重复惩罚就地修改logits中出现过的词, 其余logit不变
+int32_t sampler_sample_row(Sampler* sampler, const SamplerConfig* config, float* logits,
+                           const int32_t* history, int history_length, SampleRng* rng);
+
+// 对 [num_rows, vocab_size] 的logits逐行使用sampler->config采样, 结果写入tokens[num_rows]
+// history / history_lengths 可为NULL, rngs[i]为第i行的随机数流
+bool sampler_sample(Sampler* sampler, float* logits, int num_rows, const int32_t* const* history,
+                    const int* history_lengths, SampleRng* rngs, int32_t* tokens);
+
+// 从按logit降序排列的候选中做top-p采样, 例如 vocab_projection_topk 的输出 (已除以温度)
+// log_sum_exp为归一化常数: 传整个词表的则概率是原分布, 候选的总概率不足top_p时在全部候选中采样
+int32_t sample_from_sorted(const float* logits, const int* indices, int count, float log_sum_exp,
+                           float top_p, SampleRng* rng);
+
+#endif // SAMPLER_H
@@ -0,0 +1,601 @@
+#include "incremental_decoder.h"
+#include "split_kv_attention.h"
+#include "tensor_gemm.h"
+#include "thread_pool.h"
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// 在线softmax每次处理的key数, 这一段的分数放在栈上
+#define DECODE_SCORE_CHUNK 64
+
+// ---- 编码结果 ----
+
+// [seq_len, num_heads * head_dim] -> [num_heads][seq_len][head_dim], 每个头的key连续
+static void split_heads(const float* src, int seq_len, int num_heads, int head_dim, float* dst) {
+    const int width = num_heads * head_dim;
+    for (int h = 0; h < num_heads; h++) {
+        for (int s = 0; s < seq_len; s++) {
+            memcpy(dst + ((size_t)h * seq_len + s) * head_dim, src + (size_t)s * width + h * head_dim,
+                   head_dim * sizeof(float));
+        }
+    }
+}
+
+static void project(const float* input, int rows, int in_dim, const Tensor* weight, const Tensor* bias,
+                    float* output) {
+    const int out_dim = weight->shape[1];
+    gemm_bias_act(input, in_dim, weight->data, out_dim, bias ? bias->data : NULL, output, out_dim,
+                  rows, out_dim, in_dim, GEMM_EPILOGUE_NONE);
+}
+
+EncoderMemory* encoder_memory_create(Transformer* transformer, Tensor* encoder_input, AttentionMask* enc_mask) {
+    if (!transformer || !encoder_input || encoder_input->num_dims != 3 || encoder_input->shape[0] != 1 ||
+        encoder_input->shape[2] != transformer->model_dim) {
+        fprintf(stderr, "encoder_memory_create expects input [1, seq_len, %d]\n",
+                transformer ? transformer->model_dim : 0);
+        return NULL;
+    }
+    Decoder* decoder = transformer->decoder;
+    const MultiHeadAttention* first = decoder->layers[0]->cross_attn;
+    const int seq_len = encoder_input->shape[1];
+    const int model_dim = transformer->model_dim;
+    const int width = first->num_heads * first->head_dim;
+
+    EncoderMemory* memory = (EncoderMemory*)calloc(1, sizeof(EncoderMemory));
+    if (!memory) return NULL;
+    memory->seq_len = seq_len;
+    memory->num_layers = decoder->num_layers;
+    memory->num_heads = first->num_heads;
+    memory->head_dim = first->head_dim;
+    memory->output = tensor_create(encoder_input->shape, 3);
+    const size_t layer_floats = (size_t)seq_len * width;
+    memory->cross_keys = (float*)malloc(layer_floats * decoder->num_layers * sizeof(float));
+    memory->cross_values = (float*)malloc(layer_floats * decoder->num_layers * sizeof(float));
+    float* projected = (float*)malloc(layer_floats * sizeof(float));
+    if (!memory->output || !memory->cross_keys || !memory->cross_values || !projected) goto fail;
+
+    if (!encoder_forward(transformer->encoder, encoder_input, memory->output, enc_mask)) goto fail;
+
+    // 交叉注意力的K/V只依赖编码器输出, 每层算一次, 之后所有解码步和所有候选共用
+    for (int l = 0; l < decoder->num_layers; l++) {
+        const MultiHeadAttention* cross = decoder->layers[l]->cross_attn;
+        project(memory->output->data, seq_len, model_dim, cross->W_k, cross->b_k, projected);
+        split_heads(projected, seq_len, memory->num_heads, memory->head_dim,
+                    memory->cross_keys + layer_floats * l);
+        project(memory->output->data, seq_len, model_dim, cross->W_v, cross->b_v, projected);
+        split_heads(projected, seq_len, memory->num_heads, memory->head_dim,
+                    memory->cross_values + layer_floats * l);
+    }
+    free(projected);
+    return memory;
+
+fail:
+    free(projected);
+    encoder_memory_free(memory);
+    return NULL;
+}
+
+void encoder_memory_free(EncoderMemory* memory) {
+    if (memory) {
+        tensor_free(memory->output);
+        free(memory->cross_keys);
+        free(memory->cross_values);
+        free(memory);
+    }
+}
+
+// ---- 序列的块表 ----
+
+void decode_sequence_init(DecodeSequence* seq, const EncoderMemory* memory) {
+    memset(seq, 0, sizeof(*seq));
+    seq->memory = memory;
+}
+
+bool decode_sequence_fork(KVCachePool* pool, const DecodeSequence* src, DecodeSequence* dst) {
+    decode_sequence_init(dst, src->memory);
+    if (src->num_blocks > 0) {
+        dst->blocks = (int*)malloc(src->block_capacity * sizeof(int));
+        if (!dst->blocks) return false;
+        memcpy(dst->blocks, src->blocks, src->num_blocks * sizeof(int));
+        for (int i = 0; i < src->num_blocks; i++) {
+            if (src->blocks[i] >= 0) kv_cache_pool_retain_block(pool, src->blocks[i]);
+        }
+    }
+    dst->num_blocks = src->num_blocks;
+    dst->block_capacity = src->num_blocks > 0 ? src->block_capacity : 0;
+    dst->window_block = src->window_block;
+    dst->length = src->length;
+    return true;
+}
+
+void decode_sequence_release(KVCachePool* pool, DecodeSequence* seq) {
+    for (int i = 0; i < seq->num_blocks; i++) {
+        if (seq->blocks[i] >= 0) kv_cache_pool_release_block(pool, seq->blocks[i]);
+    }
+    free(seq->blocks);
+    decode_sequence_init(seq, seq->memory);
+}
+
+int decode_sequence_held_blocks(const DecodeSequence* seq) {
+    int held = 0;
+    for (int i = 0; i < seq->num_blocks; i++) {
+        if (seq->blocks[i] >= 0) held++;
+    }
+    return held;
+}
+
+int decode_sequence_blocks_needed(KVCachePool* pool, const DecodeSequence* seq) {
+    const int index = seq->length / pool->block_tokens;
+    if (index >= seq->num_blocks) return 1;
+    return kv_cache_pool_block_refs(pool, seq->blocks[index]) > 1 ? 1 : 0;
+}
+
+// 全局前缀占用的块数, 这些块一直保留
+static int prefix_blocks(const IncrementalDecoder* dec) {
+    return (dec->retain_globals + dec->pool->block_tokens - 1) / dec->pool->block_tokens;
+}
+
+int incremental_decoder_max_blocks(const IncrementalDecoder* decoder, int positions) {
+    const int bt = decoder->pool->block_tokens;
+    const int all = (positions + bt - 1) / bt;
+    if (decoder->retain_window < 0) return all;
+    // 位置p的query需要 [p - window, p] 这window + 1个位置, 最多跨 (window + 1) / bt 向上取整再加1块
+    const int window = prefix_blocks(decoder) + (decoder->retain_window + 1 + bt - 1) / bt + 1;
+    return window < all ? window : all;
+}
+
+// 所有自注意力层都是局部注意力时, 把全局前缀之后、整块落在位置 seq->length 的窗口之前的块还给缓存池
+// 块表中这些位置记为-1, 之后的query不会再读到它们
+static void recycle_window(const IncrementalDecoder* dec, DecodeSequence* seq) {
+    if (dec->retain_window < 0) return;
+    const int bt = dec->pool->block_tokens;
+    const int oldest = seq->length - dec->retain_window;   // 还要读的最早位置
+    int i = seq->window_block > prefix_blocks(dec) ? seq->window_block : prefix_blocks(dec);
+    for (; i < seq->num_blocks && (i + 1) * bt <= oldest; i++) {
+        kv_cache_pool_release_block(dec->pool, seq->blocks[i]);
+        seq->blocks[i] = -1;
+    }
+    if (i > seq->window_block) seq->window_block = i;
+}
+
+// 保证位置 seq->length 所在的块存在且只属于这条序列, 先回收窗口外的块
+static bool reserve_position(const IncrementalDecoder* dec, DecodeSequence* seq) {
+    KVCachePool* pool = dec->pool;
+    recycle_window(dec, seq);
+    const int index = seq->length / pool->block_tokens;
+    if (index < seq->num_blocks) {
+        const int block = seq->blocks[index];
+        if (kv_cache_pool_block_refs(pool, block) <= 1) return true;
+
+        // 最后一块仍与其他序列共享 (如同一个父beam的多个子beam): 只复制已写入的位置
+        const int copy = kv_cache_pool_alloc_block(pool);
+        if (copy < 0) return false;
+        const int used = seq->length % pool->block_tokens;
+        const int segments = pool->num_layers * 2 * pool->num_heads;
+        const size_t segment_floats = (size_t)pool->block_tokens * pool->head_dim;
+        const float* src = pool->storage + (size_t)block * pool->block_floats;
+        float* dst = pool->storage + (size_t)copy * pool->block_floats;
+        for (int s = 0; s < segments; s++) {
+            memcpy(dst + s * segment_floats, src + s * segment_floats, (size_t)used * pool->head_dim * sizeof(float));
+        }
+        kv_cache_pool_release_block(pool, block);
+        seq->blocks[index] = copy;
+        return true;
+    }
+
+    if (seq->num_blocks == seq->block_capacity) {
+        const int capacity = seq->block_capacity > 0 ? seq->block_capacity * 2 : 4;
+        int* blocks = (int*)realloc(seq->blocks, capacity * sizeof(int));
+        if (!blocks) return false;
+        seq->blocks = blocks;
+        seq->block_capacity = capacity;
+    }
+    const int block = kv_cache_pool_alloc_block(pool);
+    if (block < 0) return false;
+    seq->blocks[seq->num_blocks++] = block;
+    return true;
+}
+
+// ---- 解码器 ----
+
+static bool check_attention(const MultiHeadAttention* mha, int model_dim, bool self_attention, int layer) {
+    const int width = mha->num_heads * mha->head_dim;
+    if (mha->engine != ATTENTION_ENGINE_SOFTMAX) {
+        fprintf(stderr, "Incremental decoding needs softmax attention (decoder layer %d)\n", layer);
+        return false;
+    }
+    if (self_attention && mha->attn_config.mode != ATTENTION_DENSE && mha->attn_config.mode != ATTENTION_LOCAL) {
+        fprintf(stderr, "Incremental decoding supports dense and local self-attention (decoder layer %d)\n", layer);
+        return false;
+    }
+    if (mha->W_q->shape[0] != model_dim || mha->W_q->shape[1] != width || mha->W_k->shape[1] != width ||
+        mha->W_v->shape[1] != width || mha->W_o->shape[0] != width || mha->W_o->shape[1] != model_dim) {
+        fprintf(stderr, "Decoder layer %d attention projections must be [%d, %d]\n", layer, model_dim, width);
+        return false;
+    }
+    return true;
+}
+
+IncrementalDecoder* incremental_decoder_create(Transformer* transformer, KVCachePool* pool, int max_rows) {
+    if (!transformer || !pool || max_rows <= 0) return NULL;
+    if (transformer->config.is_training) {
+        fprintf(stderr, "Incremental decoding requires the transformer in inference mode\n");
+        return NULL;
+    }
+    Decoder* decoder = transformer->decoder;
+    const int model_dim = transformer->model_dim;
+    for (int l = 0; l < decoder->num_layers; l++) {
+        if (!check_attention(decoder->layers[l]->self_attn, model_dim, true, l) ||
+            !check_attention(decoder->layers[l]->cross_attn, model_dim, false, l)) {
+            return NULL;
+        }
+    }
+    const MultiHeadAttention* first = decoder->layers[0]->self_attn;
+    if (pool->num_layers != decoder->num_layers || pool->num_heads != first->num_heads ||
+        pool->head_dim != first->head_dim) {
+        fprintf(stderr, "KV cache pool (%d layers, %d heads, head_dim %d) does not match the decoder "
+                "(%d layers, %d heads, head_dim %d)\n", pool->num_layers, pool->num_heads, pool->head_dim,
+                decoder->num_layers, first->num_heads, first->head_dim);
+        return NULL;
+    }
+
+    IncrementalDecoder* dec = (IncrementalDecoder*)calloc(1, sizeof(IncrementalDecoder));
+    if (!dec) return NULL;
+    dec->transformer = transformer;
+    dec->pool = pool;
+    dec->max_rows = max_rows;
+    // 窗口外的位置只有在所有层都不再读时才能回收 (一个块保存所有层的K/V)
+    for (int l = 0; l < decoder->num_layers; l++) {
+        const LayerAttentionConfig* config = &decoder->layers[l]->self_attn->attn_config;
+        if (config->mode != ATTENTION_LOCAL) {
+            dec->retain_window = -1;
+            dec->retain_globals = 0;
+            break;
+        }
+        if (config->window_size > dec->retain_window) dec->retain_window = config->window_size;
+        if (config->num_global_tokens > dec->retain_globals) dec->retain_globals = config->num_global_tokens;
+    }
+    const size_t floats = (size_t)max_rows * model_dim;
+    dec->x = (float*)malloc(floats * sizeof(float));
+    dec->q = (float*)malloc(floats * sizeof(float));
+    dec->k = (float*)malloc(floats * sizeof(float));
+    dec->v = (float*)malloc(floats * sizeof(float));
+    dec->attn = (float*)malloc(floats * sizeof(float));
+    dec->sublayer = (float*)malloc(floats * sizeof(float));
+    // 分段数由 split_kv_choose_splits 选择, 段数最多为 行数 * 头数 + 两倍线程数
+    dec->part_capacity = (long)max_rows * first->num_heads + 2L * thread_pool_num_threads();
+    dec->part_max = (float*)malloc(dec->part_capacity * sizeof(float));
+    dec->part_sum = (float*)malloc(dec->part_capacity * sizeof(float));
+    dec->part_out = (float*)malloc((size_t)dec->part_capacity * first->head_dim * sizeof(float));
+    if (!dec->x || !dec->q || !dec->k || !dec->v || !dec->attn || !dec->sublayer ||
+        !dec->part_max || !dec->part_sum || !dec->part_out) {
+        incremental_decoder_free(dec);
+        return NULL;
+    }
+    return dec;
+}
+
+void incremental_decoder_free(IncrementalDecoder* decoder) {
+    if (decoder) {
+        free(decoder->x);
+        free(decoder->q);
+        free(decoder->k);
+        free(decoder->v);
+        free(decoder->attn);
+        free(decoder->sublayer);
+        free(decoder->part_max);
+        free(decoder->part_sum);
+        free(decoder->part_out);
+        free(decoder);
+    }
+}
+
+bool decode_embed_tokens(const TransformerEmbedding* embedding, const int32_t* tokens,
+                         const int* positions, int num_rows, float* output) {
+    const TokenEmbedding* table = embedding->token_embedding;
+    if (!embedding_gather(table->weights, table->storage, table->row_scales, table->vocab_size,
+                          table->embedding_dim, tokens, num_rows, 1, embedding->embedding_scale,
+                          NULL, 0, output)) {
+        return false;
+    }
+    if (embedding->positional_encoding) {
+        for (int i = 0; i < num_rows; i++) {
+            if (!positional_encoding_add_position(embedding->positional_encoding, positions[i],
+                                                  output + (size_t)i * table->embedding_dim)) {
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+// 在线softmax: 把count个连续的key/value (行跨度head_dim) 累积进 (max, sum, acc)
+static void attend_span(const float* q, const float* keys, const float* values, int count, int head_dim,
+                        float scale, float* max, float* sum, float* acc) {
+    float scores[DECODE_SCORE_CHUNK];
+    for (int start = 0; start < count; start += DECODE_SCORE_CHUNK) {
+        const int n = count - start < DECODE_SCORE_CHUNK ? count - start : DECODE_SCORE_CHUNK;
+        float chunk_max = -INFINITY;
+        for (int j = 0; j < n; j++) {
+            const float* key = keys + (size_t)(start + j) * head_dim;
+            float dot = 0.0f;
+            #pragma omp simd reduction(+:dot)
+            for (int d = 0; d < head_dim; d++) dot += q[d] * key[d];
+            scores[j] = dot * scale;
+            chunk_max = fmaxf(chunk_max, scores[j]);
+        }
+        if (chunk_max > *max) {
+            const float correction = expf(*max - chunk_max);
+            *sum *= correction;
+            for (int d = 0; d < head_dim; d++) acc[d] *= correction;
+            *max = chunk_max;
+        }
+        for (int j = 0; j < n; j++) {
+            const float p = expf(scores[j] - *max);
+            const float* value = values + (size_t)(start + j) * head_dim;
+            *sum += p;
+            #pragma omp simd
+            for (int d = 0; d < head_dim; d++) acc[d] += p * value[d];
+        }
+    }
+}
+
+typedef struct AttentionJob {
+    const IncrementalDecoder* decoder;
+    DecodeSequence* const* seqs;
+    int layer;
+    const LayerAttentionConfig* config;   // 交叉注意力为NULL
+    int num_heads;
+    int head_dim;
+    float scale;
+    int num_splits;                       // 每个 (序列, 头) 的key切成几段, 1表示不切
+} AttentionJob;
+
+// 一个query要看的key: 自注意力为 [0, globals_end) 和 [lo, hi) 两段, 交叉注意力为整个编码结果
+// 把它们连起来编号为 [0, count), 分段计算时按这个编号切分
+typedef struct KeyRange {
+    int globals_end;
+    int lo;
+    int hi;
+} KeyRange;
+
+static KeyRange key_range(const AttentionJob* job, const DecodeSequence* seq) {
+    if (!job->config) return (KeyRange){0, 0, seq->memory->seq_len};
+    // 自注意力: 当前位置已写入缓存, 因果地看 [0, pos]; 局部注意力只看窗口和开头的全局token
+    const int pos = seq->length;
+    int lo = 0;
+    if (job->config->mode == ATTENTION_LOCAL && pos >= job->config->num_global_tokens) {
+        lo = pos - job->config->window_size > 0 ? pos - job->config->window_size : 0;
+    }
+    const int globals = job->config->mode == ATTENTION_LOCAL ? job->config->num_global_tokens : 0;
+    if (lo <= globals) return (KeyRange){0, 0, pos + 1};
+    return (KeyRange){globals, lo, pos + 1};
+}
+
+static int key_count(KeyRange range) {
+    return range.globals_end + range.hi - range.lo;
+}
+
+// 位置 [begin, end) 在块表中的K/V, 按块切成连续的段
+static void attend_cached(const KVCachePool* pool, const DecodeSequence* seq, int layer, int head,
+                          int begin, int end, const float* q, float scale, float* max, float* sum, float* acc) {
+    const int bt = pool->block_tokens;
+    for (int pos = begin; pos < end;) {
+        const int block = seq->blocks[pos / bt];
+        const int slot = pos % bt;
+        const int count = end - pos < bt - slot ? end - pos : bt - slot;
+        const size_t offset = ((size_t)head * bt + slot) * pool->head_dim;
+        attend_span(q, kv_cache_pool_keys(pool, block, layer) + offset,
+                    kv_cache_pool_values(pool, block, layer) + offset,
+                    count, pool->head_dim, scale, max, sum, acc);
+        pos += count;
+    }
+}
+
+// 把编号 [begin, end) 的key累积进 (max, sum, acc), acc未归一化
+static void attend_keys(const AttentionJob* job, const DecodeSequence* seq, int head, KeyRange range,
+                        int begin, int end, const float* q, float* max, float* sum, float* acc) {
+    if (!job->config) {
+        const EncoderMemory* memory = seq->memory;
+        const size_t offset = (((size_t)job->layer * memory->num_heads + head) * memory->seq_len + begin) *
+                              memory->head_dim;
+        attend_span(q, memory->cross_keys + offset, memory->cross_values + offset, end - begin,
+                    job->head_dim, job->scale, max, sum, acc);
+        return;
+    }
+    const KVCachePool* pool = job->decoder->pool;
+    if (begin < range.globals_end) {
+        const int globals_stop = end < range.globals_end ? end : range.globals_end;
+        attend_cached(pool, seq, job->layer, head, begin, globals_stop, q, job->scale, max, sum, acc);
+        begin = globals_stop;
+    }
+    if (begin < end) {
+        const int shift = range.lo - range.globals_end;
+        attend_cached(pool, seq, job->layer, head, begin + shift, end + shift, q, job->scale, max, sum, acc);
+    }
+}
+
+// 不分段: 每个单元是一个 (序列, 头), 直接得到归一化的输出
+static void attention_range(void* ctx, long begin, long end) {
+    const AttentionJob* job = (const AttentionJob*)ctx;
+    const IncrementalDecoder* decoder = job->decoder;
+    const int width = job->num_heads * job->head_dim;
+    for (long t = begin; t < end; t++) {
+        const int row = (int)(t / job->num_heads);
+        const int head = (int)(t % job->num_heads);
+        const DecodeSequence* seq = job->seqs[row];
+        const float* q = decoder->q + (size_t)row * width + head * job->head_dim;
+        float* out = decoder->attn + (size_t)row * width + head * job->head_dim;
+        float max = -INFINITY;
+        float sum = 0.0f;
+        memset(out, 0, job->head_dim * sizeof(float));
+
+        const KeyRange range = key_range(job, seq);
+        attend_keys(job, seq, head, range, 0, key_count(range), q, &max, &sum, out);
+
+        const float inv = sum > 0.0f ? 1.0f / sum : 0.0f;
+        for (int d = 0; d < job->head_dim; d++) out[d] *= inv;
+    }
+}
+
+// 分段 (flash-decoding): 每个单元是 (序列, 头, 段), 局部的 (max, sum, acc) 写进decoder的分段缓冲
+static void attention_parts(void* ctx, long begin, long end) {
+    const AttentionJob* job = (const AttentionJob*)ctx;
+    const IncrementalDecoder* decoder = job->decoder;
+    const int width = job->num_heads * job->head_dim;
+    for (long part = begin; part < end; part++) {
+        const long unit = part / job->num_splits;
+        const int split = (int)(part % job->num_splits);
+        const int row = (int)(unit / job->num_heads);
+        const int head = (int)(unit % job->num_heads);
+        const DecodeSequence* seq = job->seqs[row];
+        const float* q = decoder->q + (size_t)row * width + head * job->head_dim;
+        float* acc = decoder->part_out + (size_t)part * job->head_dim;
+        float max = -INFINITY;
+        float sum = 0.0f;
+        memset(acc, 0, job->head_dim * sizeof(float));
+
+        // 每条序列按自己的key数均分, 短序列后面的段为空
+        const KeyRange range = key_range(job, seq);
+        const int count = key_count(range);
+        const int chunk = (count + job->num_splits - 1) / job->num_splits;
+        const int key_begin = split * chunk < count ? split * chunk : count;
+        const int key_end = key_begin + chunk < count ? key_begin + chunk : count;
+        attend_keys(job, seq, head, range, key_begin, key_end, q, &max, &sum, acc);
+        decoder->part_max[part] = max;
+        decoder->part_sum[part] = sum;
+    }
+}
+
+static void attention_merge(void* ctx, long begin, long end) {
+    const AttentionJob* job = (const AttentionJob*)ctx;
+    const IncrementalDecoder* decoder = job->decoder;
+    for (long unit = begin; unit < end; unit++) {
+        const size_t first = (size_t)unit * job->num_splits;
+        split_kv_merge_parts(decoder->part_max + first, decoder->part_sum + first,
+                             decoder->part_out + first * job->head_dim, job->num_splits, job->head_dim,
+                             decoder->attn + (size_t)unit * job->head_dim);
+    }
+}
+
+// rows条序列的注意力写入 decoder->attn; 序列少而key多时 (行数 * 头数 不够所有线程分) 把key切段,
+// 各段并行计算后按log-sum-exp合并
+static void run_attention(IncrementalDecoder* dec, AttentionJob* job, int rows) {
+    const long units = (long)rows * job->num_heads;
+    int longest = 0;
+    for (int i = 0; i < rows; i++) {
+        const int count = key_count(key_range(job, job->seqs[i]));
+        if (count > longest) longest = count;
+    }
+    int splits = split_kv_choose_splits(rows, job->num_heads, longest, thread_pool_num_threads());
+    if (splits > dec->part_capacity / units) splits = (int)(dec->part_capacity / units);
+    if (splits <= 1) {
+        job->num_splits = 1;
+        thread_pool_parallel_for(units, 0, attention_range, job);
+        return;
+    }
+    job->num_splits = splits;
+    thread_pool_parallel_for(units * splits, 1, attention_parts, job);
+    thread_pool_parallel_for(units, units > 4 ? 0 : units, attention_merge, job);
+}
+
+// 自注意力: 投影, 旋转位置编码, 写入缓存, 对缓存做注意力, 输出投影到 decoder->sublayer
+static bool self_attention_step(IncrementalDecoder* dec, DecodeSequence* const* seqs, int rows, int layer) {
+    const MultiHeadAttention* mha = dec->transformer->decoder->layers[layer]->self_attn;
+    KVCachePool* pool = dec->pool;
+    const int model_dim = dec->transformer->model_dim;
+    const int width = mha->num_heads * mha->head_dim;
+    project(dec->x, rows, model_dim, mha->W_q, mha->b_q, dec->q);
+    project(dec->x, rows, model_dim, mha->W_k, mha->b_k, dec->k);
+    project(dec->x, rows, model_dim, mha->W_v, mha->b_v, dec->v);
+
+    for (int i = 0; i < rows; i++) {
+        const DecodeSequence* seq = seqs[i];
+        float* q = dec->q + (size_t)i * width;
+        float* k = dec->k + (size_t)i * width;
+        if (mha->rope) {
+            float* owned = NULL;
+            const float* sincos = rotary_embedding_rows(mha->rope, seq->length, 1, &owned);
+            if (!sincos) return false;
+            for (int h = 0; h < mha->num_heads; h++) {
+                rotary_rotate(q + h * mha->head_dim, q + h * mha->head_dim, sincos, mha->head_dim);
+                rotary_rotate(k + h * mha->head_dim, k + h * mha->head_dim, sincos, mha->head_dim);
+            }
+            free(owned);
+        }
+        const int block = seq->blocks[seq->length / pool->block_tokens];
+        const int slot = seq->length % pool->block_tokens;
+        for (int h = 0; h < mha->num_heads; h++) {
+            const size_t offset = ((size_t)h * pool->block_tokens + slot) * pool->head_dim;
+            memcpy(kv_cache_pool_keys(pool, block, layer) + offset, k + h * mha->head_dim,
+                   mha->head_dim * sizeof(float));
+            memcpy(kv_cache_pool_values(pool, block, layer) + offset, dec->v + (size_t)i * width + h * mha->head_dim,
+                   mha->head_dim * sizeof(float));
+        }
+    }
+
+    AttentionJob job = {dec, seqs, layer, &mha->attn_config, mha->num_heads, mha->head_dim,
+                        1.0f / sqrtf((float)mha->head_dim), 1};
+    run_attention(dec, &job, rows);
+    project(dec->attn, rows, width, mha->W_o, mha->b_o, dec->sublayer);
+    return true;
+}
+
+// 交叉注意力: 只投影Q, K/V来自各序列的EncoderMemory
+static void cross_attention_step(IncrementalDecoder* dec, DecodeSequence* const* seqs, int rows, int layer) {
+    const MultiHeadAttention* mha = dec->transformer->decoder->layers[layer]->cross_attn;
+    const int width = mha->num_heads * mha->head_dim;
+    project(dec->x, rows, dec->transformer->model_dim, mha->W_q, mha->b_q, dec->q);
+    AttentionJob job = {dec, seqs, layer, NULL, mha->num_heads, mha->head_dim,
+                        1.0f / sqrtf((float)mha->head_dim), 1};
+    run_attention(dec, &job, rows);
+    project(dec->attn, rows, width, mha->W_o, mha->b_o, dec->sublayer);
+}
+
+bool incremental_decoder_step(IncrementalDecoder* decoder, DecodeSequence* const* seqs, int num_rows,
+                              const float* inputs, float* hidden) {
+    if (!decoder || !seqs || !inputs || !hidden || num_rows <= 0 || num_rows > decoder->max_rows) {
+        return false;
+    }
+    for (int i = 0; i < num_rows; i++) {
+        if (!seqs[i] || !seqs[i]->memory) return false;
+        if (!reserve_position(decoder, seqs[i])) {
+            fprintf(stderr, "KV cache pool exhausted (%d blocks)\n", decoder->pool->num_blocks);
+            return false;
+        }
+    }
+
+    Decoder* model = decoder->transformer->decoder;
+    const int model_dim = decoder->transformer->model_dim;
+    memcpy(decoder->x, inputs, (size_t)num_rows * model_dim * sizeof(float));
+    int shape[] = {num_rows, 1, model_dim};
+    Tensor x = {decoder->x, shape, 3, true};
+    Tensor sublayer = {decoder->sublayer, shape, 3, true};
+    const DropoutKey no_dropout = {0};
+
+    for (int l = 0; l < model->num_layers; l++) {
+        DecoderLayer* layer = model->layers[l];
+        if (!self_attention_step(decoder, seqs, num_rows, l) ||
+            !layer_norm_residual_dropout_forward(layer->norm1, &sublayer, &x, &x, 0.0f, no_dropout)) {
+            return false;
+        }
+
+        cross_attention_step(decoder, seqs, num_rows, l);
+        if (!layer_norm_residual_dropout_forward(layer->norm2, &sublayer, &x, &x, 0.0f, no_dropout)) return false;
+
+        const bool ff_ok = layer->moe ? moe_feed_forward_fused(layer->moe, decoder->x, num_rows, decoder->sublayer)
+                                      : feed_forward_fused(layer->ff, decoder->x, num_rows, decoder->sublayer);
+        if (!ff_ok || !layer_norm_residual_dropout_forward(layer->norm3, &sublayer, &x, &x, 0.0f, no_dropout)) {
+            return false;
+        }
+    }
+
+    Tensor out = {hidden, shape, 3, true};
+    if (!linear_forward(model->output_linear, &x, &out)) return false;
+    for (int i = 0; i < num_rows; i++) {
+        seqs[i]->length++;
+    }
+    return true;
+}
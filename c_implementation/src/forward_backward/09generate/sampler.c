@@ -0,0 +1,292 @@
+#include "sampler.h"
+#include "fast_math.h"
+#include "philox.h"
+#include "topk_heap.h"
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// 只有top-p时按 (logit - max) / temperature 分桶的桶数和覆盖的范围, 更小的值都落进最低的桶
+#define SAMPLER_NUCLEUS_BINS 1024
+#define SAMPLER_NUCLEUS_RANGE 32.0f
+
+SampleRng sample_rng_init(uint64_t seed, uint64_t stream) {
+    SampleRng rng = {seed, stream, 0};
+    return rng;
+}
+
+float sample_rng_uniform(SampleRng* rng) {
+    const uint32_t ctr[4] = {(uint32_t)rng->counter, (uint32_t)(rng->counter >> 32),
+                             (uint32_t)rng->stream, (uint32_t)(rng->stream >> 32)};
+    const uint32_t key[2] = {(uint32_t)rng->seed, (uint32_t)(rng->seed >> 32)};
+    uint32_t out[4];
+    philox4x32_10(ctr, key, out);
+    rng->counter++;
+    // 高24位, 保证结果严格小于1
+    return (float)(out[0] >> 8) * (1.0f / 16777216.0f);
+}
+
+Sampler* sampler_create(int vocab_size, const SamplerConfig* config) {
+    if (vocab_size <= 0 || !config) return NULL;
+    Sampler* sampler = (Sampler*)calloc(1, sizeof(Sampler));
+    if (!sampler) return NULL;
+    sampler->config = *config;
+    sampler->vocab_size = vocab_size;
+    sampler->cand_logits = (float*)malloc(vocab_size * sizeof(float));
+    sampler->cand_indices = (int*)malloc(vocab_size * sizeof(int));
+    sampler->probs = (float*)malloc(vocab_size * sizeof(float));
+    sampler->seen = (uint32_t*)calloc(vocab_size, sizeof(uint32_t));
+    if (!sampler->cand_logits || !sampler->cand_indices || !sampler->probs || !sampler->seen) {
+        sampler_free(sampler);
+        return NULL;
+    }
+    return sampler;
+}
+
+void sampler_free(Sampler* sampler) {
+    if (sampler) {
+        free(sampler->cand_logits);
+        free(sampler->cand_indices);
+        free(sampler->probs);
+        free(sampler->seen);
+        free(sampler);
+    }
+}
+
+// 每个出现过的词只惩罚一次: 用递增的标记代替每行清空
+static void apply_repetition_penalty(Sampler* sampler, float penalty, float* logits,
+                                     const int32_t* history, int history_length) {
+    if (++sampler->seen_mark == 0) {
+        memset(sampler->seen, 0, sampler->vocab_size * sizeof(uint32_t));
+        sampler->seen_mark = 1;
+    }
+    for (int i = 0; i < history_length; i++) {
+        const int32_t token = history[i];
+        if (token < 0 || token >= sampler->vocab_size || sampler->seen[token] == sampler->seen_mark) continue;
+        sampler->seen[token] = sampler->seen_mark;
+        logits[token] = logits[token] > 0.0f ? logits[token] / penalty : logits[token] * penalty;
+    }
+}
+
+static float max_value(const float* x, int n) {
+    int i = 0;
+    float m = -INFINITY;
+#if VF_WIDTH > 0
+    vfloat vm = vf_set1(-INFINITY);
+    for (; i + VF_WIDTH <= n; i += VF_WIDTH) vm = vf_max(vm, vf_load(x + i));
+    m = vf_hmax(vm);
+#endif
+    for (; i < n; i++) m = fmaxf(m, x[i]);
+    return m;
+}
+
+// 第一个最大值, 与 vocab_projection_argmax 一致: 先用SIMD求最大值再找它第一次出现的位置
+static int32_t argmax(const float* logits, int n) {
+    const float max = max_value(logits, n);
+    for (int i = 0; i < n; i++) {
+        if (logits[i] == max) return i;
+    }
+    return 0;
+}
+
+// sum(exp((x - max) * scale))
+static float sum_exp(const float* x, int n, float max, float scale) {
+    int i = 0;
+    float sum = 0.0f;
+#if VF_WIDTH > 0
+    const vfloat vmax = vf_set1(max);
+    const vfloat vscale = vf_set1(scale);
+    vfloat acc = vf_set1(0.0f);
+    for (; i + VF_WIDTH <= n; i += VF_WIDTH) {
+        acc = vf_add(acc, vf_exp(vf_mul(vf_sub(vf_load(x + i), vmax), vscale)));
+    }
+    sum = vf_hsum(acc);
+#endif
+    for (; i < n; i++) sum += fast_expf((x[i] - max) * scale);
+    return sum;
+}
+
+int32_t sample_from_sorted(const float* logits, const int* indices, int count, float log_sum_exp,
+                           float top_p, SampleRng* rng) {
+    if (count <= 0) return -1;
+    // 核: 累计概率第一次达到top_p的前缀 (包括越过top_p的那个词)
+    float mass = 0.0f;
+    int n = 0;
+    while (n < count) {
+        mass += fast_expf(logits[n++] - log_sum_exp);
+        if (mass >= top_p) break;
+    }
+    float target = sample_rng_uniform(rng) * mass;
+    for (int i = 0; i < n; i++) {
+        target -= fast_expf(logits[i] - log_sum_exp);
+        if (target < 0.0f) return indices[i];
+    }
+    return indices[n - 1];
+}
+
+// 不截断: 按词表顺序累加概率, 整块的和不够时跳过这一块
+static int32_t sample_full(const float* logits, int n, float inv_temperature, float log_sum_exp, SampleRng* rng) {
+    float target = sample_rng_uniform(rng);
+    const float offset = log_sum_exp / inv_temperature;   // (logit - offset) * inv_t = logit * inv_t - lse
+    int i = 0;
+#if VF_WIDTH > 0
+    const vfloat voffset = vf_set1(offset);
+    const vfloat vscale = vf_set1(inv_temperature);
+    for (; i + VF_WIDTH <= n; i += VF_WIDTH) {
+        const float block = vf_hsum(vf_exp(vf_mul(vf_sub(vf_load(logits + i), voffset), vscale)));
+        if (target < block) break;
+        target -= block;
+    }
+#endif
+    for (; i < n; i++) {
+        target -= fast_expf((logits[i] - offset) * inv_temperature);
+        if (target < 0.0f) return i;
+    }
+    // 舍入误差使总和略小于随机数时取概率最大的词
+    return argmax(logits, n);
+}
+
+// 一次扫描维护k个最大值的小顶堆; 堆满后整段都不超过堆顶时跳过这一段
+static void top_k_scan(const float* logits, int n, int k, float* values, int* indices, int* count) {
+    int v = 0;
+    for (; v < n && *count < k; v++) {
+        topk_push(values, indices, count, k, logits[v], v);
+    }
+#if VF_WIDTH > 0
+    for (; v + 4 * VF_WIDTH <= n; v += 4 * VF_WIDTH) {
+        const vfloat m = vf_max(vf_max(vf_load(logits + v), vf_load(logits + v + VF_WIDTH)),
+                                vf_max(vf_load(logits + v + 2 * VF_WIDTH), vf_load(logits + v + 3 * VF_WIDTH)));
+        // 值相等时下标大的更差, 所以不大于堆顶的段不会改变结果
+        if (vf_hmax(m) <= values[0]) continue;
+        for (int j = v; j < v + 4 * VF_WIDTH; j++) {
+            topk_push(values, indices, count, k, logits[j], j);
+        }
+    }
+#endif
+    for (; v < n; v++) {
+        topk_push(values, indices, count, k, logits[v], v);
+    }
+}
+
+// 离max越远桶号越小; 差距在转换成int之前截到最低的桶, -inf的logit、很大的差距和NaN都落在桶0,
+// 否则越界的float转int是未定义行为
+static int nucleus_bin(float logit, float max, float inv_temperature) {
+    float distance = (max - logit) * inv_temperature * (SAMPLER_NUCLEUS_BINS / SAMPLER_NUCLEUS_RANGE);
+    if (!(distance < (float)(SAMPLER_NUCLEUS_BINS - 1))) distance = (float)(SAMPLER_NUCLEUS_BINS - 1);
+    return SAMPLER_NUCLEUS_BINS - 1 - (int)distance;
+}
+
+// 只有top-p: 按概率分桶, 找到累计概率越过top_p的那个桶, 只对这个桶里的词排序
+// 更高的桶整个在核内, 采样只需要核内的概率和, 与顺序无关, 所以它们不用排序
+static int32_t sample_nucleus(Sampler* sampler, const float* logits, float max, float inv_temperature,
+                              float top_p, SampleRng* rng) {
+    const int vocab = sampler->vocab_size;
+    float* unnormalized = sampler->probs;
+    int v = 0;
+#if VF_WIDTH > 0
+    const vfloat vmax = vf_set1(max);
+    const vfloat vscale = vf_set1(inv_temperature);
+    for (; v + VF_WIDTH <= vocab; v += VF_WIDTH) {
+        vf_store(unnormalized + v, vf_exp(vf_mul(vf_sub(vf_load(logits + v), vmax), vscale)));
+    }
+#endif
+    for (; v < vocab; v++) unnormalized[v] = fast_expf((logits[v] - max) * inv_temperature);
+
+    float bin_mass[SAMPLER_NUCLEUS_BINS] = {0};
+    float total = 0.0f;
+    for (v = 0; v < vocab; v++) {
+        bin_mass[nucleus_bin(logits[v], max, inv_temperature)] += unnormalized[v];
+        total += unnormalized[v];
+    }
+
+    const float target_mass = top_p * total;
+    float above = 0.0f;
+    int boundary = SAMPLER_NUCLEUS_BINS - 1;
+    while (boundary > 0 && above + bin_mass[boundary] < target_mass) {
+        above += bin_mass[boundary--];
+    }
+
+    // 更高桶的词放在前面, 边界桶的词接在后面组成小顶堆
+    float* probs = sampler->cand_logits;
+    int* indices = sampler->cand_indices;
+    int num_above = 0;
+    for (v = 0; v < vocab; v++) {
+        if (nucleus_bin(logits[v], max, inv_temperature) > boundary) {
+            probs[num_above] = unnormalized[v];
+            indices[num_above++] = v;
+        }
+    }
+    float* boundary_probs = probs + num_above;
+    int* boundary_indices = indices + num_above;
+    int num_boundary = 0;
+    for (v = 0; v < vocab; v++) {
+        if (nucleus_bin(logits[v], max, inv_temperature) == boundary) {
+            topk_push(boundary_probs, boundary_indices, &num_boundary, vocab - num_above, unnormalized[v], v);
+        }
+    }
+    topk_sort_desc(boundary_probs, boundary_indices, num_boundary);
+
+    // 边界桶中按概率从大到小加入, 直到达到top_p (包括越过top_p的那个词)
+    float mass = above;
+    int taken = 0;
+    while (taken < num_boundary) {
+        mass += boundary_probs[taken++];
+        if (mass >= target_mass) break;
+    }
+
+    float target = sample_rng_uniform(rng) * mass;
+    const int count = num_above + taken;
+    if (count == 0) return argmax(logits, vocab);
+    for (int i = 0; i < count; i++) {
+        target -= probs[i];
+        if (target < 0.0f) return indices[i];
+    }
+    return indices[count - 1];
+}
+
+int32_t sampler_sample_row(Sampler* sampler, const SamplerConfig* config, float* logits,
+                           const int32_t* history, int history_length, SampleRng* rng) {
+    const int vocab = sampler->vocab_size;
+    if (history && history_length > 0 && config->repetition_penalty > 0.0f && config->repetition_penalty != 1.0f) {
+        apply_repetition_penalty(sampler, config->repetition_penalty, logits, history, history_length);
+    }
+    if (config->temperature <= 0.0f || config->top_k == 1) {
+        return argmax(logits, vocab);
+    }
+    const float inv_t = 1.0f / config->temperature;
+    float* cand = sampler->cand_logits;
+    int* idx = sampler->cand_indices;
+    int count = 0;
+
+    if (config->top_k > 0 && config->top_k < vocab) {
+        // top-k之后在这k个词内重新归一化
+        top_k_scan(logits, vocab, config->top_k, cand, idx, &count);
+        topk_sort_desc(cand, idx, count);
+        for (int i = 0; i < count; i++) cand[i] *= inv_t;
+        const float lse = cand[0] + logf(sum_exp(cand, count, cand[0], 1.0f));
+        return sample_from_sorted(cand, idx, count, lse, config->top_p, rng);
+    }
+
+    const float max = max_value(logits, vocab);
+    if (config->top_p >= 1.0f) {
+        const float lse = max * inv_t + logf(sum_exp(logits, vocab, max, inv_t));
+        return sample_full(logits, vocab, inv_t, lse, rng);
+    }
+    return sample_nucleus(sampler, logits, max, inv_t, config->top_p, rng);
+}
+
+bool sampler_sample(Sampler* sampler, float* logits, int num_rows, const int32_t* const* history,
+                    const int* history_lengths, SampleRng* rngs, int32_t* tokens) {
+    if (!sampler || !logits || !rngs || !tokens || num_rows < 0) return false;
+    for (int i = 0; i < num_rows; i++) {
+        tokens[i] = sampler_sample_row(sampler, &sampler->config, logits + (size_t)i * sampler->vocab_size,
+                                       history ? history[i] : NULL, history_lengths ? history_lengths[i] : 0,
+                                       &rngs[i]);
+        if (tokens[i] < 0) {
+            fprintf(stderr, "Sampling failed for row %d\n", i);
+            return false;
+        }
+    }
+    return true;
+}
@@ -0,0 +1,58 @@
+#ifndef HALF_H
+#define HALF_H
+
+#include <stdint.h>
+#include <string.h>
+
+// IEEE 754 半精度 (fp16) 与float互转, 用于压缩存储的权重表
+
+// 无分支实现, 可在simd循环中向量化
+// 把指数和尾数移到float的位置后乘 2^112 完成指数偏置调整, 同时正确处理非规格化数
+static inline float half_to_float(uint16_t h) {
+    uint32_t bits = (uint32_t)(h & 0x7fffu) << 13;
+    float magnitude;
+    memcpy(&magnitude, &bits, sizeof(float));
+    magnitude *= 5.192296858534828e+33f;  // 2^112
+
+    memcpy(&bits, &magnitude, sizeof(float));
+    bits |= (h & 0x7c00u) == 0x7c00u ? 0x7f800000u : 0u;  // inf / nan
+    bits |= (uint32_t)(h & 0x8000u) << 16;
+
+    float result;
+    memcpy(&result, &bits, sizeof(float));
+    return result;
+}
+
+// 就近舍入到偶数, 超出范围的值变为inf
+static inline uint16_t float_to_half(float f) {
+    uint32_t bits;
+    memcpy(&bits, &f, sizeof(float));
+    const uint16_t sign = (uint16_t)((bits >> 16) & 0x8000u);
+    bits &= 0x7fffffffu;
+
+    if (bits >= 0x7f800000u) {  // inf / nan
+        return sign | 0x7c00u | (bits > 0x7f800000u ? 0x200u : 0u);
+    }
+    if (bits >= 0x477ff000u) {  // >= 65520, 舍入后溢出
+        return sign | 0x7c00u;
+    }
+    if (bits < 0x38800000u) {   // 非规格化数或0
+        if (bits < 0x33000000u) return sign;  // < 2^-25, 舍入为0
+        const uint32_t exponent = bits >> 23;
+        const uint32_t mantissa = (bits & 0x7fffffu) | 0x800000u;
+        const uint32_t shift = 126 - exponent;  // 14..24
+        uint32_t half = mantissa >> shift;
+        const uint32_t rest = mantissa & ((1u << shift) - 1);
+        const uint32_t halfway = 1u << (shift - 1);
+        if (rest > halfway || (rest == halfway && (half & 1u))) half++;
+        return sign | (uint16_t)half;
+    }
+
+    // 规格化数: 调整指数偏置后舍入尾数的低13位, 进位可自然进入指数
+    uint32_t half = ((bits - 0x38000000u) >> 13);
+    const uint32_t rest = bits & 0x1fffu;
+    if (rest > 0x1000u || (rest == 0x1000u && (half & 1u))) half++;
+    return sign | (uint16_t)half;
+}
+
+#endif // HALF_H
@@ -3,13 +3,16 @@
 
 #include <stdbool.h>
 #include <stddef.h>
+#include <stdint.h>
 
 typedef struct Tensor Tensor;
+typedef struct IntTensor IntTensor;
 
 struct Tensor {
     float* data;    // 数据指针
     int* shape;     // 维度数组
     int num_dims;   // 维度数量
+    bool borrowed_data;   // data不归张量所有 (如在大页内存区中), tensor_free不释放
 };
 
 size_t calculate_total_size(const int* shape, int num_dims);
@@ -17,4 +20,15 @@ bool check_same_shape(const Tensor* A, const Tensor* B);
 Tensor* tensor_create(int* shape, int num_dims);
 void tensor_free(Tensor* tensor);
 bool tensor_copy(Tensor* dst, const Tensor* src);
+void tensor_fill(Tensor* tensor, float value);
+
+// 整数张量, 用于token id等索引数据, 避免以float存储再转换
+struct IntTensor {
+    int32_t* data;  // 数据指针
+    int* shape;     // 维度数组
+    int num_dims;   // 维度数量
+};
+
+IntTensor* int_tensor_create(int* shape, int num_dims);
+void int_tensor_free(IntTensor* tensor);
 #endif // TENSOR_TYPE_H
@@ -1,5 +1,7 @@
 #include "tensor_type.h"
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 #include <stdbool.h>
 
 size_t calculate_total_size(const int* shape, int num_dims) {
@@ -43,6 +45,7 @@ Tensor* tensor_create(int* shape, int num_dims) {
     }
     memcpy(tensor->shape, shape, num_dims * sizeof(int));
     tensor->num_dims = num_dims;
+    tensor->borrowed_data = false;
 
     // 计算并分配数据空间
     size_t total_size = calculate_total_size(shape, num_dims);
@@ -59,7 +62,9 @@ Tensor* tensor_create(int* shape, int num_dims) {
 // 释放张量
 void tensor_free(Tensor* tensor) {
     if (tensor) {
-        free(tensor->data);
+        if (!tensor->borrowed_data) {
+            free(tensor->data);
+        }
         free(tensor->shape);
         free(tensor);
     }
@@ -81,3 +86,50 @@ bool tensor_copy(Tensor* dst, const Tensor* src) {
 
     return true;
 }
+
+// 所有元素设为value
+void tensor_fill(Tensor* tensor, float value) {
+    if (!tensor) return;
+    size_t total_size = calculate_total_size(tensor->shape, tensor->num_dims);
+    for (size_t i = 0; i < total_size; i++) {
+        tensor->data[i] = value;
+    }
+}
+
+// 创建整数张量, 数据初始化为0
+IntTensor* int_tensor_create(int* shape, int num_dims) {
+    if (!shape || num_dims <= 0) {
+        fprintf(stderr, "Invalid shape or dimensions\n");
+        return NULL;
+    }
+
+    IntTensor* tensor = (IntTensor*)malloc(sizeof(IntTensor));
+    if (!tensor) {
+        return NULL;
+    }
+
+    tensor->shape = (int*)malloc(num_dims * sizeof(int));
+    if (!tensor->shape) {
+        free(tensor);
+        return NULL;
+    }
+    memcpy(tensor->shape, shape, num_dims * sizeof(int));
+    tensor->num_dims = num_dims;
+
+    tensor->data = (int32_t*)calloc(calculate_total_size(shape, num_dims), sizeof(int32_t));
+    if (!tensor->data) {
+        free(tensor->shape);
+        free(tensor);
+        return NULL;
+    }
+
+    return tensor;
+}
+
+void int_tensor_free(IntTensor* tensor) {
+    if (tensor) {
+        free(tensor->data);
+        free(tensor->shape);
+        free(tensor);
+    }
+}
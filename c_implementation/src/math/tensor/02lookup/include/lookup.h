@@ -2,16 +2,33 @@
 #define LOOKUP_H
 
 #include <stdbool.h>
+#include <stdint.h>
 #include "tensor_type.h"
 
-bool perform_embedding_lookup(
-    const Tensor* embedding_matrix,
-    const Tensor* tokens,
-    Tensor* output,
+// 嵌入表的存储格式, 表均为行主序 [vocab_size, embedding_dim]
+typedef enum EmbeddingStorage {
+    EMBEDDING_FP32 = 0,     // float
+    EMBEDDING_FP16 = 1,     // IEEE半精度
+    EMBEDDING_INT8 = 2      // 每行对称量化: value = q * row_scales[row]
+} EmbeddingStorage;
+
+// 嵌入查找, 融合缩放与位置编码相加:
+//   output[b][s] = dequant(table[tokens[b][s]]) * scale + position_rows[s]
+// position_rows: [num_position_rows, embedding_dim], 可为NULL; s >= num_position_rows 的位置不加位置编码
+// 按 (b, s) 多线程, 每行SIMD计算, 并提前预取后面token的行
+bool embedding_gather(
+    const void* table,
+    EmbeddingStorage storage,
+    const float* row_scales,    // 只用于EMBEDDING_INT8, [vocab_size]
+    int vocab_size,
+    int embedding_dim,
+    const int32_t* tokens,      // [batch_size, seq_length]
     int batch_size,
     int seq_length,
-    int embedding_dim
+    float scale,
+    const float* position_rows,
+    int num_position_rows,
+    float* output               // [batch_size, seq_length, embedding_dim]
 );
 
 #endif // LOOKUP_H
-
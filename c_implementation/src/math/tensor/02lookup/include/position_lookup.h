@@ -4,10 +4,27 @@
 #include <stdbool.h>
 #include "tensor_type.h"
 
+// 正弦位置编码的行间隔: 每隔这么多行用sin/cos直接重新计算一次, 中间行用角度加法递推
+#define POSITION_ANCHOR_INTERVAL 64
+
+// 计算位置 [start_pos, start_pos + num_positions) 的sin/cos表, 写入 dst [num_positions, dim]
+// dst[p][2k] = sin(p * w_k), dst[p][2k+1] = cos(p * w_k), w_k = base^(-2k / dim)
+// 用 sin((p+1)w) = sin(pw)cos(w) + cos(pw)sin(w) 递推, 每行只需乘加, 不调用powf/sinf/cosf
+// 递推在double下进行并定期重新锚定, 与直接计算的误差在float精度内
+// 正弦位置编码 (base 10000) 与RoPE的cos/sin缓存都用它生成
+bool compute_sinusoid_table(
+    float* dst,
+    int start_pos,
+    int num_positions,
+    int dim,
+    double base
+);
+
+// 正弦位置编码, 即 base = 10000 的compute_sinusoid_table
 bool compute_positional_encodings(
-    Tensor* encodings,
-    int batch_size,
-    int max_seq_length,
+    float* dst,
+    int start_pos,
+    int num_positions,
     int encoding_dim
 );
 
@@ -1,35 +1,133 @@
 #include "lookup.h"
+#include "half.h"
+#include "thread_pool.h"
+#include <stdatomic.h>
 #include <stdio.h>
 #include <string.h>
 
-// 新增的嵌入查找函数，便于将来GPU加速
-bool perform_embedding_lookup(
-    const Tensor* embedding_matrix,
-    const Tensor* tokens,
-    Tensor* output,
-    int batch_size, 
-    int seq_length,
-    int embedding_dim
-) {
-    // 这部分将来可以替换为GPU实现
-    for (int b = 0; b < batch_size; b++) {
-        for (int s = 0; s < seq_length; s++) {
-            int token = (int)tokens->data[b * seq_length + s];
-            
-            // 检查token是否超出范围
-            if (token < 0 || token >= embedding_matrix->shape[0]) {
-                fprintf(stderr, "Token id %d exceeds vocabulary size %d\n", 
-                    token, embedding_matrix->shape[0]);
-                return false;
+// 预取多少个token之后的行, 查找是随机访问, 硬件预取器帮不上忙
+#define EMBEDDING_PREFETCH_DISTANCE 4
+
+static size_t embedding_row_bytes(EmbeddingStorage storage, int embedding_dim) {
+    switch (storage) {
+        case EMBEDDING_FP16: return (size_t)embedding_dim * sizeof(uint16_t);
+        case EMBEDDING_INT8: return (size_t)embedding_dim * sizeof(int8_t);
+        default:             return (size_t)embedding_dim * sizeof(float);
+    }
+}
+
+static void embedding_prefetch_row(const void* table, size_t row_bytes, int token, int vocab_size) {
+    if (token < 0 || token >= vocab_size) return;
+    const char* row = (const char*)table + (size_t)token * row_bytes;
+    for (size_t offset = 0; offset < row_bytes; offset += 64) {
+        __builtin_prefetch(row + offset, 0, 1);
+    }
+}
+
+typedef struct EmbeddingGatherJob {
+    const void* table;
+    EmbeddingStorage storage;
+    const float* row_scales;
+    int vocab_size;
+    int embedding_dim;
+    const int32_t* tokens;
+    int num_tokens;
+    int seq_length;
+    float scale;
+    const float* position_rows;
+    int num_position_rows;
+    float* output;
+    size_t row_bytes;
+    atomic_bool failed;
+} EmbeddingGatherJob;
+
+static void embedding_gather_range(void* ctx, long begin, long end) {
+    EmbeddingGatherJob* job = (EmbeddingGatherJob*)ctx;
+    const int embedding_dim = job->embedding_dim;
+    const float scale = job->scale;
+    for (long t = begin; t < end; t++) {
+        const int token = job->tokens[t];
+        if (token < 0 || token >= job->vocab_size) {
+            fprintf(stderr, "Token id %d exceeds vocabulary size %d\n", token, job->vocab_size);
+            atomic_store(&job->failed, true);
+            continue;
+        }
+        if (t + EMBEDDING_PREFETCH_DISTANCE < job->num_tokens) {
+            embedding_prefetch_row(job->table, job->row_bytes, job->tokens[t + EMBEDDING_PREFETCH_DISTANCE],
+                                   job->vocab_size);
+        }
+
+        const int s = t % job->seq_length;
+        const float* pos = job->position_rows && s < job->num_position_rows ?
+                           job->position_rows + (size_t)s * embedding_dim : NULL;
+        float* dst = job->output + (size_t)t * embedding_dim;
+
+        switch (job->storage) {
+            case EMBEDDING_FP32: {
+                const float* src = (const float*)job->table + (size_t)token * embedding_dim;
+                if (pos) {
+                    #pragma omp simd
+                    for (int d = 0; d < embedding_dim; d++) dst[d] = src[d] * scale + pos[d];
+                } else if (scale != 1.0f) {
+                    #pragma omp simd
+                    for (int d = 0; d < embedding_dim; d++) dst[d] = src[d] * scale;
+                } else {
+                    memcpy(dst, src, embedding_dim * sizeof(float));
+                }
+                break;
+            }
+            case EMBEDDING_FP16: {
+                const uint16_t* src = (const uint16_t*)job->table + (size_t)token * embedding_dim;
+                if (pos) {
+                    #pragma omp simd
+                    for (int d = 0; d < embedding_dim; d++) dst[d] = half_to_float(src[d]) * scale + pos[d];
+                } else {
+                    #pragma omp simd
+                    for (int d = 0; d < embedding_dim; d++) dst[d] = half_to_float(src[d]) * scale;
+                }
+                break;
+            }
+            case EMBEDDING_INT8: {
+                const int8_t* src = (const int8_t*)job->table + (size_t)token * embedding_dim;
+                const float row_scale = job->row_scales[token] * scale;
+                if (pos) {
+                    #pragma omp simd
+                    for (int d = 0; d < embedding_dim; d++) dst[d] = (float)src[d] * row_scale + pos[d];
+                } else {
+                    #pragma omp simd
+                    for (int d = 0; d < embedding_dim; d++) dst[d] = (float)src[d] * row_scale;
+                }
+                break;
             }
-            
-            // 计算源和目标的偏移量
-            float* dst = output->data + (b * seq_length + s) * embedding_dim;
-            float* src = embedding_matrix->data + token * embedding_dim;
-            
-            // 复制embedding向量
-            memcpy(dst, src, embedding_dim * sizeof(float));
         }
     }
-    return true;
-}
\ No newline at end of file
+}
+
+// 嵌入查找函数, 便于将来GPU加速
+bool embedding_gather(
+    const void* table,
+    EmbeddingStorage storage,
+    const float* row_scales,
+    int vocab_size,
+    int embedding_dim,
+    const int32_t* tokens,
+    int batch_size,
+    int seq_length,
+    float scale,
+    const float* position_rows,
+    int num_position_rows,
+    float* output
+) {
+    if (!table || !tokens || !output || (storage == EMBEDDING_INT8 && !row_scales)) {
+        fprintf(stderr, "Invalid arguments to embedding_gather\n");
+        return false;
+    }
+
+    const int num_tokens = batch_size * seq_length;
+    const size_t row_bytes = embedding_row_bytes(storage, embedding_dim);
+    EmbeddingGatherJob job = {table, storage, row_scales, vocab_size, embedding_dim, tokens, num_tokens, seq_length,
+                              scale, position_rows, num_position_rows, output, row_bytes, false};
+    thread_pool_parallel_for(num_tokens, (size_t)num_tokens * embedding_dim > 65536 ? 0 : num_tokens,
+                             embedding_gather_range, &job);
+    return !atomic_load(&job.failed);
+}
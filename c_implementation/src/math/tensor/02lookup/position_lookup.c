@@ -1,26 +1,102 @@
 #include "position_lookup.h"
+#include "thread_pool.h"
+#include <stdatomic.h>
 #include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
 
-// 新增：位置编码计算函数
-bool compute_positional_encodings(
-    Tensor* encodings,
-    int batch_size,
-    int max_seq_length,
-    int encoding_dim
-) {
-    if (!encodings) return false;
-
-    for (int batch = 0; batch < batch_size; batch++) {
-        for (int pos = 0; pos < max_seq_length; pos++) {
-            for (int i = 0; i < encoding_dim; i += 2) {
-                float angle = pos / powf(10000.0f, (float)i / encoding_dim);
-                int idx = (batch * max_seq_length * encoding_dim) + (pos * encoding_dim) + i;
-                encodings->data[idx] = sinf(angle);    // this part modify later to use sin and cos lookup table from model file
-                if (i + 1 < encoding_dim) {
-                    encodings->data[idx + 1] = cosf(angle);
+typedef struct SinusoidJob {
+    float* dst;
+    int start_pos;
+    int num_positions;
+    int encoding_dim;
+    int num_freqs;
+    const double* freqs;
+    const double* step_sin;
+    const double* step_cos;
+    atomic_bool failed;
+} SinusoidJob;
+
+// 每个锚定区间从锚点的精确值开始递推
+static void sinusoid_chunks(void* ctx, long begin, long end) {
+    SinusoidJob* job = (SinusoidJob*)ctx;
+    const int num_freqs = job->num_freqs;
+    const int encoding_dim = job->encoding_dim;
+    double* state = (double*)malloc(2 * num_freqs * sizeof(double));
+    if (!state) {
+        atomic_store(&job->failed, true);
+        return;
+    }
+    double* cur_sin = state;
+    double* cur_cos = state + num_freqs;
+
+    for (long chunk = begin; chunk < end; chunk++) {
+        const int first = (int)chunk * POSITION_ANCHOR_INTERVAL;
+        const int last = first + POSITION_ANCHOR_INTERVAL < job->num_positions ? first + POSITION_ANCHOR_INTERVAL
+                                                                               : job->num_positions;
+        for (int k = 0; k < num_freqs; k++) {
+            double angle = (double)(job->start_pos + first) * job->freqs[k];
+            cur_sin[k] = sin(angle);
+            cur_cos[k] = cos(angle);
+        }
+
+        for (int p = first; p < last; p++) {
+            float* row = job->dst + (size_t)p * encoding_dim;
+            for (int k = 0; k < num_freqs; k++) {
+                row[2 * k] = (float)cur_sin[k];
+                if (2 * k + 1 < encoding_dim) {
+                    row[2 * k + 1] = (float)cur_cos[k];
                 }
+                double next_sin = cur_sin[k] * job->step_cos[k] + cur_cos[k] * job->step_sin[k];
+                double next_cos = cur_cos[k] * job->step_cos[k] - cur_sin[k] * job->step_sin[k];
+                cur_sin[k] = next_sin;
+                cur_cos[k] = next_cos;
             }
         }
     }
-    return true;
-}
\ No newline at end of file
+    free(state);
+}
+
+bool compute_sinusoid_table(
+    float* dst,
+    int start_pos,
+    int num_positions,
+    int encoding_dim,
+    double base
+) {
+    if (!dst || start_pos < 0 || num_positions < 0 || encoding_dim <= 0 || base <= 0.0) return false;
+
+    const int num_freqs = (encoding_dim + 1) / 2;
+    // 每个频率的 w_k 及每步旋转量 sin(w_k), cos(w_k)
+    double* freqs = (double*)malloc(3 * num_freqs * sizeof(double));
+    if (!freqs) {
+        fprintf(stderr, "Failed to allocate frequency table for sinusoid table\n");
+        return false;
+    }
+    double* step_sin = freqs + num_freqs;
+    double* step_cos = step_sin + num_freqs;
+    for (int k = 0; k < num_freqs; k++) {
+        freqs[k] = pow(base, -(double)(2 * k) / encoding_dim);
+        step_sin[k] = sin(freqs[k]);
+        step_cos[k] = cos(freqs[k]);
+    }
+
+    // 按锚定区间并行, 各区间的递推互相独立
+    const int num_chunks = (num_positions + POSITION_ANCHOR_INTERVAL - 1) / POSITION_ANCHOR_INTERVAL;
+    SinusoidJob job = {dst, start_pos, num_positions, encoding_dim, num_freqs, freqs, step_sin, step_cos, false};
+    const bool parallel = num_chunks > 1 && (size_t)num_positions * encoding_dim > 65536;
+    thread_pool_parallel_for(num_chunks, parallel ? 1 : num_chunks, sinusoid_chunks, &job);
+
+    free(freqs);
+    return !atomic_load(&job.failed);
+}
+
+// 位置编码计算函数
+bool compute_positional_encodings(
+    float* dst,
+    int start_pos,
+    int num_positions,
+    int encoding_dim
+) {
+    return compute_sinusoid_table(dst, start_pos, num_positions, encoding_dim, 10000.0);
+}
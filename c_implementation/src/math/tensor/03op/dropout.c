@@ -0,0 +1,164 @@
+#include "dropout.h"
+#include "philox.h"
+#include "thread_pool.h"
+#include <stdbool.h>
+
+// 组数超过这个值才并行
+#define DROPOUT_PARALLEL_GROUPS 256
+
+DropoutRng dropout_rng_init(uint64_t seed, uint64_t stream) {
+    DropoutRng rng = {seed, stream, 0};
+    return rng;
+}
+
+DropoutKey dropout_rng_next(DropoutRng* rng, size_t num_elements) {
+    DropoutKey key = {rng->seed, rng->stream, rng->offset};
+    uint64_t groups = (num_elements + DROPOUT_GROUP - 1) / DROPOUT_GROUP;
+    rng->offset += groups * DROPOUT_COUNTERS_PER_GROUP;
+    return key;
+}
+
+// 第group组的32个随机字, words[r*8 + j] 为计数器 offset + group*8 + j 的第r个输出
+static void dropout_group_words(DropoutKey key, uint64_t group, uint32_t words[DROPOUT_GROUP]) {
+    const uint32_t k[2] = {(uint32_t)key.seed, (uint32_t)(key.seed >> 32)};
+    const uint64_t counter = key.offset + group * DROPOUT_COUNTERS_PER_GROUP;
+    const uint32_t lo = (uint32_t)counter;
+    const uint32_t hi = (uint32_t)(counter >> 32);
+    const uint32_t s0 = (uint32_t)key.stream;
+    const uint32_t s1 = (uint32_t)(key.stream >> 32);
+
+#if PHILOX_LANES > 0
+    // 低32位在8个计数器内不进位时走SIMD
+    if (lo <= UINT32_MAX - (DROPOUT_COUNTERS_PER_GROUP - 1)) {
+        for (int j = 0; j < DROPOUT_COUNTERS_PER_GROUP; j += PHILOX_LANES) {
+            philox_vec out[4];
+            philox4x32_10_vec(lo + j, hi, s0, s1, k, out);
+            for (int r = 0; r < 4; r++) {
+                philox_store(words + r * DROPOUT_COUNTERS_PER_GROUP + j, out[r]);
+            }
+        }
+        return;
+    }
+#endif
+    for (int j = 0; j < DROPOUT_COUNTERS_PER_GROUP; j++) {
+        const uint64_t c = counter + j;
+        const uint32_t ctr[4] = {(uint32_t)c, (uint32_t)(c >> 32), s0, s1};
+        uint32_t out[4];
+        philox4x32_10(ctr, k, out);
+        for (int r = 0; r < 4; r++) words[r * DROPOUT_COUNTERS_PER_GROUP + j] = out[r];
+    }
+}
+
+// 随机字 >= threshold 的元素保留, 保留概率为 1 - prob
+static uint32_t dropout_threshold(float prob) {
+    double t = (double)prob * 4294967296.0;
+    return t >= 4294967295.0 ? UINT32_MAX : (uint32_t)t;
+}
+
+typedef struct DropoutJob {
+    const float* x;
+    const float* residual;     // 可为NULL
+    float* y;
+    size_t n;
+    size_t index_base;
+    uint64_t first_group;      // 掩码模式下第一个组的编号
+    uint32_t threshold;
+    float scale;
+    bool keep;                 // 复制模式: true为复制/加残差, false为置0
+    DropoutKey key;
+} DropoutJob;
+
+// 不做dropout: 复制或加残差, 不生成随机数; [begin, end) 为元素下标
+static void dropout_copy_range(void* ctx, long begin, long end) {
+    const DropoutJob* job = (const DropoutJob*)ctx;
+    for (long i = begin; i < end; i++) {
+        const float v = job->keep ? job->x[i] : 0.0f;
+        job->y[i] = job->residual ? job->residual[i] + v : v;
+    }
+}
+
+// [begin, end) 为相对 first_group 的组编号
+static void dropout_mask_range(void* ctx, long begin, long end) {
+    const DropoutJob* job = (const DropoutJob*)ctx;
+    for (long g = begin; g < end; g++) {
+        const uint64_t group = job->first_group + g;
+        uint32_t words[DROPOUT_GROUP];
+        dropout_group_words(job->key, group, words);
+
+        // 本组与 [index_base, index_base + n) 的交集
+        const uint64_t group_start = group * DROPOUT_GROUP;
+        const size_t begin_elem = group_start > job->index_base ? (size_t)(group_start - job->index_base) : 0;
+        const size_t skip = group_start < job->index_base ? (size_t)(job->index_base - group_start) : 0;
+        size_t count = DROPOUT_GROUP - skip;
+        if (begin_elem + count > job->n) count = job->n - begin_elem;
+
+        const uint32_t* w = words + skip;
+        const uint32_t threshold = job->threshold;
+        const float scale = job->scale;
+        const float* xs = job->x + begin_elem;
+        float* ys = job->y + begin_elem;
+        if (job->residual) {
+            const float* rs = job->residual + begin_elem;
+            #pragma omp simd
+            for (size_t e = 0; e < count; e++) {
+                ys[e] = rs[e] + (w[e] >= threshold ? xs[e] * scale : 0.0f);
+            }
+        } else {
+            #pragma omp simd
+            for (size_t e = 0; e < count; e++) {
+                ys[e] = w[e] >= threshold ? xs[e] * scale : 0.0f;
+            }
+        }
+    }
+}
+
+static void dropout_kernel(
+    const float* x,
+    const float* residual,
+    float* y,
+    size_t n,
+    size_t index_base,
+    float prob,
+    DropoutKey key
+) {
+    if (n == 0) return;
+
+    DropoutJob job = {x, residual, y, n, index_base, 0, 0, 1.0f, prob <= 0.0f, key};
+    if (prob <= 0.0f || prob >= 1.0f) {
+        const long grain = n > DROPOUT_PARALLEL_GROUPS * DROPOUT_GROUP ? 0 : (long)n;
+        thread_pool_parallel_for((long)n, grain, dropout_copy_range, &job);
+        return;
+    }
+
+    job.threshold = dropout_threshold(prob);
+    job.scale = 1.0f / (1.0f - prob);
+    job.first_group = index_base / DROPOUT_GROUP;
+    const uint64_t last_group = (index_base + n - 1) / DROPOUT_GROUP;
+    const long num_groups = (long)(last_group - job.first_group + 1);
+    const long grain = num_groups > DROPOUT_PARALLEL_GROUPS ? 0 : num_groups;
+    thread_pool_parallel_for(num_groups, grain, dropout_mask_range, &job);
+}
+
+void dropout_apply(
+    const float* x,
+    float* y,
+    size_t n,
+    size_t index_base,
+    float prob,
+    DropoutKey key
+) {
+    if (prob <= 0.0f && x == y) return;
+    dropout_kernel(x, NULL, y, n, index_base, prob, key);
+}
+
+void dropout_residual_add(
+    const float* x,
+    const float* residual,
+    float* y,
+    size_t n,
+    size_t index_base,
+    float prob,
+    DropoutKey key
+) {
+    dropout_kernel(x, residual, y, n, index_base, prob, key);
+}
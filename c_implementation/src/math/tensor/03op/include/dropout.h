@@ -0,0 +1,57 @@
+#ifndef DROPOUT_H
+#define DROPOUT_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// 基于Philox的dropout: 第i个元素是否保留只由 (seed, stream, offset, i) 决定,
+// 反向传播用前向时的同一个key重新生成掩码, 不需要保存掩码, 各线程可以独立处理任意区间
+//
+// 元素按每组32个分组, 每组使用8个连续的Philox计数器 (每个输出4个32位字),
+// 组内第 r*8 + j 个元素取第j个计数器的第r个字; 这个映射与SIMD宽度无关, 不同编译选项下掩码一致
+#define DROPOUT_GROUP 32
+#define DROPOUT_COUNTERS_PER_GROUP 8
+
+// 一次dropout调用的随机数位置
+typedef struct DropoutKey {
+    uint64_t seed;      // Philox密钥
+    uint64_t stream;    // 计数器高64位, 区分不同的dropout位置 (如不同层)
+    uint64_t offset;    // 计数器低64位的起点
+} DropoutKey;
+
+// 每个dropout位置的生成器, 每次调用取一个key并把offset前移
+typedef struct DropoutRng {
+    uint64_t seed;
+    uint64_t stream;
+    uint64_t offset;
+} DropoutRng;
+
+DropoutRng dropout_rng_init(uint64_t seed, uint64_t stream);
+
+// 返回处理num_elements个元素用的key, 并跳过它用掉的计数器
+DropoutKey dropout_rng_next(DropoutRng* rng, size_t num_elements);
+
+// y = dropout(x), 保留的元素乘 1 / (1 - prob); prob <= 0 时直接复制, prob >= 1 时全部置0
+// index_base为x[0]在整个张量中的下标, 分块调用时各块的掩码与整体调用一致
+// y可以与x相同
+void dropout_apply(
+    const float* x,
+    float* y,
+    size_t n,
+    size_t index_base,
+    float prob,
+    DropoutKey key
+);
+
+// y = residual + dropout(x), 残差连接与dropout一次完成, y可以与x或residual相同
+void dropout_residual_add(
+    const float* x,
+    const float* residual,
+    float* y,
+    size_t n,
+    size_t index_base,
+    float prob,
+    DropoutKey key
+);
+
+#endif // DROPOUT_H
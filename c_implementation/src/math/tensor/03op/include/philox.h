@@ -0,0 +1,111 @@
+#ifndef PHILOX_H
+#define PHILOX_H
+
+#include <stdint.h>
+
+// Philox4x32-10 计数器随机数 (Salmon et al., Random123)
+// 输出只由 (计数器, 密钥) 决定, 无内部状态, 任意线程可以独立计算任意位置的随机数
+#define PHILOX_M0 0xD2511F53u
+#define PHILOX_M1 0xCD9E8D57u
+#define PHILOX_W0 0x9E3779B9u
+#define PHILOX_W1 0xBB67AE85u
+#define PHILOX_ROUNDS 10
+
+static inline void philox4x32_10(const uint32_t ctr[4], const uint32_t key[2], uint32_t out[4]) {
+    uint32_t c0 = ctr[0], c1 = ctr[1], c2 = ctr[2], c3 = ctr[3];
+    uint32_t k0 = key[0], k1 = key[1];
+    for (int r = 0; r < PHILOX_ROUNDS; r++) {
+        uint64_t p0 = (uint64_t)PHILOX_M0 * c0;
+        uint64_t p1 = (uint64_t)PHILOX_M1 * c2;
+        uint32_t n0 = (uint32_t)(p1 >> 32) ^ c1 ^ k0;
+        uint32_t n2 = (uint32_t)(p0 >> 32) ^ c3 ^ k1;
+        c1 = (uint32_t)p1;
+        c3 = (uint32_t)p0;
+        c0 = n0;
+        c2 = n2;
+        k0 += PHILOX_W0;
+        k1 += PHILOX_W1;
+    }
+    out[0] = c0;
+    out[1] = c1;
+    out[2] = c2;
+    out[3] = c3;
+}
+
+// SIMD版本: 一次计算PHILOX_LANES个相邻计数器 (c0不同, c1..c3相同), 结果按字分开存放
+// SSE2/AVX2都没有32位乘法取高位的指令, 用 mul_epu32 对偶数/奇数通道各做一次64位乘法再拼回
+#if defined(__AVX2__)
+#include <immintrin.h>
+#define PHILOX_LANES 8
+typedef __m256i philox_vec;
+
+static inline void philox_mulhilo(philox_vec a, uint32_t m, philox_vec* hi, philox_vec* lo) {
+    const __m256i vm = _mm256_set1_epi32((int)m);
+    __m256i even = _mm256_mul_epu32(a, vm);
+    __m256i odd = _mm256_mul_epu32(_mm256_srli_epi64(a, 32), vm);
+    *lo = _mm256_unpacklo_epi32(_mm256_shuffle_epi32(even, _MM_SHUFFLE(0, 0, 2, 0)),
+                                _mm256_shuffle_epi32(odd, _MM_SHUFFLE(0, 0, 2, 0)));
+    *hi = _mm256_unpacklo_epi32(_mm256_shuffle_epi32(even, _MM_SHUFFLE(0, 0, 3, 1)),
+                                _mm256_shuffle_epi32(odd, _MM_SHUFFLE(0, 0, 3, 1)));
+}
+
+#define philox_set1(x)      _mm256_set1_epi32((int)(x))
+#define philox_xor(a, b)    _mm256_xor_si256(a, b)
+#define philox_lane_ids()   _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7)
+#define philox_add(a, b)    _mm256_add_epi32(a, b)
+#define philox_store(p, v)  _mm256_storeu_si256((__m256i*)(p), v)
+
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#define PHILOX_LANES 4
+typedef __m128i philox_vec;
+
+static inline void philox_mulhilo(philox_vec a, uint32_t m, philox_vec* hi, philox_vec* lo) {
+    const __m128i vm = _mm_set1_epi32((int)m);
+    __m128i even = _mm_mul_epu32(a, vm);
+    __m128i odd = _mm_mul_epu32(_mm_srli_epi64(a, 32), vm);
+    *lo = _mm_unpacklo_epi32(_mm_shuffle_epi32(even, _MM_SHUFFLE(0, 0, 2, 0)),
+                             _mm_shuffle_epi32(odd, _MM_SHUFFLE(0, 0, 2, 0)));
+    *hi = _mm_unpacklo_epi32(_mm_shuffle_epi32(even, _MM_SHUFFLE(0, 0, 3, 1)),
+                             _mm_shuffle_epi32(odd, _MM_SHUFFLE(0, 0, 3, 1)));
+}
+
+#define philox_set1(x)      _mm_set1_epi32((int)(x))
+#define philox_xor(a, b)    _mm_xor_si128(a, b)
+#define philox_lane_ids()   _mm_setr_epi32(0, 1, 2, 3)
+#define philox_add(a, b)    _mm_add_epi32(a, b)
+#define philox_store(p, v)  _mm_storeu_si128((__m128i*)(p), v)
+
+#else
+#define PHILOX_LANES 0
+#endif
+
+#if PHILOX_LANES > 0
+// 计数器 (c0 + lane, c1, c2, c3), 调用方保证 c0 + PHILOX_LANES - 1 不溢出
+// out[r] 的第lane个通道为该计数器的第r个输出字
+static inline void philox4x32_10_vec(uint32_t c0, uint32_t c1, uint32_t c2, uint32_t c3,
+                                     const uint32_t key[2], philox_vec out[4]) {
+    philox_vec x0 = philox_add(philox_set1(c0), philox_lane_ids());
+    philox_vec x1 = philox_set1(c1);
+    philox_vec x2 = philox_set1(c2);
+    philox_vec x3 = philox_set1(c3);
+    uint32_t k0 = key[0], k1 = key[1];
+    for (int r = 0; r < PHILOX_ROUNDS; r++) {
+        philox_vec hi0, lo0, hi1, lo1;
+        philox_mulhilo(x0, PHILOX_M0, &hi0, &lo0);
+        philox_mulhilo(x2, PHILOX_M1, &hi1, &lo1);
+        x0 = philox_xor(philox_xor(hi1, x1), philox_set1(k0));
+        x2 = philox_xor(philox_xor(hi0, x3), philox_set1(k1));
+        x1 = lo1;
+        x3 = lo0;
+        k0 += PHILOX_W0;
+        k1 += PHILOX_W1;
+    }
+    out[0] = x0;
+    out[1] = x1;
+    out[2] = x2;
+    out[3] = x3;
+}
+#endif
+
+#endif // PHILOX_H
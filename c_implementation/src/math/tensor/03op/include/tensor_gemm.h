@@ -0,0 +1,29 @@
+#ifndef TENSOR_GEMM_H
+#define TENSOR_GEMM_H
+
+#include <stdbool.h>
+
+// GEMM结果写回前在寄存器里完成的后处理
+typedef enum {
+    GEMM_EPILOGUE_NONE = 0,
+    GEMM_EPILOGUE_RELU = 1,
+    GEMM_EPILOGUE_GELU_TANH = 2,
+    GEMM_EPILOGUE_GELU_ERF = 3,
+    GEMM_EPILOGUE_SILU = 4,
+    GEMM_EPILOGUE_SWIGLU = 5,   // 门控: C = SiLU(A × B + bias) * C, C中预先放好up投影
+} GemmEpilogue;
+
+// C[M, N] = act(A[M, K] × B[K, N] + bias[N]), 全部行主序, bias可为NULL
+// lda/ldb/ldc 为行跨度, 可以对更大矩阵的子块调用
+// 规模足够大时把 (行块, 列块) 拆成线程池任务; 在池任务内调用时子任务进入同一线程池, 不会超额订阅
+// B为 numa_place_weights 复制过的权重时, 每个任务读取所在NUMA节点的副本
+void gemm_bias_act(
+    const float* A, int lda,
+    const float* B, int ldb,
+    const float* bias,
+    float* C, int ldc,
+    int M, int N, int K,
+    GemmEpilogue epilogue
+);
+
+#endif // TENSOR_GEMM_H
@@ -2,6 +2,7 @@
 #define TENSOR_LOGIC_H
 
 #include "tensor_type.h"
+#include "dropout.h"
 #include <stdbool.h>
 
 // 掩码应用操作
@@ -13,12 +14,12 @@ bool tensor_apply_mask(
 );
 
 // 在训练时执行dropout操作
-// prob: dropout概率(0-1之间)
-// training: 是否处于训练模式
-bool dropout_forward(Tensor* input, Tensor* output, float prob);
+// prob: dropout概率(0-1之间), 推理时调用方传0, 此时不生成随机数
+// key: 由 dropout_rng_next 取得, 反向传播传入同一个key
+bool dropout_forward(const Tensor* input, Tensor* output, float prob, DropoutKey key);
 
-// dropout的反向传播
-bool dropout_backward(Tensor* grad_output, Tensor* grad_input, float prob);
+// dropout的反向传播, 用前向的key重新生成掩码
+bool dropout_backward(const Tensor* grad_output, Tensor* grad_input, float prob, DropoutKey key);
 
 // 张量逐元素与操作
 bool tensor_and(Tensor* a, Tensor* b, Tensor* output);
@@ -0,0 +1,192 @@
+#include "tensor_gemm.h"
+#include "activation_math.h"
+#include "thread_pool.h"
+#include "numa_placement.h"
+
+// 微内核: GEMM_MR 行 × GEMM_NR 列的结果块保存在寄存器中, 沿K累加, 结束时加偏置并做激活再写回
+#define GEMM_MR 4
+#if VF_WIDTH > 0
+#define GEMM_NR (2 * VF_WIDTH)
+#else
+#define GEMM_NR 8
+#endif
+
+// 乘加次数不超过这个值时不拆任务
+#define GEMM_PARALLEL_MIN_FLOPS (1 << 18)
+// 每个任务至少这么多次乘加, 任务再小调度开销就不划算
+#define GEMM_MIN_TASK_FLOPS (1 << 16)
+
+// c为C中原有的值, 只有门控写回会用到
+static inline float epilogue_scalar(float x, float c, GemmEpilogue epilogue) {
+    switch (epilogue) {
+        case GEMM_EPILOGUE_RELU:
+            return x > 0.0f ? x : 0.0f;
+        case GEMM_EPILOGUE_GELU_TANH:
+            return fast_gelu_tanhf(x);
+        case GEMM_EPILOGUE_GELU_ERF:
+            return fast_gelu_erff(x);
+        case GEMM_EPILOGUE_SILU:
+            return fast_siluf(x);
+        case GEMM_EPILOGUE_SWIGLU:
+            return fast_siluf(x) * c;
+        default:
+            return x;
+    }
+}
+
+#if VF_WIDTH > 0
+static inline vfloat epilogue_vector(vfloat x, const float* c, GemmEpilogue epilogue) {
+    switch (epilogue) {
+        case GEMM_EPILOGUE_RELU:
+            return vf_max(x, vf_set1(0.0f));
+        case GEMM_EPILOGUE_GELU_TANH:
+            return vf_gelu_tanh(x);
+        case GEMM_EPILOGUE_GELU_ERF:
+            return vf_gelu_erf(x);
+        case GEMM_EPILOGUE_SILU:
+            return vf_silu(x);
+        case GEMM_EPILOGUE_SWIGLU:
+            return vf_mul(vf_silu(x), vf_load(c));
+        default:
+            return x;
+    }
+}
+#endif
+
+// 计算从 (row, col) 开始的 rows(<=GEMM_MR) × GEMM_NR 块
+// 不足GEMM_MR行时, 多出的行重复读取最后一行, 只是不写回, 保证寄存器数目固定
+static void gemm_block_full(
+    const float* A, int lda, const float* B, int ldb, const float* bias,
+    float* C, int ldc, int row, int rows, int col, int K, GemmEpilogue epilogue
+) {
+    const float* a[GEMM_MR];
+    for (int r = 0; r < GEMM_MR; r++) {
+        a[r] = A + (size_t)(row + (r < rows ? r : rows - 1)) * lda;
+    }
+    const float* b = B + col;
+
+#if VF_WIDTH > 0
+    vfloat acc[GEMM_MR][2];
+    for (int r = 0; r < GEMM_MR; r++) {
+        acc[r][0] = vf_set1(0.0f);
+        acc[r][1] = vf_set1(0.0f);
+    }
+    for (int k = 0; k < K; k++) {
+        const vfloat b0 = vf_load(b + (size_t)k * ldb);
+        const vfloat b1 = vf_load(b + (size_t)k * ldb + VF_WIDTH);
+        for (int r = 0; r < GEMM_MR; r++) {
+            const vfloat ar = vf_set1(a[r][k]);
+            acc[r][0] = vf_fmadd(ar, b0, acc[r][0]);
+            acc[r][1] = vf_fmadd(ar, b1, acc[r][1]);
+        }
+    }
+
+    const vfloat bias0 = bias ? vf_load(bias + col) : vf_set1(0.0f);
+    const vfloat bias1 = bias ? vf_load(bias + col + VF_WIDTH) : vf_set1(0.0f);
+    for (int r = 0; r < rows; r++) {
+        float* c = C + (size_t)(row + r) * ldc + col;
+        vf_store(c, epilogue_vector(vf_add(acc[r][0], bias0), c, epilogue));
+        vf_store(c + VF_WIDTH, epilogue_vector(vf_add(acc[r][1], bias1), c + VF_WIDTH, epilogue));
+    }
+#else
+    float acc[GEMM_MR][GEMM_NR] = {{0.0f}};
+    for (int k = 0; k < K; k++) {
+        const float* bk = b + (size_t)k * ldb;
+        for (int r = 0; r < GEMM_MR; r++) {
+            const float ar = a[r][k];
+            for (int j = 0; j < GEMM_NR; j++) acc[r][j] += ar * bk[j];
+        }
+    }
+    for (int r = 0; r < rows; r++) {
+        float* c = C + (size_t)(row + r) * ldc + col;
+        for (int j = 0; j < GEMM_NR; j++) {
+            c[j] = epilogue_scalar(acc[r][j] + (bias ? bias[col + j] : 0.0f), c[j], epilogue);
+        }
+    }
+#endif
+}
+
+// 右侧不足GEMM_NR的列, 标量计算
+static void gemm_block_tail(
+    const float* A, int lda, const float* B, int ldb, const float* bias,
+    float* C, int ldc, int row, int rows, int col, int cols, int K, GemmEpilogue epilogue
+) {
+    for (int r = 0; r < rows; r++) {
+        const float* a = A + (size_t)(row + r) * lda;
+        float* c = C + (size_t)(row + r) * ldc;
+        for (int j = col; j < col + cols; j++) {
+            float sum = bias ? bias[j] : 0.0f;
+            for (int k = 0; k < K; k++) sum += a[k] * B[(size_t)k * ldb + j];
+            c[j] = epilogue_scalar(sum, c[j], epilogue);
+        }
+    }
+}
+
+typedef struct GemmJob {
+    const float* A;
+    int lda;
+    const float* B;
+    int ldb;
+    const float* bias;
+    float* C;
+    int ldc;
+    int M, N, K;
+    int row_blocks;
+    GemmEpilogue epilogue;
+} GemmJob;
+
+// 处理编号 [begin, end) 的 (列块, 行块) 结果块
+// 列块在外层: 同一列块的B条带被连续的行块复用
+// B为按NUMA复制的权重时读取当前节点的副本, 每个节点的线程只读本地内存
+static void gemm_tiles(void* ctx, long begin, long end) {
+    const GemmJob* job = (const GemmJob*)ctx;
+    const float* B = numa_local_weights(job->B);
+    if (numa_traffic_stats_enabled()) {
+        // 按本任务涉及的B列条带估计读取量, 同一条带被多个行块复用只算一次
+        const int first_col = (int)(begin / job->row_blocks) * GEMM_NR;
+        int last_col = (int)((end - 1) / job->row_blocks + 1) * GEMM_NR;
+        if (last_col > job->N) last_col = job->N;
+        numa_account_weight_read(job->B, (size_t)job->K * (last_col - first_col) * sizeof(float));
+    }
+    for (long tile = begin; tile < end; tile++) {
+        const int cb = (int)(tile / job->row_blocks);
+        const int rb = (int)(tile % job->row_blocks);
+        const int row = rb * GEMM_MR;
+        const int rows = job->M - row < GEMM_MR ? job->M - row : GEMM_MR;
+        const int col = cb * GEMM_NR;
+        if (col + GEMM_NR <= job->N) {
+            gemm_block_full(job->A, job->lda, B, job->ldb, job->bias, job->C, job->ldc,
+                            row, rows, col, job->K, job->epilogue);
+        } else {
+            gemm_block_tail(job->A, job->lda, B, job->ldb, job->bias, job->C, job->ldc,
+                            row, rows, col, job->N - col, job->K, job->epilogue);
+        }
+    }
+}
+
+void gemm_bias_act(
+    const float* A, int lda,
+    const float* B, int ldb,
+    const float* bias,
+    float* C, int ldc,
+    int M, int N, int K,
+    GemmEpilogue epilogue
+) {
+    if (M <= 0 || N <= 0) return;
+
+    const int row_blocks = (M + GEMM_MR - 1) / GEMM_MR;
+    const int col_blocks = (N + GEMM_NR - 1) / GEMM_NR;
+    const long tiles = (long)row_blocks * col_blocks;
+    GemmJob job = {A, lda, B, ldb, bias, C, ldc, M, N, K, row_blocks, epilogue};
+
+    // 小矩阵整体在调用线程执行; 否则每个线程约分到4个任务, 每个任务不少于 GEMM_MIN_TASK_FLOPS
+    long grain = tiles;
+    if ((size_t)M * N * K > GEMM_PARALLEL_MIN_FLOPS) {
+        const size_t tile_flops = (size_t)GEMM_MR * GEMM_NR * (K > 0 ? K : 1);
+        const long min_grain = (long)(GEMM_MIN_TASK_FLOPS / tile_flops);
+        grain = tiles / (4L * thread_pool_num_threads());
+        if (grain < min_grain) grain = min_grain;
+        if (grain < 1) grain = 1;
+    }
+    thread_pool_parallel_for(tiles, grain, gemm_tiles, &job);
+}
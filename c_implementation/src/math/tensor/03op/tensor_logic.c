@@ -25,39 +25,28 @@ bool tensor_apply_mask(
     return true;
 }
 
-bool dropout_forward(Tensor* input, Tensor* output, float prob) {
+bool dropout_forward(const Tensor* input, Tensor* output, float prob, DropoutKey key) {
     if (!input || !output) return false;
-    
-    size_t total_elements = calculate_total_size(input->shape, input->num_dims);
-    
-    // 训练阶段
-    srand(time(NULL));
-    float scale = 1.0f / (1.0f - prob); // 缩放因子
-
-    for (int i = 0; i < total_elements; i++) {
-        float random = (float)rand() / RAND_MAX;
-        if (random > prob) {
-            output->data[i] = input->data[i] * scale;
-        } else {
-            output->data[i] = 0;
-        }
+    if (!check_same_shape(input, output)) {
+        fprintf(stderr, "Dropout input and output shapes do not match\n");
+        return false;
     }
-    
+
+    size_t total_elements = calculate_total_size(input->shape, input->num_dims);
+    dropout_apply(input->data, output->data, total_elements, 0, prob, key);
     return true;
 }
 
-bool dropout_backward(Tensor* grad_output, Tensor* grad_input, float prob) {
+bool dropout_backward(const Tensor* grad_output, Tensor* grad_input, float prob, DropoutKey key) {
     if (!grad_output || !grad_input) return false;
-    
-    size_t total_elements = calculate_total_size(grad_output->shape, grad_output->num_dims);
-    
-    float scale = 1.0f / (1.0f - prob);
-    
-    for (int i = 0; i < total_elements; i++) {
-        // 如果前向传播时该位置被dropout(为0),则梯度也为0
-        grad_input->data[i] = grad_input->data[i] == 0 ? 0 : grad_output->data[i] * scale;
+    if (!check_same_shape(grad_output, grad_input)) {
+        fprintf(stderr, "Dropout gradient shapes do not match\n");
+        return false;
     }
-    
+
+    // 同一个key生成与前向相同的掩码和缩放
+    size_t total_elements = calculate_total_size(grad_output->shape, grad_output->num_dims);
+    dropout_apply(grad_output->data, grad_input->data, total_elements, 0, prob, key);
     return true;
 }
 
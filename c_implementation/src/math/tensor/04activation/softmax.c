@@ -1,39 +1,165 @@
 #include "softmax.h"
+#include "fast_math.h"
+#include "thread_pool.h"
 #include <math.h>
 #include <float.h>
+#include <stdio.h>
+#include <string.h>
 
 bool attention_scores_softmax(const Tensor* input, Tensor* output) {
-    int batch_size = input->shape[0];
-    int num_heads = input->shape[1];
-    int seq_len = input->shape[2];
-    // 最后一维也是seq_len
-    
-    // 对每个batch和head分别计算softmax
-    for (int b = 0; b < batch_size; b++) {
-        for (int h = 0; h < num_heads; h++) {
-            for (int i = 0; i < seq_len; i++) {
-                // 1. 找到最大值
-                float max_val = -FLT_MAX;
-                for (int j = 0; j < seq_len; j++) {
-                    int idx = ((b * num_heads + h) * seq_len + i) * seq_len + j;
-                    max_val = fmaxf(max_val, input->data[idx]);
-                }
-                
-                // 2. 计算exp并求和
-                float sum = 0.0f;
-                for (int j = 0; j < seq_len; j++) {
-                    int idx = ((b * num_heads + h) * seq_len + i) * seq_len + j;
-                    output->data[idx] = expf(input->data[idx] - max_val);
-                    sum += output->data[idx];
-                }
-                
-                // 3. 归一化
-                for (int j = 0; j < seq_len; j++) {
-                    int idx = ((b * num_heads + h) * seq_len + i) * seq_len + j;
-                    output->data[idx] /= sum;
-                }
-            }
+    if (!input || !output || input->num_dims != 4) {
+        return false;
+    }
+
+    // 非原地调用时先复制, 再走融合内核 (scale为1, 无掩码)
+    if (input != output) {
+        memcpy(output->data, input->data,
+               calculate_total_size(input->shape, input->num_dims) * sizeof(float));
+    }
+    return attention_scores_softmax_fused(output, 1.0f, NULL, false, false);
+}
+
+// 以下三个行内核先走SIMD主循环, 再用标量处理尾部
+
+// 缩放 + 掩码 (keep掩码0处置-inf, 或加性掩码), 返回最大值
+static float softmax_row_scale_max(float* row, int n, float scale, const float* mrow, bool additive_mask) {
+    float max_val = -INFINITY;
+    int j = 0;
+#if VF_WIDTH > 0
+    const vfloat vscale = vf_set1(scale);
+    const vfloat vneg_inf = vf_set1(-INFINITY);
+    const vfloat vzero = vf_set1(0.0f);
+    vfloat vmax = vneg_inf;
+    for (; j + VF_WIDTH <= n; j += VF_WIDTH) {
+        vfloat x = vf_mul(vf_load(row + j), vscale);
+        if (mrow) {
+            vfloat m = vf_load(mrow + j);
+            x = additive_mask ? vf_add(x, m) : vf_select(vf_cmpneq(m, vzero), x, vneg_inf);
         }
+        vf_store(row + j, x);
+        vmax = vf_max(vmax, x);
+    }
+    max_val = vf_hmax(vmax);
+#endif
+    for (; j < n; j++) {
+        float x = row[j] * scale;
+        if (mrow) x = additive_mask ? x + mrow[j] : (mrow[j] != 0.0f ? x : -INFINITY);
+        row[j] = x;
+        max_val = fmaxf(max_val, x);
+    }
+    return max_val;
+}
+
+// row[j] = exp(row[j] - max_val), 返回和
+static float softmax_row_exp_sum(float* row, int n, float max_val) {
+    float sum = 0.0f;
+    int j = 0;
+#if VF_WIDTH > 0
+    const vfloat vmax = vf_set1(max_val);
+    vfloat vsum = vf_set1(0.0f);
+    for (; j + VF_WIDTH <= n; j += VF_WIDTH) {
+        vfloat e = vf_exp(vf_sub(vf_load(row + j), vmax));
+        vf_store(row + j, e);
+        vsum = vf_add(vsum, e);
+    }
+    sum = vf_hsum(vsum);
+#endif
+    for (; j < n; j++) {
+        row[j] = fast_expf(row[j] - max_val);
+        sum += row[j];
+    }
+    return sum;
+}
+
+static void softmax_row_scale(float* row, int n, float factor) {
+    int j = 0;
+#if VF_WIDTH > 0
+    const vfloat vfactor = vf_set1(factor);
+    for (; j + VF_WIDTH <= n; j += VF_WIDTH) {
+        vf_store(row + j, vf_mul(vf_load(row + j), vfactor));
     }
+#endif
+    for (; j < n; j++) {
+        row[j] *= factor;
+    }
+}
+
+typedef struct SoftmaxRowsJob {
+    Tensor* scores;
+    const AttentionMask* mask;
+    float scale;
+    bool additive_mask;
+    bool is_causal;
+} SoftmaxRowsJob;
+
+// [begin, end) 为 (batch, head, query) 展平后的行号
+static void softmax_rows(void* ctx, long begin, long end) {
+    const SoftmaxRowsJob* job = (const SoftmaxRowsJob*)ctx;
+    const int num_heads = job->scores->shape[1];
+    const int q_len = job->scores->shape[2];
+    const int k_len = job->scores->shape[3];
+
+    for (long r = begin; r < end; r++) {
+        const int i = (int)(r % q_len);
+        const int h = (int)((r / q_len) % num_heads);
+        const int b = (int)(r / ((long)q_len * num_heads));
+        float* row = job->scores->data + (size_t)r * k_len;
+        const float* mrow = attention_mask_row(job->mask, b, h, i);
+
+        // 因果上界, 之后的列不参与计算
+        int limit = k_len;
+        if (job->is_causal) {
+            limit = i + (k_len - q_len) + 1;
+            if (limit < 0) limit = 0;
+            if (limit > k_len) limit = k_len;
+        }
+
+        // 1. 缩放 + 掩码, 同时求最大值
+        float max_val = softmax_row_scale_max(row, limit, job->scale, mrow, job->additive_mask);
+
+        // 整行被屏蔽时输出0
+        if (max_val == -INFINITY) {
+            memset(row, 0, k_len * sizeof(float));
+            continue;
+        }
+
+        // 2. 减最大值后求指数和, -inf经指数得到0
+        float sum = softmax_row_exp_sum(row, limit, max_val);
+
+        // 3. 归一化, 因果右侧写0
+        softmax_row_scale(row, limit, 1.0f / sum);
+        if (limit < k_len) {
+            memset(row + limit, 0, (k_len - limit) * sizeof(float));
+        }
+    }
+}
+
+bool attention_scores_softmax_fused(
+    Tensor* scores,
+    float scale,
+    const AttentionMask* mask,
+    bool additive_mask,
+    bool is_causal
+) {
+    if (!scores || scores->num_dims != 4) {
+        fprintf(stderr, "attention_scores_softmax_fused expects 4D scores\n");
+        return false;
+    }
+
+    const int batch_size = scores->shape[0];
+    const int num_heads = scores->shape[1];
+    const int q_len = scores->shape[2];
+    const int k_len = scores->shape[3];
+
+    const Tensor* mask_tensor = mask ? mask->mask : NULL;
+    if (mask_tensor && mask_tensor->shape[mask_tensor->num_dims - 1] != k_len) {
+        fprintf(stderr, "Mask key length %d does not match scores %d\n",
+                mask_tensor->shape[mask_tensor->num_dims - 1], k_len);
+        return false;
+    }
+
+    SoftmaxRowsJob job = {scores, mask, scale, additive_mask, is_causal};
+    const long rows = (long)batch_size * num_heads * q_len;
+    thread_pool_parallel_for(rows, rows > 64 ? 0 : rows, softmax_rows, &job);
     return true;
 }
@@ -16,7 +16,7 @@ Linear* linear_create(int in_features, int out_features);
 // input: [batch_size, seq_len, in_features]
 // output: [batch_size, seq_len, out_features]
 // 执行: output = input * weight^T + bias
-bool linear_forward(Linear* linear, Tensor* input, Tensor* output);
+bool linear_forward(Linear* linear, const Tensor* input, Tensor* output);
 
 // 释放线性层
 void linear_free(Linear* linear);
@@ -89,14 +89,24 @@ bool linear_forward(Linear* linear, const Tensor* input, Tensor* output) {
         return false;
     }
 
-    // 检查最后一个维度是否匹配权重的输入特征数
-    if (input->shape[input->num_dims - 1] != linear->weight->shape[1]) {
+    // 检查最后一个维度是否匹配权重的输入特征数 (weight是 [in_features, out_features])
+    if (input->shape[input->num_dims - 1] != linear->weight->shape[0]) {
         fprintf(stderr, "Input features dimension mismatch\n");
         return false;
     }
 
-    // 执行矩阵乘法: output = input * weight^T
-    if (!tensor_mul_3_2(input, linear->weight, output)) {
+    // 执行矩阵乘法: output = input * weight
+    // 原地计算时 (input == output, 如解码器的最后一层) 先保存输入, 否则乘法会读到已经写入的结果
+    Tensor* saved_input = NULL;
+    if (input == output) {
+        saved_input = tensor_create(input->shape, input->num_dims);
+        if (!saved_input) return false;
+        tensor_copy(saved_input, input);
+        input = saved_input;
+    }
+    bool multiplied = tensor_mul_3_2(input, linear->weight, output);
+    tensor_free(saved_input);
+    if (!multiplied) {
         fprintf(stderr, "Matrix multiplication failed in linear_forward\n");
         return false;
     }
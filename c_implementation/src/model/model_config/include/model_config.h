@@ -2,6 +2,42 @@
 #define MODEL_CONFIG_H
 
 #include <stdbool.h>
+#include <stdint.h>
+#include "activation.h"
+
+#define MAX_NUM_LAYERS 64    // 每层配置数组的最大层数
+
+// 注意力计算模式
+typedef enum AttentionMode {
+    ATTENTION_DENSE = 0,     // 全量注意力 O(n^2), 默认
+    ATTENTION_LOCAL = 1,     // 滑动窗口局部注意力 O(n*w)
+    ATTENTION_BLOCK_SPARSE = 2  // 块稀疏注意力 (局部块 + 跨步块 + 随机块 + 全局块)
+} AttentionMode;
+
+// 注意力计算引擎, 按模型选择
+typedef enum AttentionEngine {
+    ATTENTION_ENGINE_SOFTMAX = 0,    // 标准softmax注意力, 默认
+    ATTENTION_ENGINE_PERFORMER = 1   // 随机特征核化注意力 (FAVOR+), O(n*d*r)
+} AttentionEngine;
+
+// 位置编码方式
+typedef enum PositionEncoding {
+    POSITION_ENCODING_SINUSOIDAL = 0,  // 嵌入层加正弦位置编码, 默认
+    POSITION_ENCODING_ROTARY = 1       // 自注意力中对Q/K做旋转位置编码 (RoPE), 嵌入层不再加位置编码
+} PositionEncoding;
+
+// 单层注意力配置
+typedef struct LayerAttentionConfig {
+    AttentionMode mode;      // 注意力模式
+    int window_size;         // 局部注意力单侧窗口大小, query i 只看 [i-w, i+w]
+    int num_global_tokens;   // 序列开头的全局token数量, 全局token看所有位置, 所有位置也看全局token
+
+    // 块稀疏注意力参数 (只用于ATTENTION_BLOCK_SPARSE)
+    // 此时window_size为单侧局部块数, num_global_tokens向上取整到块
+    int block_size;          // 块大小 (token数)
+    int block_stride;        // 每隔block_stride个块取一个跨步块, 0表示不使用
+    int num_random_blocks;   // 每个query块随机选取的key块数量
+} LayerAttentionConfig;
 
 typedef struct ModelConfig {
     int batch_size;      // 批处理大小
@@ -11,14 +47,79 @@ typedef struct ModelConfig {
     int ff_dim;          // 前馈神经网络维度, hidden_dim
     int num_heads;       // 注意力头数量
     float dropout_prob;  // dropout概率
-    bool is_training;    // 是否处于训练模式
+    bool is_training;    // 是否处于训练模式, 为false时dropout被跳过
+    uint64_t dropout_seed;  // dropout的Philox密钥, 每层使用不同的stream
+
+    // 每层自注意力配置, 全0即为ATTENTION_DENSE
+    LayerAttentionConfig encoder_attention[MAX_NUM_LAYERS];
+    LayerAttentionConfig decoder_attention[MAX_NUM_LAYERS];
+
+    // 注意力引擎 (对ATTENTION_DENSE的层生效)
+    AttentionEngine attention_engine;
+    int num_random_features;         // performer随机特征数 r
+    unsigned int random_feature_seed;
+
+    // 位置编码
+    PositionEncoding position_encoding;
+    double rope_base;                // RoPE频率基数, 0表示默认10000
+
+    // 前馈层激活, 全0即为ReLU非门控
+    ActivationType ffn_activation;
+    bool ffn_gated;                  // 门控FFN (SwiGLU), 需要ffn_activation为SiLU
+
+    // 专家混合前馈, num_experts为0时使用普通前馈
+    int num_experts;
+    int moe_top_k;                   // 每个token路由到的专家数
+    float moe_capacity_factor;       // 专家容量系数, <= 0 不限
 } ModelConfig;
 
-// 全局配置实例
+// 全局配置实例, 只作为创建模型时的默认配置
+// transformer_create 会复制一份保存在模型上, 之后的前向/反向只读模型自己的副本,
+// 修改g_model_config不影响已创建的模型; 同一进程中可以同时存在配置不同的多个模型
 extern ModelConfig g_model_config;
 
 // 初始化配置
 void init_model_config(int batch_size, int max_seq_length, int vocab_size, 
                       int d_model, int ff_dim, int num_heads, float dropout_prob);
 
-#endif
\ No newline at end of file
+// 设置某一层自注意力的模式
+// is_decoder: false为编码器层, true为解码器层
+bool set_layer_attention(
+    bool is_decoder,
+    int layer_index,
+    AttentionMode mode,
+    int window_size,
+    int num_global_tokens
+);
+
+// 设置某一层为块稀疏注意力
+bool set_layer_block_sparse_attention(
+    bool is_decoder,
+    int layer_index,
+    int block_size,
+    int num_local_blocks,
+    int block_stride,
+    int num_random_blocks,
+    int num_global_tokens
+);
+
+// 选择模型的注意力引擎
+bool set_attention_engine(
+    AttentionEngine engine,
+    int num_random_features,
+    unsigned int random_feature_seed
+);
+
+// 选择位置编码方式, rope_base只用于POSITION_ENCODING_ROTARY
+bool set_position_encoding(PositionEncoding type, double rope_base);
+
+// 选择前馈层激活函数, gated为true时使用门控FFN (目前只支持SiLU, 即SwiGLU)
+bool set_ffn_activation(ActivationType activation, bool gated);
+
+// 设置dropout随机数种子, 在创建编码器/解码器之前调用
+void set_dropout_seed(uint64_t seed);
+
+// 编码器/解码器层使用专家混合前馈, num_experts为0时恢复普通前馈
+bool set_moe(int num_experts, int top_k, float capacity_factor);
+
+#endif
@@ -1,5 +1,6 @@
 #include "model_config.h"
 #include <stdbool.h>
+#include <stdio.h>
 
 // 定义全局配置实例
 ModelConfig g_model_config = {0};  // 初始化为0
@@ -21,4 +22,111 @@ void init_model_config(
     g_model_config.num_heads = num_heads;
     g_model_config.dropout_prob = dropout_prob;
     g_model_config.is_training = true;  // 默认为训练模式
-}
\ No newline at end of file
+}
+
+bool set_layer_attention(
+    bool is_decoder,
+    int layer_index,
+    AttentionMode mode,
+    int window_size,
+    int num_global_tokens
+) {
+    if (layer_index < 0 || layer_index >= MAX_NUM_LAYERS) {
+        fprintf(stderr, "Layer index %d out of range [0, %d)\n", layer_index, MAX_NUM_LAYERS);
+        return false;
+    }
+    if (mode != ATTENTION_DENSE && (window_size < 0 || num_global_tokens < 0)) {
+        fprintf(stderr, "Invalid attention window %d / global tokens %d\n",
+                window_size, num_global_tokens);
+        return false;
+    }
+
+    LayerAttentionConfig* config = is_decoder ?
+        &g_model_config.decoder_attention[layer_index] :
+        &g_model_config.encoder_attention[layer_index];
+    config->mode = mode;
+    config->window_size = window_size;
+    config->num_global_tokens = num_global_tokens;
+    return true;
+}
+
+bool set_layer_block_sparse_attention(
+    bool is_decoder,
+    int layer_index,
+    int block_size,
+    int num_local_blocks,
+    int block_stride,
+    int num_random_blocks,
+    int num_global_tokens
+) {
+    if (block_size <= 0 || block_stride < 0 || num_random_blocks < 0) {
+        fprintf(stderr, "Invalid block sparse pattern: block %d, stride %d, random %d\n",
+                block_size, block_stride, num_random_blocks);
+        return false;
+    }
+    if (!set_layer_attention(is_decoder, layer_index, ATTENTION_BLOCK_SPARSE,
+                             num_local_blocks, num_global_tokens)) {
+        return false;
+    }
+
+    LayerAttentionConfig* config = is_decoder ?
+        &g_model_config.decoder_attention[layer_index] :
+        &g_model_config.encoder_attention[layer_index];
+    config->block_size = block_size;
+    config->block_stride = block_stride;
+    config->num_random_blocks = num_random_blocks;
+    return true;
+}
+
+bool set_attention_engine(
+    AttentionEngine engine,
+    int num_random_features,
+    unsigned int random_feature_seed
+) {
+    if (engine == ATTENTION_ENGINE_PERFORMER && num_random_features <= 0) {
+        fprintf(stderr, "Performer needs a positive number of random features, got %d\n",
+                num_random_features);
+        return false;
+    }
+
+    g_model_config.attention_engine = engine;
+    g_model_config.num_random_features = num_random_features;
+    g_model_config.random_feature_seed = random_feature_seed;
+    return true;
+}
+
+bool set_position_encoding(PositionEncoding type, double rope_base) {
+    if (type == POSITION_ENCODING_ROTARY && rope_base < 0.0) {
+        fprintf(stderr, "Invalid RoPE base %f\n", rope_base);
+        return false;
+    }
+    g_model_config.position_encoding = type;
+    g_model_config.rope_base = rope_base;
+    return true;
+}
+
+bool set_ffn_activation(ActivationType activation, bool gated) {
+    if (gated && activation != ACTIVATION_SILU) {
+        fprintf(stderr, "Gated feed forward only supports SiLU (SwiGLU), got %s\n",
+                activation_name(activation));
+        return false;
+    }
+    g_model_config.ffn_activation = activation;
+    g_model_config.ffn_gated = gated;
+    return true;
+}
+
+void set_dropout_seed(uint64_t seed) {
+    g_model_config.dropout_seed = seed;
+}
+
+bool set_moe(int num_experts, int top_k, float capacity_factor) {
+    if (num_experts < 0 || (num_experts > 0 && (top_k <= 0 || top_k > num_experts))) {
+        fprintf(stderr, "Invalid MoE configuration: %d experts, top %d\n", num_experts, top_k);
+        return false;
+    }
+    g_model_config.num_experts = num_experts;
+    g_model_config.moe_top_k = top_k;
+    g_model_config.moe_capacity_factor = capacity_factor;
+    return true;
+}
@@ -0,0 +1,98 @@
+#ifndef INFERENCE_SERVER_H
+#define INFERENCE_SERVER_H
+
+#include "generation_scheduler.h"
+#include "latency_histogram.h"
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+// 本地推理服务: 在Unix域套接字 (或127.0.0.1上的TCP端口) 上接受请求, 交给生成调度器做连续批处理,
+// 生成的token逐个流式写回客户端
+// 两个线程:
+//   I/O线程 (inference_server_run的调用者): epoll事件循环, 负责accept、非阻塞读写、解析请求和submit
+//   计算线程: 只循环调用 generation_scheduler_step, 没有工作时在 generation_scheduler_wait 上休眠
+// 计算线程的回调只把输出追加到连接的缓冲区并通过eventfd唤醒I/O线程, 从不直接做socket I/O,
+// 慢的客户端不会拖慢解码
+//
+// 协议: 每行一个命令, 以'\n'结束
+//   TOKENS [key=value ...] | t1 t2 ...    编码器输入为token id
+//   TEXT [key=value ...] | raw text       编码器输入为原始文本, 按字节切分 (token id = 字节值, 需要vocab >= 256)
+//     key: max_new, temperature, top_k, top_p, penalty, seed, eos, prompt (逗号分隔的解码器前缀, 默认bos)
+//   CANCEL <tag>                          取消本连接的请求
+//   STATS                                 文本格式的指标 (Prometheus风格), 以"# EOF"行结束
+// 响应:
+//   TOK <tag> <token>                     每采出一个token一行
+//   END <tag> <eos|length|cancelled|rejected|error> <generated>
+//   ERR <message>                         无法解析的命令, 不占用tag
+// tag是请求在本连接中的序号 (从1开始, 按提交顺序), 同一连接的多个请求可以同时进行, 输出按tag交错
+// 客户端关闭写端 (EOF) 后, 服务端把已提交的请求跑完再关闭连接; 连接出错时取消它的所有请求
+//
+// 每个请求的延迟记入直方图: 排队 (提交到被接纳), 编码器, 首token (提交到第一个token), token间隔
+
+typedef struct InferenceServerConfig {
+    const char* socket_path;        // 非NULL时监听这个Unix域套接字 (已存在的文件会被删除)
+    int tcp_port;                   // socket_path为NULL时监听127.0.0.1:tcp_port
+    int max_connections;
+    int max_line_bytes;             // 一行请求的最大长度
+    size_t max_pending_output;      // 一个连接未发出的输出超过这个字节数时断开它
+    int max_source_tokens;          // 编码器输入的最大长度 (编码器嵌入的max_seq_len)
+    int max_positions;              // prompt + max_new 的上限 (解码器嵌入的max_seq_len)
+    int vocab_size;
+    int default_max_new_tokens;
+    int32_t bos_token;              // 默认的解码器前缀
+    int32_t eos_token;              // 默认的结束token, < 0 只按长度结束
+} InferenceServerConfig;
+
+// 每类延迟一个直方图
+typedef enum ServerLatency {
+    SERVER_LATENCY_QUEUE = 0,
+    SERVER_LATENCY_ENCODER,
+    SERVER_LATENCY_FIRST_TOKEN,
+    SERVER_LATENCY_INTER_TOKEN,
+    SERVER_LATENCY_TOTAL,
+    SERVER_LATENCY_COUNT
+} ServerLatency;
+
+typedef struct ServerConnection ServerConnection;
+
+typedef struct InferenceServer {
+    InferenceServerConfig config;
+    GenerationScheduler* scheduler;
+    int listen_fd;
+    int epoll_fd;
+    int wake_fd;                    // eventfd: 有连接需要写出, 或者要求停止
+    atomic_bool stop_requested;
+    pthread_t compute_thread;
+
+    // 以下由lock保护
+    pthread_mutex_t lock;
+    ServerConnection* connections;  // 所有未释放的连接
+    ServerConnection* dirty;        // 有新输出或状态变化、等待I/O线程处理的连接
+    int num_connections;            // 打开的连接数
+    uint64_t accepted;
+    uint64_t finished[GENERATION_FINISHED_ERROR + 1];   // 按结束原因计数
+    LatencyHistogram latency[SERVER_LATENCY_COUNT];
+} InferenceServer;
+
+// 返回config的默认值, socket_path为NULL, tcp_port为0
+InferenceServerConfig inference_server_default_config(void);
+
+// 创建监听套接字; scheduler由调用者创建和释放, 必须比server活得久
+InferenceServer* inference_server_create(GenerationScheduler* scheduler, const InferenceServerConfig* config);
+
+// 启动计算线程并在当前线程运行事件循环, 直到inference_server_stop;
+// 返回前关闭所有连接, 调用generation_scheduler_shutdown并等待计算线程退出
+bool inference_server_run(InferenceServer* server);
+
+// 可以在任意线程或信号处理函数中调用
+void inference_server_stop(InferenceServer* server);
+
+// 把指标以STATS的格式写入stream
+void inference_server_write_stats(InferenceServer* server, FILE* stream);
+
+// 在generation_scheduler_free之后调用 (scheduler释放时未完成请求的回调仍会访问server)
+void inference_server_free(InferenceServer* server);
+
+#endif // INFERENCE_SERVER_H
@@ -0,0 +1,30 @@
+#ifndef LATENCY_HISTOGRAM_H
+#define LATENCY_HISTOGRAM_H
+
+#include <stdint.h>
+
+// 对数刻度的延迟直方图: 以微秒计, 每个2的幂分成4个桶 (相对误差约19%), 覆盖1us到约70分钟
+// 记录只是一次计数, 固定大小, 不随样本数增长; 不加锁, 由调用者保证互斥
+
+#define LATENCY_HISTOGRAM_SUB_BUCKETS 4
+#define LATENCY_HISTOGRAM_BUCKETS (32 * LATENCY_HISTOGRAM_SUB_BUCKETS + 1)
+
+typedef struct LatencyHistogram {
+    uint64_t counts[LATENCY_HISTOGRAM_BUCKETS];
+    uint64_t count;
+    double sum;                 // 秒
+    double max;                 // 秒
+} LatencyHistogram;
+
+void latency_histogram_reset(LatencyHistogram* histogram);
+
+// 记录一个延迟 (秒), 负值按0记
+void latency_histogram_record(LatencyHistogram* histogram, double seconds);
+
+// 第quantile分位 (0~1) 所在桶的上界 (秒), 不超过记录到的最大值; 没有样本时为0
+double latency_histogram_quantile(const LatencyHistogram* histogram, double quantile);
+
+// 第bucket个桶的上界 (秒)
+double latency_histogram_bucket_upper(int bucket);
+
+#endif // LATENCY_HISTOGRAM_H
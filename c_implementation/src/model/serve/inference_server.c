@@ -0,0 +1,868 @@
+#define _GNU_SOURCE
+#include "inference_server.h"
+#include <arpa/inet.h>
+#include <errno.h>
+#include <limits.h>
+#include <netinet/in.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <time.h>
+#include <unistd.h>
+
+#define SERVER_MAX_EVENTS 64
+#define SERVER_READ_CHUNK 4096
+
+// 一个已提交的请求, 作为调度器回调的user_data; on_finish时释放
+typedef struct ServerRequest {
+    InferenceServer* server;
+    ServerConnection* conn;
+    uint64_t tag;
+    uint64_t scheduler_id;              // submit返回后由I/O线程写入, 0表示还不知道
+    double last_token;                  // 上一个token的时间, 用于token间隔
+    struct ServerRequest* prev;         // 连接的活动请求链表
+    struct ServerRequest* next;
+} ServerRequest;
+
+struct ServerConnection {
+    int fd;                             // 关闭后为-1, 之后的输出直接丢弃
+    int refs;                           // I/O线程一个, 每个活动请求一个; 由server->lock保护
+    // 输入缓冲只由I/O线程访问
+    char* in;
+    size_t in_len;
+    bool discarding;                    // 当前行超长, 丢弃到下一个换行
+    bool read_closed;                   // 客户端已关闭写端
+    uint64_t next_tag;
+    // 以下由server->lock保护
+    char* out;
+    size_t out_len;
+    size_t out_sent;
+    size_t out_cap;
+    bool failed;                        // 连接出错或输出积压过多, 由I/O线程关闭
+    bool want_write;                    // 注册了EPOLLOUT
+    bool dirty;
+    ServerRequest* active;
+    ServerConnection* next_dirty;
+    ServerConnection* next_close;       // I/O线程处理dirty列表时的局部链表
+    ServerConnection* prev;
+    ServerConnection* next;
+};
+
+static const char* const finish_names[] = {"eos", "length", "cancelled", "rejected", "error"};
+static const char* const latency_names[SERVER_LATENCY_COUNT] = {
+    "queue", "encoder", "first_token", "inter_token", "request"};
+
+static double now_seconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+InferenceServerConfig inference_server_default_config(void) {
+    InferenceServerConfig config;
+    memset(&config, 0, sizeof(config));
+    config.socket_path = NULL;
+    config.tcp_port = 0;
+    config.max_connections = 256;
+    config.max_line_bytes = 64 * 1024;
+    config.max_pending_output = 4 * 1024 * 1024;
+    config.max_source_tokens = 512;
+    config.max_positions = 512;
+    config.vocab_size = 0;
+    config.default_max_new_tokens = 32;
+    config.bos_token = 1;
+    config.eos_token = 2;
+    return config;
+}
+
+static void wake_io_thread(InferenceServer* server) {
+    const uint64_t one = 1;
+    // eventfd计数溢出之前I/O线程一定会读走, 失败 (EAGAIN) 时已经有未处理的唤醒
+    if (write(server->wake_fd, &one, sizeof(one)) < 0 && errno != EAGAIN) {
+        perror("eventfd write");
+    }
+}
+
+// ---- 连接 (调用者持有server->lock) ----
+
+static void mark_dirty_locked(InferenceServer* server, ServerConnection* conn) {
+    if (conn->fd < 0 || conn->dirty) return;
+    conn->dirty = true;
+    conn->next_dirty = server->dirty;
+    const bool was_empty = server->dirty == NULL;
+    server->dirty = conn;
+    if (was_empty) wake_io_thread(server);
+}
+
+static void append_output_locked(InferenceServer* server, ServerConnection* conn, const char* data, size_t length) {
+    if (conn->fd < 0 || conn->failed) return;
+    if (conn->out_len - conn->out_sent + length > server->config.max_pending_output) {
+        // 客户端不读输出: 断开它, 取消它的请求, 不让缓冲无限增长
+        conn->failed = true;
+        mark_dirty_locked(server, conn);
+        return;
+    }
+    if (conn->out_sent > 0 && conn->out_len + length > conn->out_cap) {
+        memmove(conn->out, conn->out + conn->out_sent, conn->out_len - conn->out_sent);
+        conn->out_len -= conn->out_sent;
+        conn->out_sent = 0;
+    }
+    if (conn->out_len + length > conn->out_cap) {
+        size_t capacity = conn->out_cap ? conn->out_cap : 4096;
+        while (capacity < conn->out_len + length) capacity *= 2;
+        char* out = (char*)realloc(conn->out, capacity);
+        if (!out) {
+            conn->failed = true;
+            mark_dirty_locked(server, conn);
+            return;
+        }
+        conn->out = out;
+        conn->out_cap = capacity;
+    }
+    memcpy(conn->out + conn->out_len, data, length);
+    conn->out_len += length;
+    mark_dirty_locked(server, conn);
+}
+
+static void appendf_locked(InferenceServer* server, ServerConnection* conn, const char* format, ...)
+    __attribute__((format(printf, 3, 4)));
+
+static void appendf_locked(InferenceServer* server, ServerConnection* conn, const char* format, ...) {
+    char line[256];
+    va_list args;
+    va_start(args, format);
+    const int length = vsnprintf(line, sizeof(line), format, args);
+    va_end(args);
+    if (length > 0) {
+        append_output_locked(server, conn, line, (size_t)length < sizeof(line) ? (size_t)length : sizeof(line) - 1);
+    }
+}
+
+static void release_connection_locked(InferenceServer* server, ServerConnection* conn) {
+    if (--conn->refs > 0) return;
+    if (conn->dirty) {
+        ServerConnection** link = &server->dirty;
+        while (*link != conn) link = &(*link)->next_dirty;
+        *link = conn->next_dirty;
+    }
+    if (conn->prev) {
+        conn->prev->next = conn->next;
+    } else {
+        server->connections = conn->next;
+    }
+    if (conn->next) conn->next->prev = conn->prev;
+    free(conn->in);
+    free(conn->out);
+    free(conn);
+}
+
+static ServerRequest* find_request_locked(ServerConnection* conn, uint64_t tag) {
+    for (ServerRequest* r = conn->active; r; r = r->next) {
+        if (r->tag == tag) return r;
+    }
+    return NULL;
+}
+
+
+// ---- 调度器回调 (计算线程; 被拒绝的请求在I/O线程的submit中回调) ----
+
+static void on_token(void* user_data, uint64_t request_id, int32_t token) {
+    (void)request_id;
+    ServerRequest* r = (ServerRequest*)user_data;
+    InferenceServer* server = r->server;
+    const double now = now_seconds();
+    pthread_mutex_lock(&server->lock);
+    // 第一个token的延迟在on_finish中按调度器的时间点统计
+    if (r->last_token > 0.0) {
+        latency_histogram_record(&server->latency[SERVER_LATENCY_INTER_TOKEN], now - r->last_token);
+    }
+    r->last_token = now;
+    appendf_locked(server, r->conn, "TOK %llu %d\n", (unsigned long long)r->tag, token);
+    pthread_mutex_unlock(&server->lock);
+}
+
+static void on_finish(void* user_data, uint64_t request_id, GenerationFinishReason reason,
+                      const GenerationTiming* timing, int generated_tokens) {
+    (void)request_id;
+    ServerRequest* r = (ServerRequest*)user_data;
+    InferenceServer* server = r->server;
+    ServerConnection* conn = r->conn;
+    pthread_mutex_lock(&server->lock);
+    server->finished[reason]++;
+    if (timing->admitted > 0.0) {
+        latency_histogram_record(&server->latency[SERVER_LATENCY_QUEUE], timing->admitted - timing->submitted);
+    }
+    if (timing->encoded > 0.0) {
+        latency_histogram_record(&server->latency[SERVER_LATENCY_ENCODER], timing->encoded - timing->admitted);
+    }
+    if (timing->first_token > 0.0) {
+        latency_histogram_record(&server->latency[SERVER_LATENCY_FIRST_TOKEN],
+                                 timing->first_token - timing->submitted);
+    }
+    if (reason != GENERATION_FINISHED_REJECTED) {
+        latency_histogram_record(&server->latency[SERVER_LATENCY_TOTAL], timing->finished - timing->submitted);
+    }
+    appendf_locked(server, conn, "END %llu %s %d\n", (unsigned long long)r->tag, finish_names[reason],
+                   generated_tokens);
+
+    if (r->prev) {
+        r->prev->next = r->next;
+    } else {
+        conn->active = r->next;
+    }
+    if (r->next) r->next->prev = r->prev;
+    // 客户端已关闭写端时, 最后一个请求结束后由I/O线程关闭连接
+    mark_dirty_locked(server, conn);
+    release_connection_locked(server, conn);
+    pthread_mutex_unlock(&server->lock);
+    free(r);
+}
+
+// ---- 请求解析 (I/O线程) ----
+
+static void reply_error(InferenceServer* server, ServerConnection* conn, const char* message) {
+    pthread_mutex_lock(&server->lock);
+    appendf_locked(server, conn, "ERR %s\n", message);
+    pthread_mutex_unlock(&server->lock);
+}
+
+static bool parse_int(const char* text, long min, long max, long* value) {
+    char* end;
+    errno = 0;
+    const long v = strtol(text, &end, 10);
+    if (errno || end == text || *end != '\0' || v < min || v > max) return false;
+    *value = v;
+    return true;
+}
+
+static bool parse_float(const char* text, float* value) {
+    char* end;
+    errno = 0;
+    const float v = strtof(text, &end);
+    if (errno || end == text || *end != '\0') return false;
+    *value = v;
+    return true;
+}
+
+// 空白分隔的token id, 或 (separator为',') 逗号分隔; 返回个数, 出错返回-1
+static int parse_token_list(char* text, char separator, int32_t* tokens, int capacity, int vocab_size) {
+    int count = 0;
+    const char delimiters[] = {separator, separator == ' ' ? '\t' : '\0', '\0'};
+    char* save = NULL;
+    for (char* item = strtok_r(text, delimiters, &save); item; item = strtok_r(NULL, delimiters, &save)) {
+        long token;
+        if (count == capacity || !parse_int(item, 0, vocab_size - 1, &token)) return -1;
+        tokens[count++] = (int32_t)token;
+    }
+    return count;
+}
+
+// 提交前的检查都在这里做, 调度器只会因为缓存池不够大或正在关闭而拒绝
+static void handle_generate(InferenceServer* server, ServerConnection* conn, char* args, bool text_input) {
+    const InferenceServerConfig* config = &server->config;
+    char* body = strchr(args, '|');
+    if (!body) {
+        reply_error(server, conn, "missing '|' before the input");
+        return;
+    }
+    *body++ = '\0';
+
+    GenerationRequest request;
+    memset(&request, 0, sizeof(request));
+    request.max_new_tokens = config->default_max_new_tokens;
+    request.eos_token = config->eos_token;
+    request.sampling = (SamplerConfig){0.0f, 0, 1.0f, 1.0f};
+    int32_t* source = (int32_t*)malloc(config->max_source_tokens * sizeof(int32_t));
+    int32_t* prompt = (int32_t*)malloc(config->max_positions * sizeof(int32_t));
+    ServerRequest* r = (ServerRequest*)calloc(1, sizeof(ServerRequest));
+    const char* error = NULL;
+    if (!source || !prompt || !r) {
+        error = "out of memory";
+        goto done;
+    }
+    prompt[0] = config->bos_token;
+    request.prompt_length = 1;
+
+    char* save = NULL;
+    for (char* option = strtok_r(args, " \t", &save); option; option = strtok_r(NULL, " \t", &save)) {
+        char* value = strchr(option, '=');
+        if (!value) {
+            error = "options must be key=value";
+            goto done;
+        }
+        *value++ = '\0';
+        long n;
+        bool ok;
+        if (strcmp(option, "max_new") == 0) {
+            ok = parse_int(value, 1, config->max_positions, &n);
+            request.max_new_tokens = (int)n;
+        } else if (strcmp(option, "temperature") == 0) {
+            ok = parse_float(value, &request.sampling.temperature);
+        } else if (strcmp(option, "top_k") == 0) {
+            ok = parse_int(value, 0, config->vocab_size, &n);
+            request.sampling.top_k = (int)n;
+        } else if (strcmp(option, "top_p") == 0) {
+            ok = parse_float(value, &request.sampling.top_p) && request.sampling.top_p > 0.0f;
+        } else if (strcmp(option, "penalty") == 0) {
+            ok = parse_float(value, &request.sampling.repetition_penalty) &&
+                 request.sampling.repetition_penalty > 0.0f;
+        } else if (strcmp(option, "seed") == 0) {
+            char* end;
+            errno = 0;
+            request.seed = strtoull(value, &end, 10);
+            ok = !errno && end != value && *end == '\0';
+        } else if (strcmp(option, "eos") == 0) {
+            ok = parse_int(value, -1, config->vocab_size - 1, &n);
+            request.eos_token = (int32_t)n;
+        } else if (strcmp(option, "prompt") == 0) {
+            request.prompt_length = parse_token_list(value, ',', prompt, config->max_positions, config->vocab_size);
+            ok = request.prompt_length > 0;
+        } else {
+            error = "unknown option";
+            goto done;
+        }
+        if (!ok) {
+            error = "invalid option value";
+            goto done;
+        }
+    }
+
+    if (text_input) {
+        // 没有分词器: 原始文本按字节作为token, '|'后的一个空格是分隔符不属于文本
+        if (config->vocab_size < 256) {
+            error = "TEXT needs a vocabulary of at least 256 byte tokens";
+            goto done;
+        }
+        if (*body == ' ') body++;
+        const size_t length = strlen(body);
+        if (length > (size_t)config->max_source_tokens) {
+            error = "input too long";
+            goto done;
+        }
+        for (size_t i = 0; i < length; i++) source[i] = (unsigned char)body[i];
+        request.source_length = (int)length;
+    } else {
+        request.source_length = parse_token_list(body, ' ', source, config->max_source_tokens, config->vocab_size);
+        if (request.source_length < 0) {
+            error = "invalid or too many input tokens";
+            goto done;
+        }
+    }
+    if (request.source_length == 0) {
+        error = "empty input";
+        goto done;
+    }
+    if (request.prompt_length + request.max_new_tokens > config->max_positions) {
+        error = "prompt + max_new exceeds the maximum sequence length";
+        goto done;
+    }
+
+    request.source_tokens = source;
+    request.prompt_tokens = prompt;
+    request.callbacks = (GenerationCallbacks){on_token, on_finish, r};
+    r->server = server;
+    r->conn = conn;
+    r->tag = ++conn->next_tag;
+    pthread_mutex_lock(&server->lock);
+    r->next = conn->active;
+    if (conn->active) conn->active->prev = r;
+    conn->active = r;
+    conn->refs++;
+    pthread_mutex_unlock(&server->lock);
+
+    // 回调可能在submit返回之前就在计算线程中执行完 (r已释放), 所以之后按tag查找
+    const uint64_t tag = r->tag;
+    r = NULL;
+    const uint64_t id = generation_scheduler_submit(server->scheduler, &request);
+    if (id != 0) {
+        pthread_mutex_lock(&server->lock);
+        ServerRequest* submitted = find_request_locked(conn, tag);
+        if (submitted) submitted->scheduler_id = id;
+        pthread_mutex_unlock(&server->lock);
+    }
+
+done:
+    if (error) reply_error(server, conn, error);
+    free(source);
+    free(prompt);
+    free(r);
+}
+
+static void handle_cancel(InferenceServer* server, ServerConnection* conn, char* args) {
+    long tag;
+    while (*args == ' ') args++;
+    if (!parse_int(args, 1, LONG_MAX, &tag)) {
+        reply_error(server, conn, "CANCEL expects a request tag");
+        return;
+    }
+    pthread_mutex_lock(&server->lock);
+    const ServerRequest* r = find_request_locked(conn, (uint64_t)tag);
+    const uint64_t id = r ? r->scheduler_id : 0;
+    pthread_mutex_unlock(&server->lock);
+    // 请求已结束时END已经 (或即将) 发出, 不需要回复
+    if (id != 0) generation_scheduler_cancel(server->scheduler, id);
+}
+
+static void handle_stats(InferenceServer* server, ServerConnection* conn) {
+    char* text = NULL;
+    size_t length = 0;
+    FILE* stream = open_memstream(&text, &length);
+    if (!stream) {
+        reply_error(server, conn, "out of memory");
+        return;
+    }
+    inference_server_write_stats(server, stream);
+    fclose(stream);
+    pthread_mutex_lock(&server->lock);
+    append_output_locked(server, conn, text, length);
+    pthread_mutex_unlock(&server->lock);
+    free(text);
+}
+
+static void handle_line(InferenceServer* server, ServerConnection* conn, char* line) {
+    size_t length = strlen(line);
+    if (length > 0 && line[length - 1] == '\r') line[--length] = '\0';
+    if (length == 0) return;
+    char* args = line;
+    while (*args && *args != ' ' && *args != '\t') args++;
+    if (*args) *args++ = '\0';
+
+    if (strcmp(line, "TOKENS") == 0) {
+        handle_generate(server, conn, args, false);
+    } else if (strcmp(line, "TEXT") == 0) {
+        handle_generate(server, conn, args, true);
+    } else if (strcmp(line, "CANCEL") == 0) {
+        handle_cancel(server, conn, args);
+    } else if (strcmp(line, "STATS") == 0) {
+        handle_stats(server, conn);
+    } else {
+        reply_error(server, conn, "unknown command");
+    }
+}
+
+// ---- 事件循环 (I/O线程) ----
+
+static void update_events(InferenceServer* server, ServerConnection* conn) {
+    struct epoll_event event;
+    event.events = (conn->read_closed ? 0 : EPOLLIN) | (conn->want_write ? EPOLLOUT : 0);
+    event.data.ptr = conn;
+    if (epoll_ctl(server->epoll_fd, EPOLL_CTL_MOD, conn->fd, &event) < 0) perror("epoll_ctl");
+}
+
+static void accept_connections(InferenceServer* server) {
+    while (true) {
+        const int fd = accept4(server->listen_fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (fd < 0) {
+            if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) perror("accept");
+            if (errno == EINTR) continue;
+            return;
+        }
+        pthread_mutex_lock(&server->lock);
+        const bool full = server->num_connections >= server->config.max_connections;
+        pthread_mutex_unlock(&server->lock);
+        ServerConnection* conn = full ? NULL : (ServerConnection*)calloc(1, sizeof(ServerConnection));
+        if (conn) conn->in = (char*)malloc(server->config.max_line_bytes + 1);
+        if (!conn || !conn->in) {
+            static const char busy[] = "ERR too many connections\n";
+            if (send(fd, busy, sizeof(busy) - 1, MSG_NOSIGNAL | MSG_DONTWAIT) < 0) {
+                // 客户端已经走了, 没有别的可做
+            }
+            close(fd);
+            if (conn) free(conn);
+            continue;
+        }
+        conn->fd = fd;
+        conn->refs = 1;
+
+        struct epoll_event event;
+        event.events = EPOLLIN;
+        event.data.ptr = conn;
+        if (epoll_ctl(server->epoll_fd, EPOLL_CTL_ADD, fd, &event) < 0) {
+            perror("epoll_ctl");
+            close(fd);
+            free(conn->in);
+            free(conn);
+            continue;
+        }
+        pthread_mutex_lock(&server->lock);
+        conn->next = server->connections;
+        if (server->connections) server->connections->prev = conn;
+        server->connections = conn;
+        server->num_connections++;
+        server->accepted++;
+        pthread_mutex_unlock(&server->lock);
+    }
+}
+
+static void read_connection(InferenceServer* server, ServerConnection* conn) {
+    const size_t capacity = server->config.max_line_bytes + 1;
+    while (!conn->read_closed) {
+        const ssize_t n = recv(conn->fd, conn->in + conn->in_len, capacity - conn->in_len, 0);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            if (errno == EAGAIN || errno == EWOULDBLOCK) return;
+            pthread_mutex_lock(&server->lock);
+            conn->failed = true;
+            mark_dirty_locked(server, conn);
+            pthread_mutex_unlock(&server->lock);
+            return;
+        }
+        if (n == 0) {
+            // 客户端关闭写端: 不再读, 已提交的请求继续, 都结束后关闭
+            conn->read_closed = true;
+            update_events(server, conn);
+            pthread_mutex_lock(&server->lock);
+            mark_dirty_locked(server, conn);
+            pthread_mutex_unlock(&server->lock);
+            return;
+        }
+
+        // 处理完整的行, 剩下的半行移到缓冲区开头
+        size_t start = 0;
+        const size_t end = conn->in_len + (size_t)n;
+        for (size_t i = conn->in_len; i < end; i++) {
+            if (conn->in[i] != '\n') continue;
+            conn->in[i] = '\0';
+            if (!conn->discarding) handle_line(server, conn, conn->in + start);
+            conn->discarding = false;
+            start = i + 1;
+        }
+        conn->in_len = end - start;
+        memmove(conn->in, conn->in + start, conn->in_len);
+        if (conn->in_len == capacity) {
+            if (!conn->discarding) reply_error(server, conn, "line too long");
+            conn->discarding = true;
+            conn->in_len = 0;
+        }
+    }
+}
+
+// 写出尽可能多的输出; 返回连接是否应该关闭
+static bool flush_connection_locked(InferenceServer* server, ServerConnection* conn) {
+    while (!conn->failed && conn->out_sent < conn->out_len) {
+        const ssize_t n = send(conn->fd, conn->out + conn->out_sent, conn->out_len - conn->out_sent,
+                               MSG_NOSIGNAL | MSG_DONTWAIT);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            if (errno != EAGAIN && errno != EWOULDBLOCK) conn->failed = true;
+            break;
+        }
+        conn->out_sent += (size_t)n;
+    }
+    if (conn->failed) return true;
+    const bool pending = conn->out_sent < conn->out_len;
+    if (!pending) conn->out_len = conn->out_sent = 0;
+    if (pending != conn->want_write) {
+        conn->want_write = pending;
+        update_events(server, conn);
+    }
+    return conn->read_closed && !pending && !conn->active;
+}
+
+// 关闭套接字并取消连接上还没结束的请求, 最后释放I/O线程的引用
+static void close_connection(InferenceServer* server, ServerConnection* conn) {
+    epoll_ctl(server->epoll_fd, EPOLL_CTL_DEL, conn->fd, NULL);
+    close(conn->fd);
+
+    pthread_mutex_lock(&server->lock);
+    conn->fd = -1;
+    server->num_connections--;
+    int count = 0;
+    for (const ServerRequest* r = conn->active; r; r = r->next) count++;
+    uint64_t* ids = count ? (uint64_t*)malloc(count * sizeof(uint64_t)) : NULL;
+    count = 0;
+    for (const ServerRequest* r = conn->active; ids && r; r = r->next) {
+        if (r->scheduler_id) ids[count++] = r->scheduler_id;
+    }
+    pthread_mutex_unlock(&server->lock);
+
+    // cancel不能在持有server->lock时调用: 计算线程的回调先拿调度器的状态再拿server->lock
+    for (int i = 0; i < count; i++) generation_scheduler_cancel(server->scheduler, ids[i]);
+    free(ids);
+
+    pthread_mutex_lock(&server->lock);
+    release_connection_locked(server, conn);
+    pthread_mutex_unlock(&server->lock);
+}
+
+static void process_dirty(InferenceServer* server) {
+    ServerConnection* to_close = NULL;
+    pthread_mutex_lock(&server->lock);
+    ServerConnection* conn = server->dirty;
+    server->dirty = NULL;
+    while (conn) {
+        ServerConnection* next = conn->next_dirty;
+        conn->dirty = false;
+        conn->next_dirty = NULL;
+        if (conn->fd >= 0 && flush_connection_locked(server, conn)) {
+            conn->next_close = to_close;
+            to_close = conn;
+        }
+        conn = next;
+    }
+    pthread_mutex_unlock(&server->lock);
+
+    while (to_close) {
+        ServerConnection* next = to_close->next_close;
+        close_connection(server, to_close);
+        to_close = next;
+    }
+}
+
+static void* compute_thread_main(void* arg) {
+    InferenceServer* server = (InferenceServer*)arg;
+    while (true) {
+        const int rows = generation_scheduler_step(server->scheduler);
+        if (rows < 0) fprintf(stderr, "Inference server: generation step failed\n");
+        if (rows <= 0 && !generation_scheduler_wait(server->scheduler)) break;
+    }
+    return NULL;
+}
+
+// ---- 公共接口 ----
+
+static int open_listen_socket(InferenceServerConfig* config) {
+    int fd;
+    if (config->socket_path) {
+        struct sockaddr_un address;
+        memset(&address, 0, sizeof(address));
+        address.sun_family = AF_UNIX;
+        if (strlen(config->socket_path) >= sizeof(address.sun_path)) {
+            fprintf(stderr, "Socket path too long: %s\n", config->socket_path);
+            return -1;
+        }
+        strcpy(address.sun_path, config->socket_path);
+        fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+        if (fd < 0) {
+            perror("socket");
+            return -1;
+        }
+        unlink(config->socket_path);
+        if (bind(fd, (struct sockaddr*)&address, sizeof(address)) < 0) {
+            perror("bind");
+            close(fd);
+            return -1;
+        }
+    } else {
+        struct sockaddr_in address;
+        memset(&address, 0, sizeof(address));
+        address.sin_family = AF_INET;
+        address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        address.sin_port = htons((uint16_t)config->tcp_port);
+        fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+        if (fd < 0) {
+            perror("socket");
+            return -1;
+        }
+        const int reuse = 1;
+        setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+        socklen_t length = sizeof(address);
+        if (bind(fd, (struct sockaddr*)&address, sizeof(address)) < 0 ||
+            getsockname(fd, (struct sockaddr*)&address, &length) < 0) {
+            perror("bind");
+            close(fd);
+            return -1;
+        }
+        // 端口为0时由系统分配, 记下实际端口
+        config->tcp_port = ntohs(address.sin_port);
+    }
+    if (listen(fd, SOMAXCONN) < 0) {
+        perror("listen");
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+InferenceServer* inference_server_create(GenerationScheduler* scheduler, const InferenceServerConfig* config) {
+    if (!scheduler || !config || config->vocab_size <= 0 || config->max_connections <= 0 ||
+        config->max_line_bytes <= 0 || config->max_source_tokens <= 0 || config->max_positions <= 1 ||
+        config->default_max_new_tokens <= 0) {
+        fprintf(stderr, "Invalid inference server config\n");
+        return NULL;
+    }
+    InferenceServer* server = (InferenceServer*)calloc(1, sizeof(InferenceServer));
+    if (!server) return NULL;
+    server->config = *config;
+    server->scheduler = scheduler;
+    server->listen_fd = -1;
+    server->wake_fd = -1;
+    server->epoll_fd = -1;
+    atomic_init(&server->stop_requested, false);
+    pthread_mutex_init(&server->lock, NULL);
+    for (int i = 0; i < SERVER_LATENCY_COUNT; i++) latency_histogram_reset(&server->latency[i]);
+
+    server->listen_fd = open_listen_socket(&server->config);
+    server->wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    server->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    if (server->listen_fd < 0 || server->wake_fd < 0 || server->epoll_fd < 0) goto fail;
+
+    // listen_fd和wake_fd的事件用它们在server中的地址区分, 连接的事件指向ServerConnection
+    struct epoll_event event;
+    event.events = EPOLLIN;
+    event.data.ptr = &server->listen_fd;
+    if (epoll_ctl(server->epoll_fd, EPOLL_CTL_ADD, server->listen_fd, &event) < 0) goto fail;
+    event.data.ptr = &server->wake_fd;
+    if (epoll_ctl(server->epoll_fd, EPOLL_CTL_ADD, server->wake_fd, &event) < 0) goto fail;
+    return server;
+
+fail:
+    if (server->epoll_fd < 0 || server->wake_fd < 0) perror("Inference server");
+    inference_server_free(server);
+    return NULL;
+}
+
+bool inference_server_run(InferenceServer* server) {
+    if (pthread_create(&server->compute_thread, NULL, compute_thread_main, server) != 0) {
+        fprintf(stderr, "Failed to start the compute thread\n");
+        return false;
+    }
+
+    bool ok = true;
+    struct epoll_event events[SERVER_MAX_EVENTS];
+    while (!atomic_load(&server->stop_requested)) {
+        const int n = epoll_wait(server->epoll_fd, events, SERVER_MAX_EVENTS, -1);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            perror("epoll_wait");
+            ok = false;
+            break;
+        }
+        for (int i = 0; i < n; i++) {
+            void* source = events[i].data.ptr;
+            if (source == &server->listen_fd) {
+                accept_connections(server);
+            } else if (source == &server->wake_fd) {
+                uint64_t count;
+                if (read(server->wake_fd, &count, sizeof(count)) < 0 && errno != EAGAIN) perror("eventfd read");
+            } else {
+                ServerConnection* conn = (ServerConnection*)source;
+                if (events[i].events & (EPOLLIN | EPOLLHUP | EPOLLERR)) read_connection(server, conn);
+                pthread_mutex_lock(&server->lock);
+                // 两端都关闭了 (EPOLLHUP) 时输出已经无处可写
+                if ((events[i].events & (EPOLLHUP | EPOLLERR)) && conn->read_closed) conn->failed = true;
+                // EPOLLOUT: 套接字又可写了, 由process_dirty继续写出
+                mark_dirty_locked(server, conn);
+                pthread_mutex_unlock(&server->lock);
+            }
+        }
+        process_dirty(server);
+    }
+
+    // 关闭所有连接 (取消它们的请求), 然后让计算线程在当前step结束后退出
+    while (true) {
+        pthread_mutex_lock(&server->lock);
+        ServerConnection* conn = server->connections;
+        while (conn && conn->fd < 0) conn = conn->next;
+        pthread_mutex_unlock(&server->lock);
+        if (!conn) break;
+        close_connection(server, conn);
+    }
+    generation_scheduler_shutdown(server->scheduler);
+    pthread_join(server->compute_thread, NULL);
+    return ok;
+}
+
+void inference_server_stop(InferenceServer* server) {
+    atomic_store(&server->stop_requested, true);
+    const uint64_t one = 1;
+    // 只用async-signal-safe的调用
+    if (write(server->wake_fd, &one, sizeof(one)) < 0) {
+        // 计数已满时I/O线程一定会醒来
+    }
+}
+
+static void write_summary(FILE* stream, const char* name, const char* help, const LatencyHistogram* histogram) {
+    static const double quantiles[] = {0.5, 0.9, 0.99};
+    fprintf(stream, "# HELP transformer_server_%s_seconds %s\n", name, help);
+    fprintf(stream, "# TYPE transformer_server_%s_seconds summary\n", name);
+    for (size_t q = 0; q < sizeof(quantiles) / sizeof(quantiles[0]); q++) {
+        fprintf(stream, "transformer_server_%s_seconds{quantile=\"%g\"} %.6f\n", name, quantiles[q],
+                latency_histogram_quantile(histogram, quantiles[q]));
+    }
+    fprintf(stream, "transformer_server_%s_seconds_sum %.6f\n", name, histogram->sum);
+    fprintf(stream, "transformer_server_%s_seconds_count %llu\n", name, (unsigned long long)histogram->count);
+    fprintf(stream, "transformer_server_%s_seconds_max %.6f\n", name, histogram->max);
+}
+
+void inference_server_write_stats(InferenceServer* server, FILE* stream) {
+    static const char* const latency_help[SERVER_LATENCY_COUNT] = {
+        "Time from submission until the scheduler admits the request.",
+        "Encoder forward time per request.",
+        "Time from submission to the first generated token.",
+        "Time between consecutive generated tokens of a request.",
+        "Time from submission until the request finishes."};
+    LatencyHistogram latency[SERVER_LATENCY_COUNT];
+    uint64_t finished[GENERATION_FINISHED_ERROR + 1];
+    pthread_mutex_lock(&server->lock);
+    memcpy(latency, server->latency, sizeof(latency));
+    memcpy(finished, server->finished, sizeof(finished));
+    const int connections = server->num_connections;
+    const uint64_t accepted = server->accepted;
+    pthread_mutex_unlock(&server->lock);
+    const GenerationSchedulerMetrics m = generation_scheduler_metrics(server->scheduler);
+
+    for (int i = 0; i < SERVER_LATENCY_COUNT; i++) {
+        write_summary(stream, latency_names[i], latency_help[i], &latency[i]);
+    }
+    fprintf(stream, "# TYPE transformer_server_requests_total counter\n");
+    for (int r = 0; r <= GENERATION_FINISHED_ERROR; r++) {
+        fprintf(stream, "transformer_server_requests_total{reason=\"%s\"} %llu\n", finish_names[r],
+                (unsigned long long)finished[r]);
+    }
+    fprintf(stream, "# TYPE transformer_server_connections gauge\ntransformer_server_connections %d\n", connections);
+    fprintf(stream, "# TYPE transformer_server_connections_total counter\ntransformer_server_connections_total %llu\n",
+            (unsigned long long)accepted);
+    fprintf(stream, "# TYPE transformer_scheduler_queue_depth gauge\ntransformer_scheduler_queue_depth %d\n",
+            m.queue_depth);
+    fprintf(stream, "# TYPE transformer_scheduler_running gauge\ntransformer_scheduler_running %d\n", m.running);
+    fprintf(stream, "# TYPE transformer_scheduler_max_batch gauge\ntransformer_scheduler_max_batch %d\n",
+            m.max_batch);
+    fprintf(stream, "# TYPE transformer_scheduler_kv_blocks gauge\n");
+    fprintf(stream, "transformer_scheduler_kv_blocks{state=\"used\"} %d\n", m.used_blocks);
+    fprintf(stream, "transformer_scheduler_kv_blocks{state=\"reserved\"} %d\n", m.reserved_blocks);
+    fprintf(stream, "transformer_scheduler_kv_blocks{state=\"total\"} %d\n", m.total_blocks);
+    fprintf(stream, "# TYPE transformer_scheduler_steps_total counter\ntransformer_scheduler_steps_total %llu\n",
+            (unsigned long long)m.steps);
+    fprintf(stream, "# TYPE transformer_scheduler_generated_tokens_total counter\n"
+                    "transformer_scheduler_generated_tokens_total %llu\n",
+            (unsigned long long)m.generated_tokens);
+    fprintf(stream, "# TYPE transformer_scheduler_tokens_per_second gauge\n"
+                    "transformer_scheduler_tokens_per_second %.1f\n", m.tokens_per_second);
+    fprintf(stream, "# TYPE transformer_scheduler_mean_batch gauge\ntransformer_scheduler_mean_batch %.3f\n",
+            m.mean_batch);
+    fprintf(stream, "# TYPE transformer_scheduler_busy_seconds_total counter\n"
+                    "transformer_scheduler_busy_seconds_total %.3f\n", m.busy_seconds);
+    fprintf(stream, "# EOF\n");
+}
+
+void inference_server_free(InferenceServer* server) {
+    if (!server) return;
+    // 剩下的连接都已关闭, 只等请求的引用; scheduler已释放, 不会再有回调
+    while (server->connections) {
+        ServerConnection* conn = server->connections;
+        server->connections = conn->next;
+        for (ServerRequest* r = conn->active; r;) {
+            ServerRequest* next = r->next;
+            free(r);
+            r = next;
+        }
+        if (conn->fd >= 0) close(conn->fd);
+        free(conn->in);
+        free(conn->out);
+        free(conn);
+    }
+    if (server->listen_fd >= 0) {
+        close(server->listen_fd);
+        if (server->config.socket_path) unlink(server->config.socket_path);
+    }
+    if (server->wake_fd >= 0) close(server->wake_fd);
+    if (server->epoll_fd >= 0) close(server->epoll_fd);
+    pthread_mutex_destroy(&server->lock);
+    free(server);
+}
@@ -0,0 +1,44 @@
+#include "latency_histogram.h"
+#include <math.h>
+#include <string.h>
+
+void latency_histogram_reset(LatencyHistogram* histogram) {
+    memset(histogram, 0, sizeof(LatencyHistogram));
+}
+
+// 桶0: < 1us; 桶i (i >= 1): [2^((i-1)/4), 2^(i/4)) us
+static int bucket_of(double microseconds) {
+    if (microseconds < 1.0) return 0;
+    const int bucket = (int)floor(log2(microseconds) * LATENCY_HISTOGRAM_SUB_BUCKETS) + 1;
+    return bucket < LATENCY_HISTOGRAM_BUCKETS ? bucket : LATENCY_HISTOGRAM_BUCKETS - 1;
+}
+
+double latency_histogram_bucket_upper(int bucket) {
+    return exp2((double)bucket / LATENCY_HISTOGRAM_SUB_BUCKETS) * 1e-6;
+}
+
+void latency_histogram_record(LatencyHistogram* histogram, double seconds) {
+    if (!(seconds > 0.0)) seconds = 0.0;
+    histogram->counts[bucket_of(seconds * 1e6)]++;
+    histogram->count++;
+    histogram->sum += seconds;
+    if (seconds > histogram->max) histogram->max = seconds;
+}
+
+double latency_histogram_quantile(const LatencyHistogram* histogram, double quantile) {
+    if (histogram->count == 0) return 0.0;
+    if (quantile < 0.0) quantile = 0.0;
+    if (quantile > 1.0) quantile = 1.0;
+    // 排名第rank的样本 (从1开始) 所在的桶
+    uint64_t rank = (uint64_t)ceil(quantile * (double)histogram->count);
+    if (rank == 0) rank = 1;
+    uint64_t cumulative = 0;
+    for (int b = 0; b < LATENCY_HISTOGRAM_BUCKETS; b++) {
+        cumulative += histogram->counts[b];
+        if (cumulative >= rank) {
+            const double upper = latency_histogram_bucket_upper(b);
+            return upper < histogram->max ? upper : histogram->max;
+        }
+    }
+    return histogram->max;
+}
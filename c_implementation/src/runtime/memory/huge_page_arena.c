@@ -0,0 +1,294 @@
+#define _GNU_SOURCE
+#include "huge_page_arena.h"
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/mman.h>
+#include <sys/prctl.h>
+#include <unistd.h>
+
+// 老的头文件可能没有这些定义
+#ifndef MAP_HUGE_SHIFT
+#define MAP_HUGE_SHIFT 26
+#endif
+#ifndef MAP_HUGE_2MB
+#define MAP_HUGE_2MB (21 << MAP_HUGE_SHIFT)
+#endif
+#ifndef PR_SET_VMA
+#define PR_SET_VMA 0x53564d41
+#define PR_SET_VMA_ANON_NAME 0
+#endif
+
+// 一次映射. 普通/透明大页映射的前后各留一个PROT_NONE保护页,
+// 使它不与相邻的匿名映射合并成同一个VMA, smaps中的统计才能只算这块内存
+typedef struct HugeArenaChunk {
+    char* base;              // 可用区域, 2MB对齐
+    size_t length;           // 可用长度, 2MB的整数倍
+    size_t used;
+    char* map_base;          // 含保护页的整个映射
+    size_t map_bytes;
+    HugePageMode backing;    // 实际得到的方式: EXPLICIT / TRANSPARENT / OFF
+    struct HugeArenaChunk* next;
+} HugeArenaChunk;
+
+struct HugePageArena {
+    char name[48];
+    HugePageMode mode;
+    size_t chunk_bytes;
+    HugeArenaChunk* chunks;  // 最新的映射在表头, 只从表头分配
+    pthread_mutex_t lock;
+};
+
+static size_t round_up(size_t value, size_t alignment) {
+    return (value + alignment - 1) / alignment * alignment;
+}
+
+static void name_mapping(const HugePageArena* arena, void* base, size_t length) {
+    // 在 /proc/self/smaps 中显示为 [anon:transformer-<name>]; 内核不支持时忽略
+    char label[64];
+    snprintf(label, sizeof(label), "transformer-%s", arena->name);
+    prctl(PR_SET_VMA, PR_SET_VMA_ANON_NAME, (unsigned long)base, length, (unsigned long)label);
+}
+
+static bool map_explicit(HugeArenaChunk* chunk, size_t length) {
+    void* base = mmap(NULL, length, PROT_READ | PROT_WRITE,
+                      MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB | MAP_HUGE_2MB, -1, 0);
+    if (base == MAP_FAILED) return false;
+    chunk->base = chunk->map_base = (char*)base;
+    chunk->length = chunk->map_bytes = length;
+    chunk->backing = HUGE_PAGES_EXPLICIT;
+    return true;
+}
+
+// 普通映射, 可用区域2MB对齐; transparent为true时再请求透明大页
+static bool map_regular(HugeArenaChunk* chunk, size_t length, bool transparent) {
+    const size_t page = (size_t)sysconf(_SC_PAGESIZE);
+    const size_t total = length + HUGE_PAGE_SIZE + 2 * page;
+    char* raw = (char*)mmap(NULL, total, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (raw == MAP_FAILED) return false;
+
+    char* base = (char*)round_up((uintptr_t)raw + page, HUGE_PAGE_SIZE);
+    char* map_base = base - page;
+    char* map_end = base + length + page;
+    if (mprotect(base, length, PROT_READ | PROT_WRITE) != 0) {
+        munmap(raw, total);
+        return false;
+    }
+    // 去掉对齐多出来的部分, 前后只保留一个保护页
+    if (map_base > raw) munmap(raw, map_base - raw);
+    if (raw + total > map_end) munmap(map_end, raw + total - map_end);
+
+    chunk->base = base;
+    chunk->length = length;
+    chunk->map_base = map_base;
+    chunk->map_bytes = map_end - map_base;
+    chunk->backing = HUGE_PAGES_OFF;
+#ifdef MADV_HUGEPAGE
+    // 内核关闭了透明大页 (enabled=never) 时madvise仍可能成功, 实际覆盖率以smaps为准
+    if (transparent && madvise(base, length, MADV_HUGEPAGE) == 0) {
+        chunk->backing = HUGE_PAGES_TRANSPARENT;
+    }
+#else
+    (void)transparent;
+#endif
+    return true;
+}
+
+// 调用方持有锁
+static HugeArenaChunk* arena_add_chunk(HugePageArena* arena, size_t min_bytes) {
+    HugeArenaChunk* chunk = (HugeArenaChunk*)calloc(1, sizeof(HugeArenaChunk));
+    if (!chunk) return NULL;
+    const size_t length = round_up(min_bytes > arena->chunk_bytes ? min_bytes : arena->chunk_bytes,
+                                   HUGE_PAGE_SIZE);
+
+    bool mapped = false;
+    if (arena->mode == HUGE_PAGES_EXPLICIT || arena->mode == HUGE_PAGES_AUTO) {
+        mapped = map_explicit(chunk, length);
+    }
+    if (!mapped) {
+        mapped = map_regular(chunk, length, arena->mode != HUGE_PAGES_OFF);
+    }
+    if (!mapped) {
+        fprintf(stderr, "Failed to map %zu bytes for arena '%s'\n", length, arena->name);
+        free(chunk);
+        return NULL;
+    }
+    name_mapping(arena, chunk->base, chunk->length);
+    chunk->next = arena->chunks;
+    arena->chunks = chunk;
+    return chunk;
+}
+
+HugePageArena* huge_arena_create(const char* name, size_t chunk_bytes, HugePageMode mode) {
+    HugePageArena* arena = (HugePageArena*)calloc(1, sizeof(HugePageArena));
+    if (!arena) return NULL;
+    snprintf(arena->name, sizeof(arena->name), "%s", name ? name : "arena");
+    arena->mode = mode;
+    arena->chunk_bytes = round_up(chunk_bytes > 0 ? chunk_bytes : HUGE_PAGE_SIZE, HUGE_PAGE_SIZE);
+    pthread_mutex_init(&arena->lock, NULL);
+    return arena;
+}
+
+void* huge_arena_alloc(HugePageArena* arena, size_t bytes) {
+    if (!arena) return NULL;
+    bytes = round_up(bytes > 0 ? bytes : 1, HUGE_ARENA_ALIGNMENT);
+
+    pthread_mutex_lock(&arena->lock);
+    HugeArenaChunk* chunk = arena->chunks;
+    if (!chunk || chunk->length - chunk->used < bytes) {
+        // 只从最新的映射分配, 旧映射剩下的尾部不再使用; 权重和KV池都是一次分配好, 浪费很少
+        chunk = arena_add_chunk(arena, bytes);
+    }
+    void* ptr = NULL;
+    if (chunk) {
+        ptr = chunk->base + chunk->used;
+        chunk->used += bytes;
+    }
+    pthread_mutex_unlock(&arena->lock);
+    // 映射只增不复用, 新分配的内存一定是0
+    return ptr;
+}
+
+bool huge_arena_contains(HugePageArena* arena, const void* ptr) {
+    if (!arena || !ptr) return false;
+    bool found = false;
+    pthread_mutex_lock(&arena->lock);
+    for (HugeArenaChunk* chunk = arena->chunks; chunk && !found; chunk = chunk->next) {
+        found = (const char*)ptr >= chunk->base && (const char*)ptr < chunk->base + chunk->length;
+    }
+    pthread_mutex_unlock(&arena->lock);
+    return found;
+}
+
+Tensor* huge_arena_tensor_create(HugePageArena* arena, int* shape, int num_dims) {
+    if (!arena || !shape || num_dims <= 0) return NULL;
+    Tensor* tensor = (Tensor*)malloc(sizeof(Tensor));
+    int* tensor_shape = (int*)malloc(num_dims * sizeof(int));
+    float* data = (float*)huge_arena_alloc(arena, calculate_total_size(shape, num_dims) * sizeof(float));
+    if (!tensor || !tensor_shape || !data) {
+        free(tensor);
+        free(tensor_shape);
+        return NULL;
+    }
+    memcpy(tensor_shape, shape, num_dims * sizeof(int));
+    tensor->data = data;
+    tensor->shape = tensor_shape;
+    tensor->num_dims = num_dims;
+    tensor->borrowed_data = true;
+    return tensor;
+}
+
+bool huge_arena_adopt_tensor(HugePageArena* arena, Tensor* tensor) {
+    if (!arena || !tensor || !tensor->data) return false;
+    if (tensor->borrowed_data && huge_arena_contains(arena, tensor->data)) return true;
+
+    const size_t bytes = calculate_total_size(tensor->shape, tensor->num_dims) * sizeof(float);
+    float* data = (float*)huge_arena_alloc(arena, bytes);
+    if (!data) return false;
+    memcpy(data, tensor->data, bytes);
+    if (!tensor->borrowed_data) {
+        free(tensor->data);
+    }
+    tensor->data = data;
+    tensor->borrowed_data = true;
+    return true;
+}
+
+// 从 /proc/self/smaps 累计落在本内存区映射中的驻留量和透明大页量, 调用方持有锁
+static void read_smaps(const HugePageArena* arena, HugeArenaStats* stats) {
+    FILE* file = fopen("/proc/self/smaps", "r");
+    if (!file) return;
+    char line[512];
+    bool inside = false;
+    while (fgets(line, sizeof(line), file)) {
+        unsigned long start, end;
+        size_t kb;
+        if (sscanf(line, "%lx-%lx ", &start, &end) == 2 && strchr(line, '-') < strchr(line, ' ')) {
+            // 保护页保证VMA不会越过映射的边界, 与任意一块可用区域相交即属于本内存区
+            inside = false;
+            for (const HugeArenaChunk* chunk = arena->chunks; chunk && !inside; chunk = chunk->next) {
+                inside = start < (uintptr_t)chunk->base + chunk->length && end > (uintptr_t)chunk->base;
+            }
+        } else if (inside && sscanf(line, "Rss: %zu kB", &kb) == 1) {
+            stats->resident_bytes += kb << 10;
+        } else if (inside && sscanf(line, "AnonHugePages: %zu kB", &kb) == 1) {
+            stats->transparent_huge_bytes += kb << 10;
+        } else if (inside && (sscanf(line, "Private_Hugetlb: %zu kB", &kb) == 1 ||
+                              sscanf(line, "Shared_Hugetlb: %zu kB", &kb) == 1)) {
+            // hugetlb页不计入Rss
+            stats->resident_bytes += kb << 10;
+        }
+    }
+    fclose(file);
+}
+
+void huge_arena_stats(HugePageArena* arena, HugeArenaStats* stats) {
+    memset(stats, 0, sizeof(*stats));
+    if (!arena) return;
+    pthread_mutex_lock(&arena->lock);
+    for (const HugeArenaChunk* chunk = arena->chunks; chunk; chunk = chunk->next) {
+        stats->reserved_bytes += chunk->length;
+        stats->used_bytes += chunk->used;
+        if (chunk->backing == HUGE_PAGES_EXPLICIT) {
+            stats->explicit_huge_bytes += chunk->length;
+        }
+        stats->num_chunks++;
+    }
+    read_smaps(arena, stats);
+    pthread_mutex_unlock(&arena->lock);
+}
+
+void huge_arena_print_report(HugePageArena* arena, FILE* stream) {
+    if (!arena) return;
+    HugeArenaStats stats;
+    huge_arena_stats(arena, &stats);
+    const double mb = 1.0 / (1 << 20);
+    const size_t huge = stats.explicit_huge_bytes + stats.transparent_huge_bytes;
+    fprintf(stream, "arena '%s' (%s): %d mappings, reserved %.1f MB, used %.1f MB, resident %.1f MB\n",
+            arena->name, huge_page_mode_name(arena->mode), stats.num_chunks,
+            stats.reserved_bytes * mb, stats.used_bytes * mb, stats.resident_bytes * mb);
+    fprintf(stream, "  huge pages: %.1f MB explicit + %.1f MB transparent = %.1f%% of resident\n",
+            stats.explicit_huge_bytes * mb, stats.transparent_huge_bytes * mb,
+            stats.resident_bytes > 0 ? 100.0 * huge / stats.resident_bytes : 0.0);
+    pthread_mutex_lock(&arena->lock);
+    for (const HugeArenaChunk* chunk = arena->chunks; chunk; chunk = chunk->next) {
+        fprintf(stream, "  %p %8.1f MB used %8.1f MB  %s\n", (void*)chunk->base,
+                chunk->length * mb, chunk->used * mb, huge_page_mode_name(chunk->backing));
+    }
+    pthread_mutex_unlock(&arena->lock);
+}
+
+void huge_arena_free(HugePageArena* arena) {
+    if (!arena) return;
+    HugeArenaChunk* chunk = arena->chunks;
+    while (chunk) {
+        HugeArenaChunk* next = chunk->next;
+        munmap(chunk->map_base, chunk->map_bytes);
+        free(chunk);
+        chunk = next;
+    }
+    pthread_mutex_destroy(&arena->lock);
+    free(arena);
+}
+
+HugePageMode huge_page_mode_from_env(void) {
+    const char* env = getenv("TRANSFORMER_HUGE_PAGES");
+    if (!env || !*env || strcasecmp(env, "auto") == 0) return HUGE_PAGES_AUTO;
+    if (strcasecmp(env, "off") == 0 || strcmp(env, "0") == 0) return HUGE_PAGES_OFF;
+    if (strcasecmp(env, "thp") == 0) return HUGE_PAGES_TRANSPARENT;
+    if (strcasecmp(env, "explicit") == 0) return HUGE_PAGES_EXPLICIT;
+    fprintf(stderr, "Unknown TRANSFORMER_HUGE_PAGES mode '%s', expected off/thp/explicit/auto\n", env);
+    return HUGE_PAGES_AUTO;
+}
+
+const char* huge_page_mode_name(HugePageMode mode) {
+    switch (mode) {
+        case HUGE_PAGES_OFF: return "4k pages";
+        case HUGE_PAGES_TRANSPARENT: return "transparent huge pages";
+        case HUGE_PAGES_EXPLICIT: return "hugetlbfs";
+        case HUGE_PAGES_AUTO: return "auto";
+    }
+    return "unknown";
+}
@@ -0,0 +1,68 @@
+#ifndef HUGE_PAGE_ARENA_H
+#define HUGE_PAGE_ARENA_H
+
+#include "tensor_type.h"
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdio.h>
+
+// 大页内存区, 用于加载后长期驻留的大块内存 (模型权重, KV缓存池)
+// 几百MB的权重用4KB页时TLB远远覆盖不到, GEMM按列条带读取权重时几乎每个页都要走一次页表;
+// 这里按2MB大页整块映射, 区内顺序分配, 不单独释放, 整个区一起释放
+//
+// 映射方式:
+//   HUGE_PAGES_EXPLICIT:    MAP_HUGETLB, 从hugetlbfs预留池取页 (需要 vm.nr_hugepages 预留足够的页)
+//   HUGE_PAGES_TRANSPARENT: 2MB对齐的普通映射 + madvise(MADV_HUGEPAGE), 内核在缺页时分配透明大页
+//   HUGE_PAGES_OFF:         普通页
+//   HUGE_PAGES_AUTO:        依次尝试上面三种
+// 任何一种方式失败都退到下一种, 不报错, 只影响大页覆盖率; 实际覆盖率用 huge_arena_stats 查询
+
+#define HUGE_PAGE_SIZE ((size_t)2 << 20)
+#define HUGE_ARENA_ALIGNMENT 64
+
+typedef enum HugePageMode {
+    HUGE_PAGES_OFF = 0,
+    HUGE_PAGES_TRANSPARENT = 1,
+    HUGE_PAGES_EXPLICIT = 2,
+    HUGE_PAGES_AUTO = 3
+} HugePageMode;
+
+typedef struct HugePageArena HugePageArena;
+
+typedef struct HugeArenaStats {
+    size_t reserved_bytes;       // 已映射的总长度
+    size_t used_bytes;           // 已分配 (含对齐填充)
+    size_t resident_bytes;       // 已驻留物理内存的部分
+    size_t explicit_huge_bytes;  // 来自hugetlbfs预留池的部分
+    size_t transparent_huge_bytes;   // 由透明大页支持的部分 (/proc/self/smaps 的 AnonHugePages)
+    int num_chunks;              // 映射次数
+} HugeArenaStats;
+
+// 创建内存区, 每次不够时新映射至少chunk_bytes (向上取整到2MB); 此时不映射任何内存
+HugePageArena* huge_arena_create(const char* name, size_t chunk_bytes, HugePageMode mode);
+
+// 分配bytes字节, 64字节对齐, 内容为0; 线程安全. 失败返回NULL
+void* huge_arena_alloc(HugePageArena* arena, size_t bytes);
+
+// ptr是否在该内存区中
+bool huge_arena_contains(HugePageArena* arena, const void* ptr);
+
+// 创建数据在内存区中的张量, tensor_free只释放张量结构, 数据随内存区释放
+Tensor* huge_arena_tensor_create(HugePageArena* arena, int* shape, int num_dims);
+
+// 把已有张量的数据搬进内存区并释放原数据; 调用方要保证此时没有其他线程使用该张量,
+// 并且没有保存旧的data指针 (如NUMA登记, 先numa_forget_weights, 搬完再重新放置)
+bool huge_arena_adopt_tensor(HugePageArena* arena, Tensor* tensor);
+
+// 统计映射和大页覆盖情况; 透明大页的覆盖率要读smaps, 不要在热路径上调用
+void huge_arena_stats(HugePageArena* arena, HugeArenaStats* stats);
+void huge_arena_print_report(HugePageArena* arena, FILE* stream);
+
+// 释放所有映射, 之后内存区中的张量不能再使用
+void huge_arena_free(HugePageArena* arena);
+
+// 由环境变量 TRANSFORMER_HUGE_PAGES (off/thp/explicit/auto) 取映射方式, 未设置时为auto
+HugePageMode huge_page_mode_from_env(void);
+const char* huge_page_mode_name(HugePageMode mode);
+
+#endif // HUGE_PAGE_ARENA_H
@@ -0,0 +1,70 @@
+#ifndef KV_CACHE_POOL_H
+#define KV_CACHE_POOL_H
+
+#include "huge_page_arena.h"
+#include <pthread.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdio.h>
+
+// 分块的KV缓存池, 存储在一个大页内存区中, 创建时一次分配并预先写入, 解码时不再缺页
+// 每个块保存block_tokens个位置在所有层的K和V, 一个序列的缓存是若干块组成的块表;
+// 块有引用计数, 多个序列 (如束搜索的各条候选) 可以共享相同前缀的块
+//
+// 块内布局 (每层两段, 先K后V):
+//   [num_layers][2][num_heads][block_tokens][head_dim]
+// 每段head_dim连续, 与 split_kv_attention 的 [B,H,L,head_dim] 缓存中一个头的布局相同
+
+typedef struct KVCachePool {
+    int num_layers;
+    int num_heads;
+    int head_dim;
+    int block_tokens;           // 每块的位置数
+    int num_blocks;
+    size_t block_floats;        // 一块的float数, 按64字节对齐
+
+    float* storage;             // [num_blocks * block_floats]
+    HugePageArena* arena;
+
+    pthread_mutex_t lock;       // 保护下面的空闲栈和引用计数
+    int* free_blocks;           // 空闲块栈
+    int num_free;
+    int* ref_counts;            // [num_blocks], 0表示空闲
+} KVCachePool;
+
+// 创建能容纳 num_blocks * block_tokens 个位置的缓存池, 内存按mode从大页分配
+KVCachePool* kv_cache_pool_create(int num_layers, int num_heads, int head_dim,
+                                  int block_tokens, int num_blocks, HugePageMode mode);
+
+// 按字节预算计算能放下的块数
+int kv_cache_pool_blocks_for_bytes(int num_layers, int num_heads, int head_dim,
+                                   int block_tokens, size_t bytes);
+
+// 取一个空闲块, 引用计数为1; 池满时返回-1, 调用方决定等待还是拒绝请求
+int kv_cache_pool_alloc_block(KVCachePool* pool);
+
+// 共享块时增加引用, 不再使用时释放; 计数降到0的块回到空闲栈, 内容不清零
+void kv_cache_pool_retain_block(KVCachePool* pool, int block);
+void kv_cache_pool_release_block(KVCachePool* pool, int block);
+
+// 块的引用计数, 大于1时写入前要先复制 (写时复制)
+int kv_cache_pool_block_refs(KVCachePool* pool, int block);
+
+int kv_cache_pool_free_blocks(KVCachePool* pool);
+
+// 第layer层在block块中的K/V, 指向 [num_heads][block_tokens][head_dim]
+static inline float* kv_cache_pool_keys(const KVCachePool* pool, int block, int layer) {
+    return pool->storage + (size_t)block * pool->block_floats +
+           (size_t)layer * 2 * pool->num_heads * pool->block_tokens * pool->head_dim;
+}
+
+static inline float* kv_cache_pool_values(const KVCachePool* pool, int block, int layer) {
+    return kv_cache_pool_keys(pool, block, layer) + (size_t)pool->num_heads * pool->block_tokens * pool->head_dim;
+}
+
+// 打印块的使用情况和大页覆盖率
+void kv_cache_pool_print_report(KVCachePool* pool, FILE* stream);
+
+void kv_cache_pool_free(KVCachePool* pool);
+
+#endif // KV_CACHE_POOL_H
@@ -0,0 +1,120 @@
+#include "kv_cache_pool.h"
+#include <limits.h>
+#include <stdlib.h>
+#include <string.h>
+
+static size_t block_floats_for(int num_layers, int num_heads, int head_dim, int block_tokens) {
+    const size_t floats = (size_t)num_layers * 2 * num_heads * block_tokens * head_dim;
+    const size_t align = HUGE_ARENA_ALIGNMENT / sizeof(float);
+    return (floats + align - 1) / align * align;
+}
+
+int kv_cache_pool_blocks_for_bytes(int num_layers, int num_heads, int head_dim,
+                                   int block_tokens, size_t bytes) {
+    if (num_layers <= 0 || num_heads <= 0 || head_dim <= 0 || block_tokens <= 0) return 0;
+    const size_t block_bytes = block_floats_for(num_layers, num_heads, head_dim, block_tokens) * sizeof(float);
+    const size_t blocks = bytes / block_bytes;
+    return blocks > (size_t)INT_MAX ? INT_MAX : (int)blocks;
+}
+
+KVCachePool* kv_cache_pool_create(int num_layers, int num_heads, int head_dim,
+                                  int block_tokens, int num_blocks, HugePageMode mode) {
+    if (num_layers <= 0 || num_heads <= 0 || head_dim <= 0 || block_tokens <= 0 || num_blocks <= 0) {
+        fprintf(stderr, "Invalid KV cache pool: %d layers, %d heads, head_dim %d, %d x %d tokens\n",
+                num_layers, num_heads, head_dim, num_blocks, block_tokens);
+        return NULL;
+    }
+
+    KVCachePool* pool = (KVCachePool*)calloc(1, sizeof(KVCachePool));
+    if (!pool) return NULL;
+    pool->num_layers = num_layers;
+    pool->num_heads = num_heads;
+    pool->head_dim = head_dim;
+    pool->block_tokens = block_tokens;
+    pool->num_blocks = num_blocks;
+    pool->block_floats = block_floats_for(num_layers, num_heads, head_dim, block_tokens);
+    pthread_mutex_init(&pool->lock, NULL);
+
+    const size_t bytes = pool->block_floats * num_blocks * sizeof(float);
+    pool->arena = huge_arena_create("kv-cache", bytes, mode);
+    pool->storage = (float*)huge_arena_alloc(pool->arena, bytes);
+    pool->free_blocks = (int*)malloc(num_blocks * sizeof(int));
+    pool->ref_counts = (int*)calloc(num_blocks, sizeof(int));
+    if (!pool->storage || !pool->free_blocks || !pool->ref_counts) {
+        fprintf(stderr, "Failed to allocate KV cache pool of %zu bytes\n", bytes);
+        kv_cache_pool_free(pool);
+        return NULL;
+    }
+
+    // 预先写入, 大页在这里分配好, 解码时第一次写某个块不会缺页
+    memset(pool->storage, 0, bytes);
+
+    // 低编号的块先分配, 使用中的块集中在内存区的前部
+    for (int i = 0; i < num_blocks; i++) {
+        pool->free_blocks[i] = num_blocks - 1 - i;
+    }
+    pool->num_free = num_blocks;
+    return pool;
+}
+
+int kv_cache_pool_alloc_block(KVCachePool* pool) {
+    int block = -1;
+    pthread_mutex_lock(&pool->lock);
+    if (pool->num_free > 0) {
+        block = pool->free_blocks[--pool->num_free];
+        pool->ref_counts[block] = 1;
+    }
+    pthread_mutex_unlock(&pool->lock);
+    return block;
+}
+
+void kv_cache_pool_retain_block(KVCachePool* pool, int block) {
+    if (block < 0 || block >= pool->num_blocks) return;
+    pthread_mutex_lock(&pool->lock);
+    if (pool->ref_counts[block] > 0) {
+        pool->ref_counts[block]++;
+    }
+    pthread_mutex_unlock(&pool->lock);
+}
+
+void kv_cache_pool_release_block(KVCachePool* pool, int block) {
+    if (block < 0 || block >= pool->num_blocks) return;
+    pthread_mutex_lock(&pool->lock);
+    if (pool->ref_counts[block] > 0 && --pool->ref_counts[block] == 0) {
+        pool->free_blocks[pool->num_free++] = block;
+    }
+    pthread_mutex_unlock(&pool->lock);
+}
+
+int kv_cache_pool_block_refs(KVCachePool* pool, int block) {
+    if (block < 0 || block >= pool->num_blocks) return 0;
+    pthread_mutex_lock(&pool->lock);
+    const int refs = pool->ref_counts[block];
+    pthread_mutex_unlock(&pool->lock);
+    return refs;
+}
+
+int kv_cache_pool_free_blocks(KVCachePool* pool) {
+    pthread_mutex_lock(&pool->lock);
+    const int free_blocks = pool->num_free;
+    pthread_mutex_unlock(&pool->lock);
+    return free_blocks;
+}
+
+void kv_cache_pool_print_report(KVCachePool* pool, FILE* stream) {
+    if (!pool) return;
+    const int free_blocks = kv_cache_pool_free_blocks(pool);
+    fprintf(stream, "KV cache pool: %d/%d blocks in use, %d tokens per block, %.1f KB per block\n",
+            pool->num_blocks - free_blocks, pool->num_blocks, pool->block_tokens,
+            pool->block_floats * sizeof(float) / 1024.0);
+    huge_arena_print_report(pool->arena, stream);
+}
+
+void kv_cache_pool_free(KVCachePool* pool) {
+    if (!pool) return;
+    huge_arena_free(pool->arena);
+    free(pool->free_blocks);
+    free(pool->ref_counts);
+    pthread_mutex_destroy(&pool->lock);
+    free(pool);
+}
@@ -0,0 +1,91 @@
+#ifndef NUMA_PLACEMENT_H
+#define NUMA_PLACEMENT_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+// NUMA感知的权重放置和线程绑定
+// 拓扑从 /sys/devices/system/node 读取, 内存策略直接用mbind系统调用, 不依赖libnuma;
+// 单节点机器或容器不允许设置内存策略时, 所有接口退化为普通行为
+//
+// 只读权重有两种放置方式:
+//   NUMA_POLICY_INTERLEAVE: 权重的页轮流放在各节点上, 各节点带宽平均使用, 约 (N-1)/N 的读取跨节点
+//   NUMA_POLICY_REPLICATE:  每个节点一份副本, GEMM任务读取当前线程所在节点的副本, 读取全部在本地
+// 副本在放置时从原权重复制, 之后再修改原权重不会同步, 所以只用于推理, 在权重加载完成后调用
+
+#define NUMA_MAX_NODES 64
+
+typedef enum NumaPolicy {
+    NUMA_POLICY_NONE = 0,        // 不干预, 页落在第一次写入它的线程所在节点
+    NUMA_POLICY_INTERLEAVE = 1,
+    NUMA_POLICY_REPLICATE = 2
+} NumaPolicy;
+
+typedef struct NumaTopology {
+    int num_nodes;               // 有CPU的节点数, 至少为1
+    int node_ids[NUMA_MAX_NODES];    // 内核中的节点编号
+    int num_cpus;                // 所有节点的CPU总数
+    int* cpus;                   // [num_cpus] 按节点排列的CPU编号
+    int* node_cpu_offset;        // [num_nodes + 1] 第n个节点的CPU在cpus中的区间
+    int max_cpu;                 // cpu_node的长度
+    int* cpu_node;               // [max_cpu] CPU编号 -> 节点序号 (0..num_nodes-1), 未知为-1
+} NumaTopology;
+
+// 估计的权重读取流量, 由GEMM按读取的B条带累计
+typedef struct NumaTraffic {
+    uint64_t local_bytes;        // 读取本节点内存
+    uint64_t remote_bytes;       // 读取其他节点内存
+    uint64_t unplaced_bytes;     // 读取未登记的权重, 所在节点未知
+} NumaTraffic;
+
+// 拓扑只在第一次调用时读取, 返回的结构在进程内不变
+const NumaTopology* numa_topology(void);
+
+// 当前线程所在的节点序号; 绑定过的工作线程直接返回绑定节点, 其他线程按当前CPU查询
+int numa_current_node(void);
+
+// 线程池启动时是否把工作线程绑定到CPU; 默认取环境变量 TRANSFORMER_PIN_THREADS (非0即开启)
+// 必须在线程池第一次使用之前设置, 之后修改要 thread_pool_shutdown 再重新初始化才生效
+void numa_set_thread_pinning(bool enabled);
+bool numa_thread_pinning_enabled(void);
+
+// 第slot个 (共num_slots个) 线程所属的节点序号, 线程按slot顺序均匀分到各节点
+int numa_slot_node(int slot, int num_slots);
+
+// 把调用线程绑定到第slot个线程对应的CPU, 返回绑定的节点序号, 失败返回-1
+// 同一节点的线程占用该节点的不同CPU
+int numa_pin_thread(int slot, int num_slots);
+
+// 把调用线程绑定到编号为cpu的CPU, 返回它所在的节点序号, 失败返回-1
+int numa_pin_thread_to_cpu(int cpu);
+
+// 登记一块只读权重并按policy放置, 之后GEMM读取它时按当前节点选择副本并累计流量
+// data必须在numa_forget_weights之前保持有效; 重复登记同一地址会先撤销之前的放置
+bool numa_place_weights(const float* data, size_t count, NumaPolicy policy);
+
+// 撤销登记并释放副本, 释放权重内存之前必须调用
+void numa_forget_weights(const float* data);
+
+// 返回ptr在当前节点的副本中的对应位置, ptr可以指向登记区域的内部 (如子矩阵);
+// 没有副本时返回ptr本身. 没有任何登记时只有一次原子读; 否则不加锁, 只写调用线程自己的读状态,
+// 放置/撤销发布新的登记表快照并等正在读旧快照的查询结束, 所以可以与它们并发调用
+const float* numa_local_weights(const float* ptr);
+
+// 累计从ptr开始读取bytes字节的权重流量, 只有开启统计时才记录
+void numa_account_weight_read(const float* ptr, size_t bytes);
+
+// 流量统计, 默认在放置过权重或设置了环境变量 TRANSFORMER_NUMA_STATS 时开启
+void numa_set_traffic_stats(bool enabled);
+bool numa_traffic_stats_enabled(void);
+void numa_traffic_snapshot(NumaTraffic* traffic);
+void numa_traffic_reset(void);
+
+// 打印拓扑、已登记的权重和流量估计
+void numa_print_report(FILE* stream);
+
+// 由环境变量 TRANSFORMER_NUMA (none/interleave/replicate) 取默认策略
+NumaPolicy numa_policy_from_env(void);
+
+#endif // NUMA_PLACEMENT_H
@@ -0,0 +1,648 @@
+#define _GNU_SOURCE
+#include "numa_placement.h"
+#include <errno.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+// 内存策略常量, 与 <numaif.h> 一致; 直接用系统调用, 不链接libnuma
+#define NUMA_MPOL_BIND 2
+#define NUMA_MPOL_INTERLEAVE 3
+#define NUMA_MPOL_MF_MOVE (1 << 1)
+#define NUMA_MPOL_F_NODE (1 << 0)
+#define NUMA_MPOL_F_ADDR (1 << 1)
+#define NUMA_MASK_WORDS ((NUMA_MAX_NODES * 8 + 63) / 64)
+
+// 一块登记的权重
+typedef struct NumaRegion {
+    const float* base;
+    size_t bytes;
+    NumaPolicy policy;
+    int home_node;                       // 原数据所在的节点序号, 未知为-1
+    const float* replicas[NUMA_MAX_NODES];   // 各节点读取的副本, NULL表示读原数据
+    size_t mapped_bytes;                 // 每个mmap副本的长度
+} NumaRegion;
+
+static NumaTopology g_topology;
+static pthread_once_t g_topology_once = PTHREAD_ONCE_INIT;
+
+// 按base排序的登记表快照, 发布后不再修改; 没有登记时为NULL
+typedef struct NumaRegionTable {
+    int count;
+    NumaRegion regions[];
+} NumaRegionTable;
+
+// 查询线程的读状态, 每个线程独占一个缓存行
+// seq为奇数表示正在读登记表; 线程退出后槽位留给后来的线程
+typedef struct NumaReaderSlot {
+    _Alignas(64) atomic_uint seq;
+    bool in_use;
+    struct NumaReaderSlot* next;
+} NumaReaderSlot;
+
+// GEMM查询时不加锁: 读线程只写自己的槽位, 再读当前快照.
+// 放置/撤销在g_regions_lock下复制出新快照并发布, 然后等每个读线程离开读旧快照的区间, 再释放旧快照
+static pthread_mutex_t g_regions_lock = PTHREAD_MUTEX_INITIALIZER;
+static _Atomic(NumaRegionTable*) g_region_table;
+static NumaReaderSlot* g_reader_slots;           // 由g_regions_lock保护, 槽位只增不减
+static pthread_key_t g_reader_key;
+static pthread_once_t g_reader_key_once = PTHREAD_ONCE_INIT;
+static _Thread_local NumaReaderSlot* tls_reader_slot;
+
+static atomic_int g_pinning = -1;        // -1: 还没读取环境变量
+static atomic_int g_stats = -1;
+static _Atomic uint64_t g_local_bytes;
+static _Atomic uint64_t g_remote_bytes;
+static _Atomic uint64_t g_unplaced_bytes;
+static atomic_bool g_mbind_warned;
+
+static _Thread_local int tls_pinned_node = -1;
+
+// ---- 拓扑 ----
+
+// 解析 "0-3,8,10-11" 形式的列表, 对每个编号调用fn; 返回编号个数
+static int parse_list(const char* text, void (*fn)(int value, void* ctx), void* ctx) {
+    int count = 0;
+    const char* p = text;
+    while (*p) {
+        char* end;
+        long first = strtol(p, &end, 10);
+        if (end == p) break;
+        long last = first;
+        p = end;
+        if (*p == '-') {
+            last = strtol(p + 1, &end, 10);
+            p = end;
+        }
+        for (long v = first; v <= last; v++) {
+            if (fn) fn((int)v, ctx);
+            count++;
+        }
+        while (*p == ',' || *p == ' ' || *p == '\n') p++;
+    }
+    return count;
+}
+
+static bool read_small_file(const char* path, char* buffer, size_t size) {
+    FILE* file = fopen(path, "r");
+    if (!file) return false;
+    size_t n = fread(buffer, 1, size - 1, file);
+    fclose(file);
+    buffer[n] = '\0';
+    return true;
+}
+
+typedef struct CpuCollector {
+    int* cpus;
+    int count;
+    const cpu_set_t* allowed;
+} CpuCollector;
+
+static void collect_cpu(int cpu, void* ctx) {
+    CpuCollector* collector = (CpuCollector*)ctx;
+    if (cpu < 0 || cpu >= CPU_SETSIZE || !CPU_ISSET(cpu, collector->allowed)) return;
+    collector->cpus[collector->count++] = cpu;
+}
+
+static void collect_node(int node, void* ctx) {
+    int* nodes = (int*)ctx;
+    if (nodes[0] < NUMA_MAX_NODES) nodes[1 + nodes[0]++] = node;
+}
+
+static void topology_init(void) {
+    NumaTopology* topo = &g_topology;
+    cpu_set_t allowed;
+    CPU_ZERO(&allowed);
+    if (sched_getaffinity(0, sizeof(allowed), &allowed) != 0) {
+        long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+        for (long c = 0; c < cpus && c < CPU_SETSIZE; c++) CPU_SET(c, &allowed);
+    }
+
+    topo->cpus = (int*)malloc(sizeof(int) * CPU_SETSIZE);
+    topo->node_cpu_offset = (int*)calloc(NUMA_MAX_NODES + 1, sizeof(int));
+    if (!topo->cpus || !topo->node_cpu_offset) {
+        fprintf(stderr, "Failed to allocate NUMA topology\n");
+        abort();
+    }
+
+    // 只保留有可用CPU的节点, 纯内存节点 (如CXL) 不参与线程绑定
+    char text[4096];
+    int nodes[1 + NUMA_MAX_NODES] = {0};
+    if (read_small_file("/sys/devices/system/node/online", text, sizeof(text))) {
+        parse_list(text, collect_node, nodes);
+    }
+    CpuCollector collector = {topo->cpus, 0, &allowed};
+    for (int i = 0; i < nodes[0]; i++) {
+        char path[128];
+        snprintf(path, sizeof(path), "/sys/devices/system/node/node%d/cpulist", nodes[1 + i]);
+        if (!read_small_file(path, text, sizeof(text))) continue;
+        const int before = collector.count;
+        parse_list(text, collect_cpu, &collector);
+        if (collector.count > before) {
+            topo->node_ids[topo->num_nodes] = nodes[1 + i];
+            topo->node_cpu_offset[++topo->num_nodes] = collector.count;
+        }
+    }
+
+    // 没有sysfs信息时当作一个节点, 包含所有可用CPU
+    if (topo->num_nodes == 0) {
+        collector.count = 0;
+        for (int c = 0; c < CPU_SETSIZE; c++) {
+            if (CPU_ISSET(c, &allowed)) topo->cpus[collector.count++] = c;
+        }
+        topo->num_nodes = 1;
+        topo->node_ids[0] = 0;
+        topo->node_cpu_offset[1] = collector.count;
+    }
+    topo->num_cpus = collector.count;
+
+    topo->max_cpu = 0;
+    for (int i = 0; i < topo->num_cpus; i++) {
+        if (topo->cpus[i] + 1 > topo->max_cpu) topo->max_cpu = topo->cpus[i] + 1;
+    }
+    topo->cpu_node = (int*)malloc(sizeof(int) * (topo->max_cpu > 0 ? topo->max_cpu : 1));
+    if (!topo->cpu_node) {
+        fprintf(stderr, "Failed to allocate NUMA topology\n");
+        abort();
+    }
+    for (int c = 0; c < topo->max_cpu; c++) topo->cpu_node[c] = -1;
+    for (int n = 0; n < topo->num_nodes; n++) {
+        for (int i = topo->node_cpu_offset[n]; i < topo->node_cpu_offset[n + 1]; i++) {
+            topo->cpu_node[topo->cpus[i]] = n;
+        }
+    }
+}
+
+const NumaTopology* numa_topology(void) {
+    pthread_once(&g_topology_once, topology_init);
+    return &g_topology;
+}
+
+int numa_current_node(void) {
+    if (tls_pinned_node >= 0) return tls_pinned_node;
+    const NumaTopology* topo = numa_topology();
+    if (topo->num_nodes == 1) return 0;
+    const int cpu = sched_getcpu();
+    if (cpu < 0 || cpu >= topo->max_cpu || topo->cpu_node[cpu] < 0) return 0;
+    return topo->cpu_node[cpu];
+}
+
+// ---- 线程绑定 ----
+
+static bool env_flag(const char* name) {
+    const char* env = getenv(name);
+    return env && *env && strcmp(env, "0") != 0;
+}
+
+void numa_set_thread_pinning(bool enabled) {
+    atomic_store(&g_pinning, enabled ? 1 : 0);
+}
+
+bool numa_thread_pinning_enabled(void) {
+    int pinning = atomic_load(&g_pinning);
+    if (pinning < 0) {
+        pinning = env_flag("TRANSFORMER_PIN_THREADS") ? 1 : 0;
+        atomic_store(&g_pinning, pinning);
+    }
+    return pinning == 1;
+}
+
+// 节点n拥有 [ceil(n*S/N), ceil((n+1)*S/N)) 这些slot
+int numa_slot_node(int slot, int num_slots) {
+    const NumaTopology* topo = numa_topology();
+    if (slot < 0 || num_slots <= 0) return 0;
+    return (int)((long)(slot % num_slots) * topo->num_nodes / num_slots);
+}
+
+int numa_pin_thread(int slot, int num_slots) {
+    const NumaTopology* topo = numa_topology();
+    if (slot < 0 || slot >= num_slots || topo->num_cpus == 0) return -1;
+
+    const int node = numa_slot_node(slot, num_slots);
+    const int first_slot = (int)(((long)node * num_slots + topo->num_nodes - 1) / topo->num_nodes);
+    const int node_cpus = topo->node_cpu_offset[node + 1] - topo->node_cpu_offset[node];
+    return numa_pin_thread_to_cpu(topo->cpus[topo->node_cpu_offset[node] + (slot - first_slot) % node_cpus]);
+}
+
+int numa_pin_thread_to_cpu(int cpu) {
+    const NumaTopology* topo = numa_topology();
+    if (cpu < 0 || cpu >= CPU_SETSIZE) return -1;
+
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    if (pthread_setaffinity_np(pthread_self(), sizeof(set), &set) != 0) {
+        return -1;
+    }
+    const int node = cpu < topo->max_cpu && topo->cpu_node[cpu] >= 0 ? topo->cpu_node[cpu] : 0;
+    tls_pinned_node = node;
+    return node;
+}
+
+// ---- 内存策略 ----
+
+static long page_size(void) {
+    return sysconf(_SC_PAGESIZE);
+}
+
+static void warn_mbind(const char* what) {
+    if (!atomic_exchange(&g_mbind_warned, true)) {
+        fprintf(stderr, "NUMA %s failed (%s), falling back to default placement\n", what, strerror(errno));
+    }
+}
+
+static bool mbind_range(void* addr, size_t bytes, int mode, const unsigned long* mask) {
+    return syscall(SYS_mbind, addr, bytes, mode, mask, (unsigned long)(NUMA_MASK_WORDS * 64),
+                   NUMA_MPOL_MF_MOVE) == 0;
+}
+
+// 数据第一页所在的节点序号, 未知返回-1
+static int home_node_of(const void* addr) {
+    const NumaTopology* topo = numa_topology();
+    int kernel_node = -1;
+    if (syscall(SYS_get_mempolicy, &kernel_node, NULL, 0UL, addr,
+                NUMA_MPOL_F_NODE | NUMA_MPOL_F_ADDR) != 0) {
+        return topo->num_nodes == 1 ? 0 : -1;
+    }
+    for (int n = 0; n < topo->num_nodes; n++) {
+        if (topo->node_ids[n] == kernel_node) return n;
+    }
+    return -1;
+}
+
+// 把区间内完整的页交错到所有节点, 首尾不完整的页与相邻数据共享, 保持原样
+static void interleave_pages(const float* data, size_t bytes) {
+    const NumaTopology* topo = numa_topology();
+    const uintptr_t page = (uintptr_t)page_size();
+    uintptr_t begin = ((uintptr_t)data + page - 1) & ~(page - 1);
+    uintptr_t end = ((uintptr_t)data + bytes) & ~(page - 1);
+    if (end <= begin) return;
+
+    unsigned long mask[NUMA_MASK_WORDS] = {0};
+    for (int n = 0; n < topo->num_nodes; n++) {
+        mask[topo->node_ids[n] / 64] |= 1UL << (topo->node_ids[n] % 64);
+    }
+    if (!mbind_range((void*)begin, end - begin, NUMA_MPOL_INTERLEAVE, mask)) {
+        warn_mbind("interleave");
+    }
+}
+
+// 在节点node上分配一份副本; 不能绑定到该节点时返回NULL, 读取时退回原数据
+static float* replicate_on_node(const float* data, size_t bytes, int node, size_t* mapped_bytes) {
+    const NumaTopology* topo = numa_topology();
+    const size_t page = (size_t)page_size();
+    const size_t length = (bytes + page - 1) / page * page;
+    void* copy = mmap(NULL, length, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (copy == MAP_FAILED) {
+        fprintf(stderr, "Failed to map %zu bytes for NUMA replica\n", length);
+        return NULL;
+    }
+    unsigned long mask[NUMA_MASK_WORDS] = {0};
+    mask[topo->node_ids[node] / 64] |= 1UL << (topo->node_ids[node] % 64);
+    // 先绑定再写入, 页在第一次写入时就分配在目标节点
+    if (!mbind_range(copy, length, NUMA_MPOL_BIND, mask)) {
+        warn_mbind("bind");
+        munmap(copy, length);
+        return NULL;
+    }
+    memcpy(copy, data, bytes);
+    *mapped_bytes = length;
+    return (float*)copy;
+}
+
+// ---- 登记表 ----
+
+// ---- 读线程的槽位 ----
+
+// 线程退出时归还槽位; 此时它一定不在读区间内
+static void reader_slot_release(void* slot) {
+    pthread_mutex_lock(&g_regions_lock);
+    ((NumaReaderSlot*)slot)->in_use = false;
+    pthread_mutex_unlock(&g_regions_lock);
+}
+
+static void reader_key_create(void) {
+    pthread_key_create(&g_reader_key, reader_slot_release);
+}
+
+// 调用线程的槽位, 第一次调用时登记; 内存不足返回NULL
+static NumaReaderSlot* reader_slot(void) {
+    if (tls_reader_slot) return tls_reader_slot;
+
+    pthread_once(&g_reader_key_once, reader_key_create);
+    pthread_mutex_lock(&g_regions_lock);
+    NumaReaderSlot* slot = g_reader_slots;
+    while (slot && slot->in_use) slot = slot->next;
+    if (!slot) {
+        slot = (NumaReaderSlot*)aligned_alloc(64, sizeof(NumaReaderSlot));
+        if (slot) {
+            atomic_init(&slot->seq, 0);
+            slot->next = g_reader_slots;
+            g_reader_slots = slot;
+        }
+    }
+    if (slot) slot->in_use = true;
+    pthread_mutex_unlock(&g_regions_lock);
+
+    if (!slot) return NULL;
+    pthread_setspecific(g_reader_key, slot);
+    tls_reader_slot = slot;
+    return slot;
+}
+
+// 进入读区间并返回当前快照; slot为NULL (槽位分配失败) 时退化为加锁读, 由read_end解锁
+static const NumaRegionTable* read_begin(NumaReaderSlot* slot) {
+    if (!slot) {
+        pthread_mutex_lock(&g_regions_lock);
+        return atomic_load_explicit(&g_region_table, memory_order_relaxed);
+    }
+    const unsigned int seq = atomic_load_explicit(&slot->seq, memory_order_relaxed);
+    atomic_store_explicit(&slot->seq, seq + 1, memory_order_relaxed);
+    // 与 table_publish 中的fence配对: 写者要么看到奇数seq并等待, 要么读者读到新快照
+    atomic_thread_fence(memory_order_seq_cst);
+    return atomic_load_explicit(&g_region_table, memory_order_acquire);
+}
+
+static void read_end(NumaReaderSlot* slot) {
+    if (!slot) {
+        pthread_mutex_unlock(&g_regions_lock);
+        return;
+    }
+    const unsigned int seq = atomic_load_explicit(&slot->seq, memory_order_relaxed);
+    atomic_store_explicit(&slot->seq, seq + 1, memory_order_release);
+}
+
+// ---- 登记表 ----
+
+// 第一个 base > ptr 的位置
+static int region_upper_bound(const NumaRegionTable* table, const float* ptr) {
+    int lo = 0, hi = table ? table->count : 0;
+    while (lo < hi) {
+        const int mid = (lo + hi) / 2;
+        if ((uintptr_t)table->regions[mid].base <= (uintptr_t)ptr) lo = mid + 1;
+        else hi = mid;
+    }
+    return lo;
+}
+
+// 包含ptr的登记区域
+static const NumaRegion* region_find(const NumaRegionTable* table, const float* ptr) {
+    const int i = region_upper_bound(table, ptr) - 1;
+    if (i < 0) return NULL;
+    const NumaRegion* region = &table->regions[i];
+    return (uintptr_t)ptr < (uintptr_t)region->base + region->bytes ? region : NULL;
+}
+
+static void region_release(NumaRegion* region) {
+    for (int n = 0; n < NUMA_MAX_NODES; n++) {
+        if (region->replicas[n] && region->replicas[n] != region->base) {
+            munmap((void*)region->replicas[n], region->mapped_bytes);
+        }
+    }
+}
+
+// 发布新快照 (可以为NULL), 等所有可能还在读旧快照的线程离开读区间后释放旧快照
+// 调用方持有g_regions_lock; 读区间很短且不加锁, 等待不会死锁
+static void table_publish(NumaRegionTable* table) {
+    NumaRegionTable* old = atomic_exchange(&g_region_table, table);
+    atomic_thread_fence(memory_order_seq_cst);
+    for (NumaReaderSlot* slot = g_reader_slots; slot; slot = slot->next) {
+        const unsigned int seq = atomic_load_explicit(&slot->seq, memory_order_acquire);
+        if (!(seq & 1)) continue;
+        while (atomic_load_explicit(&slot->seq, memory_order_acquire) == seq) {
+            sched_yield();
+        }
+    }
+    free(old);
+}
+
+// 当前快照去掉以data开头的区域 (存在时写入*removed, *found为true), 再在排序位置插入added (可以为NULL)
+// 返回新表; 新表为空时返回NULL并把*empty设为true. 内存不足, 或者没有要修改的内容时返回NULL, *empty为false
+static NumaRegionTable* table_edit(const float* data, const NumaRegion* added, NumaRegion* removed,
+                                   bool* found, bool* empty) {
+    const NumaRegionTable* current = atomic_load_explicit(&g_region_table, memory_order_relaxed);
+    const int count = current ? current->count : 0;
+    const int i = region_upper_bound(current, data) - 1;
+    *found = i >= 0 && current->regions[i].base == data;
+    if (*found) *removed = current->regions[i];
+
+    const int new_count = count - (*found ? 1 : 0) + (added ? 1 : 0);
+    *empty = new_count == 0;
+    if (new_count == 0 || (!*found && !added)) return NULL;
+
+    NumaRegionTable* table = (NumaRegionTable*)malloc(sizeof(NumaRegionTable) + sizeof(NumaRegion) * new_count);
+    if (!table) return NULL;
+    int n = 0;
+    bool inserted = !added;
+    for (int j = 0; j < count; j++) {
+        if (*found && j == i) continue;
+        if (!inserted && (uintptr_t)current->regions[j].base > (uintptr_t)data) {
+            table->regions[n++] = *added;
+            inserted = true;
+        }
+        table->regions[n++] = current->regions[j];
+    }
+    if (!inserted) table->regions[n++] = *added;
+    table->count = n;
+    return table;
+}
+
+bool numa_place_weights(const float* data, size_t count, NumaPolicy policy) {
+    if (!data || count == 0) return false;
+    const NumaTopology* topo = numa_topology();
+    const size_t bytes = count * sizeof(float);
+
+    NumaRegion region;
+    memset(&region, 0, sizeof(region));
+    region.base = data;
+    region.bytes = bytes;
+    region.policy = policy;
+
+    // 副本在发布之前准备好, 查询方不会看到半成品
+    if (policy == NUMA_POLICY_INTERLEAVE && topo->num_nodes > 1) {
+        interleave_pages(data, bytes);
+    }
+    region.home_node = home_node_of(data);
+    if (policy == NUMA_POLICY_REPLICATE && topo->num_nodes > 1) {
+        for (int n = 0; n < topo->num_nodes; n++) {
+            region.replicas[n] = n == region.home_node ? data :
+                replicate_on_node(data, bytes, n, &region.mapped_bytes);
+        }
+    }
+
+    pthread_mutex_lock(&g_regions_lock);
+    NumaRegion removed;
+    bool found, empty;
+    NumaRegionTable* table = table_edit(data, &region, &removed, &found, &empty);
+    if (!table) {
+        pthread_mutex_unlock(&g_regions_lock);
+        fprintf(stderr, "Failed to grow NUMA weight registry\n");
+        region_release(&region);
+        return false;
+    }
+    table_publish(table);
+    pthread_mutex_unlock(&g_regions_lock);
+    if (found) region_release(&removed);
+
+    if (policy != NUMA_POLICY_NONE && atomic_load(&g_stats) < 0) {
+        atomic_store(&g_stats, 1);
+    }
+    return true;
+}
+
+void numa_forget_weights(const float* data) {
+    if (!data || !atomic_load(&g_region_table)) return;
+    pthread_mutex_lock(&g_regions_lock);
+    NumaRegion removed;
+    bool found, empty;
+    NumaRegionTable* table = table_edit(data, NULL, &removed, &found, &empty);
+    if (found && !table && !empty) {
+        // 复制失败时保留旧表, 副本不能释放 (查询方仍可能返回它)
+        fprintf(stderr, "Failed to shrink NUMA weight registry, keeping replicas of %p\n", (const void*)data);
+        found = false;
+    } else if (found) {
+        table_publish(table);
+    }
+    pthread_mutex_unlock(&g_regions_lock);
+    if (found) region_release(&removed);
+}
+
+const float* numa_local_weights(const float* ptr) {
+    if (!atomic_load_explicit(&g_region_table, memory_order_relaxed)) return ptr;
+
+    const float* local = ptr;
+    NumaReaderSlot* slot = reader_slot();
+    const NumaRegionTable* table = read_begin(slot);
+    const NumaRegion* region = region_find(table, ptr);
+    if (region && region->policy == NUMA_POLICY_REPLICATE) {
+        const float* replica = region->replicas[numa_current_node()];
+        if (replica) local = replica + (ptr - region->base);
+    }
+    read_end(slot);
+    return local;
+}
+
+// ---- 流量统计 ----
+
+void numa_set_traffic_stats(bool enabled) {
+    atomic_store(&g_stats, enabled ? 1 : 0);
+}
+
+bool numa_traffic_stats_enabled(void) {
+    int stats = atomic_load_explicit(&g_stats, memory_order_relaxed);
+    if (stats < 0) {
+        if (!env_flag("TRANSFORMER_NUMA_STATS")) return false;
+        atomic_store(&g_stats, 1);
+        stats = 1;
+    }
+    return stats == 1;
+}
+
+void numa_account_weight_read(const float* ptr, size_t bytes) {
+    if (!numa_traffic_stats_enabled()) return;
+
+    const NumaTopology* topo = numa_topology();
+    const int node = numa_current_node();
+    uint64_t local = 0, remote = 0, unplaced = 0;
+
+    NumaReaderSlot* slot = reader_slot();
+    const NumaRegion* region = region_find(read_begin(slot), ptr);
+    if (!region) {
+        unplaced = bytes;
+    } else if (topo->num_nodes == 1) {
+        local = bytes;
+    } else if (region->policy == NUMA_POLICY_INTERLEAVE) {
+        // 页均匀分布在各节点上, 本节点约占 1/N
+        local = bytes / topo->num_nodes;
+        remote = bytes - local;
+    } else if (region->policy == NUMA_POLICY_REPLICATE && region->replicas[node]) {
+        local = bytes;
+    } else if (region->home_node < 0) {
+        unplaced = bytes;
+    } else if (region->home_node == node) {
+        local = bytes;
+    } else {
+        remote = bytes;
+    }
+    read_end(slot);
+
+    if (local) atomic_fetch_add_explicit(&g_local_bytes, local, memory_order_relaxed);
+    if (remote) atomic_fetch_add_explicit(&g_remote_bytes, remote, memory_order_relaxed);
+    if (unplaced) atomic_fetch_add_explicit(&g_unplaced_bytes, unplaced, memory_order_relaxed);
+}
+
+void numa_traffic_snapshot(NumaTraffic* traffic) {
+    traffic->local_bytes = atomic_load(&g_local_bytes);
+    traffic->remote_bytes = atomic_load(&g_remote_bytes);
+    traffic->unplaced_bytes = atomic_load(&g_unplaced_bytes);
+}
+
+void numa_traffic_reset(void) {
+    atomic_store(&g_local_bytes, 0);
+    atomic_store(&g_remote_bytes, 0);
+    atomic_store(&g_unplaced_bytes, 0);
+}
+
+static const char* policy_name(NumaPolicy policy) {
+    switch (policy) {
+        case NUMA_POLICY_INTERLEAVE: return "interleave";
+        case NUMA_POLICY_REPLICATE: return "replicate";
+        default: return "none";
+    }
+}
+
+void numa_print_report(FILE* stream) {
+    const NumaTopology* topo = numa_topology();
+    fprintf(stream, "NUMA: %d node(s), %d cpu(s), thread pinning %s\n", topo->num_nodes, topo->num_cpus,
+            numa_thread_pinning_enabled() ? "on" : "off");
+    for (int n = 0; n < topo->num_nodes; n++) {
+        fprintf(stream, "  node %d: %d cpu(s)\n", topo->node_ids[n],
+                topo->node_cpu_offset[n + 1] - topo->node_cpu_offset[n]);
+    }
+
+    size_t placed[3] = {0, 0, 0};
+    size_t replica_bytes = 0;
+    pthread_mutex_lock(&g_regions_lock);
+    const NumaRegionTable* table = atomic_load(&g_region_table);
+    const int regions = table ? table->count : 0;
+    for (int i = 0; i < regions; i++) {
+        const NumaRegion* region = &table->regions[i];
+        placed[region->policy] += region->bytes;
+        for (int n = 0; n < topo->num_nodes; n++) {
+            if (region->replicas[n] && region->replicas[n] != region->base) {
+                replica_bytes += region->mapped_bytes;
+            }
+        }
+    }
+    pthread_mutex_unlock(&g_regions_lock);
+
+    fprintf(stream, "  %d weight region(s):", regions);
+    for (int p = 0; p < 3; p++) {
+        fprintf(stream, " %s %.1f MB%s", policy_name((NumaPolicy)p), placed[p] / 1048576.0, p < 2 ? "," : "\n");
+    }
+    fprintf(stream, "  replica memory %.1f MB\n", replica_bytes / 1048576.0);
+
+    NumaTraffic traffic;
+    numa_traffic_snapshot(&traffic);
+    const uint64_t total = traffic.local_bytes + traffic.remote_bytes + traffic.unplaced_bytes;
+    fprintf(stream, "  estimated GEMM weight reads: local %.1f MB, remote %.1f MB (%.1f%%), unplaced %.1f MB\n",
+            traffic.local_bytes / 1048576.0, traffic.remote_bytes / 1048576.0,
+            total ? 100.0 * traffic.remote_bytes / total : 0.0, traffic.unplaced_bytes / 1048576.0);
+}
+
+NumaPolicy numa_policy_from_env(void) {
+    const char* env = getenv("TRANSFORMER_NUMA");
+    if (!env) return NUMA_POLICY_NONE;
+    if (strcasecmp(env, "interleave") == 0) return NUMA_POLICY_INTERLEAVE;
+    if (strcasecmp(env, "replicate") == 0) return NUMA_POLICY_REPLICATE;
+    if (strcasecmp(env, "none") != 0 && *env) {
+        fprintf(stderr, "Unknown TRANSFORMER_NUMA policy '%s', expected none/interleave/replicate\n", env);
+    }
+    return NUMA_POLICY_NONE;
+}
@@ -0,0 +1,40 @@
+#ifndef SPSC_QUEUE_H
+#define SPSC_QUEUE_H
+
+#include <stdatomic.h>
+#include <stdbool.h>
+
+// 单生产者/单消费者的有界无锁队列, 元素为非NULL指针
+// 生产者只写tail, 消费者只写head, 各自缓存对方的位置
+// 阻塞版本先自旋, 再在futex上休眠; 只有对方正在休眠时才发起唤醒系统调用
+// 每次push/pop都要检查对方是否在休眠, 所以对方的休眠标记放在自己的缓存行上 (只在休眠前后被对方写):
+// 队列不满/不空且对方没有休眠时, push/pop只访问自己的缓存行和元素槽
+
+typedef struct SpscQueue {
+    _Alignas(64) atomic_uint head;      // 下一个pop的位置, 只由消费者写
+    unsigned int cached_tail;           // 消费者看到的tail
+    atomic_int producer_sleeping;       // 生产者在head上休眠, 由生产者写, pop检查
+    _Alignas(64) atomic_uint tail;      // 下一个push的位置, 只由生产者写
+    unsigned int cached_head;           // 生产者看到的head
+    atomic_int consumer_sleeping;       // 消费者在tail上休眠, 由消费者写, push检查
+    _Alignas(64) unsigned int capacity; // 2的幂
+    unsigned int mask;
+    void** slots;
+} SpscQueue;
+
+// 容量向上取整到2的幂
+SpscQueue* spsc_queue_create(unsigned int capacity);
+void spsc_queue_free(SpscQueue* queue);
+
+// 非阻塞: 队列满时push返回false, 队列空时pop返回NULL
+bool spsc_queue_push(SpscQueue* queue, void* item);
+void* spsc_queue_pop(SpscQueue* queue);
+
+// 阻塞直到成功
+void spsc_queue_push_wait(SpscQueue* queue, void* item);
+void* spsc_queue_pop_wait(SpscQueue* queue);
+
+// 近似的元素个数, 只用于统计
+unsigned int spsc_queue_size(SpscQueue* queue);
+
+#endif // SPSC_QUEUE_H
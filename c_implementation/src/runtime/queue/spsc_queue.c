@@ -0,0 +1,134 @@
+#define _GNU_SOURCE
+#include "spsc_queue.h"
+#include <linux/futex.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+// 休眠之前的自旋轮数, 流水线相邻阶段通常很快就会交付下一个微批次
+#define SPSC_SPIN_ROUNDS 256
+
+static void futex_wait(atomic_uint* word, unsigned int expected) {
+    syscall(SYS_futex, (unsigned int*)word, FUTEX_WAIT_PRIVATE, expected, NULL, NULL, 0);
+}
+
+static void futex_wake(atomic_uint* word) {
+    syscall(SYS_futex, (unsigned int*)word, FUTEX_WAKE_PRIVATE, 1, NULL, NULL, 0);
+}
+
+SpscQueue* spsc_queue_create(unsigned int capacity) {
+    if (capacity == 0 || capacity > (1u << 30)) {
+        fprintf(stderr, "Invalid SPSC queue capacity %u\n", capacity);
+        return NULL;
+    }
+    unsigned int rounded = 1;
+    while (rounded < capacity) rounded <<= 1;
+
+    SpscQueue* queue = (SpscQueue*)aligned_alloc(64, sizeof(SpscQueue));
+    void** slots = (void**)calloc(rounded, sizeof(void*));
+    if (!queue || !slots) {
+        free(queue);
+        free(slots);
+        return NULL;
+    }
+    atomic_init(&queue->head, 0);
+    atomic_init(&queue->tail, 0);
+    atomic_init(&queue->consumer_sleeping, 0);
+    atomic_init(&queue->producer_sleeping, 0);
+    queue->cached_tail = 0;
+    queue->cached_head = 0;
+    queue->capacity = rounded;
+    queue->mask = rounded - 1;
+    queue->slots = slots;
+    return queue;
+}
+
+void spsc_queue_free(SpscQueue* queue) {
+    if (queue) {
+        free(queue->slots);
+        free(queue);
+    }
+}
+
+bool spsc_queue_push(SpscQueue* queue, void* item) {
+    const unsigned int tail = atomic_load_explicit(&queue->tail, memory_order_relaxed);
+    if (tail - queue->cached_head == queue->capacity) {
+        queue->cached_head = atomic_load_explicit(&queue->head, memory_order_acquire);
+        if (tail - queue->cached_head == queue->capacity) {
+            return false;
+        }
+    }
+    queue->slots[tail & queue->mask] = item;
+    // release: 消费者acquire读到新的tail时, 元素 (和它指向的数据) 已经可见
+    atomic_store_explicit(&queue->tail, tail + 1, memory_order_release);
+    // 与 pop_wait 中 "先标记休眠再检查tail" 配对, 两边至少有一方看到对方的写入
+    atomic_thread_fence(memory_order_seq_cst);
+    if (atomic_load_explicit(&queue->consumer_sleeping, memory_order_relaxed)) {
+        futex_wake(&queue->tail);
+    }
+    return true;
+}
+
+void* spsc_queue_pop(SpscQueue* queue) {
+    const unsigned int head = atomic_load_explicit(&queue->head, memory_order_relaxed);
+    if (queue->cached_tail == head) {
+        queue->cached_tail = atomic_load_explicit(&queue->tail, memory_order_acquire);
+        if (queue->cached_tail == head) {
+            return NULL;
+        }
+    }
+    void* item = queue->slots[head & queue->mask];
+    atomic_store_explicit(&queue->head, head + 1, memory_order_release);
+    atomic_thread_fence(memory_order_seq_cst);
+    if (atomic_load_explicit(&queue->producer_sleeping, memory_order_relaxed)) {
+        futex_wake(&queue->head);
+    }
+    return item;
+}
+
+void spsc_queue_push_wait(SpscQueue* queue, void* item) {
+    int spins = 0;
+    while (!spsc_queue_push(queue, item)) {
+        if (++spins < SPSC_SPIN_ROUNDS) {
+            sched_yield();
+            continue;
+        }
+        atomic_store_explicit(&queue->producer_sleeping, 1, memory_order_relaxed);
+        atomic_thread_fence(memory_order_seq_cst);
+        const unsigned int head = atomic_load_explicit(&queue->head, memory_order_acquire);
+        const unsigned int tail = atomic_load_explicit(&queue->tail, memory_order_relaxed);
+        if (tail - head == queue->capacity) {
+            futex_wait(&queue->head, head);
+        }
+        atomic_store_explicit(&queue->producer_sleeping, 0, memory_order_relaxed);
+        spins = 0;
+    }
+}
+
+void* spsc_queue_pop_wait(SpscQueue* queue) {
+    int spins = 0;
+    void* item;
+    while (!(item = spsc_queue_pop(queue))) {
+        if (++spins < SPSC_SPIN_ROUNDS) {
+            sched_yield();
+            continue;
+        }
+        atomic_store_explicit(&queue->consumer_sleeping, 1, memory_order_relaxed);
+        atomic_thread_fence(memory_order_seq_cst);
+        const unsigned int tail = atomic_load_explicit(&queue->tail, memory_order_acquire);
+        if (tail == atomic_load_explicit(&queue->head, memory_order_relaxed)) {
+            futex_wait(&queue->tail, tail);
+        }
+        atomic_store_explicit(&queue->consumer_sleeping, 0, memory_order_relaxed);
+        spins = 0;
+    }
+    return item;
+}
+
+unsigned int spsc_queue_size(SpscQueue* queue) {
+    const unsigned int head = atomic_load_explicit(&queue->head, memory_order_acquire);
+    const unsigned int tail = atomic_load_explicit(&queue->tail, memory_order_acquire);
+    return tail - head;
+}
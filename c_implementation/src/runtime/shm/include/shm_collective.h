@@ -0,0 +1,70 @@
+#ifndef SHM_COLLECTIVE_H
+#define SHM_COLLECTIVE_H
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <sys/types.h>
+
+// 同一台机器上多个进程之间的共享内存集合通信, 不经过网络
+// 一块POSIX共享内存 (shm_open, 映射后立即unlink, 进程退出后自动回收) 中放:
+//   控制块: futex屏障、命令序号、各进程的状态
+//   每个进程一段部分和, 加一段归约结果, 用于all-reduce
+//   一段自由使用的数据区, 由rank 0写入命令参数和输入
+// 工作进程由 shm_group_fork 从rank 0 fork出来, 继承映射和fork之前的全部内存 (如模型权重, 写时复制)
+//
+// 屏障等待先自旋再在futex上休眠 (跨进程, 不能用PRIVATE); 休眠带超时,
+// 超时后rank 0检查工作进程是否退出, 工作进程检查rank 0是否还在, 发现对方退出就中止整个组,
+// 之后所有屏障和all-reduce都返回false, 不会永久阻塞
+
+#define SHM_GROUP_MAX_RANKS 64
+
+typedef struct ShmGroupControl ShmGroupControl;
+
+typedef struct ShmGroup {
+    int num_ranks;
+    int rank;                   // 本进程的编号, fork之后在各进程中不同
+    size_t reduce_floats;       // 每段部分和的容量
+    size_t payload_bytes;
+    ShmGroupControl* control;   // 共享内存的起始位置
+    size_t mapped_bytes;
+    float* partials;            // [num_ranks][reduce_floats]
+    float* reduced;             // [reduce_floats]
+    void* payload;
+    pid_t parent;               // rank 0的进程号
+    pid_t workers[SHM_GROUP_MAX_RANKS];   // 只在rank 0中有效
+    unsigned int last_command;  // 工作进程已处理的命令序号
+} ShmGroup;
+
+// 创建共享内存, 此时只有rank 0; 失败返回NULL
+ShmGroup* shm_group_create(int num_ranks, size_t reduce_floats, size_t payload_bytes);
+
+// fork出 num_ranks - 1 个工作进程, 父进程返回0, 工作进程返回自己的编号, 失败返回-1 (已fork的进程被回收)
+int shm_group_fork(ShmGroup* group);
+
+// 本进程的部分和缓冲区, all-reduce之前把本进程的结果写在这里
+float* shm_group_partial(ShmGroup* group);
+
+// 对所有进程部分和的前n个元素求和, 结果在 group->reduced 中, 所有进程看到相同的结果
+// 每个进程按固定顺序 (rank 0, 1, ...) 归约自己负责的一段, 结果与进程调度无关
+// ok为本进程到目前为止是否成功; 任何一个进程为false时都不归约, 所有进程都返回false
+// 所有进程必须以相同的顺序调用相同次数 (失败的进程也要调用)
+bool shm_group_all_reduce(ShmGroup* group, size_t n, bool ok);
+
+// 所有进程到达后返回; 组已中止时返回false
+bool shm_group_barrier(ShmGroup* group);
+
+// rank 0发布命令, 唤醒等待的工作进程
+void shm_group_post_command(ShmGroup* group, int command);
+
+// 工作进程等待下一条命令; 组中止或rank 0退出时返回-1
+int shm_group_wait_command(ShmGroup* group);
+
+// 中止整个组, 唤醒所有等待者
+void shm_group_abort(ShmGroup* group);
+bool shm_group_aborted(const ShmGroup* group);
+
+// rank 0: 等待工作进程退出 (中止的组先杀掉它们) 并解除映射; 工作进程: 只解除映射
+void shm_group_free(ShmGroup* group);
+
+#endif // SHM_COLLECTIVE_H
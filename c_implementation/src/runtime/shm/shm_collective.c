@@ -0,0 +1,254 @@
+#define _GNU_SOURCE
+#include "shm_collective.h"
+#include "thread_pool.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <linux/futex.h>
+#include <sched.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+// 休眠前的自旋轮数; all-reduce两侧的计算量接近时对方很快就会到达
+#define SHM_SPIN_ROUNDS 2048
+// futex休眠的超时, 到时检查对方进程是否还在
+#define SHM_WAIT_TIMEOUT_NS 100000000L
+// 每个并行块归约的元素数
+#define SHM_REDUCE_GRAIN 16384
+
+struct ShmGroupControl {
+    _Alignas(64) atomic_uint arrived;       // 已到达屏障的进程数
+    _Alignas(64) atomic_uint generation;    // 屏障每完成一次加1, 等待者在它上面休眠
+    _Alignas(64) atomic_uint command_seq;   // 命令序号, 工作进程在它上面休眠
+    atomic_int command;
+    atomic_int aborted;
+    atomic_int ok[SHM_GROUP_MAX_RANKS];      // 当前all-reduce中各进程的状态
+};
+
+static size_t align_up(size_t value, size_t alignment) {
+    return (value + alignment - 1) / alignment * alignment;
+}
+
+// 共享映射上的futex, 跨进程不能用 FUTEX_*_PRIVATE
+static void futex_wait_timeout(atomic_uint* word, unsigned int expected) {
+    struct timespec timeout = {0, SHM_WAIT_TIMEOUT_NS};
+    syscall(SYS_futex, (unsigned int*)word, FUTEX_WAIT, expected, &timeout, NULL, 0);
+}
+
+static void futex_wake_all(atomic_uint* word) {
+    syscall(SYS_futex, (unsigned int*)word, FUTEX_WAKE, INT_MAX, NULL, NULL, 0);
+}
+
+ShmGroup* shm_group_create(int num_ranks, size_t reduce_floats, size_t payload_bytes) {
+    if (num_ranks <= 0 || num_ranks > SHM_GROUP_MAX_RANKS) {
+        fprintf(stderr, "Invalid shared memory group size %d (max %d)\n", num_ranks, SHM_GROUP_MAX_RANKS);
+        return NULL;
+    }
+    ShmGroup* group = (ShmGroup*)calloc(1, sizeof(ShmGroup));
+    if (!group) return NULL;
+    group->num_ranks = num_ranks;
+    group->reduce_floats = align_up(reduce_floats > 0 ? reduce_floats : 1, 16);
+    group->payload_bytes = payload_bytes;
+    group->parent = getpid();
+
+    const size_t control_bytes = align_up(sizeof(ShmGroupControl), 64);
+    const size_t reduce_bytes = group->reduce_floats * sizeof(float);
+    group->mapped_bytes = control_bytes + reduce_bytes * (num_ranks + 1) + align_up(payload_bytes, 64);
+
+    // 名字只在打开到unlink之间存在, 进程号加计数保证同一台机器上不冲突
+    static atomic_uint counter;
+    char name[64];
+    snprintf(name, sizeof(name), "/transformer-shm-%d-%u", (int)getpid(), atomic_fetch_add(&counter, 1));
+    const int fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0600);
+    if (fd < 0) {
+        fprintf(stderr, "shm_open %s failed: %s\n", name, strerror(errno));
+        free(group);
+        return NULL;
+    }
+    void* base = MAP_FAILED;
+    if (ftruncate(fd, (off_t)group->mapped_bytes) == 0) {
+        base = mmap(NULL, group->mapped_bytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    }
+    shm_unlink(name);
+    close(fd);
+    if (base == MAP_FAILED) {
+        fprintf(stderr, "Failed to map %zu bytes of shared memory\n", group->mapped_bytes);
+        free(group);
+        return NULL;
+    }
+
+    char* bytes = (char*)base;
+    group->control = (ShmGroupControl*)bytes;
+    group->partials = (float*)(bytes + control_bytes);
+    group->reduced = group->partials + group->reduce_floats * num_ranks;
+    group->payload = bytes + control_bytes + reduce_bytes * (num_ranks + 1);
+    // 新的共享内存全为0, 控制块的原子变量初值都是0
+    return group;
+}
+
+int shm_group_fork(ShmGroup* group) {
+    for (int r = 1; r < group->num_ranks; r++) {
+        const pid_t pid = fork();
+        if (pid == 0) {
+            group->rank = r;
+            memset(group->workers, 0, sizeof(group->workers));
+            return r;
+        }
+        if (pid < 0) {
+            fprintf(stderr, "Failed to fork worker %d: %s\n", r, strerror(errno));
+            shm_group_abort(group);
+            for (int w = 1; w < r; w++) {
+                waitpid(group->workers[w], NULL, 0);
+                group->workers[w] = 0;
+            }
+            return -1;
+        }
+        group->workers[r] = pid;
+    }
+    group->rank = 0;
+    return 0;
+}
+
+float* shm_group_partial(ShmGroup* group) {
+    return group->partials + group->reduce_floats * group->rank;
+}
+
+void shm_group_abort(ShmGroup* group) {
+    atomic_store(&group->control->aborted, 1);
+    atomic_fetch_add(&group->control->generation, 1);
+    atomic_fetch_add(&group->control->command_seq, 1);
+    futex_wake_all(&group->control->generation);
+    futex_wake_all(&group->control->command_seq);
+}
+
+bool shm_group_aborted(const ShmGroup* group) {
+    return atomic_load(&group->control->aborted) != 0;
+}
+
+// 等待超时后检查对方: rank 0查看工作进程是否已退出, 工作进程查看父进程是否还是rank 0
+static bool peers_alive(ShmGroup* group) {
+    if (group->rank != 0) {
+        return getppid() == group->parent;
+    }
+    for (int r = 1; r < group->num_ranks; r++) {
+        if (group->workers[r] > 0 && waitpid(group->workers[r], NULL, WNOHANG) == group->workers[r]) {
+            fprintf(stderr, "Worker process %d (rank %d) exited unexpectedly\n", (int)group->workers[r], r);
+            group->workers[r] = 0;
+            return false;
+        }
+    }
+    return true;
+}
+
+bool shm_group_barrier(ShmGroup* group) {
+    ShmGroupControl* control = group->control;
+    if (atomic_load(&control->aborted)) return false;
+    if (group->num_ranks == 1) return true;
+
+    const unsigned int generation = atomic_load(&control->generation);
+    if (atomic_fetch_add(&control->arrived, 1) + 1 == (unsigned int)group->num_ranks) {
+        // 最后到达: 先清零计数再推进generation, 等待者醒来后才可能进入下一次屏障
+        atomic_store(&control->arrived, 0);
+        atomic_fetch_add(&control->generation, 1);
+        futex_wake_all(&control->generation);
+        return !atomic_load(&control->aborted);
+    }
+
+    int spins = 0;
+    while (atomic_load(&control->generation) == generation) {
+        if (++spins < SHM_SPIN_ROUNDS) {
+            sched_yield();
+            continue;
+        }
+        futex_wait_timeout(&control->generation, generation);
+        if (atomic_load(&control->generation) == generation && !peers_alive(group)) {
+            shm_group_abort(group);
+        }
+    }
+    return !atomic_load(&control->aborted);
+}
+
+typedef struct ReduceJob {
+    const ShmGroup* group;
+    size_t begin;
+} ReduceJob;
+
+static void reduce_range(void* ctx, long begin, long end) {
+    const ReduceJob* job = (const ReduceJob*)ctx;
+    const ShmGroup* group = job->group;
+    const size_t first = job->begin + (size_t)begin;
+    const size_t count = (size_t)(end - begin);
+    float* out = group->reduced + first;
+    memcpy(out, group->partials + first, count * sizeof(float));
+    for (int r = 1; r < group->num_ranks; r++) {
+        const float* partial = group->partials + group->reduce_floats * r + first;
+        #pragma omp simd
+        for (size_t i = 0; i < count; i++) out[i] += partial[i];
+    }
+}
+
+bool shm_group_all_reduce(ShmGroup* group, size_t n, bool ok) {
+    if (n > group->reduce_floats) {
+        fprintf(stderr, "All-reduce of %zu floats exceeds group capacity %zu\n", n, group->reduce_floats);
+        ok = false;
+    }
+    atomic_store(&group->control->ok[group->rank], ok ? 1 : 0);
+    if (!shm_group_barrier(group)) return false;
+
+    // 所有进程读到相同的状态, 一起跳过归约, 屏障次数保持一致
+    for (int r = 0; r < group->num_ranks; r++) {
+        if (!atomic_load(&group->control->ok[r])) return false;
+    }
+    if (n == 0) return true;
+
+    // 第r个进程归约第r段, 再经过一次屏障所有进程都能读到完整结果
+    const size_t begin = n * group->rank / group->num_ranks;
+    const size_t end = n * (group->rank + 1) / group->num_ranks;
+    ReduceJob job = {group, begin};
+    thread_pool_parallel_for((long)(end - begin), SHM_REDUCE_GRAIN, reduce_range, &job);
+    return shm_group_barrier(group);
+}
+
+void shm_group_post_command(ShmGroup* group, int command) {
+    atomic_store(&group->control->command, command);
+    atomic_fetch_add(&group->control->command_seq, 1);
+    futex_wake_all(&group->control->command_seq);
+}
+
+int shm_group_wait_command(ShmGroup* group) {
+    ShmGroupControl* control = group->control;
+    for (;;) {
+        if (atomic_load(&control->aborted)) return -1;
+        const unsigned int seq = atomic_load(&control->command_seq);
+        if (seq != group->last_command) {
+            group->last_command = seq;
+            return atomic_load(&control->command);
+        }
+        futex_wait_timeout(&control->command_seq, seq);
+        if (!peers_alive(group)) {
+            shm_group_abort(group);
+            return -1;
+        }
+    }
+}
+
+void shm_group_free(ShmGroup* group) {
+    if (!group) return;
+    if (group->rank == 0) {
+        for (int r = 1; r < group->num_ranks; r++) {
+            if (group->workers[r] <= 0) continue;
+            if (shm_group_aborted(group)) kill(group->workers[r], SIGKILL);
+            waitpid(group->workers[r], NULL, 0);
+        }
+    }
+    munmap(group->control, group->mapped_bytes);
+    free(group);
+}
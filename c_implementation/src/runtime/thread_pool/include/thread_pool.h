@@ -0,0 +1,72 @@
+#ifndef THREAD_POOL_H
+#define THREAD_POOL_H
+
+#include <stdatomic.h>
+#include <stdbool.h>
+
+// 进程内共享的工作窃取线程池, 推理路径上的并行内核 (GEMM、注意力、softmax、层归一化、嵌入查找、
+// 词表投影和交叉熵、MoE路由等) 都在这里执行
+// 每个工作线程有自己的Chase-Lev双端队列: 自己从底部压入/弹出 (LIFO, 缓存友好),
+// 空闲线程从其他队列顶部窃取 (FIFO, 先拿到较大的任务). 池外线程 (如主线程) 提交的任务进入全局注入队列
+//
+// 线程总数固定: num_threads - 1 个工作线程加上调用方线程. 任务中再调用 thread_pool_parallel_for
+// 或提交任务时, 子任务进入同一组队列, 不会创建新线程, 所以嵌套并行不会超额订阅CPU.
+// 等待任务组的线程先执行队列中的任务, 组内剩下的任务都在别的线程上执行时休眠,
+// 直到组完成或有新任务提交, 不会空转占用CPU
+//
+// 线程数: thread_pool_init 显式指定; 否则第一次使用时取环境变量 TRANSFORMER_NUM_THREADS,
+// 再否则取 omp_get_max_threads() (受 OMP_NUM_THREADS 影响), 不用OpenMP编译时取在线CPU数
+// 仍使用 #pragma omp parallel 的只有 src/math/tensor 下最早的张量辅助函数 (tensor_trio / tensor_logic /
+// tensor_expand 构造掩码, tensor_std 的3维层归一化), 它们由OpenMP运行时负责, 不在推理的热路径上;
+// 工作线程和执行任务的池外线程内OpenMP线程数被设为1, 在任务中调用它们时串行执行, 不会与线程池争抢CPU
+// 开启 numa_set_thread_pinning (或环境变量 TRANSFORMER_PIN_THREADS) 时工作线程按编号均匀绑定到各NUMA节点的CPU,
+// 空闲线程优先窃取同一节点的任务
+//
+// 除共享池以外还可以创建独立的线程池 (如流水线的每个阶段一个, 绑定到不相交的CPU组),
+// 池外线程用 thread_pool_attach 选择之后 parallel_for / 任务组使用的池; 工作线程总是使用自己所属的池
+// fork出的子进程不继承任何池 (工作线程不会被复制), 第一次使用时重新创建共享池
+
+#define THREAD_POOL_MAX_THREADS 256
+
+typedef struct ThreadPool ThreadPool;
+
+// 任务组: 记录已提交但还没执行完的任务数
+typedef struct TaskGroup {
+    atomic_int pending;
+} TaskGroup;
+
+// 显式初始化, num_threads <= 0 表示自动选择; 已初始化时返回false
+bool thread_pool_init(int num_threads);
+
+// 停止并回收工作线程, 之后再次使用会重新初始化
+void thread_pool_shutdown(void);
+
+// 调用线程当前使用的池中参与计算的线程数 (工作线程 + 调用方)
+int thread_pool_num_threads(void);
+
+// 创建独立的线程池, 共num_threads个线程 (含attach它的调用方线程);
+// cpus不为NULL时第i个工作线程 (从1开始) 绑定到 cpus[i % num_cpus], cpus[0]留给调用方线程自己绑定
+ThreadPool* thread_pool_create(int num_threads, const int* cpus, int num_cpus);
+
+// 停止并回收独立线程池的工作线程; 调用前不能再有线程attach在它上面提交任务
+void thread_pool_free(ThreadPool* pool);
+
+// 让调用线程 (必须是池外线程) 之后的并行调用使用pool, NULL恢复共享池
+void thread_pool_attach(ThreadPool* pool);
+
+// 对 [0, n) 分块并行执行 fn(ctx, begin, end), 返回时所有块都已完成
+// grain为每块最少的迭代数, <= 0 时按线程数自动选择; n <= grain 或只有一个线程时直接在调用方执行
+// 区间按二分递归拆分, 空闲线程窃取剩下的一半
+typedef void (*ThreadPoolRangeFn)(void* ctx, long begin, long end);
+void thread_pool_parallel_for(long n, long grain, ThreadPoolRangeFn fn, void* ctx);
+
+// 任务组接口, 用于层级代码提交相互独立的任务 (如Q/K/V投影, 不同专家)
+void task_group_init(TaskGroup* group);
+
+// 提交 fn(arg), 任务内存由线程池管理; 内存不足或队列已满时直接在当前线程执行
+void task_group_spawn(TaskGroup* group, void (*fn)(void* arg), void* arg);
+
+// 等待组内所有任务完成, 等待期间执行其他任务
+void task_group_wait(TaskGroup* group);
+
+#endif // THREAD_POOL_H
@@ -0,0 +1,594 @@
+#include "thread_pool.h"
+#include "numa_placement.h"
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+// 每个工作线程队列的容量 (2的幂), 满了以后新任务直接在提交线程执行
+#define DEQUE_CAPACITY 4096
+#define DEQUE_MASK (DEQUE_CAPACITY - 1)
+// 找不到任务时先让出CPU这么多次, 再进入休眠
+#define IDLE_SPIN_ROUNDS 64
+// 等待任务组时找不到任务, 先重试这么多次 (组内任务可能马上完成), 再进入休眠
+#define WAIT_SPIN_ROUNDS 64
+// 一次 range_run 最多拆出的子区间数, 足够覆盖 long 范围的二分
+#define RANGE_MAX_SPLITS 64
+// 自动grain时每个线程平均分到的块数, 多于1块才能在负载不均时窃取
+#define RANGE_CHUNKS_PER_THREAD 4
+
+typedef struct PoolTask {
+    void (*fn)(void* arg);
+    void* arg;
+    TaskGroup* group;
+    bool owned;                // 由 task_group_spawn 分配, 执行后释放
+    struct PoolTask* next;     // 注入队列链表
+} PoolTask;
+
+// Chase-Lev双端队列 (Lê et al. 2013 的C11内存序版本), 固定容量
+// top和bottom放在不同缓存行, 避免窃取方和所有者互相干扰
+typedef struct Worker {
+    _Alignas(64) atomic_long top;
+    _Alignas(64) atomic_long bottom;
+    unsigned int rng;          // 选择窃取目标的随机数状态
+    int slot;                  // 线程编号, 调用方为0, 工作线程从1开始
+    int node;                  // 绑定的NUMA节点序号, 没有绑定时为-1
+    int cpu;                   // 独立线程池中绑定的CPU, 没有指定时为-1
+    ThreadPool* pool;          // 所属的线程池
+    _Alignas(64) _Atomic(PoolTask*) buffer[DEQUE_CAPACITY];
+} Worker;
+
+struct ThreadPool {
+    int num_threads;           // 含调用方线程
+    int num_workers;
+    int num_nodes;             // 工作线程绑定到的NUMA节点数, 没有绑定时为1
+    Worker* workers;
+    pthread_t* threads;
+
+    // 池外线程提交的任务
+    pthread_mutex_t inject_lock;
+    PoolTask* inject_head;
+    PoolTask* inject_tail;
+    atomic_int inject_count;
+
+    // 空闲工作线程和等待任务组的线程休眠; epoch在每次提交后加1, 休眠前检查epoch防止丢失唤醒
+    // waiters是其中等待任务组的线程数, 任务组的计数归零时广播唤醒它们
+    pthread_mutex_t sleep_lock;
+    pthread_cond_t wake;
+    atomic_int sleepers;
+    atomic_int waiters;
+    atomic_uint epoch;
+    atomic_bool stop;
+};
+
+static ThreadPool g_pool;
+static atomic_bool g_pool_ready;
+static pthread_mutex_t g_pool_init_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_once_t g_atfork_once = PTHREAD_ONCE_INIT;
+
+static _Thread_local Worker* tls_worker;      // 池外线程为NULL
+static _Thread_local ThreadPool* tls_pool;    // 池外线程用 thread_pool_attach 选择的池, NULL为共享池
+static _Thread_local int tls_region_depth;    // 池外线程嵌套执行任务/并行区间的深度
+static _Thread_local int tls_saved_omp_threads;
+static _Thread_local unsigned int tls_rng = 0x9e3779b9u;
+
+// ---- 双端队列 ----
+
+// 只能由所有者调用
+static bool deque_push(Worker* w, PoolTask* task) {
+    long b = atomic_load_explicit(&w->bottom, memory_order_relaxed);
+    long t = atomic_load_explicit(&w->top, memory_order_acquire);
+    if (b - t >= DEQUE_CAPACITY) {
+        return false;
+    }
+    atomic_store_explicit(&w->buffer[b & DEQUE_MASK], task, memory_order_relaxed);
+    // release: 窃取方acquire读到新的bottom时, 任务内容已经可见
+    atomic_store_explicit(&w->bottom, b + 1, memory_order_release);
+    return true;
+}
+
+// 只能由所有者调用, 从底部取最近压入的任务
+static PoolTask* deque_take(Worker* w) {
+    long b = atomic_load_explicit(&w->bottom, memory_order_relaxed) - 1;
+    atomic_store_explicit(&w->bottom, b, memory_order_relaxed);
+    atomic_thread_fence(memory_order_seq_cst);
+    long t = atomic_load_explicit(&w->top, memory_order_relaxed);
+
+    if (t > b) {
+        atomic_store_explicit(&w->bottom, b + 1, memory_order_relaxed);
+        return NULL;
+    }
+    PoolTask* task = atomic_load_explicit(&w->buffer[b & DEQUE_MASK], memory_order_relaxed);
+    if (t == b) {
+        // 最后一个元素, 与窃取方竞争
+        if (!atomic_compare_exchange_strong_explicit(&w->top, &t, t + 1,
+                                                     memory_order_seq_cst, memory_order_relaxed)) {
+            task = NULL;
+        }
+        atomic_store_explicit(&w->bottom, b + 1, memory_order_relaxed);
+    }
+    return task;
+}
+
+// 任意线程调用, 从顶部取最早压入的任务; 竞争失败返回NULL
+static PoolTask* deque_steal(Worker* w) {
+    long t = atomic_load_explicit(&w->top, memory_order_acquire);
+    atomic_thread_fence(memory_order_seq_cst);
+    long b = atomic_load_explicit(&w->bottom, memory_order_acquire);
+    if (t >= b) {
+        return NULL;
+    }
+    PoolTask* task = atomic_load_explicit(&w->buffer[t & DEQUE_MASK], memory_order_relaxed);
+    if (!atomic_compare_exchange_strong_explicit(&w->top, &t, t + 1,
+                                                 memory_order_seq_cst, memory_order_relaxed)) {
+        return NULL;
+    }
+    return task;
+}
+
+// ---- 注入队列 ----
+
+static void inject_push(ThreadPool* pool, PoolTask* task) {
+    task->next = NULL;
+    pthread_mutex_lock(&pool->inject_lock);
+    if (pool->inject_tail) {
+        pool->inject_tail->next = task;
+    } else {
+        pool->inject_head = task;
+    }
+    pool->inject_tail = task;
+    atomic_fetch_add(&pool->inject_count, 1);
+    pthread_mutex_unlock(&pool->inject_lock);
+}
+
+static PoolTask* inject_pop(ThreadPool* pool) {
+    if (atomic_load_explicit(&pool->inject_count, memory_order_relaxed) == 0) {
+        return NULL;
+    }
+    pthread_mutex_lock(&pool->inject_lock);
+    PoolTask* task = pool->inject_head;
+    if (task) {
+        pool->inject_head = task->next;
+        if (!pool->inject_head) pool->inject_tail = NULL;
+        atomic_fetch_sub(&pool->inject_count, 1);
+    }
+    pthread_mutex_unlock(&pool->inject_lock);
+    return task;
+}
+
+// ---- 调度 ----
+
+static unsigned int next_random(unsigned int* state) {
+    unsigned int x = *state;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    *state = x;
+    return x;
+}
+
+// 先取自己队列的底部, 再取注入队列, 最后从随机位置开始轮流窃取
+// 绑定了NUMA节点时先窃取同一节点的队列, 任务的数据更可能在本节点的缓存和内存中
+static PoolTask* find_task(ThreadPool* pool, Worker* self) {
+    PoolTask* task;
+    if (self && (task = deque_take(self))) {
+        return task;
+    }
+    if ((task = inject_pop(pool))) {
+        return task;
+    }
+
+    const int n = pool->num_workers;
+    if (n == 0) return NULL;
+    const int start = (int)(next_random(self ? &self->rng : &tls_rng) % (unsigned int)n);
+    const bool by_node = self && self->node >= 0 && pool->num_nodes > 1;
+    for (int pass = by_node ? 0 : 1; pass < 2; pass++) {
+        for (int i = 0; i < n; i++) {
+            Worker* victim = &pool->workers[(start + i) % n];
+            if (victim == self || (pass == 0 && victim->node != self->node)) continue;
+            if ((task = deque_steal(victim))) {
+                return task;
+            }
+        }
+    }
+    return NULL;
+}
+
+// 池外线程执行任务或并行区间时, 把它的OpenMP线程数临时设为1
+// 工作线程在启动时已经设置过
+static void region_enter(void) {
+    if (tls_worker) return;
+    if (tls_region_depth++ == 0) {
+#ifdef _OPENMP
+        tls_saved_omp_threads = omp_get_max_threads();
+        omp_set_num_threads(1);
+#endif
+    }
+}
+
+static void region_leave(void) {
+    if (tls_worker) return;
+    if (--tls_region_depth == 0) {
+#ifdef _OPENMP
+        omp_set_num_threads(tls_saved_omp_threads);
+#endif
+    }
+}
+
+static void run_task(ThreadPool* pool, PoolTask* task) {
+    TaskGroup* group = task->group;
+    region_enter();
+    task->fn(task->arg);
+    region_leave();
+    if (task->owned) {
+        free(task);
+    }
+    // 最后再减计数: 栈上的任务和任务组在计数归零后可能已经失效, 之后只能访问pool
+    // 与 task_group_wait 中先加waiters再检查pending配对 (都是seq_cst), 不会两边都错过
+    if (atomic_fetch_sub(&group->pending, 1) == 1 && atomic_load(&pool->waiters) > 0) {
+        pthread_mutex_lock(&pool->sleep_lock);
+        pthread_cond_broadcast(&pool->wake);
+        pthread_mutex_unlock(&pool->sleep_lock);
+    }
+}
+
+static void notify_workers(ThreadPool* pool) {
+    atomic_fetch_add(&pool->epoch, 1);
+    if (atomic_load(&pool->sleepers) > 0) {
+        pthread_mutex_lock(&pool->sleep_lock);
+        pthread_cond_signal(&pool->wake);
+        pthread_mutex_unlock(&pool->sleep_lock);
+    }
+}
+
+// 工作线程提交到自己的队列, 池外线程提交到pool的注入队列
+static void submit_task(ThreadPool* pool, PoolTask* task) {
+    atomic_fetch_add_explicit(&task->group->pending, 1, memory_order_relaxed);
+    Worker* self = tls_worker;
+    if (self) {
+        if (!deque_push(self, task)) {
+            run_task(pool, task);
+            return;
+        }
+    } else {
+        inject_push(pool, task);
+    }
+    notify_workers(pool);
+}
+
+static void* worker_main(void* arg) {
+    Worker* self = (Worker*)arg;
+    ThreadPool* pool = self->pool;
+    tls_worker = self;
+    if (self->cpu >= 0) {
+        if (numa_pin_thread_to_cpu(self->cpu) < 0) {
+            fprintf(stderr, "Failed to pin worker thread %d to cpu %d\n", self->slot, self->cpu);
+        }
+    } else if (self->node >= 0 && numa_pin_thread(self->slot, pool->num_threads) < 0) {
+        fprintf(stderr, "Failed to pin worker thread %d\n", self->slot);
+    }
+#ifdef _OPENMP
+    omp_set_num_threads(1);
+#endif
+
+    int idle = 0;
+    while (!atomic_load(&pool->stop)) {
+        const unsigned int epoch = atomic_load(&pool->epoch);
+        PoolTask* task = find_task(pool, self);
+        if (task) {
+            run_task(pool, task);
+            idle = 0;
+            continue;
+        }
+        if (++idle < IDLE_SPIN_ROUNDS) {
+            sched_yield();
+            continue;
+        }
+
+        pthread_mutex_lock(&pool->sleep_lock);
+        atomic_fetch_add(&pool->sleepers, 1);
+        if (!atomic_load(&pool->stop) && atomic_load(&pool->epoch) == epoch) {
+            pthread_cond_wait(&pool->wake, &pool->sleep_lock);
+        }
+        atomic_fetch_sub(&pool->sleepers, 1);
+        pthread_mutex_unlock(&pool->sleep_lock);
+        idle = 0;
+    }
+    return NULL;
+}
+
+// ---- 初始化 ----
+
+static int default_num_threads(void) {
+    const char* env = getenv("TRANSFORMER_NUM_THREADS");
+    if (env && atoi(env) > 0) {
+        return atoi(env);
+    }
+#ifdef _OPENMP
+    return omp_get_max_threads();
+#else
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    return cpus > 0 ? (int)cpus : 1;
+#endif
+}
+
+// fork出的子进程只有调用fork的线程, 继承的池里的工作线程都不存在了:
+// 丢弃 (不回收) 继承的状态, 子进程第一次使用时重新创建共享池
+static void pool_atfork_child(void) {
+    memset(&g_pool, 0, sizeof(g_pool));
+    atomic_store(&g_pool_ready, false);
+    pthread_mutex_init(&g_pool_init_lock, NULL);
+    tls_worker = NULL;
+    tls_pool = NULL;
+    tls_region_depth = 0;
+}
+
+static void pool_register_atfork(void) {
+    pthread_atfork(NULL, NULL, pool_atfork_child);
+}
+
+// 初始化pool并启动工作线程; cpus不为NULL时第i个线程 (调用方为0) 绑定到 cpus[i % num_cpus],
+// 否则按NUMA设置绑定. 工作线程启动失败时退化为单线程
+static bool pool_setup(ThreadPool* pool, int num_threads, const int* cpus, int num_cpus) {
+    pthread_once(&g_atfork_once, pool_register_atfork);
+    if (num_threads <= 0) num_threads = default_num_threads();
+    if (num_threads > THREAD_POOL_MAX_THREADS) num_threads = THREAD_POOL_MAX_THREADS;
+
+    memset(pool, 0, sizeof(*pool));
+    pool->num_threads = num_threads;
+    pool->num_workers = num_threads - 1;
+    pthread_mutex_init(&pool->inject_lock, NULL);
+    pthread_mutex_init(&pool->sleep_lock, NULL);
+    pthread_cond_init(&pool->wake, NULL);
+    atomic_init(&pool->inject_count, 0);
+    atomic_init(&pool->sleepers, 0);
+    atomic_init(&pool->waiters, 0);
+    atomic_init(&pool->epoch, 0);
+    atomic_init(&pool->stop, false);
+
+    if (pool->num_workers > 0) {
+        pool->workers = (Worker*)aligned_alloc(64, sizeof(Worker) * pool->num_workers);
+        pool->threads = (pthread_t*)malloc(sizeof(pthread_t) * pool->num_workers);
+        if (!pool->workers || !pool->threads) {
+            fprintf(stderr, "Failed to allocate thread pool with %d threads\n", num_threads);
+            free(pool->workers);
+            free(pool->threads);
+            pool->workers = NULL;
+            pool->threads = NULL;
+            pool->num_workers = 0;
+            pool->num_threads = 1;
+        }
+    }
+
+    // 绑定线程时工作线程按编号均匀分到各NUMA节点, 调用方线程占编号0但不绑定
+    const bool pin = !cpus && numa_thread_pinning_enabled();
+    pool->num_nodes = pin ? numa_topology()->num_nodes : 1;
+    for (int i = 0; i < pool->num_workers; i++) {
+        Worker* w = &pool->workers[i];
+        atomic_init(&w->top, 0);
+        atomic_init(&w->bottom, 0);
+        w->rng = 0x9e3779b9u * (unsigned int)(i + 1);
+        w->slot = i + 1;
+        w->node = pin ? numa_slot_node(w->slot, num_threads) : -1;
+        w->cpu = cpus && num_cpus > 0 ? cpus[w->slot % num_cpus] : -1;
+        w->pool = pool;
+    }
+    for (int i = 0; i < pool->num_workers; i++) {
+        if (pthread_create(&pool->threads[i], NULL, worker_main, &pool->workers[i]) != 0) {
+            // 回收已启动的线程, 退化为单线程执行
+            fprintf(stderr, "Failed to start worker thread %d, running single-threaded\n", i);
+            atomic_store(&pool->stop, true);
+            for (int j = 0; j < i; j++) pthread_join(pool->threads[j], NULL);
+            atomic_store(&pool->stop, false);
+            pool->num_workers = 0;
+            pool->num_threads = 1;
+            break;
+        }
+    }
+    return true;
+}
+
+static void pool_teardown(ThreadPool* pool) {
+    pthread_mutex_lock(&pool->sleep_lock);
+    atomic_store(&pool->stop, true);
+    pthread_cond_broadcast(&pool->wake);
+    pthread_mutex_unlock(&pool->sleep_lock);
+    for (int i = 0; i < pool->num_workers; i++) {
+        pthread_join(pool->threads[i], NULL);
+    }
+    free(pool->workers);
+    free(pool->threads);
+    pthread_mutex_destroy(&pool->inject_lock);
+    pthread_mutex_destroy(&pool->sleep_lock);
+    pthread_cond_destroy(&pool->wake);
+    memset(pool, 0, sizeof(*pool));
+}
+
+static void pool_ensure(void) {
+    if (atomic_load_explicit(&g_pool_ready, memory_order_acquire)) return;
+    pthread_mutex_lock(&g_pool_init_lock);
+    if (!atomic_load_explicit(&g_pool_ready, memory_order_relaxed)) {
+        pool_setup(&g_pool, 0, NULL, 0);
+        atomic_store_explicit(&g_pool_ready, true, memory_order_release);
+    }
+    pthread_mutex_unlock(&g_pool_init_lock);
+}
+
+// 调用线程当前使用的池: 工作线程用所属的池, 池外线程用attach的池, 否则用共享池
+static ThreadPool* current_pool(void) {
+    if (tls_worker) return tls_worker->pool;
+    if (tls_pool) return tls_pool;
+    pool_ensure();
+    return &g_pool;
+}
+
+bool thread_pool_init(int num_threads) {
+    pthread_mutex_lock(&g_pool_init_lock);
+    bool started = false;
+    if (!atomic_load_explicit(&g_pool_ready, memory_order_relaxed)) {
+        started = pool_setup(&g_pool, num_threads, NULL, 0);
+        atomic_store_explicit(&g_pool_ready, true, memory_order_release);
+    }
+    pthread_mutex_unlock(&g_pool_init_lock);
+    return started;
+}
+
+void thread_pool_shutdown(void) {
+    pthread_mutex_lock(&g_pool_init_lock);
+    if (atomic_load_explicit(&g_pool_ready, memory_order_relaxed)) {
+        pool_teardown(&g_pool);
+        atomic_store_explicit(&g_pool_ready, false, memory_order_release);
+    }
+    pthread_mutex_unlock(&g_pool_init_lock);
+}
+
+ThreadPool* thread_pool_create(int num_threads, const int* cpus, int num_cpus) {
+    ThreadPool* pool = (ThreadPool*)malloc(sizeof(ThreadPool));
+    if (!pool) return NULL;
+    pool_setup(pool, num_threads, cpus, num_cpus);
+    return pool;
+}
+
+void thread_pool_free(ThreadPool* pool) {
+    if (!pool || pool == &g_pool) return;
+    pool_teardown(pool);
+    free(pool);
+}
+
+void thread_pool_attach(ThreadPool* pool) {
+    if (tls_worker) return;
+    tls_pool = pool;
+}
+
+int thread_pool_num_threads(void) {
+    return current_pool()->num_threads;
+}
+
+// ---- 任务组 ----
+
+void task_group_init(TaskGroup* group) {
+    atomic_init(&group->pending, 0);
+}
+
+void task_group_spawn(TaskGroup* group, void (*fn)(void* arg), void* arg) {
+    ThreadPool* pool = current_pool();
+    PoolTask* task = pool->num_workers > 0 ? (PoolTask*)malloc(sizeof(PoolTask)) : NULL;
+    if (!task) {
+        region_enter();
+        fn(arg);
+        region_leave();
+        return;
+    }
+    task->fn = fn;
+    task->arg = arg;
+    task->group = group;
+    task->owned = true;
+    task->next = NULL;
+    submit_task(pool, task);
+}
+
+// 有任务就执行 (不一定属于这个组), 组内剩下的任务都在别的线程上执行时休眠,
+// 直到组的计数归零或者有新任务提交 (可能是组内任务拆出的子任务, 醒来帮忙执行)
+void task_group_wait(TaskGroup* group) {
+    ThreadPool* pool = current_pool();
+    int idle = 0;
+    while (atomic_load_explicit(&group->pending, memory_order_acquire) > 0) {
+        const unsigned int epoch = atomic_load(&pool->epoch);
+        PoolTask* task = find_task(pool, tls_worker);
+        if (task) {
+            run_task(pool, task);
+            idle = 0;
+            continue;
+        }
+        if (++idle < WAIT_SPIN_ROUNDS) {
+            continue;
+        }
+
+        pthread_mutex_lock(&pool->sleep_lock);
+        atomic_fetch_add(&pool->waiters, 1);
+        atomic_fetch_add(&pool->sleepers, 1);
+        if (atomic_load(&group->pending) > 0 && atomic_load(&pool->epoch) == epoch &&
+            !atomic_load(&pool->stop)) {
+            pthread_cond_wait(&pool->wake, &pool->sleep_lock);
+        }
+        atomic_fetch_sub(&pool->sleepers, 1);
+        atomic_fetch_sub(&pool->waiters, 1);
+        pthread_mutex_unlock(&pool->sleep_lock);
+        idle = 0;
+    }
+}
+
+// ---- 并行区间 ----
+
+typedef struct RangeJob {
+    ThreadPool* pool;
+    ThreadPoolRangeFn fn;
+    void* ctx;
+    long grain;
+} RangeJob;
+
+typedef struct RangeTask {
+    PoolTask task;
+    const RangeJob* job;
+    long begin;
+    long end;
+} RangeTask;
+
+static void range_task_run(void* arg);
+
+// 不断把右半部分作为任务提交, 自己执行剩下的左半部分, 最后等待提交出去的部分
+// 子任务放在本函数的栈上, 所以必须等它们全部完成才能返回
+static void range_run(const RangeJob* job, long begin, long end) {
+    TaskGroup group;
+    task_group_init(&group);
+    RangeTask splits[RANGE_MAX_SPLITS];
+    int num_splits = 0;
+
+    while (end - begin > job->grain && num_splits < RANGE_MAX_SPLITS) {
+        const long mid = begin + (end - begin) / 2;
+        RangeTask* split = &splits[num_splits++];
+        split->task.fn = range_task_run;
+        split->task.arg = split;
+        split->task.group = &group;
+        split->task.owned = false;
+        split->task.next = NULL;
+        split->job = job;
+        split->begin = mid;
+        split->end = end;
+        submit_task(job->pool, &split->task);
+        end = mid;
+    }
+
+    job->fn(job->ctx, begin, end);
+    task_group_wait(&group);
+}
+
+static void range_task_run(void* arg) {
+    RangeTask* split = (RangeTask*)arg;
+    range_run(split->job, split->begin, split->end);
+}
+
+void thread_pool_parallel_for(long n, long grain, ThreadPoolRangeFn fn, void* ctx) {
+    if (n <= 0) return;
+    ThreadPool* pool = current_pool();
+
+    const int threads = pool->num_threads;
+    if (grain <= 0) {
+        const long chunks = (long)threads * RANGE_CHUNKS_PER_THREAD;
+        grain = (n + chunks - 1) / chunks;
+    }
+    if (threads <= 1 || n <= grain) {
+        fn(ctx, 0, n);
+        return;
+    }
+
+    RangeJob job = {pool, fn, ctx, grain};
+    region_enter();
+    range_run(&job, 0, n);
+    region_leave();
+}
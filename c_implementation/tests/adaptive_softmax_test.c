@@ -0,0 +1,315 @@
+// 自适应softmax和词汇候选表与朴素实现一致
+// 参考实现用double按定义计算: 头部log-softmax, 尾部簇先投影再log-softmax, 加上簇token的对数概率.
+// 检查 adaptive_softmax_log_prob (每行概率和为1)、topk (簇剪枝不能漏掉真正的前k个)、
+// loss (含ignore_index行) 以及隐状态和各参数梯度 (与参考损失的中心差分比较);
+// 候选表检查 lexical_shortlist_build 的去重排序和 vocab_projection_topk_shortlist 只在候选内归一化
+#include "adaptive_softmax.h"
+#include "shortlist.h"
+#include "vocab_projection.h"
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define MODEL_DIM 32
+#define VOCAB 400
+#define NUM_CLUSTERS 3
+#define NUM_ROWS 9
+#define TOP_K 6
+#define IGNORE_INDEX -100
+#define FD_EPS 1e-2f
+
+static const int cutoffs[NUM_CLUSTERS] = {20, 100, 250};
+
+static void fill_values(float* data, size_t count, float scale, unsigned int seed) {
+    srand(seed);
+    for (size_t i = 0; i < count; i++) {
+        data[i] = scale * ((float)rand() / RAND_MAX - 0.5f);
+    }
+}
+
+static void log_softmax(double* y, int cols) {
+    double max = y[0], total = 0.0;
+    for (int j = 1; j < cols; j++) {
+        if (y[j] > max) max = y[j];
+    }
+    for (int j = 0; j < cols; j++) total += exp(y[j] - max);
+    const double log_sum_exp = max + log(total);
+    for (int j = 0; j < cols; j++) y[j] -= log_sum_exp;
+}
+
+// out[o] = W[o] . x
+static void project(const float* W, const double* x, int in_dim, int out_dim, double* out) {
+    for (int o = 0; o < out_dim; o++) {
+        double dot = 0.0;
+        for (int i = 0; i < in_dim; i++) dot += (double)W[(size_t)o * in_dim + i] * x[i];
+        out[o] = dot;
+    }
+}
+
+// 一行的参考对数概率 [VOCAB]
+static void reference_log_prob(const AdaptiveSoftmax* as, const float* hidden, double* log_probs) {
+    double h[MODEL_DIM], head[VOCAB], u[MODEL_DIM];
+    for (int d = 0; d < MODEL_DIM; d++) h[d] = hidden[d];
+    project(as->head_weight->data, h, MODEL_DIM, as->head_size, head);
+    log_softmax(head, as->head_size);
+    memcpy(log_probs, head, as->cutoffs[0] * sizeof(double));
+    for (int c = 0; c < as->num_clusters; c++) {
+        const int size = as->cutoffs[c + 1] - as->cutoffs[c];
+        double* y = log_probs + as->cutoffs[c];
+        project(as->tail_proj[c]->data, h, MODEL_DIM, as->tail_dims[c], u);
+        project(as->tail_weight[c]->data, u, as->tail_dims[c], size, y);
+        log_softmax(y, size);
+        for (int j = 0; j < size; j++) y[j] += head[as->cutoffs[0] + c];
+    }
+}
+
+static double reference_loss(const AdaptiveSoftmax* as, const float* hidden, const int32_t* targets) {
+    double log_probs[VOCAB], loss = 0.0;
+    int count = 0;
+    for (int r = 0; r < NUM_ROWS; r++) {
+        if (targets[r] == IGNORE_INDEX) continue;
+        reference_log_prob(as, hidden + (size_t)r * MODEL_DIM, log_probs);
+        loss -= log_probs[targets[r]];
+        count++;
+    }
+    return loss / count;
+}
+
+static int check_log_prob_and_topk(const AdaptiveSoftmax* as, const float* hidden) {
+    float log_probs[NUM_ROWS * VOCAB], top_log_probs[NUM_ROWS * TOP_K];
+    int top_indices[NUM_ROWS * TOP_K];
+    double expected[VOCAB];
+    int failures = 0, tail_hits = 0;
+    if (!adaptive_softmax_log_prob(as, hidden, NUM_ROWS, log_probs) ||
+        !adaptive_softmax_topk(as, hidden, NUM_ROWS, TOP_K, top_indices, top_log_probs)) {
+        fprintf(stderr, "adaptive softmax failed\n");
+        return 1;
+    }
+    double max_error = 0.0, max_mass_error = 0.0;
+    for (int r = 0; r < NUM_ROWS; r++) {
+        reference_log_prob(as, hidden + (size_t)r * MODEL_DIM, expected);
+        double mass = 0.0;
+        for (int v = 0; v < VOCAB; v++) {
+            const double error = fabs(log_probs[r * VOCAB + v] - expected[v]);
+            if (!(error <= max_error)) max_error = error;
+            mass += exp(log_probs[r * VOCAB + v]);
+        }
+        if (fabs(mass - 1.0) > max_mass_error) max_mass_error = fabs(mass - 1.0);
+
+        bool taken[VOCAB] = {false};
+        for (int i = 0; i < TOP_K; i++) {
+            int best = -1;
+            for (int v = 0; v < VOCAB; v++) {
+                if (!taken[v] && (best < 0 || expected[v] > expected[best])) best = v;
+            }
+            taken[best] = true;
+            if (best >= cutoffs[0]) tail_hits++;
+            if (top_indices[r * TOP_K + i] != best) {
+                fprintf(stderr, "top-k: row %d rank %d is token %d, expected %d\n", r, i,
+                        top_indices[r * TOP_K + i], best);
+                failures++;
+            }
+            const double error = fabs(top_log_probs[r * TOP_K + i] - expected[best]);
+            if (!(error <= max_error)) max_error = error;
+        }
+    }
+    printf("adaptive_softmax_test: log_prob/top-%d max error %.3g, probability mass error %.3g, "
+           "%d of %d top-k entries from tail clusters\n",
+           TOP_K, max_error, max_mass_error, tail_hits, NUM_ROWS * TOP_K);
+    if (!(max_error < 1e-4) || !(max_mass_error < 1e-4)) {
+        fprintf(stderr, "log probabilities differ from the reference\n");
+        failures++;
+    }
+    return failures;
+}
+
+// 参数梯度与参考损失的中心差分比较; 每个张量抽查几个元素
+static double parameter_error(AdaptiveSoftmax* as, Tensor* param, const Tensor* grad, const float* hidden,
+                              const int32_t* targets) {
+    const size_t total = calculate_total_size(param->shape, param->num_dims);
+    double max_error = 0.0;
+    for (int s = 0; s < 4; s++) {
+        const size_t i = (total * (2 * s + 1)) / 8;
+        const float saved = param->data[i];
+        param->data[i] = saved + FD_EPS;
+        const float up = param->data[i];
+        const double loss_up = reference_loss(as, hidden, targets);
+        param->data[i] = saved - FD_EPS;
+        const float down = param->data[i];
+        const double loss_down = reference_loss(as, hidden, targets);
+        param->data[i] = saved;
+        const double numeric = (loss_up - loss_down) / ((double)up - down);
+        const double error = fabs(grad->data[i] - numeric);
+        if (!(error <= max_error)) max_error = error;
+    }
+    return max_error;
+}
+
+static int check_loss_and_gradients(AdaptiveSoftmax* as, float* hidden) {
+    int32_t targets[NUM_ROWS];
+    float grad_hidden[NUM_ROWS * MODEL_DIM];
+    float loss = 0.0f;
+    int failures = 0;
+    // 目标覆盖头部和每个尾部簇, 第2行忽略
+    for (int r = 0; r < NUM_ROWS; r++) targets[r] = (r * 97 + 3) % VOCAB;
+    targets[2] = IGNORE_INDEX;
+    memset(grad_hidden, 0xff, sizeof(grad_hidden));
+    if (!adaptive_softmax_loss(as, hidden, targets, NUM_ROWS, IGNORE_INDEX, &loss, grad_hidden)) {
+        fprintf(stderr, "adaptive_softmax_loss failed\n");
+        return 1;
+    }
+    const double expected_loss = reference_loss(as, hidden, targets);
+
+    double hidden_error = 0.0;
+    for (int i = 0; i < NUM_ROWS * MODEL_DIM; i++) {
+        const float saved = hidden[i];
+        hidden[i] = saved + FD_EPS;
+        const float up = hidden[i];
+        const double loss_up = reference_loss(as, hidden, targets);
+        hidden[i] = saved - FD_EPS;
+        const float down = hidden[i];
+        const double loss_down = reference_loss(as, hidden, targets);
+        hidden[i] = saved;
+        const double error = fabs(grad_hidden[i] - (loss_up - loss_down) / ((double)up - down));
+        if (!(error <= hidden_error)) hidden_error = error;
+    }
+    double param_error = parameter_error(as, as->head_weight, as->grad_head_weight, hidden, targets);
+    for (int c = 0; c < as->num_clusters; c++) {
+        const double proj_error = parameter_error(as, as->tail_proj[c], as->grad_tail_proj[c], hidden, targets);
+        const double weight_error = parameter_error(as, as->tail_weight[c], as->grad_tail_weight[c], hidden, targets);
+        if (proj_error > param_error) param_error = proj_error;
+        if (weight_error > param_error) param_error = weight_error;
+    }
+    printf("adaptive_softmax_test: loss %.6f vs %.6f, grad error hidden %.3g parameters %.3g\n", loss,
+           expected_loss, hidden_error, param_error);
+    if (!(fabs(loss - expected_loss) < 1e-4 * (1.0 + expected_loss))) {
+        fprintf(stderr, "loss differs from the reference\n");
+        failures++;
+    }
+    if (!(hidden_error < 1e-3) || !(param_error < 1e-3)) {
+        fprintf(stderr, "gradients differ from central differences of the reference loss\n");
+        failures++;
+    }
+    return failures;
+}
+
+// 候选表: 每个源词3个候选 (有重复), 外加总是保留的词; 只在候选内打分和归一化
+static int check_shortlist(const float* hidden) {
+    enum { SOURCE_VOCAB = 10, PER_SOURCE = 3, SHORTLIST_K = 4 };
+    int row_ptr[SOURCE_VOCAB + 1];
+    int32_t candidates[SOURCE_VOCAB * PER_SOURCE];
+    const int32_t always_include[] = {0, 2, 399};
+    const int32_t source[] = {4, 7, 4, 1};
+    for (int s = 0; s <= SOURCE_VOCAB; s++) row_ptr[s] = s * PER_SOURCE;
+    for (int i = 0; i < SOURCE_VOCAB * PER_SOURCE; i++) candidates[i] = (i * 53 + 7) % 60 * 5;
+
+    LexicalShortlist* shortlist = lexical_shortlist_create(SOURCE_VOCAB, VOCAB, row_ptr, candidates,
+                                                           always_include, 3);
+    VocabProjection* proj = vocab_projection_create(VOCAB, MODEL_DIM, false);
+    int32_t* built = (int32_t*)malloc(VOCAB * sizeof(int32_t));
+    int failures = 0;
+    if (!shortlist || !proj || !built) {
+        fprintf(stderr, "shortlist: allocation failed\n");
+        failures++;
+        goto cleanup;
+    }
+    fill_values(proj->weight->data, (size_t)VOCAB * MODEL_DIM, 1.0f, 21);
+
+    // 参考: 用标记数组求并集, 按编号升序
+    bool member[VOCAB] = {false};
+    int32_t expected[VOCAB];
+    int expected_size = 0;
+    for (int i = 0; i < 3; i++) member[always_include[i]] = true;
+    for (int t = 0; t < 4; t++) {
+        for (int i = row_ptr[source[t]]; i < row_ptr[source[t] + 1]; i++) member[candidates[i]] = true;
+    }
+    for (int v = 0; v < VOCAB; v++) {
+        if (member[v]) expected[expected_size++] = v;
+    }
+    const int size = lexical_shortlist_build(shortlist, source, 4, built);
+    if (size != expected_size || memcmp(built, expected, expected_size * sizeof(int32_t)) != 0) {
+        fprintf(stderr, "shortlist: built %d candidates, expected %d\n", size, expected_size);
+        failures++;
+        goto cleanup;
+    }
+
+    int top_indices[NUM_ROWS * SHORTLIST_K];
+    float top_logits[NUM_ROWS * SHORTLIST_K], log_sum_exp[NUM_ROWS];
+    if (!vocab_projection_topk_shortlist(proj, hidden, NUM_ROWS, built, size, SHORTLIST_K, 1.0f, top_indices,
+                                         top_logits, log_sum_exp)) {
+        fprintf(stderr, "shortlist: vocab_projection_topk_shortlist failed\n");
+        failures++;
+        goto cleanup;
+    }
+    double max_error = 0.0;
+    for (int r = 0; r < NUM_ROWS && !failures; r++) {
+        double h[MODEL_DIM], logits[VOCAB], max = -INFINITY, total = 0.0;
+        for (int d = 0; d < MODEL_DIM; d++) h[d] = hidden[(size_t)r * MODEL_DIM + d];
+        project(proj->weight->data, h, MODEL_DIM, VOCAB, logits);
+        bool taken[VOCAB] = {false};
+        for (int i = 0; i < SHORTLIST_K; i++) {
+            int best = -1;
+            for (int j = 0; j < size; j++) {
+                const int v = expected[j];
+                if (!taken[v] && (best < 0 || logits[v] > logits[best])) best = v;
+            }
+            taken[best] = true;
+            if (top_indices[r * SHORTLIST_K + i] != best) {
+                fprintf(stderr, "shortlist: row %d rank %d is token %d, expected %d\n", r, i,
+                        top_indices[r * SHORTLIST_K + i], best);
+                failures++;
+            }
+            const double error = fabs(top_logits[r * SHORTLIST_K + i] - logits[best]);
+            if (error > max_error) max_error = error;
+        }
+        for (int j = 0; j < size; j++) {
+            if (logits[expected[j]] > max) max = logits[expected[j]];
+        }
+        for (int j = 0; j < size; j++) total += exp(logits[expected[j]] - max);
+        const double error = fabs(log_sum_exp[r] - (max + log(total)));
+        if (error > max_error) max_error = error;
+    }
+    printf("adaptive_softmax_test: shortlist of %d tokens, top-%d and log-sum-exp max error %.3g\n", size,
+           SHORTLIST_K, max_error);
+    if (!(max_error < 1e-4)) {
+        fprintf(stderr, "shortlist: logits differ from the reference\n");
+        failures++;
+    }
+
+cleanup:
+    free(built);
+    vocab_projection_free(proj);
+    lexical_shortlist_free(shortlist);
+    return failures;
+}
+
+int main(void) {
+    AdaptiveSoftmax* as = adaptive_softmax_create(MODEL_DIM, VOCAB, cutoffs, NUM_CLUSTERS, 2.0f);
+    float hidden[NUM_ROWS * MODEL_DIM];
+    int failures = 0;
+    if (!as) {
+        fprintf(stderr, "failed to create adaptive softmax\n");
+        return 1;
+    }
+    // 簇token的权重放大, 尾部簇的分布更尖, 让前k个中有足够多的尾部词
+    fill_values(as->head_weight->data, calculate_total_size(as->head_weight->shape, 2), 1.0f, 1);
+    for (int i = cutoffs[0] * MODEL_DIM; i < as->head_size * MODEL_DIM; i++) as->head_weight->data[i] *= 3.0f;
+    for (int c = 0; c < as->num_clusters; c++) {
+        fill_values(as->tail_proj[c]->data, calculate_total_size(as->tail_proj[c]->shape, 2), 1.0f, 10 + c);
+        fill_values(as->tail_weight[c]->data, calculate_total_size(as->tail_weight[c]->shape, 2), 6.0f, 20 + c);
+    }
+    fill_values(hidden, NUM_ROWS * MODEL_DIM, 2.0f, 3);
+
+    failures += check_log_prob_and_topk(as, hidden);
+    failures += check_loss_and_gradients(as, hidden);
+    failures += check_shortlist(hidden);
+
+    adaptive_softmax_free(as);
+    if (failures) {
+        fprintf(stderr, "adaptive_softmax_test: %d failure(s)\n", failures);
+        return 1;
+    }
+    printf("adaptive_softmax_test: ok\n");
+    return 0;
+}
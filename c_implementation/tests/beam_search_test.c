@@ -0,0 +1,172 @@
+// beam_width为1的束搜索就是greedy解码
+// 参考实现不用KV缓存: 每生成一个token都对 bos + 已生成的token 整个前缀跑一遍 transformer_forward,
+// 取最后一行logit最大的词, 遇到eos或到达max_length结束. 分别检查按长度结束和中途遇到eos两种情况,
+// 并检查返回前缓存池的块全部归还
+#include "beam_search.h"
+#include "transformer.h"
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define VOCAB 50
+#define MODEL_DIM 32
+#define NUM_HEADS 4
+#define FF_DIM 64
+#define NUM_LAYERS 2
+#define MAX_SEQ 64
+#define ENC_SEQ 5
+#define MAX_LENGTH 12
+#define BOS 1
+
+static void fill_weights(Tensor* tensor, unsigned int seed) {
+    srand(seed);
+    size_t total = calculate_total_size(tensor->shape, tensor->num_dims);
+    for (size_t i = 0; i < total; i++) {
+        tensor->data[i] = (float)rand() / RAND_MAX - 0.5f;
+    }
+}
+
+static AttentionMask* causal_mask(int seq_len) {
+    AttentionMask* mask = (AttentionMask*)malloc(sizeof(AttentionMask));
+    int shape[] = {seq_len, seq_len};
+    if (!mask) return NULL;
+    mask->seq_length = seq_len;
+    mask->mask = tensor_create(shape, 2);
+    if (!mask->mask) {
+        free(mask);
+        return NULL;
+    }
+    for (int i = 0; i < seq_len; i++) {
+        for (int j = 0; j <= i; j++) mask->mask->data[i * seq_len + j] = 1.0f;
+    }
+    return mask;
+}
+
+// 不用KV缓存的greedy解码, 返回生成的token数 (含eos), 出错时返回-1
+static int greedy_reference(Transformer* transformer, const TransformerEmbedding* embedding,
+                            const VocabProjection* vocab, Tensor* encoder_input, int32_t eos, int32_t* output) {
+    int32_t sequence[MAX_LENGTH + 1] = {BOS};
+    float logits[VOCAB];
+    int generated = 0;
+    bool ok = true;
+    while (ok && generated < MAX_LENGTH) {
+        const int length = generated + 1;
+        int token_shape[] = {1, length};
+        int dec_shape[] = {1, length, MODEL_DIM};
+        IntTensor* prefix = int_tensor_create(token_shape, 2);
+        Tensor* decoder_input = tensor_create(dec_shape, 3);
+        Tensor* hidden = tensor_create(dec_shape, 3);
+        AttentionMask* mask = causal_mask(length);
+        ok = prefix && decoder_input && hidden && mask;
+        if (ok) {
+            memcpy(prefix->data, sequence, length * sizeof(int32_t));
+            ok = transformer_embedding_forward(embedding, prefix, decoder_input) &&
+                 transformer_forward(transformer, encoder_input, decoder_input, hidden, NULL, mask, NULL) &&
+                 vocab_projection_logits(vocab, hidden->data + (size_t)(length - 1) * MODEL_DIM, 1, logits);
+        }
+        if (ok) {
+            int best = 0;
+            for (int v = 1; v < VOCAB; v++) {
+                if (logits[v] > logits[best]) best = v;
+            }
+            output[generated++] = best;
+            sequence[length] = best;
+        }
+        attention_mask_free(mask);
+        tensor_free(hidden);
+        tensor_free(decoder_input);
+        int_tensor_free(prefix);
+        if (ok && output[generated - 1] == eos) break;
+    }
+    return ok ? generated : -1;
+}
+
+// 返回失败数; eos_index >= 0 时用greedy结果中不早于该位置第一次出现的词作为eos, 让解码中途结束
+static int check_greedy(Transformer* transformer, const TransformerEmbedding* embedding,
+                        const VocabProjection* vocab, Tensor* encoder_input, int eos_index) {
+    int32_t expected[MAX_LENGTH];
+    int32_t eos = -1;
+    int expected_length = greedy_reference(transformer, embedding, vocab, encoder_input, eos, expected);
+    for (int i = eos_index; expected_length > 0 && i >= 0 && i < expected_length && eos < 0; i++) {
+        eos = expected[i];
+        for (int j = 0; j < i; j++) {
+            if (expected[j] == eos) eos = -1;
+        }
+    }
+    if (eos >= 0) {
+        expected_length = greedy_reference(transformer, embedding, vocab, encoder_input, eos, expected);
+    }
+    if (expected_length <= 0) {
+        fprintf(stderr, "greedy reference failed\n");
+        return 1;
+    }
+
+    KVCachePool* pool = kv_cache_pool_create(NUM_LAYERS, NUM_HEADS, MODEL_DIM / NUM_HEADS, 4, 16, HUGE_PAGES_OFF);
+    const BeamSearchConfig config = {1, MAX_LENGTH, BOS, eos, 0.0f};
+    BeamSearch* search = pool ? beam_search_create(transformer, embedding, vocab, pool, &config) : NULL;
+    BeamSearchResult result = {0};
+    int failures = 0;
+    if (!search || !beam_search_run(search, encoder_input, NULL, &result)) {
+        fprintf(stderr, "beam search failed\n");
+        failures++;
+    } else if (result.num_hypotheses != 1) {
+        fprintf(stderr, "beam width 1 returned %d hypotheses\n", result.num_hypotheses);
+        failures++;
+    } else {
+        const BeamHypothesis* best = &result.hypotheses[0];
+        if (best->length != expected_length || memcmp(best->tokens, expected, expected_length * sizeof(int32_t)) ||
+            best->finished != (eos >= 0)) {
+            fprintf(stderr, "eos %d: beam width 1 (%d tokens, finished %d) differs from greedy (%d tokens)\n", eos,
+                    best->length, best->finished, expected_length);
+            failures++;
+        }
+    }
+    if (pool && kv_cache_pool_free_blocks(pool) != pool->num_blocks) {
+        fprintf(stderr, "eos %d: %d of %d cache blocks free after beam search\n", eos,
+                kv_cache_pool_free_blocks(pool), pool->num_blocks);
+        failures++;
+    }
+    printf("beam_search_test: eos %d, %d greedy tokens, %d failure(s)\n", eos, expected_length, failures);
+
+    beam_search_result_free(&result);
+    beam_search_free(search);
+    kv_cache_pool_free(pool);
+    return failures;
+}
+
+int main(void) {
+    init_model_config(1, MAX_SEQ, VOCAB, MODEL_DIM, FF_DIM, NUM_HEADS, 0.0f);
+    ModelConfig config = g_model_config;
+    config.is_training = false;
+
+    Transformer* transformer = transformer_create_from_config(&config, NUM_LAYERS);
+    TransformerEmbedding* embedding = transformer_embedding_create(VOCAB, MODEL_DIM, MAX_SEQ,
+                                                                   config.position_encoding);
+    VocabProjection* vocab = vocab_projection_create(VOCAB, MODEL_DIM, false);
+    int enc_shape[] = {1, ENC_SEQ, MODEL_DIM};
+    Tensor* encoder_input = tensor_create(enc_shape, 3);
+    int failures = 0;
+    if (!transformer || !embedding || !vocab || !encoder_input) {
+        fprintf(stderr, "failed to create model\n");
+        failures++;
+    } else {
+        transformer_init_random(transformer, 7);
+        fill_weights(embedding->token_embedding->embedding_matrix, 1);
+        fill_weights(vocab->weight, 2);
+        fill_weights(encoder_input, 6);
+        failures += check_greedy(transformer, embedding, vocab, encoder_input, -1);
+        failures += check_greedy(transformer, embedding, vocab, encoder_input, 1);
+    }
+
+    tensor_free(encoder_input);
+    vocab_projection_free(vocab);
+    free_transformer_embedding(embedding);
+    transformer_free(transformer);
+    if (failures) {
+        fprintf(stderr, "beam_search_test: %d failure(s)\n", failures);
+        return 1;
+    }
+    printf("beam_search_test: ok\n");
+    return 0;
+}
@@ -0,0 +1,147 @@
+// 融合交叉熵的损失和梯度与朴素实现一致
+// 参考实现用double算出完整的logits和softmax: loss为非忽略行的平均NLL,
+// g = (softmax - onehot) / 行数, grad_hidden = g W, grad_weight += g^T h, grad_bias += g.
+// 行数超过一个行块 (CE_ROW_CHUNK), 其中一行为ignore_index; 权重梯度预先填入非零值以检查累加,
+// 忽略行的grad_hidden预先填入非零值以检查覆盖写. 在4个线程的独立线程池上运行, 词表切成多个区间
+#include "cross_entropy.h"
+#include "thread_pool.h"
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define VOCAB 301
+#define MODEL_DIM 24
+#define NUM_ROWS 70
+#define IGNORE_INDEX -100
+#define IGNORED_ROW 5
+
+static void fill_values(float* data, size_t count, unsigned int seed) {
+    srand(seed);
+    for (size_t i = 0; i < count; i++) {
+        data[i] = (float)rand() / RAND_MAX - 0.5f;
+    }
+}
+
+static double max_abs_diff(const float* a, const double* b, size_t count) {
+    double max = 0.0;
+    for (size_t i = 0; i < count; i++) {
+        const double diff = fabs(a[i] - b[i]);
+        if (!(diff <= max)) max = diff;     // NaN也算作不一致
+    }
+    return max;
+}
+
+// 参考: 返回平均损失, 梯度写入/累加到double数组
+static double reference_cross_entropy(const VocabProjection* proj, const float* hidden, const int32_t* targets,
+                                      double* grad_hidden, double* grad_weight, double* grad_bias) {
+    const float* weight = proj->weight->data;
+    double logits[VOCAB];
+    int count = 0;
+    for (int r = 0; r < NUM_ROWS; r++) count += targets[r] != IGNORE_INDEX;
+
+    double loss = 0.0;
+    memset(grad_hidden, 0, (size_t)NUM_ROWS * MODEL_DIM * sizeof(double));
+    for (int r = 0; r < NUM_ROWS; r++) {
+        if (targets[r] == IGNORE_INDEX) continue;
+        const float* h = hidden + (size_t)r * MODEL_DIM;
+        double max = -INFINITY, total = 0.0;
+        for (int v = 0; v < VOCAB; v++) {
+            double dot = proj->bias->data[v];
+            for (int d = 0; d < MODEL_DIM; d++) dot += (double)h[d] * weight[(size_t)v * MODEL_DIM + d];
+            logits[v] = dot;
+            if (dot > max) max = dot;
+        }
+        for (int v = 0; v < VOCAB; v++) total += exp(logits[v] - max);
+        const double log_sum_exp = max + log(total);
+        loss += log_sum_exp - logits[targets[r]];
+        for (int v = 0; v < VOCAB; v++) {
+            const double g = (exp(logits[v] - log_sum_exp) - (v == targets[r])) / count;
+            for (int d = 0; d < MODEL_DIM; d++) {
+                grad_hidden[(size_t)r * MODEL_DIM + d] += g * weight[(size_t)v * MODEL_DIM + d];
+                grad_weight[(size_t)v * MODEL_DIM + d] += g * h[d];
+            }
+            grad_bias[v] += g;
+        }
+    }
+    return loss / count;
+}
+
+int main(void) {
+    const size_t hidden_size = (size_t)NUM_ROWS * MODEL_DIM, weight_size = (size_t)VOCAB * MODEL_DIM;
+    VocabProjection* proj = vocab_projection_create(VOCAB, MODEL_DIM, true);
+    float* hidden = (float*)malloc(hidden_size * sizeof(float));
+    float* grad_hidden = (float*)malloc(hidden_size * sizeof(float));
+    float* grad_weight = (float*)malloc(weight_size * sizeof(float));
+    float* grad_bias = (float*)malloc(VOCAB * sizeof(float));
+    double* expected_hidden = (double*)malloc(hidden_size * sizeof(double));
+    double* expected_weight = (double*)malloc(weight_size * sizeof(double));
+    double* expected_bias = (double*)malloc(VOCAB * sizeof(double));
+    int32_t targets[NUM_ROWS];
+    ThreadPool* pool = thread_pool_create(4, NULL, 0);
+    int failures = 0;
+    if (!proj || !hidden || !grad_hidden || !grad_weight || !grad_bias || !expected_hidden || !expected_weight ||
+        !expected_bias || !pool) {
+        fprintf(stderr, "allocation failed\n");
+        failures++;
+        goto cleanup;
+    }
+
+    fill_values(proj->weight->data, weight_size, 1);
+    fill_values(proj->bias->data, VOCAB, 2);
+    fill_values(hidden, hidden_size, 3);
+    for (size_t i = 0; i < hidden_size; i++) hidden[i] *= 4.0f;
+    for (int r = 0; r < NUM_ROWS; r++) targets[r] = (r * 37 + 11) % VOCAB;
+    targets[IGNORED_ROW] = IGNORE_INDEX;
+    // 已有的梯度: 权重和偏置应在此基础上累加, grad_hidden应被覆盖
+    fill_values(grad_weight, weight_size, 4);
+    fill_values(grad_bias, VOCAB, 5);
+    fill_values(grad_hidden, hidden_size, 6);
+    for (size_t i = 0; i < weight_size; i++) expected_weight[i] = grad_weight[i];
+    for (int v = 0; v < VOCAB; v++) expected_bias[v] = grad_bias[v];
+
+    const double expected_loss = reference_cross_entropy(proj, hidden, targets, expected_hidden, expected_weight,
+                                                         expected_bias);
+    float loss = 0.0f;
+    thread_pool_attach(pool);
+    const bool ok = fused_cross_entropy(proj, hidden, targets, NUM_ROWS, IGNORE_INDEX, &loss, grad_hidden,
+                                        grad_weight, grad_bias);
+    thread_pool_attach(NULL);
+    if (!ok) {
+        fprintf(stderr, "fused_cross_entropy failed\n");
+        failures++;
+        goto cleanup;
+    }
+
+    const double loss_error = fabs(loss - expected_loss);
+    const double hidden_error = max_abs_diff(grad_hidden, expected_hidden, hidden_size);
+    const double weight_error = max_abs_diff(grad_weight, expected_weight, weight_size);
+    const double bias_error = max_abs_diff(grad_bias, expected_bias, VOCAB);
+    printf("cross_entropy_test: loss %.6f (error %.3g), grad error hidden %.3g weight %.3g bias %.3g\n", loss,
+           loss_error, hidden_error, weight_error, bias_error);
+    if (!(loss_error < 1e-4 * (1.0 + expected_loss))) {
+        fprintf(stderr, "loss differs from the reference %.6f\n", expected_loss);
+        failures++;
+    }
+    if (!(hidden_error < 1e-5) || !(weight_error < 1e-5) || !(bias_error < 1e-5)) {
+        fprintf(stderr, "gradients differ from the reference\n");
+        failures++;
+    }
+
+cleanup:
+    thread_pool_free(pool);
+    free(expected_bias);
+    free(expected_weight);
+    free(expected_hidden);
+    free(grad_bias);
+    free(grad_weight);
+    free(grad_hidden);
+    free(hidden);
+    vocab_projection_free(proj);
+    if (failures) {
+        fprintf(stderr, "cross_entropy_test: %d failure(s)\n", failures);
+        return 1;
+    }
+    printf("cross_entropy_test: ok\n");
+    return 0;
+}
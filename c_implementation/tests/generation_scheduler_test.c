@@ -0,0 +1,313 @@
+// 连续批处理调度器与逐条greedy解码的结果一致, 结束后缓存块全部归还
+// 参考实现每生成一个token都对整个前缀重新跑一遍 transformer_forward, 取最后一行logit最大的词;
+// 调度器把不同进度的请求 (预填充/生成中/刚接纳) 放在同一批增量解码, 批内的行互相干扰时结果会不一致.
+// 另外检查取消 (等待中和运行中) 和缓存池不够时排队接纳之后, 预留和实际使用的块都回到0
+#include "generation_scheduler.h"
+#include "transformer.h"
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define VOCAB 50
+#define MODEL_DIM 32
+#define NUM_HEADS 4
+#define FF_DIM 64
+#define NUM_LAYERS 2
+#define MAX_SEQ 64
+#define MAX_NEW 10
+#define NUM_REQUESTS 4
+
+typedef struct TestModel {
+    Transformer* transformer;
+    TransformerEmbedding* encoder_embedding;
+    TransformerEmbedding* decoder_embedding;
+    VocabProjection* vocab;
+} TestModel;
+
+// 一个请求的输入和回调收到的输出
+typedef struct RequestRecord {
+    int32_t source[6];
+    int source_length;
+    int32_t prompt[4];
+    int prompt_length;
+    int32_t tokens[MAX_NEW];
+    int generated;
+    int finished;
+    GenerationFinishReason reason;
+} RequestRecord;
+
+static void fill_weights(Tensor* tensor, unsigned int seed) {
+    srand(seed);
+    size_t total = calculate_total_size(tensor->shape, tensor->num_dims);
+    for (size_t i = 0; i < total; i++) {
+        tensor->data[i] = (float)rand() / RAND_MAX - 0.5f;
+    }
+}
+
+static AttentionMask* causal_mask(int seq_len) {
+    AttentionMask* mask = (AttentionMask*)malloc(sizeof(AttentionMask));
+    int shape[] = {seq_len, seq_len};
+    if (!mask) return NULL;
+    mask->seq_length = seq_len;
+    mask->mask = tensor_create(shape, 2);
+    if (!mask->mask) {
+        free(mask);
+        return NULL;
+    }
+    for (int i = 0; i < seq_len; i++) {
+        for (int j = 0; j <= i; j++) mask->mask->data[i * seq_len + j] = 1.0f;
+    }
+    return mask;
+}
+
+static void on_token(void* user_data, uint64_t request_id, int32_t token) {
+    RequestRecord* record = (RequestRecord*)user_data;
+    (void)request_id;
+    if (record->generated < MAX_NEW) record->tokens[record->generated] = token;
+    record->generated++;
+}
+
+static void on_finish(void* user_data, uint64_t request_id, GenerationFinishReason reason,
+                      const GenerationTiming* timing, int generated_tokens) {
+    RequestRecord* record = (RequestRecord*)user_data;
+    (void)request_id;
+    (void)timing;
+    (void)generated_tokens;
+    record->finished++;
+    record->reason = reason;
+}
+
+static GenerationRequest make_request(RequestRecord* record) {
+    const GenerationRequest request = {record->source, record->source_length, record->prompt, record->prompt_length,
+                                       MAX_NEW, -1, {0.0f, 0, 1.0f, 1.0f}, 1, {on_token, on_finish, record}};
+    return request;
+}
+
+static IntTensor* token_tensor(const int32_t* tokens, int length) {
+    int shape[] = {1, length};
+    IntTensor* tensor = int_tensor_create(shape, 2);
+    if (tensor) memcpy(tensor->data, tokens, length * sizeof(int32_t));
+    return tensor;
+}
+
+// 不用KV缓存的greedy解码: 每一步对 prompt + 已生成的token 整个前缀做一次前向
+static bool greedy_reference(const TestModel* model, const RequestRecord* record, int32_t* output) {
+    int32_t sequence[4 + MAX_NEW];
+    int length = record->prompt_length;
+    memcpy(sequence, record->prompt, length * sizeof(int32_t));
+
+    int enc_shape[] = {1, record->source_length, MODEL_DIM};
+    IntTensor* source = token_tensor(record->source, record->source_length);
+    Tensor* encoder_input = tensor_create(enc_shape, 3);
+    float* logits = (float*)malloc(VOCAB * sizeof(float));
+    bool ok = source && encoder_input && logits &&
+              transformer_embedding_forward(model->encoder_embedding, source, encoder_input);
+    for (int step = 0; ok && step < MAX_NEW; step++) {
+        int dec_shape[] = {1, length, MODEL_DIM};
+        IntTensor* prefix = token_tensor(sequence, length);
+        Tensor* decoder_input = tensor_create(dec_shape, 3);
+        Tensor* hidden = tensor_create(dec_shape, 3);
+        AttentionMask* mask = causal_mask(length);
+        ok = prefix && decoder_input && hidden && mask &&
+             transformer_embedding_forward(model->decoder_embedding, prefix, decoder_input) &&
+             transformer_forward(model->transformer, encoder_input, decoder_input, hidden, NULL, mask, NULL) &&
+             vocab_projection_logits(model->vocab, hidden->data + (size_t)(length - 1) * MODEL_DIM, 1, logits);
+        if (ok) {
+            int best = 0;
+            for (int v = 1; v < VOCAB; v++) {
+                if (logits[v] > logits[best]) best = v;
+            }
+            output[step] = best;
+            sequence[length++] = best;
+        }
+        attention_mask_free(mask);
+        tensor_free(hidden);
+        tensor_free(decoder_input);
+        int_tensor_free(prefix);
+    }
+    free(logits);
+    tensor_free(encoder_input);
+    int_tensor_free(source);
+    return ok;
+}
+
+static void init_records(RequestRecord* records) {
+    memset(records, 0, NUM_REQUESTS * sizeof(RequestRecord));
+    for (int r = 0; r < NUM_REQUESTS; r++) {
+        records[r].source_length = 3 + r;
+        for (int i = 0; i < records[r].source_length; i++) records[r].source[i] = (7 * r + 3 * i + 1) % VOCAB;
+        records[r].prompt_length = 1 + r % 3;
+        for (int i = 0; i < records[r].prompt_length; i++) records[r].prompt[i] = (5 * r + i) % VOCAB;
+    }
+}
+
+// 一直step到没有运行和等待中的请求; 取消的序列在step中结束, 空出的预留要到下一次step才接纳
+static void run_to_completion(GenerationScheduler* scheduler) {
+    for (int guard = 0; guard < 200; guard++) {
+        const int rows = generation_scheduler_step(scheduler);
+        const GenerationSchedulerMetrics metrics = generation_scheduler_metrics(scheduler);
+        if (rows <= 0 && metrics.running == 0 && metrics.queue_depth == 0) break;
+    }
+}
+
+// 缓存池中的块全部空闲, 调度器没有预留
+static int check_released(GenerationScheduler* scheduler, KVCachePool* pool, const char* name) {
+    const GenerationSchedulerMetrics metrics = generation_scheduler_metrics(scheduler);
+    if (metrics.reserved_blocks != 0 || metrics.used_blocks != 0 ||
+        kv_cache_pool_free_blocks(pool) != pool->num_blocks) {
+        fprintf(stderr, "%s: %d blocks still reserved, %d used, %d of %d free\n", name, metrics.reserved_blocks,
+                metrics.used_blocks, kv_cache_pool_free_blocks(pool), pool->num_blocks);
+        return 1;
+    }
+    return 0;
+}
+
+// 请求在不同的step提交, 同一批里有预填充和生成中的序列
+static int check_interleaved(const TestModel* model) {
+    RequestRecord records[NUM_REQUESTS];
+    int failures = 0;
+    init_records(records);
+    KVCachePool* pool = kv_cache_pool_create(NUM_LAYERS, NUM_HEADS, MODEL_DIM / NUM_HEADS, 4, 64, HUGE_PAGES_OFF);
+    GenerationScheduler* scheduler = pool ? generation_scheduler_create(model->transformer, model->encoder_embedding,
+                                                                        model->decoder_embedding, model->vocab, pool, 3)
+                                          : NULL;
+    if (!scheduler) {
+        fprintf(stderr, "interleaved: failed to create scheduler\n");
+        kv_cache_pool_free(pool);
+        return 1;
+    }
+
+    for (int r = 0; r < NUM_REQUESTS; r++) {
+        const GenerationRequest request = make_request(&records[r]);
+        if (generation_scheduler_submit(scheduler, &request) == 0) {
+            fprintf(stderr, "interleaved: request %d rejected\n", r);
+            failures++;
+        }
+        for (int step = 0; step < 2; step++) generation_scheduler_step(scheduler);
+    }
+    run_to_completion(scheduler);
+
+    for (int r = 0; r < NUM_REQUESTS; r++) {
+        int32_t expected[MAX_NEW];
+        if (!greedy_reference(model, &records[r], expected)) {
+            fprintf(stderr, "interleaved: greedy reference failed\n");
+            failures++;
+            continue;
+        }
+        if (records[r].finished != 1 || records[r].reason != GENERATION_FINISHED_LENGTH ||
+            records[r].generated != MAX_NEW) {
+            fprintf(stderr, "interleaved: request %d finished %d time(s) with reason %d after %d tokens\n", r,
+                    records[r].finished, (int)records[r].reason, records[r].generated);
+            failures++;
+        } else if (memcmp(records[r].tokens, expected, sizeof(expected)) != 0) {
+            fprintf(stderr, "interleaved: request %d differs from sequential greedy decoding\n", r);
+            failures++;
+        }
+    }
+    failures += check_released(scheduler, pool, "interleaved");
+    printf("generation_scheduler_test: %d interleaved requests vs sequential greedy, %d failure(s)\n",
+           NUM_REQUESTS, failures);
+
+    generation_scheduler_free(scheduler);
+    kv_cache_pool_free(pool);
+    return failures;
+}
+
+// 缓存池只够一个请求的预留: 其余请求排队; 取消一个运行中的和一个等待中的
+static int check_cancel_and_admission(const TestModel* model) {
+    RequestRecord records[NUM_REQUESTS];
+    uint64_t ids[NUM_REQUESTS];
+    int failures = 0;
+    init_records(records);
+    // 每个请求最多写 3 + MAX_NEW - 1 个位置, 每块4个位置, 预留3块
+    KVCachePool* pool = kv_cache_pool_create(NUM_LAYERS, NUM_HEADS, MODEL_DIM / NUM_HEADS, 4, 4, HUGE_PAGES_OFF);
+    GenerationScheduler* scheduler = pool ? generation_scheduler_create(model->transformer, model->encoder_embedding,
+                                                                        model->decoder_embedding, model->vocab, pool, 3)
+                                          : NULL;
+    if (!scheduler) {
+        fprintf(stderr, "cancel: failed to create scheduler\n");
+        kv_cache_pool_free(pool);
+        return 1;
+    }
+
+    for (int r = 0; r < NUM_REQUESTS; r++) {
+        const GenerationRequest request = make_request(&records[r]);
+        ids[r] = generation_scheduler_submit(scheduler, &request);
+    }
+    for (int step = 0; step < 3; step++) generation_scheduler_step(scheduler);
+    GenerationSchedulerMetrics metrics = generation_scheduler_metrics(scheduler);
+    if (metrics.running != 1 || metrics.queue_depth != NUM_REQUESTS - 1) {
+        fprintf(stderr, "cancel: %d running, %d queued; the pool only fits one reservation\n", metrics.running,
+                metrics.queue_depth);
+        failures++;
+    }
+    if (!generation_scheduler_cancel(scheduler, ids[0]) || !generation_scheduler_cancel(scheduler, ids[2])) {
+        fprintf(stderr, "cancel: live request not found\n");
+        failures++;
+    }
+    run_to_completion(scheduler);
+
+    const GenerationFinishReason expected[NUM_REQUESTS] = {GENERATION_FINISHED_CANCELLED, GENERATION_FINISHED_LENGTH,
+                                                           GENERATION_FINISHED_CANCELLED, GENERATION_FINISHED_LENGTH};
+    for (int r = 0; r < NUM_REQUESTS; r++) {
+        if (records[r].finished != 1 || records[r].reason != expected[r]) {
+            fprintf(stderr, "cancel: request %d finished %d time(s) with reason %d, expected %d\n", r,
+                    records[r].finished, (int)records[r].reason, (int)expected[r]);
+            failures++;
+        }
+    }
+    if (generation_scheduler_cancel(scheduler, ids[1])) {
+        fprintf(stderr, "cancel: finished request still live\n");
+        failures++;
+    }
+    metrics = generation_scheduler_metrics(scheduler);
+    if (metrics.cancelled != 2 || metrics.completed != 2) {
+        fprintf(stderr, "cancel: %llu cancelled, %llu completed\n", (unsigned long long)metrics.cancelled,
+                (unsigned long long)metrics.completed);
+        failures++;
+    }
+    failures += check_released(scheduler, pool, "cancel");
+    printf("generation_scheduler_test: cancel and queued admission, %d failure(s)\n", failures);
+
+    generation_scheduler_free(scheduler);
+    kv_cache_pool_free(pool);
+    return failures;
+}
+
+int main(void) {
+    init_model_config(1, MAX_SEQ, VOCAB, MODEL_DIM, FF_DIM, NUM_HEADS, 0.0f);
+    ModelConfig config = g_model_config;
+    config.is_training = false;
+
+    TestModel model = {0};
+    model.transformer = transformer_create_from_config(&config, NUM_LAYERS);
+    model.encoder_embedding = transformer_embedding_create(VOCAB, MODEL_DIM, MAX_SEQ, config.position_encoding);
+    model.decoder_embedding = model.encoder_embedding
+                                  ? transformer_embedding_create_shared(model.encoder_embedding->token_embedding,
+                                                                        MAX_SEQ, config.position_encoding)
+                                  : NULL;
+    model.vocab = vocab_projection_create(VOCAB, MODEL_DIM, false);
+    int failures = 0;
+    if (!model.transformer || !model.decoder_embedding || !model.vocab) {
+        fprintf(stderr, "failed to create model\n");
+        failures++;
+    } else {
+        transformer_init_random(model.transformer, 7);
+        fill_weights(model.encoder_embedding->token_embedding->embedding_matrix, 1);
+        fill_weights(model.vocab->weight, 2);
+        failures += check_interleaved(&model);
+        failures += check_cancel_and_admission(&model);
+    }
+
+    vocab_projection_free(model.vocab);
+    free_transformer_embedding(model.decoder_embedding);
+    free_transformer_embedding(model.encoder_embedding);
+    transformer_free(model.transformer);
+    if (failures) {
+        fprintf(stderr, "generation_scheduler_test: %d failure(s)\n", failures);
+        return 1;
+    }
+    printf("generation_scheduler_test: ok\n");
+    return 0;
+}
@@ -0,0 +1,180 @@
+// 采样器: 随机数流可复现, 采到的词都在核 (top-k / top-p) 内
+// 参考实现对整个词表做softmax并排序 (double), 按定义取累计概率第一次达到top_p的前缀;
+// 采样器的top-p路径按概率分桶、只排序边界桶, 分桶或边界处理出错时会采到核外的词或改变核内的比例.
+// 随机数按 (seed, stream) 区分: 同一个流重复得到同样的结果, 与batch中其他行的顺序无关
+#include "sampler.h"
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define VOCAB 1000
+#define NUM_DRAWS 5000
+#define NUM_ROWS 3
+#define SEQUENCE 200
+
+static void fill_logits(float* logits, int count, unsigned int seed) {
+    srand(seed);
+    for (int i = 0; i < count; i++) {
+        logits[i] = 8.0f * ((float)rand() / RAND_MAX) - 4.0f;
+    }
+}
+
+static const float* sort_logits;
+
+static int compare_desc(const void* a, const void* b) {
+    const float x = sort_logits[*(const int*)a];
+    const float y = sort_logits[*(const int*)b];
+    return (x < y) - (x > y);
+}
+
+// 参考的核: mass_before[v] 为按概率降序排在v之前的词 (核内重新归一化前) 的概率和, 核外的词为2;
+// 返回核内概率最大的词在核内重新归一化后的概率
+static double reference_nucleus(const float* logits, const SamplerConfig* config, double* mass_before, int* top) {
+    int* order = (int*)malloc(VOCAB * sizeof(int));
+    double* probs = (double*)malloc(VOCAB * sizeof(double));
+    if (!order || !probs) {
+        free(order);
+        free(probs);
+        return -1.0;
+    }
+    for (int v = 0; v < VOCAB; v++) order[v] = v;
+    sort_logits = logits;
+    qsort(order, VOCAB, sizeof(int), compare_desc);
+
+    const int count = config->top_k > 0 && config->top_k < VOCAB ? config->top_k : VOCAB;
+    double total = 0.0;
+    for (int i = 0; i < count; i++) {
+        probs[i] = exp(((double)logits[order[i]] - logits[order[0]]) / config->temperature);
+        total += probs[i];
+    }
+    for (int v = 0; v < VOCAB; v++) mass_before[v] = 2.0;
+    double mass = 0.0, nucleus = 0.0;
+    for (int i = 0; i < count && mass < config->top_p; i++) {
+        mass_before[order[i]] = mass;
+        mass += probs[i] / total;
+        nucleus += probs[i];
+    }
+    *top = order[0];
+    const double top_prob = probs[0] / nucleus;
+    free(order);
+    free(probs);
+    return top_prob;
+}
+
+// 多次采样: 每个词都在核内 (容许边界上的舍入误差), 概率最大的词的频率符合核内重新归一化的概率
+static int check_nucleus(const char* name, const SamplerConfig* config, unsigned int seed) {
+    float logits[VOCAB], row[VOCAB];
+    double mass_before[VOCAB];
+    int top;
+    fill_logits(logits, VOCAB, seed);
+    const double top_prob = reference_nucleus(logits, config, mass_before, &top);
+    Sampler* sampler = sampler_create(VOCAB, config);
+    if (top_prob < 0.0 || !sampler) {
+        fprintf(stderr, "%s: allocation failed\n", name);
+        sampler_free(sampler);
+        return 1;
+    }
+
+    const float top_p = config->top_p < 1.0f ? config->top_p : 1.0f;
+    SampleRng rng = sample_rng_init(seed, 0);
+    int failures = 0, outside = 0, top_count = 0;
+    for (int i = 0; i < NUM_DRAWS; i++) {
+        memcpy(row, logits, sizeof(row));
+        const int32_t token = sampler_sample_row(sampler, config, row, NULL, 0, &rng);
+        if (token < 0 || token >= VOCAB || !(mass_before[token] < top_p + 1e-4)) {
+            outside++;
+        } else if (token == top) {
+            top_count++;
+        }
+    }
+    const double frequency = (double)top_count / NUM_DRAWS;
+    const double tolerance = 5.0 * sqrt(top_prob * (1.0 - top_prob) / NUM_DRAWS) + 1e-3;
+    if (outside) {
+        fprintf(stderr, "%s: %d of %d samples outside the nucleus\n", name, outside, NUM_DRAWS);
+        failures++;
+    }
+    if (fabs(frequency - top_prob) > tolerance) {
+        fprintf(stderr, "%s: top token frequency %.4f, expected %.4f\n", name, frequency, top_prob);
+        failures++;
+    }
+    printf("sampler_test: %s, top token %.4f vs %.4f, %d outside nucleus\n", name, frequency, top_prob, outside);
+    sampler_free(sampler);
+    return failures;
+}
+
+// 同一个 (seed, stream) 的序列相同, 换一个stream不同; 批量采样与逐行采样一致, 与行的顺序无关
+static int check_determinism(void) {
+    const SamplerConfig config = {1.0f, 0, 0.95f, 1.0f};
+    float logits[VOCAB], row[VOCAB];
+    int32_t first[SEQUENCE], second[SEQUENCE], other[SEQUENCE];
+    int failures = 0;
+    fill_logits(logits, VOCAB, 11);
+    Sampler* sampler = sampler_create(VOCAB, &config);
+    if (!sampler) return 1;
+
+    SampleRng a = sample_rng_init(42, 7), b = sample_rng_init(42, 7), c = sample_rng_init(42, 8);
+    for (int i = 0; i < SEQUENCE; i++) {
+        memcpy(row, logits, sizeof(row));
+        first[i] = sampler_sample_row(sampler, &config, row, NULL, 0, &a);
+        memcpy(row, logits, sizeof(row));
+        other[i] = sampler_sample_row(sampler, &config, row, NULL, 0, &c);
+        memcpy(row, logits, sizeof(row));
+        second[i] = sampler_sample_row(sampler, &config, row, NULL, 0, &b);
+    }
+    if (memcmp(first, second, sizeof(first)) != 0) {
+        fprintf(stderr, "determinism: the same (seed, stream) produced different tokens\n");
+        failures++;
+    }
+    if (memcmp(first, other, sizeof(first)) == 0) {
+        fprintf(stderr, "determinism: different streams produced the same tokens\n");
+        failures++;
+    }
+
+    // 每行一个stream, 分别按正序和倒序排成batch
+    float batch[NUM_ROWS * VOCAB];
+    SampleRng forward[NUM_ROWS], backward[NUM_ROWS];
+    int32_t forward_tokens[NUM_ROWS], backward_tokens[NUM_ROWS];
+    for (int step = 0; step < SEQUENCE && !failures; step++) {
+        if (step == 0) {
+            for (int r = 0; r < NUM_ROWS; r++) {
+                forward[r] = sample_rng_init(42, r);
+                backward[NUM_ROWS - 1 - r] = sample_rng_init(42, r);
+            }
+        }
+        for (int r = 0; r < NUM_ROWS; r++) memcpy(batch + (size_t)r * VOCAB, logits, sizeof(logits));
+        if (!sampler_sample(sampler, batch, NUM_ROWS, NULL, NULL, forward, forward_tokens)) failures++;
+        for (int r = 0; r < NUM_ROWS; r++) memcpy(batch + (size_t)r * VOCAB, logits, sizeof(logits));
+        if (!sampler_sample(sampler, batch, NUM_ROWS, NULL, NULL, backward, backward_tokens)) failures++;
+        for (int r = 0; r < NUM_ROWS; r++) {
+            if (forward_tokens[r] != backward_tokens[NUM_ROWS - 1 - r]) {
+                fprintf(stderr, "determinism: stream %d depends on its position in the batch\n", r);
+                failures++;
+                break;
+            }
+        }
+    }
+    printf("sampler_test: determinism per (seed, stream), %d failure(s)\n", failures);
+    sampler_free(sampler);
+    return failures;
+}
+
+int main(void) {
+    int failures = 0;
+    const SamplerConfig nucleus = {1.0f, 0, 0.9f, 1.0f};
+    const SamplerConfig sharp_nucleus = {0.25f, 0, 0.5f, 1.0f};
+    const SamplerConfig top_k_nucleus = {1.0f, 20, 0.8f, 1.0f};
+    const SamplerConfig top_k = {0.7f, 5, 1.0f, 1.0f};
+    failures += check_nucleus("top-p 0.9", &nucleus, 1);
+    failures += check_nucleus("temperature 0.25, top-p 0.5", &sharp_nucleus, 2);
+    failures += check_nucleus("top-k 20, top-p 0.8", &top_k_nucleus, 3);
+    failures += check_nucleus("temperature 0.7, top-k 5", &top_k, 4);
+    failures += check_determinism();
+
+    if (failures) {
+        fprintf(stderr, "sampler_test: %d failure(s)\n", failures);
+        return 1;
+    }
+    printf("sampler_test: ok\n");
+    return 0;
+}
@@ -0,0 +1,70 @@
+// Token嵌入的反向传播: 梯度表的形状与嵌入表相同, 同一token在不同位置的梯度累加到同一行
+#include "01token_embedding_baclward.h"
+#include <math.h>
+#include <stdio.h>
+
+#define CHECK(condition)                                                           \
+    do {                                                                           \
+        if (!(condition)) {                                                        \
+            fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #condition); \
+            failures++;                                                            \
+        }                                                                          \
+    } while (0)
+
+int main(void) {
+    int failures = 0;
+    const int vocab = 5, dim = 3, batch = 2, seq = 3;
+    TokenEmbedding* embedding = token_embedding_create(vocab, dim);
+    int token_shape[] = {batch, seq};
+    int grad_shape[] = {batch, seq, dim};
+    IntTensor* tokens = int_tensor_create(token_shape, 2);
+    Tensor* grad_output = tensor_create(grad_shape, 3);
+    if (!embedding || !tokens || !grad_output) {
+        fprintf(stderr, "allocation failed\n");
+        return 1;
+    }
+
+    // token 1 出现三次, token 4 两次, token 0 一次
+    const int32_t ids[] = {1, 4, 1, 0, 1, 4};
+    for (int i = 0; i < batch * seq; i++) {
+        tokens->data[i] = ids[i];
+        for (int d = 0; d < dim; d++) {
+            grad_output->data[i * dim + d] = (float)(i + 1) + 0.1f * (float)d;
+        }
+    }
+
+    // 调用两次, 第二次应在第一次的结果上继续累加
+    for (int pass = 0; pass < 2; pass++) {
+        CHECK(token_embedding_backward(embedding, tokens, grad_output));
+    }
+
+    const Tensor* grad = embedding->grad_embedding;
+    CHECK(grad != NULL);
+    if (grad) {
+        CHECK(grad->num_dims == 2);
+        CHECK(grad->shape[0] == vocab && grad->shape[1] == dim);
+        for (int v = 0; v < vocab; v++) {
+            for (int d = 0; d < dim; d++) {
+                float expected = 0.0f;
+                for (int i = 0; i < batch * seq; i++) {
+                    if (ids[i] == v) expected += 2.0f * ((float)(i + 1) + 0.1f * (float)d);
+                }
+                CHECK(fabsf(grad->data[v * dim + d] - expected) < 1e-5f);
+            }
+        }
+    }
+
+    // 越界的token id应报错
+    tokens->data[0] = vocab;
+    CHECK(!token_embedding_backward(embedding, tokens, grad_output));
+
+    tensor_free(grad_output);
+    int_tensor_free(tokens);
+    free_token_embedding(embedding);
+    if (failures) {
+        fprintf(stderr, "token_embedding_backward_test: %d failure(s)\n", failures);
+        return 1;
+    }
+    printf("token_embedding_backward_test: ok\n");
+    return 0;
+}
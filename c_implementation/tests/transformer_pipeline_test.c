@@ -0,0 +1,151 @@
+// 流水线推理与逐层的前向结果一致
+// 三种算法: transformer_forward (各层原地计算), transformer_pipeline_forward (多个阶段、切成微批次),
+// 以及每层都写到新张量的参考实现; 原地计算时残差或输出投影读到被覆盖的数据会与参考不一致
+#include "transformer.h"
+#include "transformer_pipeline.h"
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#define BATCH 4
+#define ENC_SEQ 6
+#define DEC_SEQ 5
+#define MODEL_DIM 32
+#define NUM_HEADS 4
+#define FF_DIM 64
+#define NUM_LAYERS 3
+
+static void fill_inputs(Tensor* tensor, unsigned int seed) {
+    srand(seed);
+    size_t total = calculate_total_size(tensor->shape, tensor->num_dims);
+    for (size_t i = 0; i < total; i++) {
+        tensor->data[i] = (float)rand() / RAND_MAX - 0.5f;
+    }
+}
+
+// [q, k] 的因果掩码, 所有样本共享
+static AttentionMask* causal_mask(int seq_len) {
+    AttentionMask* mask = (AttentionMask*)malloc(sizeof(AttentionMask));
+    int shape[] = {seq_len, seq_len};
+    if (!mask) return NULL;
+    mask->seq_length = seq_len;
+    mask->mask = tensor_create(shape, 2);
+    if (!mask->mask) {
+        free(mask);
+        return NULL;
+    }
+    for (int i = 0; i < seq_len; i++) {
+        for (int j = 0; j <= i; j++) mask->mask->data[i * seq_len + j] = 1.0f;
+    }
+    return mask;
+}
+
+static float max_abs_diff(const Tensor* a, const Tensor* b) {
+    size_t total = calculate_total_size(a->shape, a->num_dims);
+    float max = 0.0f;
+    for (size_t i = 0; i < total; i++) {
+        const float diff = fabsf(a->data[i] - b->data[i]);
+        if (!(diff <= max)) max = diff;     // NaN也算作不一致
+    }
+    return max;
+}
+
+// 参考实现: 每一层的输入和输出都是不同的张量
+static bool reference_forward(Transformer* transformer, Tensor* encoder_input, Tensor* decoder_input,
+                              Tensor* output, AttentionMask* dec_mask) {
+    Encoder* encoder = transformer->encoder;
+    Decoder* decoder = transformer->decoder;
+    Tensor* enc[NUM_LAYERS + 1] = {encoder_input};
+    Tensor* dec[NUM_LAYERS + 1] = {decoder_input};
+    bool ok = true;
+    for (int i = 1; i <= NUM_LAYERS; i++) {
+        enc[i] = tensor_create(encoder_input->shape, 3);
+        dec[i] = tensor_create(decoder_input->shape, 3);
+        ok = ok && enc[i] && dec[i];
+    }
+    for (int i = 0; ok && i < encoder->num_layers; i++) {
+        ok = encoder_layer_forward(encoder->layers[i], enc[i], enc[i + 1], NULL);
+    }
+    for (int i = 0; ok && i < decoder->num_layers; i++) {
+        ok = decoder_layer_forward(decoder->layers[i], dec[i], enc[NUM_LAYERS], dec[i + 1], dec_mask, NULL);
+    }
+    ok = ok && linear_forward(decoder->output_linear, dec[NUM_LAYERS], output);
+    for (int i = 1; i <= NUM_LAYERS; i++) {
+        tensor_free(enc[i]);
+        tensor_free(dec[i]);
+    }
+    return ok;
+}
+
+int main(void) {
+    int failures = 0;
+    init_model_config(BATCH, 16, 32, MODEL_DIM, FF_DIM, NUM_HEADS, 0.0f);
+    ModelConfig config = g_model_config;
+    config.is_training = false;
+    Transformer* transformer = transformer_create_from_config(&config, NUM_LAYERS);
+    if (!transformer) {
+        fprintf(stderr, "failed to create transformer\n");
+        return 1;
+    }
+    transformer_init_random(transformer, 7);
+
+    int enc_shape[] = {BATCH, ENC_SEQ, MODEL_DIM};
+    int dec_shape[] = {BATCH, DEC_SEQ, MODEL_DIM};
+    Tensor* encoder_input = tensor_create(enc_shape, 3);
+    Tensor* decoder_input = tensor_create(dec_shape, 3);
+    Tensor* stacked = tensor_create(dec_shape, 3);
+    Tensor* pipelined = tensor_create(dec_shape, 3);
+    Tensor* reference = tensor_create(dec_shape, 3);
+    AttentionMask* dec_mask = causal_mask(DEC_SEQ);
+    if (!encoder_input || !decoder_input || !stacked || !pipelined || !reference || !dec_mask) {
+        fprintf(stderr, "allocation failed\n");
+        return 1;
+    }
+    fill_inputs(encoder_input, 1);
+    fill_inputs(decoder_input, 2);
+
+    if (!reference_forward(transformer, encoder_input, decoder_input, reference, dec_mask)) {
+        fprintf(stderr, "reference forward failed\n");
+        failures++;
+    }
+    if (!transformer_forward(transformer, encoder_input, decoder_input, stacked, NULL, dec_mask, NULL)) {
+        fprintf(stderr, "transformer_forward failed\n");
+        failures++;
+    }
+
+    // 2个阶段, 每个阶段1个线程, 4个样本切成大小为1的微批次, 多个微批次同时在流水线中
+    TransformerPipeline* pipeline = transformer_pipeline_create(transformer, 2, 1);
+    if (!pipeline || !transformer_pipeline_forward(pipeline, encoder_input, decoder_input, pipelined,
+                                                   NULL, dec_mask, NULL, 1)) {
+        fprintf(stderr, "transformer_pipeline_forward failed\n");
+        failures++;
+    }
+    transformer_pipeline_free(pipeline);
+
+    const float stack_error = max_abs_diff(stacked, reference);
+    const float pipeline_error = max_abs_diff(pipelined, stacked);
+    printf("transformer_pipeline_test: stack vs reference %.3g, pipeline vs stack %.3g\n",
+           stack_error, pipeline_error);
+    if (!(stack_error < 1e-4f)) {
+        fprintf(stderr, "transformer_forward differs from the out-of-place reference\n");
+        failures++;
+    }
+    if (!(pipeline_error < 1e-4f)) {
+        fprintf(stderr, "pipeline output differs from transformer_forward\n");
+        failures++;
+    }
+
+    attention_mask_free(dec_mask);
+    tensor_free(reference);
+    tensor_free(pipelined);
+    tensor_free(stacked);
+    tensor_free(decoder_input);
+    tensor_free(encoder_input);
+    transformer_free(transformer);
+    if (failures) {
+        fprintf(stderr, "transformer_pipeline_test: %d failure(s)\n", failures);
+        return 1;
+    }
+    printf("transformer_pipeline_test: ok\n");
+    return 0;
+}
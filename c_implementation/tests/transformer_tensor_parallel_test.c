@@ -0,0 +1,139 @@
+// 张量并行推理与 transformer_forward 的结果一致
+// 2个进程各算一半的头和前馈列; 分别检查dense、局部/块稀疏和performer三种注意力路径,
+// 分片的投影宽度只有完整模型的一半, 按完整宽度计算形状时前向会失败或结果不一致
+#include "transformer.h"
+#include "transformer_tensor_parallel.h"
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#define BATCH 2
+#define ENC_SEQ 6
+#define DEC_SEQ 6
+#define MODEL_DIM 32
+#define NUM_HEADS 4
+#define FF_DIM 64
+#define NUM_LAYERS 2
+#define NUM_RANKS 2
+
+static void fill_inputs(Tensor* tensor, unsigned int seed) {
+    srand(seed);
+    size_t total = calculate_total_size(tensor->shape, tensor->num_dims);
+    for (size_t i = 0; i < total; i++) {
+        tensor->data[i] = (float)rand() / RAND_MAX - 0.5f;
+    }
+}
+
+// [q, k] 的因果掩码, 所有样本共享
+static AttentionMask* causal_mask(int seq_len) {
+    AttentionMask* mask = (AttentionMask*)malloc(sizeof(AttentionMask));
+    int shape[] = {seq_len, seq_len};
+    if (!mask) return NULL;
+    mask->seq_length = seq_len;
+    mask->mask = tensor_create(shape, 2);
+    if (!mask->mask) {
+        free(mask);
+        return NULL;
+    }
+    for (int i = 0; i < seq_len; i++) {
+        for (int j = 0; j <= i; j++) mask->mask->data[i * seq_len + j] = 1.0f;
+    }
+    return mask;
+}
+
+static float max_abs_diff(const Tensor* a, const Tensor* b) {
+    size_t total = calculate_total_size(a->shape, a->num_dims);
+    float max = 0.0f;
+    for (size_t i = 0; i < total; i++) {
+        const float diff = fabsf(a->data[i] - b->data[i]);
+        if (!(diff <= max)) max = diff;     // NaN也算作不一致
+    }
+    return max;
+}
+
+// 用g_model_config建模型, 比较单进程和张量并行的输出; 返回失败数
+static int check_model(const char* name, AttentionMask* dec_mask) {
+    ModelConfig config = g_model_config;
+    config.is_training = false;
+    Transformer* transformer = transformer_create_from_config(&config, NUM_LAYERS);
+    if (!transformer) {
+        fprintf(stderr, "%s: failed to create transformer\n", name);
+        return 1;
+    }
+    transformer_init_random(transformer, 7);
+
+    int enc_shape[] = {BATCH, ENC_SEQ, MODEL_DIM};
+    int dec_shape[] = {BATCH, DEC_SEQ, MODEL_DIM};
+    Tensor* encoder_input = tensor_create(enc_shape, 3);
+    Tensor* decoder_input = tensor_create(dec_shape, 3);
+    Tensor* expected = tensor_create(dec_shape, 3);
+    Tensor* parallel = tensor_create(dec_shape, 3);
+    int failures = 0;
+    if (!encoder_input || !decoder_input || !expected || !parallel) {
+        fprintf(stderr, "%s: allocation failed\n", name);
+        failures++;
+        goto cleanup;
+    }
+    fill_inputs(encoder_input, 1);
+    fill_inputs(decoder_input, 2);
+
+    if (!transformer_forward(transformer, encoder_input, decoder_input, expected, NULL, dec_mask, NULL)) {
+        fprintf(stderr, "%s: transformer_forward failed\n", name);
+        failures++;
+    }
+    TensorParallel* tp = transformer_tensor_parallel_create(transformer, NUM_RANKS, 1, BATCH, DEC_SEQ);
+    if (!tp || !transformer_tensor_parallel_forward(tp, encoder_input, decoder_input, parallel,
+                                                    NULL, dec_mask, NULL)) {
+        fprintf(stderr, "%s: transformer_tensor_parallel_forward failed\n", name);
+        failures++;
+    }
+    transformer_tensor_parallel_free(tp);
+
+    const float error = max_abs_diff(parallel, expected);
+    printf("transformer_tensor_parallel_test: %s, %d ranks vs transformer_forward %.3g\n",
+           name, NUM_RANKS, error);
+    if (!(error < 1e-4f)) {
+        fprintf(stderr, "%s: tensor parallel output differs from transformer_forward\n", name);
+        failures++;
+    }
+
+cleanup:
+    tensor_free(parallel);
+    tensor_free(expected);
+    tensor_free(decoder_input);
+    tensor_free(encoder_input);
+    transformer_free(transformer);
+    return failures;
+}
+
+int main(void) {
+    int failures = 0;
+    AttentionMask* dec_mask = causal_mask(DEC_SEQ);
+    if (!dec_mask) {
+        fprintf(stderr, "allocation failed\n");
+        return 1;
+    }
+
+    init_model_config(BATCH, 16, 32, MODEL_DIM, FF_DIM, NUM_HEADS, 0.0f);
+    const ModelConfig dense_config = g_model_config;
+    failures += check_model("dense", dec_mask);
+
+    // 编码器两层分别为局部和块稀疏注意力, 解码器第一层为局部注意力
+    set_layer_attention(false, 0, ATTENTION_LOCAL, 2, 1);
+    set_layer_block_sparse_attention(false, 1, 2, 1, 0, 0, 0);
+    set_layer_attention(true, 0, ATTENTION_LOCAL, 2, 0);
+    failures += check_model("local/block sparse", dec_mask);
+
+    // performer的解码器自注意力由is_causal保证因果, 不传掩码
+    g_model_config = dense_config;
+    set_attention_engine(ATTENTION_ENGINE_PERFORMER, 16, 3);
+    failures += check_model("performer", NULL);
+
+    attention_mask_free(dec_mask);
+    if (failures) {
+        fprintf(stderr, "transformer_tensor_parallel_test: %d failure(s)\n", failures);
+        return 1;
+    }
+    printf("transformer_tensor_parallel_test: ok\n");
+    return 0;
+}
@@ -0,0 +1,115 @@
+// 流式词表投影的top-k和log-sum-exp与朴素实现一致
+// 参考实现用double算出整行logits, 排序取前k个, 再对整行求log-sum-exp;
+// vocab_projection_topk 按词表分块、各线程维护自己的小顶堆和在线log-sum-exp再合并,
+// 分块边界 (词表不是块大小的整数倍)、合并或温度缩放出错时结果会不一致.
+// 分别在共享线程池和4个线程的独立线程池上运行, 后者会把词表切成多个区间
+#include "vocab_projection.h"
+#include "thread_pool.h"
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#define VOCAB 1003
+#define MODEL_DIM 48
+#define NUM_ROWS 5
+#define TOP_K 10
+#define TEMPERATURE 0.7f
+
+static void fill_values(float* data, size_t count, unsigned int seed) {
+    srand(seed);
+    for (size_t i = 0; i < count; i++) {
+        data[i] = (float)rand() / RAND_MAX - 0.5f;
+    }
+}
+
+// 一行的参考logits (已除以温度)
+static void reference_logits(const VocabProjection* proj, const float* hidden, double* logits) {
+    const float* weight = vocab_projection_weight_data(proj);
+    for (int v = 0; v < VOCAB; v++) {
+        double dot = proj->bias ? proj->bias->data[v] : 0.0;
+        for (int d = 0; d < MODEL_DIM; d++) dot += (double)hidden[d] * weight[(size_t)v * MODEL_DIM + d];
+        logits[v] = dot / TEMPERATURE;
+    }
+}
+
+static int check_rows(const VocabProjection* proj, const float* hidden, const char* name) {
+    int top_indices[NUM_ROWS * TOP_K], argmax[NUM_ROWS];
+    float top_logits[NUM_ROWS * TOP_K], log_sum_exp[NUM_ROWS];
+    double logits[VOCAB];
+    int failures = 0;
+    if (!vocab_projection_topk(proj, hidden, NUM_ROWS, TOP_K, TEMPERATURE, top_indices, top_logits, log_sum_exp) ||
+        !vocab_projection_argmax(proj, hidden, NUM_ROWS, argmax)) {
+        fprintf(stderr, "%s: vocab projection failed\n", name);
+        return 1;
+    }
+
+    double max_error = 0.0;
+    for (int r = 0; r < NUM_ROWS; r++) {
+        reference_logits(proj, hidden + (size_t)r * MODEL_DIM, logits);
+        // 选择排序出前k个 (logit相同时取编号小的)
+        bool taken[VOCAB] = {false};
+        double max = logits[0];
+        for (int v = 1; v < VOCAB; v++) {
+            if (logits[v] > max) max = logits[v];
+        }
+        for (int i = 0; i < TOP_K; i++) {
+            int best = -1;
+            for (int v = 0; v < VOCAB; v++) {
+                if (!taken[v] && (best < 0 || logits[v] > logits[best])) best = v;
+            }
+            taken[best] = true;
+            const int got = top_indices[r * TOP_K + i];
+            if (got != best) {
+                fprintf(stderr, "%s: row %d rank %d is token %d, expected %d\n", name, r, i, got, best);
+                failures++;
+            }
+            const double error = fabs(top_logits[r * TOP_K + i] - logits[best]);
+            if (error > max_error) max_error = error;
+            if (i == 0 && argmax[r] != best) {
+                fprintf(stderr, "%s: row %d argmax %d, expected %d\n", name, r, argmax[r], best);
+                failures++;
+            }
+        }
+        double total = 0.0;
+        for (int v = 0; v < VOCAB; v++) total += exp(logits[v] - max);
+        const double error = fabs(log_sum_exp[r] - (max + log(total)));
+        if (error > max_error) max_error = error;
+    }
+    printf("vocab_projection_test: %s, top-%d and log-sum-exp max error %.3g\n", name, TOP_K, max_error);
+    if (!(max_error < 1e-4)) {
+        fprintf(stderr, "%s: logits differ from the reference\n", name);
+        failures++;
+    }
+    return failures;
+}
+
+int main(void) {
+    VocabProjection* proj = vocab_projection_create(VOCAB, MODEL_DIM, true);
+    float* hidden = (float*)malloc((size_t)NUM_ROWS * MODEL_DIM * sizeof(float));
+    ThreadPool* pool = thread_pool_create(4, NULL, 0);
+    int failures = 0;
+    if (!proj || !hidden || !pool) {
+        fprintf(stderr, "allocation failed\n");
+        failures++;
+    } else {
+        fill_values(proj->weight->data, (size_t)VOCAB * MODEL_DIM, 1);
+        fill_values(proj->bias->data, VOCAB, 2);
+        fill_values(hidden, (size_t)NUM_ROWS * MODEL_DIM, 3);
+        for (size_t i = 0; i < (size_t)NUM_ROWS * MODEL_DIM; i++) hidden[i] *= 8.0f;
+
+        failures += check_rows(proj, hidden, "shared pool");
+        thread_pool_attach(pool);
+        failures += check_rows(proj, hidden, "4 threads");
+        thread_pool_attach(NULL);
+    }
+
+    thread_pool_free(pool);
+    free(hidden);
+    vocab_projection_free(proj);
+    if (failures) {
+        fprintf(stderr, "vocab_projection_test: %d failure(s)\n", failures);
+        return 1;
+    }
+    printf("vocab_projection_test: ok\n");
+    return 0;
+}